@@ -19,10 +19,9 @@
 
 #include "CCHandshake.h"
 
-#include "HW_i2c.h"
-
-static FUSB302_D_t Driver;
-
+#ifndef DBG
+#define DBG(format, ...)
+#endif
 
 #if ONSEMI_LIBRARY==true
 
@@ -48,117 +47,184 @@ extern DeviceReg_t              Registers;
 // #include "main.h"
 
 #include <string.h>
-#include "PD.h"
-#include "util-string.h"	// https://github.com/tschiemer/c-utils
-
-typedef enum {
-	PD_State_Disabled,
-	PD_State_HardReset,
-	PD_State_Reset,
-	PD_State_Idle,
-	PD_State_Rx,
-	PD_State_AwaitGoodCRC,
-	PD_State_Resend,
-} PD_State_t;
 
 //static uint8_t * regPtr( FUSB302_D_Register_t reg );
 
-static bool read( FUSB302_D_Register_t reg, uint8_t * value );
-static bool write( FUSB302_D_Register_t reg, uint8_t value );
+static bool read( CCHandshake_Port_t * port, FUSB302_D_Register_t reg, uint8_t * value );
+static bool set( CCHandshake_Port_t * port, FUSB302_D_Register_t reg, uint8_t value );
+static bool commit( CCHandshake_Port_t * port );
+static bool strobe( CCHandshake_Port_t * port, FUSB302_D_Register_t reg, uint8_t bits );
+
+static bool readAll( CCHandshake_Port_t * port );
+static void applyStatus( CCHandshake_Port_t * port, const uint8_t * buf );
+static bool readStatus( CCHandshake_Port_t * port );
+static bool configure( CCHandshake_Port_t * port );
+
+static void typeC_core( CCHandshake_Port_t * port );
+static void nextDeadline( uint32_t * events, uint32_t * next, uint32_t event, uint32_t deadline );
+static void notify( CCHandshake_Port_t * port, CCHandshake_Notification_t * notification );
+
+#if CCHANDSHAKE_USE_TOGGLE==true
+static bool startToggle( CCHandshake_Port_t * port );
+static CCHandshake_CC_t detectCCPinToggle( CCHandshake_Port_t * port );
+#else
+static bool readCCVoltageLevel( CCHandshake_Port_t * port, uint8_t * bc_lvl );
+static bool startCCMeasurement( CCHandshake_Port_t * port, CCHandshake_CC_t cc );
+static CCHandshake_CC_t detectCCPinSink( CCHandshake_Port_t * port );
+#endif
+static bool setPowerState( CCHandshake_Port_t * port, CCHandshake_Power_t state );
+#if CCHANDSHAKE_LOW_POWER==true
+static bool enterStandby( CCHandshake_Port_t * port );
+static bool wakeUp( CCHandshake_Port_t * port );
+#endif
+static bool enableSink( CCHandshake_Port_t * port, CCHandshake_CC_t cc );
+static bool disableSink( CCHandshake_Port_t * port );
+
+
+static void pd_core( CCHandshake_Port_t * port );
+
+static void pd_init( CCHandshake_Port_t * port );
+static void pd_deinit( CCHandshake_Port_t * port );
+
+static bool pd_hasMessage( CCHandshake_Port_t * port );
+static bool pd_getMessage( CCHandshake_Port_t * port, uint8_t * frame );
+static bool pd_drainRxFifo( CCHandshake_Port_t * port );
+static bool pd_skipMessage( CCHandshake_Port_t * port, uint8_t * frame );
+static void pd_encodeMessage( CCHandshake_Port_t * port, uint8_t numberOfDataObjects, uint16_t commandCode, const PD_DataObject_t * dataObjects );
+static void pd_encodeFrame( CCHandshake_Port_t * port, uint8_t len );
+static bool pd_sendMessage( CCHandshake_Port_t * port, PD_State_t (*onAcknowledged)( CCHandshake_Port_t * port, const PD_MessageView_t * message) );
+
+static PD_State_t pd_processMessage( CCHandshake_Port_t * port, const PD_MessageView_t * message );
+static PD_State_t pd_onSourceCapabilities( CCHandshake_Port_t * port, const PD_MessageView_t * message );
+
+static void pd_requestCapability( CCHandshake_Port_t * port );
+static uint32_t pd_scoreCapability( CCHandshake_Port_t * port, uint32_t caps, uint8_t position, uint32_t * rdo );
+static bool pd_isPPSContract( CCHandshake_Port_t * port );
+static bool pd_hasWork( CCHandshake_Port_t * port );
+static bool pd_isChunking( CCHandshake_Port_t * port );
+static void pd_getRequestedPower( CCHandshake_Port_t * port, uint32_t rdo, uint16_t * millivolt, uint16_t * milliamp );
+static void pd_setSpecRev( CCHandshake_Port_t * port, uint16_t specRev );
+static void pd_sendSinkCapabilities( CCHandshake_Port_t * port );
+static void pd_sendNotSupported( CCHandshake_Port_t * port );
+#if CCHANDSHAKE_PD_REV3==true
+static PD_State_t pd_onExtendedMessage( CCHandshake_Port_t * port, const PD_MessageView_t * message );
+static void pd_encodeChunk( CCHandshake_Port_t * port, uint8_t type, uint16_t extHeader, const uint8_t * data, uint8_t len );
+static void pd_sendChunk( CCHandshake_Port_t * port, uint8_t chunk );
+static void pd_abortChunking( CCHandshake_Port_t * port );
+static void pd_extendedCore( CCHandshake_Port_t * port );
+#endif
+static void pd_createRequest( CCHandshake_Port_t * port );
+
+
+static void pd_hardreset( CCHandshake_Port_t * port );
+static void pd_reset( CCHandshake_Port_t * port );
 
-static bool readAll( void );
-static bool readStatus( void );
-static bool configure( void );
+//static void pd_setRoles( CCHandshake_PD_Role_t powerRole, CCHandshake_PD_Role_t dataRole )
+//static void pd_setAutoGoodCrc( bool enabled );
 
-static void typeC_core( void );
+static void pd_flushFifos( CCHandshake_Port_t * port );
 
-static bool readCCVoltageLevel( uint8_t * bc_lvl );
-static CCHandshake_CC_t detectCCPinSink( void );
-static bool enableSink( CCHandshake_CC_t cc );
-static bool disableSink();
+static void pd_timerStart( CCHandshake_Port_t * port, PD_Timer_t timer, uint32_t ms );
+static void pd_timerStop( CCHandshake_Port_t * port, PD_Timer_t timer );
+static PD_Timer_t pd_timerExpired( CCHandshake_Port_t * port );
+static void pd_awaitCapabilities( CCHandshake_Port_t * port, uint32_t ms );
 
+static void pe_setState( CCHandshake_Port_t * port, PE_State_t state );
+static void pe_onSoftReset( CCHandshake_Port_t * port );
+static void pe_ready( CCHandshake_Port_t * port );
+static void pe_dropContract( CCHandshake_Port_t * port );
 
-static void pd_core( void );
 
-static void pd_init( void );
-static void pd_deinit( void );
 
-static bool pd_hasMessage( void );
-static bool pd_getMessage( PD_Message_t * message );
-static bool pd_sendMessage( PD_Message_t * message, PD_State_t (*onAcknowledged)( PD_Message_t * message) );
+// CCHandshake_getNextService() events that come with a deadline
+#define NEXT_DEADLINES	( CCHANDSHAKE_NEXT_DEBOUNCE | CCHANDSHAKE_NEXT_TIMER | CCHANDSHAKE_NEXT_PPS )
 
-static PD_State_t pd_processMessage( PD_Message_t * message );
-static PD_State_t pd_onSourceCapabilities( PD_Message_t * message );
+// rx fifo frame: token, header, data objects, crc
+#define PD_RX_FRAME_HEAD_SIZE	3
+// tx fifo frame: sop tokens, packsym, header, data objects, jam crc, eop, txoff, txon
+#define PD_TX_FRAME_HEAD_SIZE	5
 
-static void pd_createRequest( PD_Message_t * message );
+// messages the sink acts on or answers (bit per command), anything else is dropped right after its header
+#define PD_RX_CONTROL_MASK		( PD_ControlCommand_VALID_MASK & ~((1 << PD_ControlCommand_Ping) | (1 << PD_ControlCommand_NotSupported) | (1 << PD_ControlCommand_FRSwap)) )
+#define PD_RX_DATA_MASK			( (1 << PD_DataCommand_SourceCapabilities) | (1 << PD_DataCommand_Request) | (1 << PD_DataCommand_GetCountryInfo) )
 
+#define PD_isWantedMessage( __h__ ) ( PD_HeaderWord_isExtended(__h__) ? CCHANDSHAKE_PD_REV3==true : \
+	(( (PD_HeaderWord_getNumberOfDataObjects(__h__) ? (uint32_t)PD_RX_DATA_MASK : (uint32_t)PD_RX_CONTROL_MASK) >> PD_HeaderWord_getCommandCode(__h__) ) & 1) )
 
-static void pd_hardreset( void );
-static void pd_reset( void );
+#if CCHANDSHAKE_USE_INTERRUPT==true
 
-//static void pd_setRoles( CCHandshake_PD_Role_t powerRole, CCHandshake_PD_Role_t dataRole )
-//static void pd_setAutoGoodCrc( bool enabled );
+// only the events the sink actually reacts to may pull INT_N low
+#if CCHANDSHAKE_LOW_POWER==true
+#define CCHANDSHAKE_IRQ_WAKE	FUSB302_D_Mask1_M_WAKE
+#else
+#define CCHANDSHAKE_IRQ_WAKE	0
+#endif
+
+#define CCHANDSHAKE_IRQ_Mask1	(FUSB302_D_Mask1_ALL & ~(FUSB302_D_Mask1_M_BC_LVL | FUSB302_D_Mask1_M_COMP_CHNG | FUSB302_D_Mask1_M_VBUSOK | CCHANDSHAKE_IRQ_WAKE))
+#if CCHANDSHAKE_USE_TOGGLE==true
+#define CCHANDSHAKE_IRQ_TOGDONE	FUSB302_D_Maska_M_TOGDONE
+#else
+#define CCHANDSHAKE_IRQ_TOGDONE	0
+#endif
 
-static void pd_flushRxFifo( void );
-static void pd_flushTxFifo( void );
+#define CCHANDSHAKE_IRQ_Maska	(FUSB302_D_Maska_ALL & ~(FUSB302_D_Maska_M_TXSENT | FUSB302_D_Maska_M_HARDRST | FUSB302_D_Maska_M_RETRYFAIL | CCHANDSHAKE_IRQ_TOGDONE))
+#define CCHANDSHAKE_IRQ_Maskb	(FUSB302_D_Maskb_ALL & ~FUSB302_D_Maskb_M_GCRCSENT)
 
-static void pd_startTx( void );
+#endif
 
 
+// PD timers (ms), upper limits of the spec
+#define PD_T_SINK_WAIT_CAP			620
+#define PD_T_SENDER_RESPONSE		30
+#define PD_T_PS_TRANSITION			550
+#define PD_T_HARD_RESET_COMPLETE	5
+// source back after a hard reset (tSrcRecover + tSrcTurnOn), then tTypeCSinkWaitCap
+#define PD_T_HARD_RESET_RECOVER		(1000 + 275 + PD_T_SINK_WAIT_CAP)
 
-static FUSB302_D_Registers_st Registers;
+// a PPS contract is requested again well within tPPSRequest (10s), the source gives up after tPPSTimeout
+#define PD_T_PPS_REQUEST			8000
 
-static volatile CCHandshake_CC_t ConnectedCC;
+// next chunk (request) due (tChunkSenderRequest / tChunkSenderResponse, 24..30ms)
+#define PD_T_CHUNK					27
 
-static struct {
-	volatile PD_State_t State;
-	struct {
-		uint8_t MessageId;
-		PD_Message_t Message;
-		bool HasData;
-	} Rx;
-	struct {
-		uint8_t MessageId;
-		PD_Message_t Message;
-		PD_State_t (*OnAcknowledged)( PD_Message_t * message );
-		TimerTime_t SentTs;
-		uint8_t SendAttempts;
-	} Tx;
-	struct {
-		uint8_t NSourceCapabilities;
-		PD_DataObject_t SourceCapabilities[PD_MESSAGE_MAX_OBJECTS];
+#define PD_N_HARD_RESET_COUNT		2
 
-		uint8_t BestCapIndex;
-//		PD_DataObject_t BestCap;
-	} Power;
+// a PPS target wins over the power of any other offer
+#define PD_PPS_SCORE				(1UL << 24)
 
-} PD;
+// comparator threshold on cc, (MDAC + 1) * 42mV
+#define CCHANDSHAKE_DETACH_MDAC		( (CCHANDSHAKE_DETACH_CC_MV + 41) / 42 - 1 )
 
+// power register per power state
+static const uint8_t PowerStateBits[CCHandshake_Power_Count] = {
+	[CCHandshake_Power_Standby] = FUSB302_D_Power_PWR_BandgapAndWake,
+	[CCHandshake_Power_Detect] = FUSB302_D_Power_PWR_BandgapAndWake | FUSB302_D_Power_PWR_RxAndCur4MB | FUSB302_D_Power_PWR_MeasurementBlock,
+	[CCHandshake_Power_Active] = FUSB302_D_Power_PWR_MASK
+};
 
-static inline void pd_clearTx( void )
-{
-	memset( (uint8_t*)&PD.Tx.Message, 0, sizeof(PD_Message_t) );
-}
 
-static inline uint8_t pd_nextTxMessageId( void )
+static inline uint8_t pd_nextTxMessageId( CCHandshake_Port_t * port )
 {
-//	uint8_t mid = PD.Rx.MessageId + 1;
-	uint8_t mid = PD.Tx.MessageId;
+//	uint8_t mid = port->PD.Rx.MessageId + 1;
+	uint8_t mid = port->PD.Tx.MessageId;
 
-	PD.Tx.MessageId = (PD.Tx.MessageId + 1) % PD_MESSAGE_MAX_MID;
+	port->PD.Tx.MessageId = (port->PD.Tx.MessageId + 1) % (PD_MESSAGE_MAX_MID + 1);
 
 	return mid;
 }
 
 #endif
 
-void CCHandshake_init( void )
+bool CCHandshake_init( CCHandshake_Port_t * port, const FUSB302_D_Transport_t * transport, void * bus, uint16_t i2cAddr )
 {
-	FUSB302_D_Init( &Driver, HW_I2C_Handle(), I2CX_IRQn, FUSB302_D_DEFAULT_ADDRESS );
+	if (FUSB302_D_Init( &port->Driver, transport, bus, i2cAddr ) == FUSB302_D_ERROR)
+	{
+		return false;
+	}
 
-	if (FUSB302_D_Probe( &Driver, 3, 100 ) == FUSB302_D_ERROR )
+	if (FUSB302_D_Probe( &port->Driver, 3, 100 ) == FUSB302_D_ERROR )
 	{
-		Error_Handler( ErrorCodeCCHandshakeFail );
+		return false;
 	}
 
 #if ONSEMI_LIBRARY==true
@@ -177,45 +243,94 @@ void CCHandshake_init( void )
 //	SetStateUnattached();
 
 #else
-	ConnectedCC = CCHandshake_CC_None;
+	port->ConnectedCC = CCHandshake_CC_None;
+	port->ExpectVbusLoss = false;
+	port->Detect.Measuring = CCHandshake_CC_None;
+	port->OnNotify = NULL;
+	port->NotifyCtx = NULL;
+
+	port->Profile.MinMillivolt = 0;
+	port->Profile.MaxMillivolt = PD_REQUEST_MAX_MILLIVOLT;
+	port->Profile.MinMilliamp = 0;
+	port->Profile.MaxMilliamp = PD_REQUEST_MAX_MILLIAMP;
+	port->Profile.PreferredMillivolt = 0;
+	port->Profile.EfficiencyWeight = 0;
+	port->Profile.PPSMillivolt = 0;
+	port->Profile.PPSMilliamp = 0;
+	port->PD.Power.Reselect = false;
+
+	port->PowerState.Current = CCHandshake_Power_Active;
+	port->PowerState.EnteredTs = FUSB302_D_GetTime( &port->Driver );
+	memset( port->PowerState.TimeMs, 0, sizeof(port->PowerState.TimeMs) );
+
+	port->PD.Rx.Head = 0;
+	port->PD.Rx.Count = 0;
+	memset( &port->PD.Rx.Stats, 0, sizeof(port->PD.Rx.Stats) );
+
+#if CCHANDSHAKE_SLEEP_STATS==true
+	memset( &port->Sleep, 0, sizeof(port->Sleep) );
+#endif
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	port->Events.Head = 0;
+	port->Events.Tail = 0;
+	port->Events.Overruns = 0;
+	port->Events.HasEdge = false;
+	memset( &port->Events.Stats, 0, sizeof(port->Events.Stats) );
+#endif
+
+	// forget about the shadow, the device is reset anyways
+	port->Registers.Dirty = 0;
+	port->Registers.Valid = 0;
+	port->Registers.Reset = 0;
 
-//	read( FUSB302_D_Register_Reset,  );
-//	Registers.Reset |= FUSB302_D_Reset_SW_RES;
-	write( FUSB302_D_Register_Reset, FUSB302_D_Reset_SW_RES );
-//	Registers.Reset &= ~FUSB302_D_Reset_SW_RES;
+	strobe( port, FUSB302_D_Register_Reset, FUSB302_D_Reset_SW_RES );
 
-	if (readAll() == false)
+	if (readAll( port ) == false)
 	{
-		Error_Handler( ErrorCodeCCHandshakeFail );
+		return false;
 	}
-	if (configure() == false)
+	if (configure( port ) == false)
 	{
-		Error_Handler( ErrorCodeCCHandshakeFail );
+		return false;
 	}
 
-	PD.State = PD_State_Disabled;
+	port->PD.State = PD_State_Disabled;
+	port->PD.Timers.Running = 0;
+	port->PD.SpecRev = PD_HeaderWord_SpecRev_2_0;	// see configure()
+
+	memset( &port->PD.PE, 0, sizeof(port->PD.PE) );
+	port->PD.PE.State = PE_State_Disabled;
+	port->PD.PE.EnteredTs = FUSB302_D_GetTime( &port->Driver );
 
 #endif
+
+	return true;
 }
 
-void CCHandshake_deinit( void )
+void CCHandshake_deinit( CCHandshake_Port_t * port )
 {
 #if ONSEMI_LIBRARY==false
-	ConnectedCC = CCHandshake_CC_None;
-	PD.State = PD_State_Disabled;
+	port->ConnectedCC = CCHandshake_CC_None;
+	port->PD.State = PD_State_Disabled;
+	port->PD.PE.State = PE_State_Disabled;
+	port->PD.PE.HasContract = false;
 #endif
+
+	// frees the slot of the shared bus
+	FUSB302_D_DeInit( &port->Driver );
 }
 
-CCHandshake_CC_t CCHandshake_getOrientation( void )
+CCHandshake_CC_t CCHandshake_getOrientation( CCHandshake_Port_t * port )
 {
 #if ONSEMI_LIBRARY==true
 	return CCHandshake_CC_None;
 #else
-	return ConnectedCC;
+	return port->ConnectedCC;
 #endif
 }
 
-void CCHandshake_core( void )
+void CCHandshake_core( CCHandshake_Port_t * port )
 {
 #if ONSEMI_LIBRARY==true
 	core_state_machine();
@@ -226,1313 +341,2883 @@ void CCHandshake_core( void )
 
 //	while(1){
 
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	// edges queued after this are not covered by the read and stay in the ring
+	uint8_t head = port->Events.Head;
+
+	if (head != port->Events.Tail)
+	{
+		// reading the interrupt registers clears them (and releases INT_N), on failure the edges stay queued
+		if (readStatus( port ) == false)
+		{
+			return;
+		}
+
+		CCHandshake_takeEvents( port, head );
+	}
+	else
+	{
+		// nothing latched: the attached idle case does not need the bus at all
+		// (unattached detection still polls the cc pins)
+		if (CCHandshake_isIdle( port ))
+		{
+			return;
+		}
+
+		port->Events.HasEdge = false;
+
+		// run pending internal work on the cached status, but without events
+		port->Registers.Interrupta = 0;
+		port->Registers.Interruptb = 0;
+		port->Registers.Interrupt = 0;
+	}
+#else
 	// read all essential registers
-	readStatus();
+	readStatus( port );
+#endif
 
-//	if ( Registers.Interrupt != 0 ){
-//		DBG("Interrupt  %02x\n", Registers.Interrupt);
+//	if ( port->Registers.Interrupt != 0 ){
+//		DBG("Interrupt  %02x\n", port->Registers.Interrupt);
 //	}
-//	if ( Registers.Interrupta != 0 ){
-//		DBG("Interrupt  %02x\n", Registers.Interrupta);
+//	if ( port->Registers.Interrupta != 0 ){
+//		DBG("Interrupt  %02x\n", port->Registers.Interrupta);
 //	}
-//	if ( Registers.Interruptb != 0 ){
-//		DBG("Interrupt  %02x\n", Registers.Interruptb);
+//	if ( port->Registers.Interruptb != 0 ){
+//		DBG("Interrupt  %02x\n", port->Registers.Interruptb);
 //	}
 
-	typeC_core();
+	typeC_core( port );
 
-	pd_core();
+	pd_core( port );
 
 //	}
 #endif
 #endif /* ONSEMI_LIBRARY */
 }
 
-#if ONSEMI_LIBRARY==true
+#if ONSEMI_LIBRARY==false
 
-FSC_BOOL platform_get_device_irq_state( void )
+void CCHandshake_setNotifyCallback( CCHandshake_Port_t * port, CCHandshake_NotifyCallback_t callback, void * ctx )
 {
-	uint8_t reg = 0;
+	port->OnNotify = callback;
+	port->NotifyCtx = ctx;
+}
 
-	DeviceRead(regInterrupta, 2, &Registers.Status.InterruptAdv);
-	DeviceRead(regInterrupt, 1, &Registers.Status.Interrupt1);
+bool CCHandshake_isIdle( CCHandshake_Port_t * port )
+{
+	// with sink polling nothing is to be done until I_TOGDONE, in standby until I_WAKE
+	bool waiting = CCHANDSHAKE_USE_TOGGLE==true || port->PowerState.Current == CCHandshake_Power_Standby;
 
-	if (Registers.Status.InterruptAdv != 0 || Registers.Status.Interrupt1 != 0)
+	if ((port->ConnectedCC != CCHandshake_CC_None || waiting) == false)
 	{
-//		DBG("interruptAdv %04X \t interrupt1 %04X\n", Registers.Status.InterruptAdv, Registers.Status.Interrupt1 );
-		if (Registers.Status.I_OCP_TEMP){ DBG("I_OCP_TEMP " ); }
-		if (Registers.Status.I_TOGDONE){ DBG("I_TOGDONE " ); }
-		if (Registers.Status.I_SOFTFAIL){ DBG("I_SOFTFAIL " ); }
-		if (Registers.Status.I_RETRYFAIL){ DBG("I_RETRYFAIL " ); }
-		if (Registers.Status.I_HARDSENT){ DBG("I_HARDSENT " ); }
-		if (Registers.Status.I_TXSENT){ DBG("I_TXSENT " ); }
-		if (Registers.Status.I_SOFTRST){ DBG("I_SOFTRST " ); }
-		if (Registers.Status.I_HARDRST){ DBG("I_HARDRST " ); }
-
-		if (Registers.Status.I_GCRCSENT){ DBG("I_GCRCSENT " ); }
-
-		if (Registers.Status.I_VBUSOK){ DBG("I_VBUSOK " ); }
-		if (Registers.Status.I_ACTIVITY){ DBG("I_ACTIVITY " ); }
-		if (Registers.Status.I_COMP_CHNG){ DBG("I_COMP_CHNG " ); }
-		if (Registers.Status.I_CRC_CHK){ DBG("I_CRC_CHK " ); }
-		if (Registers.Status.I_ALERT){ DBG("I_ALERT " ); }
-		if (Registers.Status.I_WAKE){ DBG("I_WAKE " ); }
-		if (Registers.Status.I_COLLISION){ DBG("I_COLLISION " ); }
-		if (Registers.Status.I_BC_LVL){ DBG("I_BC_LVL " ); }
-
-		DBG("\n");
+		return false;
+	}
+	if (pd_hasWork( port ))
+	{
+		return false;
 	}
 
+	// a timeout to be handled
+	uint32_t deadline = 0;
+	if (CCHandshake_getNextDeadline( port, &deadline ) && (int32_t)(FUSB302_D_GetTime( &port->Driver ) - deadline) >= 0)
+	{
+		return false;
+	}
 
-	return (Registers.Status.Interrupt1 != 0 || Registers.Status.InterruptAdv != 0);
-//
-//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Interrupta, &reg) == FUSB302_D_OK)
-//	{
-//		if (reg != interrupta)
-//		{
-//			interrupta = reg;
-//			return TRUE;
-//		}
-//	}
-//
-//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Interruptb, &reg) == FUSB302_D_OK)
-//	{
-//		if (reg != interruptb)
-//		{
-//			interruptb = reg;
-//			return TRUE;
-//		}
-//	}
-//
-//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Status0, &reg) == FUSB302_D_OK)
-//	{
-//		if (reg != status0)
-//		{
-//			status0 = reg;
-//			return TRUE;
-//		}
-//	}
-//
-//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Status1, &reg) == FUSB302_D_OK)
-//	{
-//		if (reg != status1)
-//		{
-//			status1 = reg;
-//			return TRUE;
-//		}
-//	}
-//
-//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Interrupt, &reg) == FUSB302_D_OK)
-//	{
-//		if (reg != interrupt)
-//		{
-//			interrupt = reg;
-//			return TRUE;
-//		}
-//	}
+	return true;
 }
 
-#else
+bool CCHandshake_getNextDeadline( CCHandshake_Port_t * port, uint32_t * deadline )
+{
+	bool any = false;
 
+	*deadline = 0;
 
-static void typeC_core( void )
-{
-	// if not connected check if there is one
-	if (ConnectedCC == CCHandshake_CC_None)
+	for (uint8_t t = 0; t < PD_Timer_Count; t++)
 	{
-		CCHandshake_CC_t detected = detectCCPinSink();
-
-		// if none detected, just quit
-		if (detected == CCHandshake_CC_None)
+		if ((port->PD.Timers.Running & (1 << t)) == 0)
 		{
-			return;
+			continue;
 		}
-
-//		DBG("typeC Switches1 %02x\n", Registers.Switches1 );
-
-		if (enableSink( detected ) == false)
+		if (any == false || (int32_t)(port->PD.Timers.Deadline[t] - *deadline) < 0)
 		{
-			return;
+			*deadline = port->PD.Timers.Deadline[t];
+			any = true;
 		}
+	}
 
-//		DBG("typeC Switches1 %02x\n", Registers.Switches1 );
-		pd_init();
+	return any;
+}
+
+uint32_t CCHandshake_getNextService( CCHandshake_Port_t * port, uint32_t * next )
+{
+	uint32_t events = 0;
 
-		ConnectedCC = detected;
+	*next = FUSB302_D_GetTime( &port->Driver );
 
-//		DBG("typeC Switches1 %02x\n", Registers.Switches1 );
-		DBG("CC detected %d\n", detected);
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	if (CCHandshake_hasInterrupt( port ))
+	{
+		events |= CCHANDSHAKE_NEXT_BUSY;
 	}
-	else // check if it's still connected
+#else
+	events |= CCHANDSHAKE_NEXT_POLL;
+#endif
+
+	if (port->ConnectedCC == CCHandshake_CC_None && port->PowerState.Current != CCHandshake_Power_Standby)
 	{
-//		if (read( FUSB302_D_Register_Interrupt ) == false)
-//		{
-//			return;
-//		}
-		if ( (Registers.Interrupt & FUSB302_D_Interrupt_I_BC_LVL) != FUSB302_D_Interrupt_I_BC_LVL )
+#if CCHANDSHAKE_LOW_POWER==true
+		nextDeadline( &events, next, CCHANDSHAKE_NEXT_TIMER, port->PowerState.EnteredTs + CCHANDSHAKE_WAKE_TIMEOUT_MS );
+#endif
+#if CCHANDSHAKE_USE_TOGGLE==false
+		if (port->Detect.Measuring != CCHandshake_CC_None && port->Driver.Transport->GetTime != NULL)
 		{
-			return;
+			nextDeadline( &events, next, CCHANDSHAKE_NEXT_DEBOUNCE, port->Detect.StartTs + CCHANDSHAKE_CC_DEBOUNCE_MS );
 		}
-
-		uint8_t bc_lvl = 0;
-//		DBG("typeC Switches1 %02x\n", Registers.Switches1 );
-
-		if (readCCVoltageLevel( &bc_lvl ) == false)
+		else
 		{
-			return;
+			events |= CCHANDSHAKE_NEXT_BUSY;
 		}
+#endif
+	}
+
+	if (pd_hasWork( port ))
+	{
+		events |= CCHANDSHAKE_NEXT_BUSY;
+	}
 
-//		DBG("typeC Switches1 %02x\n", Registers.Switches1 );
-		// above threshold?
-		if (bc_lvl >= CCHANDSHAKE_REQUIRE_BC_LVL)
+	for (uint8_t t = 0; t < PD_Timer_Count; t++)
+	{
+		if (port->PD.Timers.Running & (1 << t))
 		{
-			return; // then we're still good
+			nextDeadline( &events, next, (t == PD_Timer_PPSRequest) ? CCHANDSHAKE_NEXT_PPS : CCHANDSHAKE_NEXT_TIMER, port->PD.Timers.Deadline[t] );
 		}
+	}
+
+	return events;
+}
+
+uint32_t CCHandshake_service( CCHandshake_Port_t * port, uint32_t * next )
+{
+#if CCHANDSHAKE_SLEEP_STATS==true
+	uint32_t now = FUSB302_D_GetTime( &port->Driver );
+
+	if (port->Sleep.Stats.Calls == 0)
+	{
+		port->Sleep.StartTs = now;
+	}
+	else if ((port->Sleep.Events & CCHANDSHAKE_NEXT_BUSY) == 0)
+	{
+		// since the last call, up to the deadline it returned
+		uint32_t slept = now - port->Sleep.Ts;
 
-		if ( disableSink() == false )
+		if (port->Sleep.Events & NEXT_DEADLINES)
 		{
+			int32_t allowed = (int32_t)(port->Sleep.Next - port->Sleep.Ts);
 
+			if (allowed < 0)
+			{
+				allowed = 0;
+			}
+			if (slept > (uint32_t)allowed)
+			{
+				slept = (uint32_t)allowed;
+			}
 		}
 
-		pd_deinit();
+		port->Sleep.Stats.SleepMs += slept;
+	}
 
-		ConnectedCC = CCHandshake_CC_None;
+	port->Sleep.Stats.TotalMs = now - port->Sleep.StartTs;
+	port->Sleep.Stats.Calls++;
+#endif
 
-		DBG("CC lost\n");
-	}
-}
+	CCHandshake_core( port );
 
+	uint32_t events = CCHandshake_getNextService( port, next );
 
-//inline static uint8_t * regPtr( FUSB302_D_Register_t reg )
-//{
-//	switch (reg){
-//		case FUSB302_D_Register_DeviceID: 	return &Registers.DeviceID;
-//		case FUSB302_D_Register_Switches0: 	return &Registers.Switches0;
-//		case FUSB302_D_Register_Switches1: 	return &Registers.Switches1;
-//		case FUSB302_D_Register_Measure: 	return &Registers.Measure;
-//		case FUSB302_D_Register_Slice: 		return &Registers.Slice;
-//		case FUSB302_D_Register_Control0: 	return &Registers.Control0;
-//		case FUSB302_D_Register_Control1: 	return &Registers.Control1;
-//		case FUSB302_D_Register_Control2: 	return &Registers.Control2;
-//		case FUSB302_D_Register_Control3: 	return &Registers.Control3;
-//		case FUSB302_D_Register_Mask1: 		return &Registers.Mask1;
-//		case FUSB302_D_Register_Power: 		return &Registers.Power;
-//		case FUSB302_D_Register_Reset: 		return &Registers.Reset;
-//		case FUSB302_D_Register_OCPreg: 	return &Registers.OCPreg;
-//		case FUSB302_D_Register_Maska: 		return &Registers.Maska;
-//		case FUSB302_D_Register_Maskb: 		return &Registers.Maskb;
-//		case FUSB302_D_Register_Control4: 	return &Registers.Control4;
-//		case FUSB302_D_Register_Status0a: 	return &Registers.Status0a;
-//		case FUSB302_D_Register_Status1a: 	return &Registers.Status1a;
-//		case FUSB302_D_Register_Interrupta: return &Registers.Interrupta;
-//		case FUSB302_D_Register_Interruptb: return &Registers.Interruptb;
-//		case FUSB302_D_Register_Status0: 	return &Registers.Status0;
-//		case FUSB302_D_Register_Status1: 	return &Registers.Status1;
-//		case FUSB302_D_Register_Interrupt: 	return &Registers.Interrupt;
-//		case FUSB302_D_Register_FIFOs: 		return &Registers.FIFOs;
-//
-//		default: return NULL;
-//	}
-//}
+#if CCHANDSHAKE_SLEEP_STATS==true
+	port->Sleep.Ts = FUSB302_D_GetTime( &port->Driver );
+	port->Sleep.Events = events;
+	port->Sleep.Next = *next;
+#endif
+
+	return events;
+}
 
-static bool read( FUSB302_D_Register_t reg, uint8_t * value )
+void CCHandshake_setSinkProfile( CCHandshake_Port_t * port, const CCHandshake_SinkProfile_t * profile )
 {
-//	uint8_t * r = regPtr( reg );
-//
-//	if (r == NULL)
-//	{
-//		return false;
-//	}
+	port->Profile = *profile;
 
-	uint8_t r[2] = {0,0};
+	// nothing to renegotiate while detached (or PD was given up)
+	port->PD.Power.Reselect = port->PD.PE.State != PE_State_Disabled;
+}
 
-	if (FUSB302_D_Read( &Driver, reg, &r[0] ) == FUSB302_D_ERROR)
+void CCHandshake_setPPS( CCHandshake_Port_t * port, uint16_t millivolt, uint16_t milliamp )
+{
+	if (port->Profile.PPSMillivolt == millivolt && port->Profile.PPSMilliamp == milliamp)
 	{
-		return false;
+		return;
 	}
 
-	*value = r[0];
+	port->Profile.PPSMillivolt = millivolt;
+	port->Profile.PPSMilliamp = milliamp;
 
-	return true;
+	port->PD.Power.Reselect = port->PD.PE.State != PE_State_Disabled;
 }
 
-static bool write( FUSB302_D_Register_t reg, uint8_t value )
+#if CCHANDSHAKE_PD_REV3==true
+bool CCHandshake_requestExtended( CCHandshake_Port_t * port, PD_ControlCommand_t command )
 {
-//	uint8_t * r = regPtr( reg );
-//
-//	if (r == NULL)
-//	{
-//		return false;
-//	}
+	switch (command)
+	{
+		case PD_ControlCommand_GetSourceCapExtended:
+		case PD_ControlCommand_GetStatus:
+		case PD_ControlCommand_GetPPSStatus:
+		case PD_ControlCommand_GetCountryCodes:
+			break;
+		default:
+			return false;
+	}
 
-	if (FUSB302_D_Write( &Driver, reg, value ) == FUSB302_D_ERROR)
+	if (port->PD.SpecRev != PD_HeaderWord_SpecRev_3_0 || port->PD.Ext.Get != 0)
 	{
 		return false;
 	}
 
-	return true;
-}
+	port->PD.Ext.Get = command;
 
-static bool readAll( void )
-{
-	if (read(FUSB302_D_Register_DeviceID, &Registers.DeviceID) == false) return false;
-	if (read(FUSB302_D_Register_Switches0, &Registers.Switches0 ) == false) return false;
-	if (read(FUSB302_D_Register_Switches1, &Registers.Switches1) == false) return false;
-	if (read(FUSB302_D_Register_Measure, &Registers.Measure ) == false) return false;
-	if (read(FUSB302_D_Register_Slice, &Registers.Slice) == false) return false;
-	if (read(FUSB302_D_Register_Control0, &Registers.Control0) == false) return false;
-	if (read(FUSB302_D_Register_Control1, &Registers.Control1) == false) return false;
-	if (read(FUSB302_D_Register_Control2, &Registers.Control2 ) == false) return false;
-	if (read(FUSB302_D_Register_Control3, &Registers.Control3) == false) return false;
-	if (read(FUSB302_D_Register_Mask1, &Registers.Mask1) == false) return false;
-	if (read(FUSB302_D_Register_Power, &Registers.Power) == false) return false;
-//	if (read(FUSB302_D_Register_Reset, &Registers.Reset) == false) return false; // no point in reading this
-	if (read(FUSB302_D_Register_OCPreg, &Registers.OCPreg) == false) return false;
-	if (read(FUSB302_D_Register_Maska, &Registers.Maska) == false) return false;
-	if (read(FUSB302_D_Register_Maskb, &Registers.Maskb) == false) return false;
-	if (read(FUSB302_D_Register_Control4, &Registers.Control4) == false) return false;
-	if (read(FUSB302_D_Register_Status0a, &Registers.Status0a) == false) return false;
-	if (read(FUSB302_D_Register_Status1a, &Registers.Status1a) == false) return false;
-	if (read(FUSB302_D_Register_Status0, &Registers.Status0) == false) return false;
-	if (read(FUSB302_D_Register_Status1, &Registers.Status1) == false) return false;
-	if (read(FUSB302_D_Register_FIFOs, &Registers.FIFOs) == false) return false;
 	return true;
 }
 
-static bool readStatus( void )
+bool CCHandshake_sendExtended( CCHandshake_Port_t * port, PD_ExtendedCommand_t type, const uint8_t * data, uint16_t size )
 {
-	uint8_t buf[5] = {0,0,0,0,0};
-
+	if (PD_isValidExtendedCommand( type ) == false || size > PD_EXTENDED_MAX_DATA_SIZE)
+	{
+		return false;
+	}
 
-	if (FUSB302_D_ReadN( &Driver, FUSB302_D_Register_Interrupta, &buf[0], 5 ) == FUSB302_D_ERROR)
+	if (port->PD.SpecRev != PD_HeaderWord_SpecRev_3_0 || port->PD.Ext.Tx.Data != NULL || port->PD.Ext.Tx.Pending)
 	{
-		DBG("failed read\n");
 		return false;
 	}
-	Registers.Interrupta = buf[0];
-	Registers.Interruptb = buf[1];
-	Registers.Status0 = buf[2];
-	Registers.Status1 = buf[3];
-	Registers.Interrupt = buf[4];
 
-//	if (read(FUSB302_D_Register_Interrupta, &Registers.Interrupta) == false) return false;
-//	if (read(FUSB302_D_Register_Interruptb, &Registers.Interruptb) == false) return false;
-//	if (read(FUSB302_D_Register_Status0, &Registers.Status0) == false) return false;
-//	if (read(FUSB302_D_Register_Status1, &Registers.Status1) == false) return false;
-//	if (read(FUSB302_D_Register_Interrupt, &Registers.Interrupt) == false) return false;
+	port->PD.Ext.Tx.Type = type;
+	port->PD.Ext.Tx.Size = size;
+	port->PD.Ext.Tx.Data = data;
+	port->PD.Ext.Tx.Pending = true;
 
 	return true;
 }
 
-static bool configure( void )
+const uint8_t * CCHandshake_getExtendedMessage( CCHandshake_Port_t * port, PD_ExtendedCommand_t * type, uint16_t * size )
 {
-#if CCHANDSHAKE_AUTONOMOUS==true
+	if (port->PD.Ext.Rx.Complete == false)
+	{
+		return NULL;
+	}
 
-#else
+	*type = port->PD.Ext.Rx.Type;
+	*size = port->PD.Ext.Rx.Size;
 
-	// enable all power except internal oscillator
-	Registers.Power = FUSB302_D_Power_PWR_MASK;// & ~FUSB302_D_Power_PWR_InternalOscillator;
-	if (write( FUSB302_D_Register_Power, Registers.Power ) == false) return false;
+	return port->PD.Ext.Rx.Data;
+}
+#endif
 
-	// enable high current mode
-	// if we were using the interrupt pin, also set FUSB302_D_Control0_INT_MASK (don't forget to optionally set TOG_RD_ONLY)
-//	Registers.Control0 = (Registers.Control0 & ~FUSB302_D_Control0_HOST_CUR_MASK) | FUSB302_D_Control0_HOST_CUR_HighCurrentMode;
+PE_State_t CCHandshake_getPolicyState( CCHandshake_Port_t * port )
+{
+	return port->PD.PE.State;
+}
 
-	//	Registers.Control0 &= ~FUSB302_D_Control0_AUTO_PRE; // is 0 by default
-//	if (write( FUSB302_D_Register_Control0, Registers.Control0 ) == false) return false;
+bool CCHandshake_hasContract( CCHandshake_Port_t * port )
+{
+	return port->PD.PE.HasContract;
+}
 
-	// ON SEMI also sets TOC_USRC_EXIT of "undocumented control 4"
+uint32_t CCHandshake_getContractTime( CCHandshake_Port_t * port )
+{
+	return port->PD.PE.ContractMs;
+}
 
-	// enable sink polling (NOTE, we're not using it right now, disabled by default)
-//	read( FUSB302_D_Register_Control2 );
-//	Registers.Control2 = FUSB302_D_Control2_MODE_SnkPolling | FUSB302_D_Control2_TOGGLE;
-//	if (write( FUSB302_D_Register_Control2 );
+void CCHandshake_getPolicyStats( CCHandshake_Port_t * port, uint32_t timeMs[PE_State_Count] )
+{
+	// read only, the core may run in another task
+	PE_State_t state = port->PD.PE.State;
+	uint32_t entered = port->PD.PE.EnteredTs;
 
-	Registers.Switches1 = FUSB302_D_Switches1_POWERROLE_Sink | FUSB302_D_Switches1_DATAROLE_Sink | FUSB302_D_Switches1_SPECREV_Rev2_0 | FUSB302_D_Switches1_AUTO_CRC;
-	if (write( FUSB302_D_Register_Switches1, Registers.Switches1 ) == false) return false;
-//	DBG("configure Switches1 %02x\n", Registers.Switches1 );
+	memcpy( timeMs, port->PD.PE.TimeMs, sizeof(port->PD.PE.TimeMs) );
 
-	Registers.Control3 |= FUSB302_D_Control3_AUTO_HARDRESET | FUSB302_D_Control3_AUTO_SOFTRESET | FUSB302_D_Control3_AUTO_RETRY | (0xFF & FUSB302_D_Control3_N_RETRIES_MASK);
-	if (write( FUSB302_D_Register_Control3, Registers.Control3 ) == false) return false;
+	// the current state up to now
+	timeMs[state] += FUSB302_D_GetTime( &port->Driver ) - entered;
+}
 
-	// disable all interrupts
-	Registers.Mask1 = FUSB302_D_Mask1_ALL;
-	if (write( FUSB302_D_Register_Mask1, Registers.Mask1 ) == false) return false;
-	Registers.Maska = FUSB302_D_Maska_ALL;
-	if (write( FUSB302_D_Register_Maska, Registers.Maska ) == false) return false;
-	Registers.Maskb = FUSB302_D_Maskb_ALL;
-	if (write( FUSB302_D_Register_Maskb, Registers.Maskb ) == false) return false;
-
-//	DBG("configure Switches1 %02x\n", Registers.Switches1 );
+void CCHandshake_dispatch( CCHandshake_Port_t * port, const uint8_t * status )
+{
+	if (status != NULL)
+	{
+		applyStatus( port, status );
+	}
+	else
+	{
+#if CCHANDSHAKE_USE_INTERRUPT==true
+		port->Events.HasEdge = false;
 #endif
 
-	return true;
-}
-
-
-/**
- * Tries to get fresh value of measurement (the currently selected cc pin)
- */
-static bool readCCVoltageLevel( uint8_t * bc_lvl )
-{
-	if (read(FUSB302_D_Register_Status0, &Registers.Status0) == false)
-	{
-		return false;
+		// keep the last status, but without events
+		port->Registers.Interrupta = 0;
+		port->Registers.Interruptb = 0;
+		port->Registers.Interrupt = 0;
 	}
 
-	*bc_lvl = Registers.Status0 & FUSB302_D_Status0_BC_LVL_MASK;
+	typeC_core( port );
 
-	return true;
+	pd_core( port );
 }
 
-/**
- * Tries to detect which cc pin has voltage
- * WARNING: resets Switches0 register
- */
-static CCHandshake_CC_t detectCCPinSink( void )
-{
-	uint8_t BC_LVL;
+#endif
 
-//	read( FUSB302_D_Register_Switches0 );
+void CCHandshake_Scheduler_init( CCHandshake_Scheduler_t * sched, CCHandshake_Port_t ** ports, uint8_t nports )
+{
+	sched->Ports = ports;
+	sched->NPorts = nports;
+	sched->Next = 0;
+}
 
-	// enable measurement on cc1
-	Registers.Switches0 = (Registers.Switches0 & ~FUSB302_D_Switches0_MEAS_CC_MASK) | FUSB302_D_Switches0_MEAS_CC1;// | FUSB302_D_Switches0_PDWN2 | FUSB302_D_Switches0_PDWN1;
-	write( FUSB302_D_Register_Switches0, Registers.Switches0 );
+void CCHandshake_Scheduler_run( CCHandshake_Scheduler_t * sched )
+{
+	CCHandshake_Scheduler_runSlice( sched, sched->NPorts );
+}
 
-	// wait a bit
-	DelayMs(250);
+void CCHandshake_Scheduler_runSlice( CCHandshake_Scheduler_t * sched, uint8_t budget )
+{
+	if (sched->NPorts == 0)
+	{
+		return;
+	}
 
-	// get measurement
-	if (readCCVoltageLevel( &BC_LVL ) == false)
+	if (budget > sched->NPorts)
 	{
-		return CCHandshake_CC_None;
+		budget = sched->NPorts;
 	}
-	if ( BC_LVL > FUSB302_D_Status0_BC_LVL_LessThan200mV )
+
+	// round robin, so a slice that does not cover all ports does not starve the last ones
+	for (uint8_t i = 0; i < budget; i++)
 	{
-		return CCHandshake_CC_1;
+		CCHandshake_core( sched->Ports[sched->Next] );
+
+		sched->Next = (sched->Next + 1) % sched->NPorts;
 	}
+}
 
-	// enable measurement on cc2
-	Registers.Switches0 = (Registers.Switches0 & ~FUSB302_D_Switches0_MEAS_CC_MASK) | FUSB302_D_Switches0_MEAS_CC2;// | FUSB302_D_Switches0_PDWN2 | FUSB302_D_Switches0_PDWN1;
-	write( FUSB302_D_Register_Switches0, Registers.Switches0 );
+#if ONSEMI_LIBRARY==false
 
-	// wait a bit
-	DelayMs(250);
+#if CCHANDSHAKE_USE_INTERRUPT==true
+void CCHandshake_onInterrupt( CCHandshake_Port_t * port )
+{
+	uint8_t head = port->Events.Head;
 
-	// get measurement
-	if (readCCVoltageLevel( &BC_LVL ) == false)
-	{
-		return CCHandshake_CC_None;
-	}
-	if ( BC_LVL > FUSB302_D_Status0_BC_LVL_LessThan200mV )
+	if ((uint8_t)(head - port->Events.Tail) == CCHANDSHAKE_EVENT_RING_SIZE)
 	{
-		return CCHandshake_CC_2;
+		// the core still has to read the status, which covers this edge too
+		port->Events.Overruns++;
+		return;
 	}
 
-	return CCHandshake_CC_None;
+	port->Events.Ts[head & (CCHANDSHAKE_EVENT_RING_SIZE - 1)] = FUSB302_D_GetTime( &port->Driver );
+
+	// publish only once the entry is written
+	port->Events.Head = head + 1;
 }
 
-static bool enableSink( CCHandshake_CC_t cc )
+bool CCHandshake_hasInterrupt( CCHandshake_Port_t * port )
 {
-	if (cc == CCHandshake_CC_None)
+	return port->Events.Head != port->Events.Tail;
+}
+
+void CCHandshake_takeEvents( CCHandshake_Port_t * port, uint8_t head )
+{
+	uint8_t tail = port->Events.Tail;
+	uint8_t n = head - tail;
+
+	if (n == 0)
 	{
-		DBG("Trying to enable none!");
-		return false;
+		return;
 	}
 
-//	DBG("enableSink Switches1 %02x\n", Registers.Switches1 );
-//	read( FUSB302_D_Register_Switches1 );
-//	read( FUSB302_D_Register_Power );
+	uint32_t now = FUSB302_D_GetTime( &port->Driver );
 
-//	DBG("switches1 %02x\n", Registers.Switches1 );
+	// the events of this status read happened with the first edge
+	port->Events.EdgeTs = port->Events.Ts[tail & (CCHANDSHAKE_EVENT_RING_SIZE - 1)];
+	port->Events.HasEdge = true;
 
-	// enable meas and txcc
-	if (cc == CCHandshake_CC_1)
+	// oldest first
+	for (; tail != head; tail++)
 	{
-		Registers.Switches0 = ((Registers.Switches0 & ~FUSB302_D_Switches0_MEAS_CC_MASK) | FUSB302_D_Switches0_MEAS_CC1);
-		Registers.Switches1 = (Registers.Switches1 & ~FUSB302_D_Switches1_TXCC_MASK) | FUSB302_D_Switches1_TXCC1;
+		uint32_t latency = now - port->Events.Ts[tail & (CCHANDSHAKE_EVENT_RING_SIZE - 1)];
+
+		if (latency > port->Events.Stats.MaxLatencyMs)
+		{
+			port->Events.Stats.MaxLatencyMs = latency;
+		}
 	}
-	else if (cc == CCHandshake_CC_2)
+
+	// the slots are free for the interrupt again
+	port->Events.Tail = head;
+
+	port->Events.Stats.Events += n;
+	if (n > port->Events.Stats.RingHighWater)
 	{
-		Registers.Switches0 = ((Registers.Switches0 & ~FUSB302_D_Switches0_MEAS_CC_MASK) | FUSB302_D_Switches0_MEAS_CC2);
-		Registers.Switches1 = (Registers.Switches1 & ~(FUSB302_D_Switches1_TXCC_MASK)) | FUSB302_D_Switches1_TXCC2;
+		port->Events.Stats.RingHighWater = n;
 	}
+}
 
-	if (write( FUSB302_D_Register_Switches0, Registers.Switches0 ) == false) return false;
-	if (write( FUSB302_D_Register_Switches1, Registers.Switches1 ) == false) return false;
+void CCHandshake_getEventStats( CCHandshake_Port_t * port, CCHandshake_EventStats_t * stats )
+{
+	*stats = port->Events.Stats;
+	stats->Overruns = port->Events.Overruns;
+}
+#endif
 
-//	read( FUSB302_D_Register_Switches1, &Registers.Switches1 );
-//	DBG("enableSink Switches1 %02x\n", Registers.Switches1 );
+#if CCHANDSHAKE_SLEEP_STATS==true
+void CCHandshake_getSleepStats( CCHandshake_Port_t * port, CCHandshake_SleepStats_t * stats )
+{
+	*stats = port->Sleep.Stats;
+}
+#endif
 
-	// enable oscillator for PD
-//	if ( (Registers.Power & FUSB302_D_Power_PWR_InternalOscillator) != FUSB302_D_Power_PWR_InternalOscillator )
-//	{
-//		DBG("activating internal oscillator\n");
-//		Registers.Power |= FUSB302_D_Power_PWR_InternalOscillator;
-//		if (write( FUSB302_D_Register_Power, Registers.Power ) == false) return false;
-//	}
+void CCHandshake_getPowerStats( CCHandshake_Port_t * port, uint32_t timeMs[CCHandshake_Power_Count] )
+{
+	uint32_t now = FUSB302_D_GetTime( &port->Driver );
 
+	// account the current state up to now
+	port->PowerState.TimeMs[port->PowerState.Current] += now - port->PowerState.EnteredTs;
+	port->PowerState.EnteredTs = now;
 
-//	Registers.Switches
-	// TXCCx = 1
-	// MEAS_CCx = 1
-	// TXCCy = 0
-	// MEAS_CCy = 0
+	memcpy( timeMs, port->PowerState.TimeMs, sizeof(port->PowerState.TimeMs) );
+}
 
-//	Registers.Switches1 // by default we don't have to set this
-	// POWERROLE = 0
-	// DATAROLE = 0
+void CCHandshake_getRxStats( CCHandshake_Port_t * port, CCHandshake_RxStats_t * stats )
+{
+	*stats = port->PD.Rx.Stats;
+}
 
-// Registers.Control
-	// ENSOP1 = 0
-	// ENSOP1DP = 0
-	// ENSOP2 = 0
-	// ENSOP2DP = 0
+#if FUSB302_D_STATS==true
+void CCHandshake_getBusStats( CCHandshake_Port_t * port, FUSB302_D_Stats_t * stats )
+{
+	FUSB302_D_GetStats( &port->Driver, stats );
+}
+#endif
 
-	// Registers.Power enable internal oscillator
+#endif /* ONSEMI_LIBRARY==false */
 
-	return true;
-}
+#if ONSEMI_LIBRARY==true
 
-static bool disableSink()
+FSC_BOOL platform_get_device_irq_state( void )
 {
-//	DBG("disableSink()\n");
+	uint8_t reg = 0;
+
+	DeviceRead(regInterrupta, 2, &Registers.Status.InterruptAdv);
+	DeviceRead(regInterrupt, 1, &Registers.Status.Interrupt1);
 
-//	read( FUSB302_D_Register_Switches1 );
-//	read( FUSB302_D_Register_Power );
+	if (Registers.Status.InterruptAdv != 0 || Registers.Status.Interrupt1 != 0)
+	{
+//		DBG("interruptAdv %04X \t interrupt1 %04X\n", Registers.Status.InterruptAdv, Registers.Status.Interrupt1 );
+		if (Registers.Status.I_OCP_TEMP){ DBG("I_OCP_TEMP " ); }
+		if (Registers.Status.I_TOGDONE){ DBG("I_TOGDONE " ); }
+		if (Registers.Status.I_SOFTFAIL){ DBG("I_SOFTFAIL " ); }
+		if (Registers.Status.I_RETRYFAIL){ DBG("I_RETRYFAIL " ); }
+		if (Registers.Status.I_HARDSENT){ DBG("I_HARDSENT " ); }
+		if (Registers.Status.I_TXSENT){ DBG("I_TXSENT " ); }
+		if (Registers.Status.I_SOFTRST){ DBG("I_SOFTRST " ); }
+		if (Registers.Status.I_HARDRST){ DBG("I_HARDRST " ); }
 
-//	DBG("disableSink Switches1 %02x\n", Registers.Switches1 );
+		if (Registers.Status.I_GCRCSENT){ DBG("I_GCRCSENT " ); }
 
-	// disable TXCCx
-	Registers.Switches1 &= ~FUSB302_D_Switches1_TXCC_MASK;
-	write( FUSB302_D_Register_Switches1, Registers.Switches1 );
+		if (Registers.Status.I_VBUSOK){ DBG("I_VBUSOK " ); }
+		if (Registers.Status.I_ACTIVITY){ DBG("I_ACTIVITY " ); }
+		if (Registers.Status.I_COMP_CHNG){ DBG("I_COMP_CHNG " ); }
+		if (Registers.Status.I_CRC_CHK){ DBG("I_CRC_CHK " ); }
+		if (Registers.Status.I_ALERT){ DBG("I_ALERT " ); }
+		if (Registers.Status.I_WAKE){ DBG("I_WAKE " ); }
+		if (Registers.Status.I_COLLISION){ DBG("I_COLLISION " ); }
+		if (Registers.Status.I_BC_LVL){ DBG("I_BC_LVL " ); }
 
-	// disable CC
-	Registers.Switches0 &= ~FUSB302_D_Switches0_MEAS_CC_MASK;
-	write( FUSB302_D_Register_Switches0, Registers.Switches0 );
+		DBG("\n");
+	}
 
-//	DBG("disableSink Switches1 %02x\n", Registers.Switches1 );
-	// disable oscillator for PD
-//	Registers.Power &= ~FUSB302_D_Power_PWR_InternalOscillator;
 
-	return true;
+	return (Registers.Status.Interrupt1 != 0 || Registers.Status.InterruptAdv != 0);
+//
+//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Interrupta, &reg) == FUSB302_D_OK)
+//	{
+//		if (reg != interrupta)
+//		{
+//			interrupta = reg;
+//			return TRUE;
+//		}
+//	}
+//
+//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Interruptb, &reg) == FUSB302_D_OK)
+//	{
+//		if (reg != interruptb)
+//		{
+//			interruptb = reg;
+//			return TRUE;
+//		}
+//	}
+//
+//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Status0, &reg) == FUSB302_D_OK)
+//	{
+//		if (reg != status0)
+//		{
+//			status0 = reg;
+//			return TRUE;
+//		}
+//	}
+//
+//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Status1, &reg) == FUSB302_D_OK)
+//	{
+//		if (reg != status1)
+//		{
+//			status1 = reg;
+//			return TRUE;
+//		}
+//	}
+//
+//	if (FUSB302_D_Read( &Driver, FUSB302_D_Register_Interrupt, &reg) == FUSB302_D_OK)
+//	{
+//		if (reg != interrupt)
+//		{
+//			interrupt = reg;
+//			return TRUE;
+//		}
+//	}
 }
 
+#else
+
 
-static void pd_core( void )
+/**
+ * Hands <notification> to the application, stamped with the INT_N edge of the status read (if any)
+ */
+static void notify( CCHandshake_Port_t * port, CCHandshake_Notification_t * notification )
 {
-	if (PD.State == PD_State_Disabled)
+	if (port->OnNotify == NULL)
 	{
-//		DBG("PD State Disabled\n");
 		return;
 	}
 
-//	static bool first = true;
-//	if (first){
-//		DBG("FIRST\n");
-//		first = false;
-//	}
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	notification->Ts = port->Events.HasEdge ? port->Events.EdgeTs : FUSB302_D_GetTime( &port->Driver );
+#else
+	notification->Ts = FUSB302_D_GetTime( &port->Driver );
+#endif
 
-	if ( (Registers.Status1 & FUSB302_D_Status1_RX_EMPTY ) == FUSB302_D_Status1_RX_EMPTY){
-//		DBG("RX_EMPTY\n");
-//		PD.Rx.HasData |= PD.Rx.HasData;
-//		PD.State = PD_State_Rx;
-	}
-	if ( (Registers.Status1 & FUSB302_D_Status1_RX_FULL ) == FUSB302_D_Status1_RX_FULL){
-		DBG("RX_FULL\n");
-	}
-	if ( (Registers.Status1 & FUSB302_D_Status1_TX_EMPTY ) == FUSB302_D_Status1_TX_EMPTY){
-//		DBG("TX_EMPTY\n");
-	}
-	if ( (Registers.Status1 & FUSB302_D_Status1_TX_FULL ) == FUSB302_D_Status1_TX_FULL){
-		DBG("TX_FULL\n");
-	}
+	port->OnNotify( port, notification, port->NotifyCtx );
+}
 
-	if ( (Registers.Interrupt & FUSB302_D_Interrupt_I_COLLISION) == FUSB302_D_Interrupt_I_COLLISION )
-	{
-		DBG("I_COLLISION\n");
-	}
-	if ( (Registers.Interrupt & FUSB302_D_Interrupt_I_ACTIVITY) == FUSB302_D_Interrupt_I_ACTIVITY )
-	{
-//		DBG("I_ACTIVITY\n");
-	}
-	if ( (Registers.Interrupt & FUSB302_D_Interrupt_I_ALERT) == FUSB302_D_Interrupt_I_ALERT )
+/**
+ * Adds <event> to the CCHandshake_getNextService() result, <next> is the earliest deadline of all
+ */
+static void nextDeadline( uint32_t * events, uint32_t * next, uint32_t event, uint32_t deadline )
+{
+	if ((*events & NEXT_DEADLINES) == 0 || (int32_t)(deadline - *next) < 0)
 	{
-		DBG("I_ALERT\n");
-	}
-
-	if ( (Registers.Interrupta & FUSB302_D_Interrupta_I_SOFTFAIL ) == FUSB302_D_Interrupta_I_SOFTFAIL){
-		DBG("I_SOFTFAIL\n");
-	}
-	if ( (Registers.Interrupta & FUSB302_D_Interrupta_I_RETRYFAIL ) == FUSB302_D_Interrupta_I_RETRYFAIL){
-		DBG("I_RETRYFAIL\n");
-	}
-	if ( (Registers.Interrupta & FUSB302_D_Interrupta_I_HARDSENT ) == FUSB302_D_Interrupta_I_HARDSENT){
-		DBG("I_HARDSENT\n");
-	}
-	if ( (Registers.Interrupta & FUSB302_D_Interrupta_I_TXSENT ) == FUSB302_D_Interrupta_I_TXSENT){
-		DBG("I_TXSENT\n");
-	}
-	if ( (Registers.Interrupta & FUSB302_D_Interrupta_I_SOFTRST ) == FUSB302_D_Interrupta_I_SOFTRST){
-		DBG("I_SOFTRST\n");
+		*next = deadline;
 	}
-	if ( (Registers.Interrupta & FUSB302_D_Interrupta_I_HARDRST ) == FUSB302_D_Interrupta_I_HARDRST){
-		DBG("I_HARDRST\n");
-//		PD.State = PD_State_Reset;
-	}
-
-	if ( (Registers.Interruptb & FUSB302_D_Interruptb_I_GCRCSENT ) == FUSB302_D_Interruptb_I_GCRCSENT){
-		DBG("I_GCRCSENT\n");
-		PD.State = PD_State_Rx;
-	}
-
 
+	*events |= event;
+}
 
-	PD_DataObject_t request = { .Value = 0 };
-
-	switch( PD.State )
+static void typeC_core( CCHandshake_Port_t * port )
+{
+	// if not connected check if there is one
+	if (port->ConnectedCC == CCHandshake_CC_None)
 	{
-		// this is only here to suppress the compiler warning
-		case PD_State_Disabled:
+#if CCHANDSHAKE_LOW_POWER==true
+		if (port->PowerState.Current == CCHandshake_Power_Standby)
 		{
-			// do nothing
-			break;
-		}
+			// nothing to do until something shows up on cc
+			if ( (port->Registers.Interrupt & FUSB302_D_Interrupt_I_WAKE) != FUSB302_D_Interrupt_I_WAKE )
+			{
+				return;
+			}
 
-		case PD_State_HardReset:
+			wakeUp( port );
+			return;
+		}
+		if (FUSB302_D_GetTime( &port->Driver ) - port->PowerState.EnteredTs >= CCHANDSHAKE_WAKE_TIMEOUT_MS)
 		{
-			DBG("PD State HardReset\n");
-			pd_hardreset();
+			DBG("no attach after wake\n");
+			enterStandby( port );
+			return;
+		}
+#endif
 
-			DelayMs(1);
+#if CCHANDSHAKE_USE_TOGGLE==true
+		CCHandshake_CC_t detected = detectCCPinToggle( port );
+#else
+		CCHandshake_CC_t detected = detectCCPinSink( port );
+#endif
 
-			PD.State = PD_State_Reset;
-			break;
+		// if none detected, just quit
+		if (detected == CCHandshake_CC_None)
+		{
+			return;
 		}
 
-		case PD_State_Reset:
+//		DBG("typeC Switches1 %02x\n", port->Registers.Switches1 );
+
+		// oscillator and receiver for PD
+		if (setPowerState( port, CCHandshake_Power_Active ) == false)
 		{
-			DBG("PD State Reset\n");
+			return;
+		}
 
-			pd_reset();
+		if (enableSink( port, detected ) == false)
+		{
+			return;
+		}
 
-			pd_flushRxFifo();
-			pd_flushTxFifo();
+//		DBG("typeC Switches1 %02x\n", port->Registers.Switches1 );
+		pd_init( port );
 
-			// try to get source capabilities
-			pd_clearTx();
+		port->ConnectedCC = detected;
 
-			PD_newMessage( &PD.Tx.Message, 0, pd_nextTxMessageId(), PD_HeaderWord_PowerRole_Sink, PD_HeaderWord_SpecRev_2_0, PD_HeaderWord_DataRole_Sink, PD_ControlCommand_GetSourceCap, NULL );
+		CCHandshake_Notification_t attach = { .Type = CCHandshake_Notify_Attach, .Orientation = detected };
+		notify( port, &attach );
 
-			pd_sendMessage( &PD.Tx.Message, NULL );
+//		DBG("typeC Switches1 %02x\n", port->Registers.Switches1 );
+		DBG("CC detected %d\n", detected);
+	}
+	else // check if it's still connected
+	{
+		// all from the last status read, no further reads needed
+		uint8_t status0 = port->Registers.Status0;
+		bool lost = false;
 
-			PD.Tx.SendAttempts = 0;
-			break;
+		// vbus drops during a hard reset (tSrcRecover), that's no detach
+		if (port->Registers.Interrupta & FUSB302_D_Interrupta_I_HARDRST)
+		{
+			port->ExpectVbusLoss = true;
 		}
-
-		case PD_State_Idle:
+		if ((port->Registers.Interrupt & FUSB302_D_Interrupt_I_VBUSOK) && (status0 & FUSB302_D_Status0_VBUSOK))
 		{
-//			DBG("PD State Idle\n");
-
-			// if neither empty nor full there is data pending
-			if ((Registers.Status1 & FUSB302_D_Status1_TX_EMPTY ) != FUSB302_D_Status1_TX_EMPTY &&
-					(Registers.Status1 & FUSB302_D_Status1_TX_FULL ) != FUSB302_D_Status1_TX_FULL )
-//					(Registers.Interrupt & FUSB302_D_Interrupt_I_ACTIVITY) != FUSB302_D_Interrupt_I_ACTIVITY)
-			{
-//				DBG("Resending\n");
+			port->ExpectVbusLoss = false;
+		}
 
-//				pd_startTx();
+		// vbus gone
+		if ((port->Registers.Interrupt & FUSB302_D_Interrupt_I_VBUSOK) && (status0 & FUSB302_D_Status0_VBUSOK) == 0 && port->ExpectVbusLoss == false)
+		{
+			DBG("VBUS lost\n");
+			lost = true;
+		}
 
-//				pd_flushTxFifo();
-//				pd_sendMessage( &PD.Tx.Message, NULL );
-			}
+		// cc fell below CCHANDSHAKE_DETACH_CC_MV (ignored while bmc is on the line)
+		if ((port->Registers.Interrupt & (FUSB302_D_Interrupt_I_COMP_CHNG | FUSB302_D_Interrupt_I_BC_LVL)) &&
+			(status0 & (FUSB302_D_Status0_COMP | FUSB302_D_Status0_ACTIVITY)) == 0)
+		{
+			DBG("CC below threshold\n");
+			lost = true;
+		}
 
-			break;
+		if (lost == false)
+		{
+			return; // then we're still good
 		}
 
-		case PD_State_Rx:
+		if ( disableSink( port ) == false )
 		{
-//			DBG("PD State Rx\n");
 
-//			if (pd_hasMessage() == false)
-//			{
-//				PD.State = PD_State_Idle;
-//				return;
-//			}
-//			DBG("PD has message\n");
+		}
 
-//			memset( &PD.Rx.Message, 0, sizeof(PD_Message_t) );
+		pd_deinit( port );
 
-			if (pd_getMessage( &PD.Rx.Message ) == false)
-			{
-				PD.State = PD_State_Idle;
-				return;
-			}
+		port->ConnectedCC = CCHandshake_CC_None;
 
-//			DBG("PD process\n");
-			PD.State = pd_processMessage( &PD.Rx.Message );
+		CCHandshake_Notification_t detach = { .Type = CCHandshake_Notify_Detach };
+		notify( port, &detach );
 
-			break;
-		}
+#if CCHANDSHAKE_LOW_POWER==true
+		enterStandby( port );
+#elif CCHANDSHAKE_USE_TOGGLE==true
+		// back to sink polling
+		startToggle( port );
+#endif
 
-//		case PD_State_AwaitGoodCRC:
-//		{
-////			DBG("PD State AwaitGoodCRC\n");
-//
-//			if (TimerGetElapsedTime(PD.Tx.SentTs) > 1000){
-//				if (PD.Tx.SendAttempts > 3)
-//				{
-//					PD.State = PD_State_HardReset;
-//				}
-//				else
-//				{
-//					PD.State = PD_State_Resend;
-//				}
-//				break;
-//			}
-//
-//			if ( (Registers.Interruptb & FUSB302_D_Interruptb_I_GCRCSENT ) == FUSB302_D_Interruptb_I_GCRCSENT){
-//				PD.State = PD_State_Idle;
-//				break;
-//			}
-////
-////			if (pd_hasMessage() == false)
-////			{
-////				return;
-////			}
-////
-////			memset( &PD.Rx.Message, 0, sizeof(PD_Message_t) );
-////
-////			if (pd_getMessage( &PD.Rx.Message ) == false)
-////			{
-////				return;
-////			}
-//
-//			break;
-//		}
-//
-//		case PD_State_Resend:
-//		{
-//			DBG("PD State Resend\n");
-//
-//			pd_sendMessage( &PD.Tx.Message, PD.Tx.OnAcknowledged );
-//			PD.Tx.SentTs = TimerGetCurrentTime();
-//			PD.Tx.SendAttempts++;
+		DBG("CC lost\n");
+	}
+}
+
+
+//inline static uint8_t * regPtr( FUSB302_D_Register_t reg )
+//{
+//	switch (reg){
+//		case FUSB302_D_Register_DeviceID: 	return &port->Registers.DeviceID;
+//		case FUSB302_D_Register_Switches0: 	return &port->Registers.Switches0;
+//		case FUSB302_D_Register_Switches1: 	return &port->Registers.Switches1;
+//		case FUSB302_D_Register_Measure: 	return &port->Registers.Measure;
+//		case FUSB302_D_Register_Slice: 		return &port->Registers.Slice;
+//		case FUSB302_D_Register_Control0: 	return &port->Registers.Control0;
+//		case FUSB302_D_Register_Control1: 	return &port->Registers.Control1;
+//		case FUSB302_D_Register_Control2: 	return &port->Registers.Control2;
+//		case FUSB302_D_Register_Control3: 	return &port->Registers.Control3;
+//		case FUSB302_D_Register_Mask1: 		return &port->Registers.Mask1;
+//		case FUSB302_D_Register_Power: 		return &port->Registers.Power;
+//		case FUSB302_D_Register_Reset: 		return &port->Registers.Reset;
+//		case FUSB302_D_Register_OCPreg: 	return &port->Registers.OCPreg;
+//		case FUSB302_D_Register_Maska: 		return &port->Registers.Maska;
+//		case FUSB302_D_Register_Maskb: 		return &port->Registers.Maskb;
+//		case FUSB302_D_Register_Control4: 	return &port->Registers.Control4;
+//		case FUSB302_D_Register_Status0a: 	return &port->Registers.Status0a;
+//		case FUSB302_D_Register_Status1a: 	return &port->Registers.Status1a;
+//		case FUSB302_D_Register_Interrupta: return &port->Registers.Interrupta;
+//		case FUSB302_D_Register_Interruptb: return &port->Registers.Interruptb;
+//		case FUSB302_D_Register_Status0: 	return &port->Registers.Status0;
+//		case FUSB302_D_Register_Status1: 	return &port->Registers.Status1;
+//		case FUSB302_D_Register_Interrupt: 	return &port->Registers.Interrupt;
+//		case FUSB302_D_Register_FIFOs: 		return &port->Registers.FIFOs;
 //
-//			PD.State = PD_State_AwaitGoodCRC;
+//		default: return NULL;
+//	}
+//}
+
+static bool read( CCHandshake_Port_t * port, FUSB302_D_Register_t reg, uint8_t * value )
+{
+//	uint8_t * r = regPtr( reg );
 //
-//			break;
-//		}
+//	if (r == NULL)
+//	{
+//		return false;
+//	}
 
-		default:
-			PD.State = PD_State_Reset;
+	// cached registers do not need the bus
+	if (FUSB302_D_ShadowRead( &port->Driver, &port->Registers, reg ) == FUSB302_D_ERROR)
+	{
+		return false;
 	}
+
+	*value = *FUSB302_D_ShadowPtr( &port->Registers, reg );
+
+	return true;
 }
 
+/**
+ * Only changes the shadow, the device is updated on the next commit()
+ */
+static bool set( CCHandshake_Port_t * port, FUSB302_D_Register_t reg, uint8_t value )
+{
+	FUSB302_D_ShadowSet( &port->Registers, reg, value );
 
+	return true;
+}
 
-static void pd_init( void )
+static bool commit( CCHandshake_Port_t * port )
 {
-//	DBG("pd_init Switches1 %02x\n", Registers.Switches1 );
+	if (FUSB302_D_ShadowCommit( &port->Driver, &port->Registers ) == FUSB302_D_ERROR)
+	{
+		DBG("failed commit\n");
+		return false;
+	}
 
-	PD.Rx.HasData = false;
+	return true;
+}
+
+/**
+ * Writes self-clearing command bits (resets, flushes, tx start) right away, the shadow itself is not changed.
+ */
+static bool strobe( CCHandshake_Port_t * port, FUSB302_D_Register_t reg, uint8_t bits )
+{
+	// keep the order of things
+	if (commit( port ) == false)
+	{
+		return false;
+	}
 
-	PD.Tx.MessageId = 2;
-	PD.State = PD_State_Idle;
+	if (FUSB302_D_Write( &port->Driver, reg, *FUSB302_D_ShadowPtr( &port->Registers, reg ) | bits ) == FUSB302_D_ERROR)
+	{
+		return false;
+	}
 
-	PD.Power.NSourceCapabilities = 0;
-	memset( &PD.Power.SourceCapabilities[0], 0, PD_MESSAGE_MAX_OBJECTS * sizeof(PD_DataObject_t) );
-	PD.Power.BestCapIndex = 0;
+	return true;
+}
 
+static bool readAll( CCHandshake_Port_t * port )
+{
+	// two bursts instead of a read per register
+	if (FUSB302_D_ShadowLoad( &port->Driver, &port->Registers ) == FUSB302_D_ERROR)
+	{
+		return false;
+	}
 
-	// enable auto goodCRC
-//	DBG("Switches1 %d\n", Registers.Switches1 );
-//	read( FUSB302_D_Register_Switches1 );
-//	DBG("Switches1 %d\n", Registers.Switches1 );
-//	Registers.Switches1 = FUSB302_D_Switches1_SPECREV_Rev2_0 | FUSB302_D_Switches1_AUTO_CRC;
-//	Registers.Switches1 = (Registers.Switches1 & ~FUSB302_D_Switches1_SPECREV_MASK) | FUSB302_D_Switches1_SPECREV_Rev2_0;
-//	Registers.Switches1 |= FUSB302_D_Switches1_AUTO_CRC;
+	port->Registers.FIFOs = 0;
 
-	// enable meas and txcc
-//	if (ConnectedCC == CCHandshake_CC_1)
-//	{
-////		Registers.Switches0 = (Registers.Switches0 & ~)
-//		Registers.Switches1 |= FUSB302_D_Switches1_TXCC1;
-//	}
-//	else if (ConnectedCC == CCHandshake_CC_2)
-//	{
-//		Registers.Switches1 |= FUSB302_D_Switches1_TXCC2;
-//
-//	}
+	return true;
+}
 
-//	DBG("Switches1 %d\n", Registers.Switches1 );
-//	write( FUSB302_D_Register_Switches1 );
-//
-//	DBG("Switches1 %d\n", Registers.Switches1 );
-//
-//	read( FUSB302_D_Register_Switches1 );
-//	DBG("Switches1 %d\n", Registers.Switches1 );
+static void applyStatus( CCHandshake_Port_t * port, const uint8_t * buf )
+{
+	port->Registers.Interrupta = buf[0];
+	port->Registers.Interruptb = buf[1];
+	port->Registers.Status0 = buf[2];
+	port->Registers.Status1 = buf[3];
+	port->Registers.Interrupt = buf[4];
+}
 
-//	read( FUSB302_D_Register_Control0, Registers.Control0 );
-//	Registers.Control0 &= ~FUSB302_D_Control0_AUTO_PRE;
-//	write( FUSB302_D_Register_Control0, Registers.Control0 );
+static bool readStatus( CCHandshake_Port_t * port )
+{
+	uint8_t buf[CCHANDSHAKE_STATUS_LEN] = {0,0,0,0,0};
 
 
-	// enable interrupts
-//	read( FUSB302_D_Register_Maska );
-//	Registers.Maska |= FUSB302_D_Maska_M_TXSENT;
-//	write( FUSB302_D_Register_Maska, Registers.Maska );
+	if (FUSB302_D_ReadN( &port->Driver, FUSB302_D_Register_Interrupta, &buf[0], CCHANDSHAKE_STATUS_LEN ) == FUSB302_D_ERROR)
+	{
+		DBG("failed read\n");
+		return false;
+	}
 
-//	read( FUSB302_D_Register_Maskb );
-//	Registers.Maskb |= FUSB302_D_Maskb_M_GCRCSENT;
-//	write( FUSB302_D_Register_Maskb, Registers.Maskb );
+	applyStatus( port, &buf[0] );
 
-//	pd_reset();
-//	pd_flushRxFifo();
-//	pd_flushTxFifo();
+//	if (read( port, FUSB302_D_Register_Interrupta, &port->Registers.Interrupta) == false) return false;
+//	if (read( port, FUSB302_D_Register_Interruptb, &port->Registers.Interruptb) == false) return false;
+//	if (read( port, FUSB302_D_Register_Status0, &port->Registers.Status0) == false) return false;
+//	if (read( port, FUSB302_D_Register_Status1, &port->Registers.Status1) == false) return false;
+//	if (read( port, FUSB302_D_Register_Interrupt, &port->Registers.Interrupt) == false) return false;
 
-//	DBG("pd_init Switches1 %02x\n", Registers.Switches1 );
+	return true;
 }
 
-static void pd_deinit( void )
+static bool configure( CCHandshake_Port_t * port )
 {
-//	DBG("pd_deinit Switches1 %02x\n", Registers.Switches1 );
+#if CCHANDSHAKE_AUTONOMOUS==true
 
-	PD.State = PD_State_Disabled;
+#else
 
-	PD.Tx.MessageId = 2;
+	// power is set below (see setPowerState())
 
-	PD.Power.NSourceCapabilities = 0;
+	// enable high current mode
+	// if we were using the interrupt pin, also set FUSB302_D_Control0_INT_MASK (don't forget to optionally set TOG_RD_ONLY)
+//	port->Registers.Control0 = (port->Registers.Control0 & ~FUSB302_D_Control0_HOST_CUR_MASK) | FUSB302_D_Control0_HOST_CUR_HighCurrentMode;
 
-	pd_reset();
-	pd_flushRxFifo();
-	pd_flushTxFifo();
+	//	port->Registers.Control0 &= ~FUSB302_D_Control0_AUTO_PRE; // is 0 by default
+//	if (write( FUSB302_D_Register_Control0, port->Registers.Control0 ) == false) return false;
 
-	// disable auto goodCRC
-//	read( FUSB302_D_Register_Switches1 );
-//	Registers.Switches1 |= FUSB302_D_Switches1_AUTO_CRC;
-//	write( FUSB302_D_Register_Switches1, Registers.Switches1 );
+	// ON SEMI also sets TOC_USRC_EXIT of "undocumented control 4"
 
-	// disable interrupts
-//	read( FUSB302_D_Register_Maska );
-	Registers.Maska &= ~FUSB302_D_Maska_M_TXSENT;
-	write( FUSB302_D_Register_Maska, Registers.Maska );
+	// sink polling is started below (if enabled)
 
-//	read( FUSB302_D_Register_Maskb );
-	Registers.Maskb &= ~FUSB302_D_Maskb_M_GCRCSENT;
-	write( FUSB302_D_Register_Maskb, Registers.Maskb );
+	set( port, FUSB302_D_Register_Switches1, FUSB302_D_Switches1_POWERROLE_Sink | FUSB302_D_Switches1_DATAROLE_Sink | FUSB302_D_Switches1_SPECREV_Rev2_0 | FUSB302_D_Switches1_AUTO_CRC );
+//	DBG("configure Switches1 %02x\n", port->Registers.Switches1 );
 
-//	DBG("pd_deinit Switches1 %02x\n", Registers.Switches1 );
-}
+	set( port, FUSB302_D_Register_Control3, port->Registers.Control3 | FUSB302_D_Control3_AUTO_HARDRESET | FUSB302_D_Control3_AUTO_SOFTRESET | FUSB302_D_Control3_AUTO_RETRY | (0xFF & FUSB302_D_Control3_N_RETRIES_MASK) );
 
-static void pd_hardreset( void )
-{
-	PD.Tx.MessageId = 2;
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	// only unmask what the sink needs
+	set( port, FUSB302_D_Register_Mask1, CCHANDSHAKE_IRQ_Mask1 );
+	set( port, FUSB302_D_Register_Maska, CCHANDSHAKE_IRQ_Maska );
+	set( port, FUSB302_D_Register_Maskb, CCHANDSHAKE_IRQ_Maskb );
+
+	// clear global interrupt mask (set by default) to let INT_N through
+	set( port, FUSB302_D_Register_Control0, port->Registers.Control0 & ~FUSB302_D_Control0_INT_MASK );
+#else
+	// disable all interrupts
+	set( port, FUSB302_D_Register_Mask1, FUSB302_D_Mask1_ALL );
+	set( port, FUSB302_D_Register_Maska, FUSB302_D_Maska_ALL );
+	set( port, FUSB302_D_Register_Maskb, FUSB302_D_Maskb_ALL );
+#endif
 
-//	read(FUSB302_D_Register_Control3);
-	Registers.Control3 |= FUSB302_D_Control3_SEND_HARD_RESET;
-	write(FUSB302_D_Register_Control3, Registers.Control3);
-	Registers.Control3 &= ~FUSB302_D_Control3_SEND_HARD_RESET;
+	if (commit( port ) == false) return false;
+
+#if CCHANDSHAKE_LOW_POWER==true
+	if (enterStandby( port ) == false) return false;
+#else
+	if (setPowerState( port, CCHandshake_Power_Active ) == false) return false;
+
+#if CCHANDSHAKE_USE_TOGGLE==true
+	if (startToggle( port ) == false) return false;
+#endif
+#endif
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	// clear anything latched so far, INT_N would otherwise stay asserted
+	if (readStatus( port ) == false) return false;
+#endif
+
+//	DBG("configure Switches1 %02x\n", port->Registers.Switches1 );
+#endif
+
+	return true;
 }
 
-static void pd_reset( void )
+
+#if CCHANDSHAKE_USE_TOGGLE==false
+
+/**
+ * Tries to get fresh value of measurement (the currently selected cc pin)
+ */
+static bool readCCVoltageLevel( CCHandshake_Port_t * port, uint8_t * bc_lvl )
 {
-//	PD.Tx.MessageId = 0;
+	if (read( port, FUSB302_D_Register_Status0, &port->Registers.Status0) == false)
+	{
+		return false;
+	}
 
-//	read(FUSB302_D_Register_Reset);
+	*bc_lvl = port->Registers.Status0 & FUSB302_D_Status0_BC_LVL_MASK;
 
-	Registers.Reset |= FUSB302_D_Reset_PD_RESET;
-	write(FUSB302_D_Register_Reset, Registers.Reset);
-	Registers.Reset &= ~FUSB302_D_Reset_PD_RESET;
+	return true;
 }
 
-static void pd_flushRxFifo( void )
+
+/**
+ * Switches the measurement to the given cc pin, the level is evaluated CCHANDSHAKE_CC_DEBOUNCE_MS later
+ */
+static bool startCCMeasurement( CCHandshake_Port_t * port, CCHandshake_CC_t cc )
 {
-//	read( FUSB302_D_Register_Control1 );
+	uint8_t meas = (cc == CCHandshake_CC_1) ? FUSB302_D_Switches0_MEAS_CC1 : FUSB302_D_Switches0_MEAS_CC2;
+
+	port->Detect.Measuring = CCHandshake_CC_None;
 
-	Registers.Control1 |= FUSB302_D_Control1_RX_FLUSH;
+	set( port, FUSB302_D_Register_Switches0, (port->Registers.Switches0 & ~FUSB302_D_Switches0_MEAS_CC_MASK) | meas );// | FUSB302_D_Switches0_PDWN2 | FUSB302_D_Switches0_PDWN1;
+	if (commit( port ) == false)
+	{
+		return false;
+	}
 
-	write( FUSB302_D_Register_Control1, Registers.Control1 );
+	port->Detect.Measuring = cc;
+	port->Detect.StartTs = FUSB302_D_GetTime( &port->Driver );
 
-	// clear bit again
-	Registers.Control1 &= ~FUSB302_D_Control1_RX_FLUSH;
+	return true;
 }
 
-static void pd_flushTxFifo( void )
+/**
+ * Tries to detect which cc pin has voltage, without blocking: every call either starts a measurement, waits for it
+ * or evaluates it (and moves on to the other pin).
+ * WARNING: resets Switches0 register
+ */
+static CCHandshake_CC_t detectCCPinSink( CCHandshake_Port_t * port )
 {
-//	read( FUSB302_D_Register_Control0 );
+	uint8_t BC_LVL;
+	CCHandshake_CC_t cc = port->Detect.Measuring;
 
-	Registers.Control0 |= FUSB302_D_Control0_TX_FLUSH;
+	if (cc == CCHandshake_CC_None)
+	{
+		startCCMeasurement( port, CCHandshake_CC_1 );
+		return CCHandshake_CC_None;
+	}
+
+	// wait a bit (no clock: evaluate right away)
+	if (port->Driver.Transport->GetTime != NULL && FUSB302_D_GetTime( &port->Driver ) - port->Detect.StartTs < CCHANDSHAKE_CC_DEBOUNCE_MS)
+	{
+		return CCHandshake_CC_None;
+	}
+
+	// get measurement
+	if (readCCVoltageLevel( port, &BC_LVL ) == false)
+	{
+		return CCHandshake_CC_None;
+	}
+	if ( BC_LVL > FUSB302_D_Status0_BC_LVL_LessThan200mV )
+	{
+		port->Detect.Measuring = CCHandshake_CC_None;
+		return cc;
+	}
 
-	write( FUSB302_D_Register_Control0, Registers.Control0 );
+	// try the other one
+	startCCMeasurement( port, (cc == CCHandshake_CC_1) ? CCHandshake_CC_2 : CCHandshake_CC_1 );
 
-	// clear bit again
-	Registers.Control0 &= ~FUSB302_D_Control0_TX_FLUSH;
+	return CCHandshake_CC_None;
 }
 
-static bool pd_hasMessage( void )
+#else
+
+/**
+ * Hands unattached detection to the FUSB302 (sink polling), it raises I_TOGDONE once a source was found.
+ * The cc switches are left to the toggle logic.
+ */
+static bool startToggle( CCHandshake_Port_t * port )
 {
-//	read( FUSB302_D_Register_Status1, &Registers.Status1 );
+	set( port, FUSB302_D_Register_Switches0, port->Registers.Switches0 & ~(FUSB302_D_Switches0_PU_EN_MASK | FUSB302_D_Switches0_MEAS_CC_MASK | FUSB302_D_Switches0_PDWN_MASK) );
+
+	// (re)starting needs TOGGLE to go from 0 to 1
+	set( port, FUSB302_D_Register_Control2, port->Registers.Control2 & ~(FUSB302_D_Control2_MODE_MASK | FUSB302_D_Control2_TOGGLE) );
+	if (commit( port ) == false) return false;
 
-	return (Registers.Status1 & FUSB302_D_Status1_RX_EMPTY) != FUSB302_D_Status1_RX_EMPTY;
+	set( port, FUSB302_D_Register_Control2, port->Registers.Control2 | FUSB302_D_Control2_MODE_SnkPolling | FUSB302_D_Control2_TOGGLE );
+
+	return commit( port );
 }
 
-static void pd_startTx( void )
+/**
+ * Takes the orientation found by the toggle logic (if done) and stops it, keeping Rd on both pins
+ */
+static CCHandshake_CC_t detectCCPinToggle( CCHandshake_Port_t * port )
 {
-//	read( FUSB302_D_Register_Control0 );
-	Registers.Control0 |= FUSB302_D_Control0_TX_START;
-	write( FUSB302_D_Register_Control0, Registers.Control0 );
-	Registers.Control0 &= ~FUSB302_D_Control0_TX_START;
+	CCHandshake_CC_t cc;
+
+	if ( (port->Registers.Interrupta & FUSB302_D_Interrupta_I_TOGDONE) != FUSB302_D_Interrupta_I_TOGDONE )
+	{
+		return CCHandshake_CC_None;
+	}
+
+	if (read( port, FUSB302_D_Register_Status1a, &port->Registers.Status1a ) == false)
+	{
+		// will be done again
+		startToggle( port );
+		return CCHandshake_CC_None;
+	}
+
+	switch (port->Registers.Status1a & FUSB302_D_Status1a_TOGSS)
+	{
+		case FUSB302_D_Status1a_TOGSS_SNK_on_CC1:	cc = CCHandshake_CC_1; break;
+		case FUSB302_D_Status1a_TOGSS_SNK_on_CC2:	cc = CCHandshake_CC_2; break;
+
+		default:
+			DBG("TOGSS %02x\n", port->Registers.Status1a & FUSB302_D_Status1a_TOGSS);
+			startToggle( port );
+			return CCHandshake_CC_None;
+	}
+
+	set( port, FUSB302_D_Register_Control2, port->Registers.Control2 & ~FUSB302_D_Control2_TOGGLE );
+	set( port, FUSB302_D_Register_Switches0, port->Registers.Switches0 | FUSB302_D_Switches0_PDWN1 | FUSB302_D_Switches0_PDWN2 );
+
+	if (commit( port ) == false)
+	{
+		startToggle( port );
+		return CCHandshake_CC_None;
+	}
+
+	return cc;
 }
-//static void pd_setRoles( CCHandshake_PD_Role_t powerRole, CCHandshake_PD_Role_t dataRole )
-//{
-//	read( FUSB302_D_Register_Switches1 );
-//
-//	// clear bits
-//	Registers.Switches1 &= ~(FUSB302_D_Switches1_POWERROLE | FUSB302_D_Switches1_DATAROLE);
-//
-//	if (powerRole == CCHandshake_PD_Role_Source)
-//	{
-//		Registers.Switches1 |= FUSB302_D_Switches1_POWERROLE_Source;
-//	}
-//	else
-//	{
-//		Registers.Switches1 |= FUSB302_D_Switches1_POWERROLE_Sink;
-//	}
-//
-//	if (dataRole == CCHandshake_PD_Role_Source)
-//	{
-//		Registers.Switches1 |= FUSB302_D_Switches1_DATAROLE_Source;
-//	}
-//	else
-//	{
-//		Registers.Switches1 |= FUSB302_D_Switches1_DATAROLE_Sink;
-//	}
-//
-//	write( FUSB302_D_Register_Switches1 );
-//}
-//
-//static void pd_setAutoGoodCrc( bool enabled )
-//{
-//	read( FUSB302_D_Register_Switches1 );
-//
-//	Registers.Switches1 &= ~FUSB302_D_Switches1_AUTO_CRC;
-//
-//	if (enabled)
-//	{
-//		Registers.Switches1 |= FUSB302_D_Switches1_AUTO_CRC;
-//	}
-//
-//	write( FUSB302_D_Register_Switches1 );
-//}
 
+#endif /* CCHANDSHAKE_USE_TOGGLE */
 
-static bool pd_getMessage( PD_Message_t * message )
+/**
+ * Powers the blocks needed in <state> and accounts the time spent in the previous one
+ */
+static bool setPowerState( CCHandshake_Port_t * port, CCHandshake_Power_t state )
 {
-	uint8_t token;
+	uint32_t now = FUSB302_D_GetTime( &port->Driver );
 
-	do {
+	port->PowerState.TimeMs[port->PowerState.Current] += now - port->PowerState.EnteredTs;
+	port->PowerState.EnteredTs = now;
+	port->PowerState.Current = state;
 
-		token = 0;
+	set( port, FUSB302_D_Register_Power, PowerStateBits[state] );
 
-		if (FUSB302_D_Read( &Driver, FUSB302_D_Register_FIFOs, &token ) == FUSB302_D_ERROR)
-		{
+	return commit( port );
+}
+
+#if CCHANDSHAKE_LOW_POWER==true
+
+/**
+ * Detached: Rd applied, no measurement or toggling, I_WAKE on anything showing up on cc
+ */
+static bool enterStandby( CCHandshake_Port_t * port )
+{
+	port->Detect.Measuring = CCHandshake_CC_None;
+
+	set( port, FUSB302_D_Register_Switches0, (port->Registers.Switches0 & ~(FUSB302_D_Switches0_PU_EN_MASK | FUSB302_D_Switches0_MEAS_CC_MASK)) | FUSB302_D_Switches0_PDWN1 | FUSB302_D_Switches0_PDWN2 );
+	set( port, FUSB302_D_Register_Control2, (port->Registers.Control2 & ~FUSB302_D_Control2_TOGGLE) | FUSB302_D_Control2_WAKE_EN );
+
+	return setPowerState( port, CCHandshake_Power_Standby );
+}
+
+/**
+ * I_WAKE: power up for cc detection
+ */
+static bool wakeUp( CCHandshake_Port_t * port )
+{
+	set( port, FUSB302_D_Register_Control2, port->Registers.Control2 & ~FUSB302_D_Control2_WAKE_EN );
+
+	if (setPowerState( port, CCHandshake_Power_Detect ) == false)
+	{
+		return false;
+	}
+
+#if CCHANDSHAKE_USE_TOGGLE==true
+	return startToggle( port );
+#else
+	return true;
+#endif
+}
+
+#endif /* CCHANDSHAKE_LOW_POWER */
+
+static bool enableSink( CCHandshake_Port_t * port, CCHandshake_CC_t cc )
+{
+	if (cc == CCHandshake_CC_None)
+	{
+		DBG("Trying to enable none!");
+		return false;
+	}
+
+//	DBG("enableSink Switches1 %02x\n", port->Registers.Switches1 );
+//	read( port, FUSB302_D_Register_Switches1 );
+//	read( port, FUSB302_D_Register_Power );
+
+//	DBG("switches1 %02x\n", port->Registers.Switches1 );
+
+	// enable meas and txcc
+	if (cc == CCHandshake_CC_1)
+	{
+		set( port, FUSB302_D_Register_Switches0, (port->Registers.Switches0 & ~FUSB302_D_Switches0_MEAS_CC_MASK) | FUSB302_D_Switches0_MEAS_CC1 );
+		set( port, FUSB302_D_Register_Switches1, (port->Registers.Switches1 & ~FUSB302_D_Switches1_TXCC_MASK) | FUSB302_D_Switches1_TXCC1 );
+	}
+	else if (cc == CCHandshake_CC_2)
+	{
+		set( port, FUSB302_D_Register_Switches0, (port->Registers.Switches0 & ~FUSB302_D_Switches0_MEAS_CC_MASK) | FUSB302_D_Switches0_MEAS_CC2 );
+		set( port, FUSB302_D_Register_Switches1, (port->Registers.Switches1 & ~FUSB302_D_Switches1_TXCC_MASK) | FUSB302_D_Switches1_TXCC2 );
+	}
+
+	// comparator on the measured cc pin for detach
+	set( port, FUSB302_D_Register_Measure, (port->Registers.Measure & ~(FUSB302_D_Measure_MEAS_VBUS | FUSB302_D_Measure_MDAC_MASK)) | CCHANDSHAKE_DETACH_MDAC );
+
+	port->ExpectVbusLoss = false;
+
+	// all in one go
+	if (commit( port ) == false) return false;
+
+//	read( port, FUSB302_D_Register_Switches1, &port->Registers.Switches1 );
+//	DBG("enableSink Switches1 %02x\n", port->Registers.Switches1 );
+
+	// enable oscillator for PD
+//	if ( (port->Registers.Power & FUSB302_D_Power_PWR_InternalOscillator) != FUSB302_D_Power_PWR_InternalOscillator )
+//	{
+//		DBG("activating internal oscillator\n");
+//		port->Registers.Power |= FUSB302_D_Power_PWR_InternalOscillator;
+//		if (write( FUSB302_D_Register_Power, port->Registers.Power ) == false) return false;
+//	}
+
+
+//	port->Registers.Switches
+	// TXCCx = 1
+	// MEAS_CCx = 1
+	// TXCCy = 0
+	// MEAS_CCy = 0
+
+//	port->Registers.Switches1 // by default we don't have to set this
+	// POWERROLE = 0
+	// DATAROLE = 0
+
+// port->Registers.Control
+	// ENSOP1 = 0
+	// ENSOP1DP = 0
+	// ENSOP2 = 0
+	// ENSOP2DP = 0
+
+	// port->Registers.Power enable internal oscillator
+
+	return true;
+}
+
+static bool disableSink( CCHandshake_Port_t * port )
+{
+//	DBG("disableSink()\n");
+
+//	read( port, FUSB302_D_Register_Switches1 );
+//	read( port, FUSB302_D_Register_Power );
+
+//	DBG("disableSink Switches1 %02x\n", port->Registers.Switches1 );
+
+	// disable TXCCx
+	set( port, FUSB302_D_Register_Switches1, port->Registers.Switches1 & ~FUSB302_D_Switches1_TXCC_MASK );
+
+	// disable CC
+	set( port, FUSB302_D_Register_Switches0, port->Registers.Switches0 & ~FUSB302_D_Switches0_MEAS_CC_MASK );
+
+	if (commit( port ) == false) return false;
+
+//	DBG("disableSink Switches1 %02x\n", port->Registers.Switches1 );
+	// disable oscillator for PD
+//	port->Registers.Power &= ~FUSB302_D_Power_PWR_InternalOscillator;
+
+	return true;
+}
+
+
+static void pd_core( CCHandshake_Port_t * port )
+{
+	if (port->PD.State == PD_State_Disabled)
+	{
+//		DBG("PD State Disabled\n");
+		return;
+	}
+
+//	static bool first = true;
+//	if (first){
+//		DBG("FIRST\n");
+//		first = false;
+//	}
+
+	if ( (port->Registers.Status1 & FUSB302_D_Status1_RX_EMPTY ) == FUSB302_D_Status1_RX_EMPTY){
+//		DBG("RX_EMPTY\n");
+//		port->PD.Rx.HasData |= port->PD.Rx.HasData;
+//		port->PD.State = PD_State_Rx;
+	}
+	if ( (port->Registers.Status1 & FUSB302_D_Status1_RX_FULL ) == FUSB302_D_Status1_RX_FULL){
+		DBG("RX_FULL\n");
+		port->PD.Rx.Stats.FifoFull++;
+	}
+	if ( (port->Registers.Status1 & FUSB302_D_Status1_TX_EMPTY ) == FUSB302_D_Status1_TX_EMPTY){
+//		DBG("TX_EMPTY\n");
+	}
+	if ( (port->Registers.Status1 & FUSB302_D_Status1_TX_FULL ) == FUSB302_D_Status1_TX_FULL){
+		DBG("TX_FULL\n");
+	}
+
+	if ( (port->Registers.Interrupt & FUSB302_D_Interrupt_I_COLLISION) == FUSB302_D_Interrupt_I_COLLISION )
+	{
+		DBG("I_COLLISION\n");
+	}
+	if ( (port->Registers.Interrupt & FUSB302_D_Interrupt_I_ACTIVITY) == FUSB302_D_Interrupt_I_ACTIVITY )
+	{
+//		DBG("I_ACTIVITY\n");
+	}
+	if ( (port->Registers.Interrupt & FUSB302_D_Interrupt_I_ALERT) == FUSB302_D_Interrupt_I_ALERT )
+	{
+		DBG("I_ALERT\n");
+	}
+
+	if ( (port->Registers.Interrupta & FUSB302_D_Interrupta_I_SOFTFAIL ) == FUSB302_D_Interrupta_I_SOFTFAIL){
+		DBG("I_SOFTFAIL\n");
+	}
+	if ( (port->Registers.Interrupta & FUSB302_D_Interrupta_I_RETRYFAIL ) == FUSB302_D_Interrupta_I_RETRYFAIL){
+		DBG("I_RETRYFAIL\n");
+		port->PD.Tx.OnWire = false;
+	}
+	if ( (port->Registers.Interrupta & FUSB302_D_Interrupta_I_HARDSENT ) == FUSB302_D_Interrupta_I_HARDSENT){
+		DBG("I_HARDSENT\n");
+		if (port->PD.Timers.Running & (1 << PD_Timer_HardResetComplete))
+		{
+			pd_timerStop( port, PD_Timer_HardResetComplete );
+			pd_awaitCapabilities( port, PD_T_HARD_RESET_RECOVER );
+		}
+	}
+	if ( (port->Registers.Interrupta & FUSB302_D_Interrupta_I_TXSENT ) == FUSB302_D_Interrupta_I_TXSENT){
+		DBG("I_TXSENT\n");
+		port->PD.Tx.OnWire = false;
+	}
+	if ( (port->Registers.Interrupta & FUSB302_D_Interrupta_I_SOFTRST ) == FUSB302_D_Interrupta_I_SOFTRST){
+		DBG("I_SOFTRST\n");
+	}
+	if ( (port->Registers.Interrupta & FUSB302_D_Interrupta_I_HARDRST ) == FUSB302_D_Interrupta_I_HARDRST){
+		DBG("I_HARDRST\n");
+//		port->PD.State = PD_State_Reset;
+		port->PD.Tx.MessageId = 2;
+
+		CCHandshake_Notification_t hardReset = { .Type = CCHandshake_Notify_HardReset, .FromSource = true };
+		notify( port, &hardReset );
+
+		pd_awaitCapabilities( port, PD_T_HARD_RESET_RECOVER );
+	}
+
+	// source capabilities are due tTypeCSinkWaitCap after vbus is on
+	if ( (port->Registers.Interrupt & FUSB302_D_Interrupt_I_VBUSOK) && (port->Registers.Status0 & FUSB302_D_Status0_VBUSOK) )
+	{
+		pd_timerStart( port, PD_Timer_SinkWaitCap, PD_T_SINK_WAIT_CAP );
+
+		if (port->PD.PE.State == PE_State_HardReset)
+		{
+			pe_setState( port, PE_State_WaitForCapabilities );
+		}
+	}
+
+	if ( (port->Registers.Interruptb & FUSB302_D_Interruptb_I_GCRCSENT ) == FUSB302_D_Interruptb_I_GCRCSENT){
+		DBG("I_GCRCSENT\n");
+		port->PD.State = PD_State_Rx;
+	}
+
+	PD_Timer_t expired = pd_timerExpired( port );
+
+	switch (expired)
+	{
+		case PD_Timer_SinkWaitCap:
+		case PD_Timer_SenderResponse:
+		case PD_Timer_PSTransition:
+			DBG("PD timeout %d\n", expired);
+			port->PD.State = PD_State_HardReset;
+			break;
+
+		case PD_Timer_HardResetComplete:
+			// take it as sent
+			pd_awaitCapabilities( port, PD_T_HARD_RESET_RECOVER );
+			break;
+
+		case PD_Timer_PPSRequest:
+			// keep alive, same as a new profile
+			port->PD.Power.Reselect = true;
+			break;
+
+#if CCHANDSHAKE_PD_REV3==true
+		case PD_Timer_Chunk:
+			// not an error of the protocol, the message is just lost
+			DBG("PD chunk timeout\n");
+			pd_abortChunking( port );
+			break;
+#endif
+
+		default:
+			break;
+	}
+
+	// new sink profile (or PPS keep alive): request again on a contract, a negotiation or chunked message under way
+	// is finished first (the last chunk is still on the wire when its exchange ends)
+	if (port->PD.Power.Reselect && port->PD.State == PD_State_Idle && port->PD.Tx.OnWire == false && pd_isChunking( port ) == false)
+	{
+		switch (port->PD.PE.State)
+		{
+			case PE_State_Ready:
+				port->PD.Power.Reselect = false;
+				pd_requestCapability( port );
+				break;
+
+			case PE_State_EvaluateCapability:
+			case PE_State_SelectCapability:
+			case PE_State_TransitionSink:
+				break;
+
+			default:
+				// the next Source_Capabilities are evaluated with it anyways
+				port->PD.Power.Reselect = false;
+		}
+	}
+
+#if CCHANDSHAKE_PD_REV3==true
+	if (port->PD.State == PD_State_Idle && port->PD.PE.State == PE_State_Ready && port->PD.Tx.OnWire == false)
+	{
+		pd_extendedCore( port );
+	}
+#endif
+
+	switch( port->PD.State )
+	{
+		// this is only here to suppress the compiler warning
+		case PD_State_Disabled:
+		{
+			// do nothing
+			break;
+		}
+
+		case PD_State_HardReset:
+		{
+			DBG("PD State HardReset\n");
+
+			port->PD.Timers.Running = 0;
+
+			// the source does not respond, stay with the implicit contract
+			if (port->PD.HardResetCount >= PD_N_HARD_RESET_COUNT)
+			{
+				DBG("PD giving up\n");
+				port->PD.State = PD_State_Disabled;
+				pe_dropContract( port );
+				pe_setState( port, PE_State_Disabled );
+				break;
+			}
+			port->PD.HardResetCount++;
+
+			CCHandshake_Notification_t hardReset = { .Type = CCHandshake_Notify_HardReset, .FromSource = false };
+			notify( port, &hardReset );
+
+			pe_dropContract( port );
+			pe_setState( port, PE_State_HardReset );
+
+			pd_hardreset( port );
+
+			pd_timerStart( port, PD_Timer_HardResetComplete, PD_T_HARD_RESET_COMPLETE );
+
+			port->PD.State = PD_State_Idle;
+			break;
+		}
+
+		case PD_State_Reset:
+		{
+			DBG("PD State Reset\n");
+
+			pd_reset( port );
+
+			pd_flushFifos( port );
+
+			// soft reset, the source accepts and sends its capabilities again
+			port->PD.Timers.Running = 0;
+			port->PD.Tx.MessageId = 0;
+
+			pd_encodeMessage( port, 0, PD_ControlCommand_SoftReset, NULL );
+
+			pd_sendMessage( port, NULL );
+
+			port->PD.Tx.SendAttempts = 0;
+
+			pe_dropContract( port );
+			pe_setState( port, PE_State_SoftReset );
+
+			pd_timerStart( port, PD_Timer_SenderResponse, PD_T_SENDER_RESPONSE );
+
+			port->PD.State = PD_State_Idle;
+			break;
+		}
+
+		case PD_State_Idle:
+		{
+//			DBG("PD State Idle\n");
+
+			// if neither empty nor full there is data pending
+			if ((port->Registers.Status1 & FUSB302_D_Status1_TX_EMPTY ) != FUSB302_D_Status1_TX_EMPTY &&
+					(port->Registers.Status1 & FUSB302_D_Status1_TX_FULL ) != FUSB302_D_Status1_TX_FULL )
+//					(port->Registers.Interrupt & FUSB302_D_Interrupt_I_ACTIVITY) != FUSB302_D_Interrupt_I_ACTIVITY)
+			{
+//				DBG("Resending\n");
+
+//				pd_startTx( port );
+
+//				pd_flushTxFifo( port );
+//				pd_sendMessage( port, &port->PD.Tx.Message, NULL );
+			}
+
+			break;
+		}
+
+		case PD_State_Rx:
+		{
+//			DBG("PD State Rx\n");
+
+//			if (pd_hasMessage( port ) == false)
+//			{
+//				port->PD.State = PD_State_Idle;
+//				return;
+//			}
+//			DBG("PD has message\n");
+
+//			memset( &port->PD.Rx.Message, 0, sizeof(PD_Message_t) );
+
+			// the whole fifo first (the GoodCRC of the source for the last message also ends up there): back to back
+			// messages like Accept and PS_RDY are handled in this call, and the fifo does not fill up meanwhile
+			bool more = pd_drainRxFifo( port );
+
+			port->PD.State = PD_State_Idle;
+
+			// then in order
+			while (port->PD.Rx.Count > 0)
+			{
+				PD_MessageView_init( &port->PD.Rx.Message, &port->PD.Rx.Frame[port->PD.Rx.Head][1] );
+				port->PD.Rx.MessageId = PD_HeaderWord_getMessageId( port->PD.Rx.Message.Header );
+
+				port->PD.Rx.Head = (port->PD.Rx.Head + 1) % CCHANDSHAKE_RX_RING_SIZE;
+				port->PD.Rx.Count--;
+
+//				DBG("PD process\n");
+				PD_State_t next = pd_processMessage( port, &port->PD.Rx.Message );
+
+				// (soft / hard) reset, whatever came after is void
+				if (next != PD_State_Idle)
+				{
+					port->PD.Rx.Count = 0;
+					port->PD.State = next;
+					more = false;
+				}
+			}
+
+			// the ring was full, the rest on the next call
+			if (more)
+			{
+				port->PD.State = PD_State_Rx;
+			}
+
+			break;
+		}
+
+//		case PD_State_AwaitGoodCRC:
+//		{
+////			DBG("PD State AwaitGoodCRC\n");
+//
+//			if (TimerGetElapsedTime(port->PD.Tx.SentTs) > 1000){
+//				if (port->PD.Tx.SendAttempts > 3)
+//				{
+//					port->PD.State = PD_State_HardReset;
+//				}
+//				else
+//				{
+//					port->PD.State = PD_State_Resend;
+//				}
+//				break;
+//			}
+//
+//			if ( (port->Registers.Interruptb & FUSB302_D_Interruptb_I_GCRCSENT ) == FUSB302_D_Interruptb_I_GCRCSENT){
+//				port->PD.State = PD_State_Idle;
+//				break;
+//			}
+////
+////			if (pd_hasMessage( port ) == false)
+////			{
+////				return;
+////			}
+////
+////			memset( &port->PD.Rx.Message, 0, sizeof(PD_Message_t) );
+////
+////			if (pd_getMessage( port, &port->PD.Rx.Message ) == false)
+////			{
+////				return;
+////			}
+//
+//			break;
+//		}
+//
+//		case PD_State_Resend:
+//		{
+//			DBG("PD State Resend\n");
+//
+//			pd_sendMessage( port, &port->PD.Tx.Message, port->PD.Tx.OnAcknowledged );
+//			port->PD.Tx.SentTs = TimerGetCurrentTime();
+//			port->PD.Tx.SendAttempts++;
+//
+//			port->PD.State = PD_State_AwaitGoodCRC;
+//
+//			break;
+//		}
+
+		default:
+			port->PD.State = PD_State_Reset;
+	}
+}
+
+
+
+static void pd_init( CCHandshake_Port_t * port )
+{
+//	DBG("pd_init Switches1 %02x\n", port->Registers.Switches1 );
+
+	port->PD.Rx.HasData = false;
+
+	port->PD.Tx.MessageId = 2;
+	port->PD.State = PD_State_Idle;
+
+	port->PD.Power.NSourceCapabilities = 0;
+	memset( &port->PD.Power.SourceCapabilities[0], 0, PD_MESSAGE_MAX_OBJECTS * sizeof(PD_DataObject_t) );
+	port->PD.Power.BestCapIndex = 0;
+
+	port->PD.HardResetCount = 0;
+	port->PD.Timers.Running = 0;
+	pd_timerStart( port, PD_Timer_SinkWaitCap, PD_T_SINK_WAIT_CAP );
+
+	pd_setSpecRev( port, PD_HeaderWord_SpecRev_2_0 );
+
+#if CCHANDSHAKE_PD_REV3==true
+	memset( &port->PD.Ext, 0, sizeof(port->PD.Ext) );
+#endif
+
+	memset( port->PD.PE.TimeMs, 0, sizeof(port->PD.PE.TimeMs) );
+	pe_dropContract( port );
+	port->PD.PE.ContractMs = 0;
+	port->PD.PE.AttachTs = FUSB302_D_GetTime( &port->Driver );
+	port->PD.PE.EnteredTs = port->PD.PE.AttachTs;
+	port->PD.PE.State = PE_State_WaitForCapabilities;
+
+
+	// enable auto goodCRC
+//	DBG("Switches1 %d\n", port->Registers.Switches1 );
+//	read( port, FUSB302_D_Register_Switches1 );
+//	DBG("Switches1 %d\n", port->Registers.Switches1 );
+//	port->Registers.Switches1 = FUSB302_D_Switches1_SPECREV_Rev2_0 | FUSB302_D_Switches1_AUTO_CRC;
+//	port->Registers.Switches1 = (port->Registers.Switches1 & ~FUSB302_D_Switches1_SPECREV_MASK) | FUSB302_D_Switches1_SPECREV_Rev2_0;
+//	port->Registers.Switches1 |= FUSB302_D_Switches1_AUTO_CRC;
+
+	// enable meas and txcc
+//	if (port->ConnectedCC == CCHandshake_CC_1)
+//	{
+////		port->Registers.Switches0 = (port->Registers.Switches0 & ~)
+//		port->Registers.Switches1 |= FUSB302_D_Switches1_TXCC1;
+//	}
+//	else if (port->ConnectedCC == CCHandshake_CC_2)
+//	{
+//		port->Registers.Switches1 |= FUSB302_D_Switches1_TXCC2;
+//
+//	}
+
+//	DBG("Switches1 %d\n", port->Registers.Switches1 );
+//	write( FUSB302_D_Register_Switches1 );
+//
+//	DBG("Switches1 %d\n", port->Registers.Switches1 );
+//
+//	read( port, FUSB302_D_Register_Switches1 );
+//	DBG("Switches1 %d\n", port->Registers.Switches1 );
+
+//	read( port, FUSB302_D_Register_Control0, port->Registers.Control0 );
+//	port->Registers.Control0 &= ~FUSB302_D_Control0_AUTO_PRE;
+//	write( FUSB302_D_Register_Control0, port->Registers.Control0 );
+
+
+	// enable interrupts
+//	read( port, FUSB302_D_Register_Maska );
+//	port->Registers.Maska |= FUSB302_D_Maska_M_TXSENT;
+//	write( FUSB302_D_Register_Maska, port->Registers.Maska );
+
+//	read( port, FUSB302_D_Register_Maskb );
+//	port->Registers.Maskb |= FUSB302_D_Maskb_M_GCRCSENT;
+//	write( FUSB302_D_Register_Maskb, port->Registers.Maskb );
+
+//	pd_reset( port );
+//	pd_flushRxFifo( port );
+//	pd_flushTxFifo( port );
+
+//	DBG("pd_init Switches1 %02x\n", port->Registers.Switches1 );
+}
+
+static void pd_deinit( CCHandshake_Port_t * port )
+{
+//	DBG("pd_deinit Switches1 %02x\n", port->Registers.Switches1 );
+
+	port->PD.State = PD_State_Disabled;
+
+	port->PD.Tx.MessageId = 2;
+
+	port->PD.Power.NSourceCapabilities = 0;
+	port->PD.Power.Reselect = false;
+
+	port->PD.Timers.Running = 0;
+
+	pe_dropContract( port );
+	pe_setState( port, PE_State_Disabled );
+
+	pd_reset( port );
+	pd_flushFifos( port );
+
+	// disable auto goodCRC
+//	read( port, FUSB302_D_Register_Switches1 );
+//	port->Registers.Switches1 |= FUSB302_D_Switches1_AUTO_CRC;
+//	write( FUSB302_D_Register_Switches1, port->Registers.Switches1 );
+
+	// disable interrupts
+//	read( port, FUSB302_D_Register_Maska );
+	set( port, FUSB302_D_Register_Maska, port->Registers.Maska & ~FUSB302_D_Maska_M_TXSENT );
+
+//	read( port, FUSB302_D_Register_Maskb );
+	set( port, FUSB302_D_Register_Maskb, port->Registers.Maskb & ~FUSB302_D_Maskb_M_GCRCSENT );
+
+	commit( port );
+
+//	DBG("pd_deinit Switches1 %02x\n", port->Registers.Switches1 );
+}
+
+static void pd_hardreset( CCHandshake_Port_t * port )
+{
+	port->PD.Tx.MessageId = 2;
+
+	// the source goes through vSafe0V
+	port->ExpectVbusLoss = true;
+
+	strobe( port, FUSB302_D_Register_Control3, FUSB302_D_Control3_SEND_HARD_RESET );
+}
+
+static void pd_reset( CCHandshake_Port_t * port )
+{
+//	port->PD.Tx.MessageId = 0;
+
+	strobe( port, FUSB302_D_Register_Reset, FUSB302_D_Reset_PD_RESET );
+}
+
+static void pd_flushFifos( CCHandshake_Port_t * port )
+{
+	// Control0 and Control1 are adjacent, so flush both with one write
+	uint8_t buf[2];
+
+	commit( port );
+
+	buf[0] = port->Registers.Control0 | FUSB302_D_Control0_TX_FLUSH;
+	buf[1] = port->Registers.Control1 | FUSB302_D_Control1_RX_FLUSH;
+
+	FUSB302_D_WriteN( &port->Driver, FUSB302_D_Register_Control0, &buf[0], 2 );
+
+	port->PD.Tx.OnWire = false;
+}
+
+static bool pd_hasMessage( CCHandshake_Port_t * port )
+{
+//	read( port, FUSB302_D_Register_Status1, &port->Registers.Status1 );
+
+	return (port->Registers.Status1 & FUSB302_D_Status1_RX_EMPTY) != FUSB302_D_Status1_RX_EMPTY;
+}
+
+static void pd_timerStart( CCHandshake_Port_t * port, PD_Timer_t timer, uint32_t ms )
+{
+	port->PD.Timers.Deadline[timer] = FUSB302_D_GetTime( &port->Driver ) + ms;
+	port->PD.Timers.Running |= 1 << timer;
+}
+
+static void pd_timerStop( CCHandshake_Port_t * port, PD_Timer_t timer )
+{
+	port->PD.Timers.Running &= ~(1 << timer);
+}
+
+/**
+ * Stops and returns the first expired timer (PD_Timer_None if none), one per call
+ */
+static PD_Timer_t pd_timerExpired( CCHandshake_Port_t * port )
+{
+	if (port->PD.Timers.Running == 0)
+	{
+		return PD_Timer_None;
+	}
+
+	uint32_t now = FUSB302_D_GetTime( &port->Driver );
+
+	for (uint8_t t = 0; t < PD_Timer_Count; t++)
+	{
+		if ((port->PD.Timers.Running & (1 << t)) && (int32_t)(now - port->PD.Timers.Deadline[t]) >= 0)
+		{
+			pd_timerStop( port, t );
+			return t;
+		}
+	}
+
+	return PD_Timer_None;
+}
+
+/**
+ * After a hard reset: fresh message ids, the source sends its capabilities once it is back
+ */
+static void pd_awaitCapabilities( CCHandshake_Port_t * port, uint32_t ms )
+{
+	port->PD.Timers.Running = 0;
+
+	pd_reset( port );
+	pd_flushFifos( port );
+
+	port->PD.State = PD_State_Idle;
+
+	pd_timerStart( port, PD_Timer_SinkWaitCap, ms );
+
+	pd_setSpecRev( port, PD_HeaderWord_SpecRev_2_0 );
+
+	pe_dropContract( port );
+	pe_setState( port, PE_State_HardReset );
+}
+
+/**
+ * Moves the policy engine to <state> and accounts the time spent in the previous one
+ */
+static void pe_setState( CCHandshake_Port_t * port, PE_State_t state )
+{
+	uint32_t now = FUSB302_D_GetTime( &port->Driver );
+
+	port->PD.PE.TimeMs[port->PD.PE.State] += now - port->PD.PE.EnteredTs;
+	port->PD.PE.EnteredTs = now;
+
+	if (port->PD.PE.State != state)
+	{
+		DBG("PE %d -> %d\n", port->PD.PE.State, state);
+		port->PD.PE.State = state;
+	}
+
+}
+
+/**
+ * Explicit contract in place (again), a PPS contract is kept alive by requesting it again before the source times out
+ */
+static void pe_ready( CCHandshake_Port_t * port )
+{
+	pe_setState( port, PE_State_Ready );
+
+	if (pd_isPPSContract( port ) == false)
+	{
+		pd_timerStop( port, PD_Timer_PPSRequest );
+	}
+	else if ((port->PD.Timers.Running & (1 << PD_Timer_PPSRequest)) == 0)
+	{
+		pd_timerStart( port, PD_Timer_PPSRequest, PD_T_PPS_REQUEST );
+	}
+}
+
+/**
+ * No explicit contract (any more), the application is told if there was one
+ */
+static void pe_dropContract( CCHandshake_Port_t * port )
+{
+#if CCHANDSHAKE_PD_REV3==true
+	// chunked messages only go with an explicit contract
+	pd_abortChunking( port );
+#endif
+
+	if (port->PD.PE.HasContract == false)
+	{
+		return;
+	}
+
+	port->PD.PE.HasContract = false;
+
+	CCHandshake_Notification_t lost = { .Type = CCHandshake_Notify_ContractLost };
+	notify( port, &lost );
+}
+
+/**
+ * Soft_Reset from the source: fresh message ids, accept and wait for its capabilities
+ */
+static void pe_onSoftReset( CCHandshake_Port_t * port )
+{
+	port->PD.Timers.Running = 0;
+	port->PD.Tx.MessageId = 0;
+
+	pd_encodeMessage( port, 0, PD_ControlCommand_Accept, NULL );
+
+	pd_sendMessage( port, NULL );
+
+	pe_dropContract( port );
+	pe_setState( port, PE_State_WaitForCapabilities );
+
+	pd_timerStart( port, PD_Timer_SinkWaitCap, PD_T_SINK_WAIT_CAP );
+}
+//static void pd_setRoles( CCHandshake_PD_Role_t powerRole, CCHandshake_PD_Role_t dataRole )
+//{
+//	read( port, FUSB302_D_Register_Switches1 );
+//
+//	// clear bits
+//	port->Registers.Switches1 &= ~(FUSB302_D_Switches1_POWERROLE | FUSB302_D_Switches1_DATAROLE);
+//
+//	if (powerRole == CCHandshake_PD_Role_Source)
+//	{
+//		port->Registers.Switches1 |= FUSB302_D_Switches1_POWERROLE_Source;
+//	}
+//	else
+//	{
+//		port->Registers.Switches1 |= FUSB302_D_Switches1_POWERROLE_Sink;
+//	}
+//
+//	if (dataRole == CCHandshake_PD_Role_Source)
+//	{
+//		port->Registers.Switches1 |= FUSB302_D_Switches1_DATAROLE_Source;
+//	}
+//	else
+//	{
+//		port->Registers.Switches1 |= FUSB302_D_Switches1_DATAROLE_Sink;
+//	}
+//
+//	write( FUSB302_D_Register_Switches1 );
+//}
+//
+//static void pd_setAutoGoodCrc( bool enabled )
+//{
+//	read( port, FUSB302_D_Register_Switches1 );
+//
+//	port->Registers.Switches1 &= ~FUSB302_D_Switches1_AUTO_CRC;
+//
+//	if (enabled)
+//	{
+//		port->Registers.Switches1 |= FUSB302_D_Switches1_AUTO_CRC;
+//	}
+//
+//	write( FUSB302_D_Register_Switches1 );
+//}
+
+
+/**
+ * Reads the next SOP message from the rx fifo into <frame>.
+ * Token and header are read in one burst, which gives the remaining length (data objects + crc) for the second burst:
+ * reading the max frame size at once would consume the beginning of a following message.
+ */
+static bool pd_getMessage( CCHandshake_Port_t * port, uint8_t * frame )
+{
+	// decoded in place, see PD_MessageView_t
+	uint8_t N;
+
+	do {
+
+		if (FUSB302_D_ReadN( &port->Driver, FUSB302_D_Register_FIFOs, &frame[0], PD_RX_FRAME_HEAD_SIZE ) == FUSB302_D_ERROR)
+		{
 			DBG("failed read 1\n");
 			return false;
 		}
 
-//		DBG(" %02x \n", addr);
+		if ( (frame[0] & FUSB302_D_RxFIFOToken_MASK) == FUSB302_D_RxFIFOToken_SOP && PD_isWantedMessage( PD_Wire_getU16( &frame[1] ) ))
+		{
+			break;
+		}
+
+		// discard message if not right type (or of no interest)
+		DBG("drop %02x %04x\n", frame[0], PD_Wire_getU16( &frame[1] ));
+		if (pd_skipMessage( port, frame ) == false)
+		{
+			return false;
+		}
+
+		read( port, FUSB302_D_Register_Status1, &port->Registers.Status1 );
+		if ((port->Registers.Status1 & FUSB302_D_Status1_RX_EMPTY) == FUSB302_D_Status1_RX_EMPTY)
+		{
+			DBG("nothing left\n");
+			return false;
+		}
+
+	} while (1);
+
+	N = PD_HeaderWord_getNumberOfDataObjects( PD_Wire_getU16( &frame[1] ) );
+
+	// data objects and crc in one go
+	if (FUSB302_D_ReadN( &port->Driver, FUSB302_D_Register_FIFOs, &frame[PD_RX_FRAME_HEAD_SIZE], N * sizeof(PD_DataObject_t) + 4 ) == FUSB302_D_ERROR)
+	{
+		DBG("failed read 2\n");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Drops the rest (data objects and crc) of the message whose token and header are in <frame>, false if the fifo is
+ * empty after it. Flushing the fifo spares reading it, but also loses anything queued behind, so that is only done
+ * with an explicit contract in place and no answer due from the source; otherwise it is read into <frame> (one burst).
+ */
+static bool pd_skipMessage( CCHandshake_Port_t * port, uint8_t * frame )
+{
+	uint8_t len = PD_HeaderWord_getNumberOfDataObjects( PD_Wire_getU16( &frame[1] ) ) * sizeof(PD_DataObject_t) + 4;
+
+	port->PD.Rx.Stats.Dropped++;
+
+#if CCHANDSHAKE_RX_FLUSH_IGNORED==true
+	const uint8_t exchange = (1 << PD_Timer_SenderResponse) | (1 << PD_Timer_PSTransition) | (1 << PD_Timer_Chunk);
+
+	// a control message is just its crc, as cheap to read as to flush
+	if (len > 4 && port->PD.PE.State == PE_State_Ready && (port->PD.Timers.Running & exchange) == 0)
+	{
+		strobe( port, FUSB302_D_Register_Control1, FUSB302_D_Control1_RX_FLUSH );
+		port->PD.Rx.Stats.BytesFlushed += len;
+		return false;
+	}
+#endif
+
+	if (FUSB302_D_ReadN( &port->Driver, FUSB302_D_Register_FIFOs, &frame[PD_RX_FRAME_HEAD_SIZE], len ) == FUSB302_D_ERROR)
+	{
+		DBG("failed read 2\n");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Reads the messages in the rx fifo into the ring until RX_EMPTY (I_GCRCSENT: there is one at least),
+ * true if the ring is full and there might be more left
+ */
+static bool pd_drainRxFifo( CCHandshake_Port_t * port )
+{
+	uint16_t bytes = 0;
+	bool full = false;
+
+	do {
+		if (port->PD.Rx.Count == CCHANDSHAKE_RX_RING_SIZE)
+		{
+			full = true;
+			break;
+		}
+
+		uint8_t * frame = port->PD.Rx.Frame[(port->PD.Rx.Head + port->PD.Rx.Count) % CCHANDSHAKE_RX_RING_SIZE];
+
+		if (pd_getMessage( port, frame ) == false)
+		{
+			break;
+		}
+
+		port->PD.Rx.Count++;
+		port->PD.Rx.Stats.Messages++;
+		bytes += PD_RX_FRAME_HEAD_SIZE + PD_HeaderWord_getNumberOfDataObjects( PD_Wire_getU16( &frame[1] ) ) * sizeof(PD_DataObject_t) + 4;
+
+	} while (read( port, FUSB302_D_Register_Status1, &port->Registers.Status1 ) && pd_hasMessage( port ));
+
+	if (bytes > port->PD.Rx.Stats.FifoHighWater)
+	{
+		port->PD.Rx.Stats.FifoHighWater = bytes;
+	}
+	if (port->PD.Rx.Count > port->PD.Rx.Stats.RingHighWater)
+	{
+		port->PD.Rx.Stats.RingHighWater = port->PD.Rx.Count;
+	}
+
+	return full;
+}
+
+
+/**
+ * Builds the tx fifo sequence with the message in place, ready for (re)sending
+ */
+static void pd_encodeMessage( CCHandshake_Port_t * port, uint8_t numberOfDataObjects, uint16_t commandCode, const PD_DataObject_t * dataObjects )
+{
+	uint16_t header = PD_HeaderWord_make( numberOfDataObjects, pd_nextTxMessageId( port ), PD_HeaderWord_PowerRole_Sink, port->PD.SpecRev, PD_HeaderWord_DataRole_Sink, commandCode );
+
+	pd_encodeFrame( port, PD_Wire_encode( &port->PD.Tx.Frame[PD_TX_FRAME_HEAD_SIZE], header, dataObjects ) );
+}
+
+/**
+ * Puts the fifo tokens around the <len> bytes of message already in place
+ */
+static void pd_encodeFrame( CCHandshake_Port_t * port, uint8_t len )
+{
+	uint8_t * frame = port->PD.Tx.Frame;
+	uint8_t i = 0;
+
+	// I don't get it, but the arduino code does it like this
+	frame[i++] = FUSB302_D_TxFIFOToken_SOP1;
+	frame[i++] = FUSB302_D_TxFIFOToken_SOP1;
+	frame[i++] = FUSB302_D_TxFIFOToken_SOP1;
+	frame[i++] = FUSB302_D_TxFIFOToken_SOP2;
+
+	// set packet size, immediately followed up by data
+	frame[i++] = FUSB302_D_TxFIFOToken_PACKSYM | len;
+
+	i += len;
+
+	// just some
+	frame[i++] = FUSB302_D_TxFIFOToken_JAM_CRC;
+	frame[i++] = FUSB302_D_TxFIFOToken_EOP;
+	frame[i++] = FUSB302_D_TxFIFOToken_TXOFF;
+
+	// command to actually start TX
+	frame[i++] = FUSB302_D_TxFIFOToken_TXON;
+
+	port->PD.Tx.FrameLen = i;
+}
+
+static bool pd_sendMessage( CCHandshake_Port_t * port, PD_State_t (*onAcknowledged)( CCHandshake_Port_t * port, const PD_MessageView_t * message) )
+{
+	PD_MessageView_t message;
+
+	PD_MessageView_init( &message, &port->PD.Tx.Frame[PD_TX_FRAME_HEAD_SIZE] );
+
+	uint8_t N = PD_MessageView_getNumberOfDataObjects( &message );
+
+	DBG( "---- PD tx\n");
+
+	DBG("mid = %d prole = %d spec = %d drole = %d cmd = %d\n" ,
+			PD_HeaderWord_getMessageId(message.Header),
+			PD_HeaderWord_getPowerRole(message.Header),
+			PD_HeaderWord_getSpecRev(message.Header),
+			PD_HeaderWord_getDataRole(message.Header),
+			PD_HeaderWord_getCommandCode(message.Header)
+			);
+
+	DBG("data (%d) ", N);
+	for ( uint8_t n = 0; n < N; n++)
+	{
+		DBG("%08x", PD_MessageView_getDataObject( &message, n ));
+	}
+
+	DBG( "\n----\n" );
+
+	port->PD.Tx.OnAcknowledged = onAcknowledged;
+
+	if (FUSB302_D_WriteN( &port->Driver, FUSB302_D_Register_FIFOs, &port->PD.Tx.Frame[0], port->PD.Tx.FrameLen ) == FUSB302_D_ERROR)
+	{
+		DBG("WRite FAIL\n");
+		return false;
+	}
+
+
+	DBG("Tx (%d)\n", port->PD.Tx.FrameLen);
+
+	port->PD.Tx.OnWire = true;
+
+//	pd_startTx( port );
+
+	port->PD.Tx.SentTs = FUSB302_D_GetTime( &port->Driver );
+	port->PD.State = PD_State_Idle;
+//	port->PD.State = PD_State_AwaitGoodCRC;
+
+	return true;
+}
+
+static PD_State_t pd_processMessage( CCHandshake_Port_t * port, const PD_MessageView_t * message )
+{
+	uint8_t N = PD_MessageView_getNumberOfDataObjects( message );
+
+	DBG( "---- PD rx\n");
+
+	DBG("mid = %d prole = %d spec = %d drole = %d cmd = %d\n" ,
+			PD_HeaderWord_getMessageId(message->Header),
+			PD_HeaderWord_getPowerRole(message->Header),
+			PD_HeaderWord_getSpecRev(message->Header),
+			PD_HeaderWord_getDataRole(message->Header),
+			PD_HeaderWord_getCommandCode(message->Header)
+			);
+
+	DBG("data (%d) ", N);
+	for ( uint8_t n = 0; n < N; n++)
+	{
+		DBG("%08x", PD_MessageView_getDataObject( message, n ));
+	}
+
+	DBG( "\n----\n" );
+
+	if (PD_HeaderWord_isExtended( message->Header ))
+	{
+#if CCHANDSHAKE_PD_REV3==true
+		return pd_onExtendedMessage( port, message );
+#else
+		DBG("Ignoring extended %d\n", PD_MessageView_getCommandCode( message ));
+		return PD_State_Idle;
+#endif
+	}
+
+	// reserved commands
+	if (PD_HeaderWord_isValidCommand( message->Header ) == 0)
+	{
+		DBG("Ignoring unknown %d\n", PD_MessageView_getCommandCode( message ));
+		return PD_State_Idle;
+	}
+
+	if (PD_MessageView_isControlMessage( message ))
+	{
+
+		switch(PD_MessageView_getCommandCode( message ))
+		{
+			case PD_ControlCommand_GoodCRC:
+			{
+				if (port->PD.Tx.OnAcknowledged != NULL){
+					return port->PD.Tx.OnAcknowledged( port, message );
+				}
+				break;
+			}
+
+			case PD_ControlCommand_Accept:
+			{
+				DBG("Accept!\n");
+				if (port->PD.PE.State == PE_State_SelectCapability)
+				{
+					pd_timerStop( port, PD_Timer_SenderResponse );
+					pd_timerStart( port, PD_Timer_PSTransition, PD_T_PS_TRANSITION );
+					pe_setState( port, PE_State_TransitionSink );
+
+					CCHandshake_Notification_t accepted = { .Type = CCHandshake_Notify_ContractAccepted };
+					pd_getRequestedPower( port, port->PD.Power.Request.Value, &accepted.Millivolt, &accepted.Milliamp );
+					notify( port, &accepted );
+				}
+				else if (port->PD.PE.State == PE_State_SoftReset)
+				{
+					pd_timerStop( port, PD_Timer_SenderResponse );
+					pd_timerStart( port, PD_Timer_SinkWaitCap, PD_T_SINK_WAIT_CAP );
+					pe_setState( port, PE_State_WaitForCapabilities );
+				}
+				break;
+			}
+
+			case PD_ControlCommand_Reject:
+			case PD_ControlCommand_Wait:
+			{
+				DBG("Reject!\n");
+				if (port->PD.PE.State != PE_State_SelectCapability)
+				{
+					break;
+				}
+				pd_timerStop( port, PD_Timer_SenderResponse );
+
+				// keep the contract there is, without one the source has to offer again (or be hard reset)
+				if (port->PD.PE.HasContract)
+				{
+					pe_ready( port );
+				}
+				else
+				{
+					pd_timerStart( port, PD_Timer_SinkWaitCap, PD_T_SINK_WAIT_CAP );
+					pe_setState( port, PE_State_WaitForCapabilities );
+				}
+				break;
+			}
+
+			case PD_ControlCommand_GotoMin:
+			{
+				DBG("GotoMin\n");
+				// only allowed if the request offered to give back power
+				if (port->PD.PE.State == PE_State_Ready && (port->PD.Power.Request.Value & PDO_Req_Fixed_GiveBack) == PDO_Req_Fixed_GiveBack)
+				{
+					pd_timerStart( port, PD_Timer_PSTransition, PD_T_PS_TRANSITION );
+					pe_setState( port, PE_State_TransitionSink );
+				}
+				break;
+			}
+
+			case PD_ControlCommand_PSRDY:
+			{
+				DBG("PS_RDY\n");
+				if (port->PD.PE.State != PE_State_TransitionSink)
+				{
+					break;
+				}
+				pd_timerStop( port, PD_Timer_PSTransition );
+
+				// explicit contract
+				port->PD.HardResetCount = 0;
+				port->PD.PE.HasContract = true;
+				port->PD.Power.Contract = port->PD.Power.Request;
+				if (port->PD.PE.ContractMs == 0)
+				{
+					port->PD.PE.ContractMs = FUSB302_D_GetTime( &port->Driver ) - port->PD.PE.AttachTs;
+				}
+
+				// a new contract, a full keep alive period
+				pd_timerStop( port, PD_Timer_PPSRequest );
+				pe_ready( port );
+
+				CCHandshake_Notification_t ready = { .Type = CCHandshake_Notify_PSReady };
+				pd_getRequestedPower( port, port->PD.Power.Contract.Value, &ready.Millivolt, &ready.Milliamp );
+				notify( port, &ready );
+				break;
+			}
+
+			case PD_ControlCommand_SoftReset:
+			{
+				DBG("Soft reset\n");
+				pe_onSoftReset( port );
+				break;
+			}
+
+			case PD_ControlCommand_GetSinkCap:
+			{
+				if (port->PD.PE.State == PE_State_Ready)
+				{
+					pd_sendSinkCapabilities( port );
+				}
+				break;
+			}
+
+			// requests the sink does not implement
+			case PD_ControlCommand_GetSourceCap:
+			case PD_ControlCommand_DRSwap:
+			case PD_ControlCommand_PRSwap:
+			case PD_ControlCommand_VCONNSwap:
+			case PD_ControlCommand_GetSourceCapExtended:
+			case PD_ControlCommand_GetStatus:
+			case PD_ControlCommand_GetPPSStatus:
+			case PD_ControlCommand_GetCountryCodes:
+			{
+				if (port->PD.PE.State == PE_State_Ready)
+				{
+					pd_sendNotSupported( port );
+				}
+				break;
+			}
+
+			default:
+				DBG("Ignoring control %d\n", PD_MessageView_getCommandCode( message ));
+		}
+	}
+	else
+	{
+		switch(PD_MessageView_getCommandCode( message ))
+		{
+			case PD_DataCommand_SourceCapabilities:
+			{
+				return pd_onSourceCapabilities( port, message );
+//				DBG("sourceCaps\n");
+//				break;
+			}
+
+			case PD_DataCommand_Request:
+			case PD_DataCommand_GetCountryInfo:
+			{
+				if (port->PD.PE.State == PE_State_Ready)
+				{
+					pd_sendNotSupported( port );
+				}
+				break;
+			}
+
+			default:
+				DBG("Ignoring data %d\n", PD_MessageView_getCommandCode( message ));
+		}
+	}
+
+	return PD_State_Idle;
+}
+
+static PD_State_t pd_onSourceCapabilities( CCHandshake_Port_t * port, const PD_MessageView_t * message )
+{
+//	DBG("sourceCaps\n");
+
+	uint8_t N = PD_MessageView_getNumberOfDataObjects( message );
+
+	// a source capabilities message must always have
+	if (N == 0)
+	{
+		DBG("no data\n");
+		return PD_State_Reset;
+	}
+
+	pd_timerStop( port, PD_Timer_SinkWaitCap );
+
+	pe_setState( port, PE_State_EvaluateCapability );
+
+#if CCHANDSHAKE_PD_REV3==true
+	// the lower revision of both
+	pd_setSpecRev( port, (message->Header & PD_HeaderWord_SpecRev_MASK) >= PD_HeaderWord_SpecRev_3_0 ? PD_HeaderWord_SpecRev_3_0 : PD_HeaderWord_SpecRev_2_0 );
+#endif
+
+	port->PD.Power.NSourceCapabilities = N;
+
+	for (uint8_t i = 0; i < N; i++)
+	{
+		// decoded once, straight from the rx frame
+		port->PD.Power.SourceCapabilities[i].Value = PD_MessageView_getDataObject( message, i );
+	}
+
+	CCHandshake_Notification_t caps = { .Type = CCHandshake_Notify_SourceCapabilities, .NSourceCapabilities = N };
+	notify( port, &caps );
+
+	pd_requestCapability( port );
+
+	return PD_State_Idle;
+}
+
+/**
+ * Picks the best of the stored offers and requests it
+ */
+static void pd_requestCapability( CCHandshake_Port_t * port )
+{
+	pd_createRequest( port );
+
+	pd_encodeMessage( port, 1, PD_DataCommand_Request, &port->PD.Power.Request );
+
+//	DelayMs(1000);
+	pd_sendMessage( port, NULL );
+
+	port->PD.Tx.SendAttempts = 0;
+
+	pd_timerStart( port, PD_Timer_SenderResponse, PD_T_SENDER_RESPONSE );
+
+	pe_setState( port, PE_State_SelectCapability );
+
+//	return PD_State_AwaitGoodCRC;
+}
+
+/**
+ * Power (mW) offer <caps> at <position> can deliver within the sink profile, less the efficiency penalty,
+ * and the matching request in <rdo>. 0 if it cannot be used at all.
+ */
+static uint32_t pd_scoreCapability( CCHandshake_Port_t * port, uint32_t caps, uint8_t position, uint32_t * rdo )
+{
+	const CCHandshake_SinkProfile_t * profile = &port->Profile;
+	uint32_t vmin, vmax, ma, mw;
+	uint32_t bonus = 0;
+
+	switch (caps & PDO_SrcCap_SupplyType_MASK)
+	{
+		case PDO_SrcCap_SupplyType_Fixed:
+		{
+			vmin = vmax = 50 * PDO_SrcCap_Fixed_getVoltage_50mV(caps);
+			ma = 10 * PDO_SrcCap_Fixed_getMaxCurrent_10mA(caps);
+
+			DBG("%d fixed  %d mV max %d mA\n", position, vmin, ma );
+
+			if (ma < profile->MinMilliamp)
+			{
+				return 0;
+			}
+			if (ma > profile->MaxMilliamp)
+			{
+				ma = profile->MaxMilliamp;
+			}
+
+			// guaranteed at the lowest voltage
+			mw = vmin * ma / 1000;
+
+			*rdo = PDO_Req_Fixed_setOperatingCurrent_10mABits( ma / 10 ) | PDO_Req_Fixed_setMaxOpCur_10mABits( ma / 10 );
+			break;
+		}
+		case PDO_SrcCap_SupplyType_Variable:
+		{
+			vmin = 50 * PDO_SrcCap_Variable_getMinVoltage_50mV(caps);
+			vmax = 50 * PDO_SrcCap_Variable_getMaxVoltage_50mV(caps);
+			ma = 10 * PDO_SrcCap_Variable_getMaxCurrent_10mA(caps);
+
+			DBG("%d variable  %d mV - %d mV  max %d mA\n", position, vmin, vmax, ma );
+
+			if (ma < profile->MinMilliamp)
+			{
+				return 0;
+			}
+			if (ma > profile->MaxMilliamp)
+			{
+				ma = profile->MaxMilliamp;
+			}
+
+			mw = vmin * ma / 1000;
 
-		// discard and abort if not right type
-		if ( (token & FUSB302_D_RxFIFOToken_MASK) != FUSB302_D_RxFIFOToken_SOP)
+			*rdo = PDO_Req_Fixed_setOperatingCurrent_10mABits( ma / 10 ) | PDO_Req_Fixed_setMaxOpCur_10mABits( ma / 10 );
+			break;
+		}
+		case PDO_SrcCap_SupplyType_Battery:
 		{
-			DBG("%02x", token);
-//			return false;
-			read( FUSB302_D_Register_Status1, &Registers.Status1 );
-			if ((Registers.Status1 & FUSB302_D_Status1_RX_EMPTY) == FUSB302_D_Status1_RX_EMPTY)
+			vmin = 50 * PDO_SrcCap_Battery_getMinVoltage_50mV(caps);
+			vmax = 50 * PDO_SrcCap_Battery_getMaxVoltage_50mV(caps);
+			mw = 250 * PDO_SrcCap_Battery_getMaxPower_250mW(caps);
+
+			DBG("%d battery  %d mV - %d mV  max %d mW\n", position, vmin, vmax, mw );
+
+			if (vmin == 0 || vmax == 0 || mw * 1000 / vmax < profile->MinMilliamp)
 			{
-				DBG("\nnothing left\n");
-				return false;
+				return 0;
 			}
+			// current is highest at the lowest voltage
+			if (mw * 1000 / vmin > profile->MaxMilliamp)
+			{
+				mw = vmin * profile->MaxMilliamp / 1000;
+			}
+
+			*rdo = PDO_Req_Battery_setOperatingPower_250mWBits( mw / 250 ) | PDO_Req_Battery_setMaxOpPower_250mWBits( mw / 250 );
+			break;
 		}
-		else
+		case PDO_SrcCap_SupplyType_APDO:
 		{
-//			DBG("- %02x\n", token);
+			if (PDO_SrcCap_isPPS(caps) == false)
+			{
+				return 0;
+			}
+
+			vmin = 100 * PDO_SrcCap_PPS_getMinVoltage_100mV(caps);
+			vmax = 100 * PDO_SrcCap_PPS_getMaxVoltage_100mV(caps);
+			ma = 50 * PDO_SrcCap_PPS_getMaxCurrent_50mA(caps);
+
+			DBG("%d pps  %d mV - %d mV  max %d mA\n", position, vmin, vmax, ma );
+
+			// only for a target (and with PD 3.0)
+			if (profile->PPSMillivolt == 0 || port->PD.SpecRev != PD_HeaderWord_SpecRev_3_0)
+			{
+				return 0;
+			}
+			if (profile->PPSMillivolt < vmin || profile->PPSMillivolt > vmax)
+			{
+				return 0;
+			}
+			if (ma > profile->PPSMilliamp)
+			{
+				ma = profile->PPSMilliamp;
+			}
+			if (ma > profile->MaxMilliamp)
+			{
+				ma = profile->MaxMilliamp;
+			}
+			if (ma < profile->MinMilliamp || ma < 50)
+			{
+				return 0;
+			}
+
+			// the supply follows the target, nothing else of the range matters
+			vmin = vmax = profile->PPSMillivolt;
+			mw = vmin * ma / 1000;
+			bonus = PD_PPS_SCORE;
+
+			*rdo = PDO_Req_PPS_setOutputVoltage_20mVBits( vmin / 20 ) | PDO_Req_PPS_setOperatingCurrent_50mABits( ma / 50 );
 			break;
 		}
+		default:
+			return 0;
+	}
 
-//		read( FUSB302_D_Register_Status1 );
+	if (vmin < profile->MinMillivolt || vmax > profile->MaxMillivolt)
+	{
+		return 0;
+	}
 
-	} while (1);
+	*rdo |= PDO_Req_Fixed_setObjectPosBits( position ) | PDO_Req_Fixed_NoUSBSuspend;
+
+	if (profile->PreferredMillivolt == 0)
+	{
+		return bonus + mw;
+	}
+
+	// worst case distance of the range to the preferred voltage
+	uint32_t dv = vmax > profile->PreferredMillivolt ? vmax - profile->PreferredMillivolt : 0;
+	if (vmin < profile->PreferredMillivolt && profile->PreferredMillivolt - vmin > dv)
+	{
+		dv = profile->PreferredMillivolt - vmin;
+	}
 
-	uint8_t header[2] = {0,0};
+	uint32_t penalty = profile->EfficiencyWeight * dv / 100; // per mille
 
-	if (FUSB302_D_ReadN( &Driver, FUSB302_D_Register_FIFOs, &header[0], 2 ) == FUSB302_D_ERROR)
+	if (penalty >= 1000)
 	{
-		DBG("failed read 2\n");
-		return false;
+		return bonus + 1;
 	}
 
-	le_to_u16( &message->Header.Word, header );
+	mw = mw * (1000 - penalty) / 1000;
 
-	PD.Rx.MessageId = PD_HeaderWord_getMessageId( message->Header.Word );
-//	PD.Tx.MessageId = PD.Rx.MessageId + 1;
+	return bonus + (mw > 0 ? mw : 1);
+}
 
-//	DBG("RX tkn %02x hdr %02x%02x\n", token, message->Header.Bytes[0], message->Header.Bytes[1] );
+/**
+ * Scores all stored offers against the sink profile, BestCapIndex and Request are those of the best one.
+ * Without any usable offer vSafe5V is requested with the capability mismatch flag.
+ */
+static void pd_createRequest( CCHandshake_Port_t * port )
+{
+	uint32_t bestScore = 0;
+	uint32_t score, rdo;
 
-	uint8_t N = PD_HeaderWord_getNumberOfDataObjects( message->Header.Word );
+	port->PD.Power.BestCapIndex = 0; // note: 0 is an invalid value (according to PD spec)
 
-	if (N > 0)
+	for (uint8_t i = 0; i < port->PD.Power.NSourceCapabilities; i++)
 	{
-		uint8_t buf[PD_MESSAGE_MAX_OBJECTS * sizeof(PD_DataObject_t)];
-		memset( buf, 0, PD_MESSAGE_MAX_OBJECTS * sizeof(PD_DataObject_t) );
+		score = pd_scoreCapability( port, port->PD.Power.SourceCapabilities[i].Value, i + 1, &rdo );
 
-		if (FUSB302_D_ReadN( &Driver, FUSB302_D_Register_FIFOs, &buf[0], sizeof(PD_DataObject_t) * N ) == FUSB302_D_ERROR)
-//		if (FUSB302_D_ReadN( &Driver, FUSB302_D_Register_FIFOs, &message->DataObjects[0], sizeof(PD_DataObject_t) * N ) == FUSB302_D_ERROR)
+		if (score > bestScore)
 		{
-			DBG("failed read 3\n");
-			return false;
+			port->PD.Power.BestCapIndex = i + 1; // Note: it's count starting by 1
+			port->PD.Power.Request.Value = rdo;
+			bestScore = score;
 		}
+	}
 
-		for(uint8_t n = 0; n < N; n++)
-		{
-//			message->DataObjects[n] = buf[n*sizeof(PD_DataObject_t)];
-			le_to_u32( &message->DataObjects[n], &buf[n*sizeof(PD_DataObject_t)] );
-
-//			DBG("%08x vs %02x%02x%02x%02x\n",
-//					message->DataObjects[n],
-//					buf[n*sizeof(PD_DataObject_t)],
-//					buf[n*sizeof(PD_DataObject_t)+1],
-//					buf[n*sizeof(PD_DataObject_t)+2],
-//					buf[n*sizeof(PD_DataObject_t)+3]);
-		}
+	if (port->PD.Power.BestCapIndex != 0)
+	{
+		return;
+	}
 
+	// the first offer is always vSafe5V
+	uint32_t c = PDO_SrcCap_Fixed_getMaxCurrent_10mA( port->PD.Power.SourceCapabilities[0].Value );
 
+	if ( 10 * c > port->Profile.MaxMilliamp )
+	{
+		c = port->Profile.MaxMilliamp / 10;
 	}
 
+	port->PD.Power.BestCapIndex = 1;
+	port->PD.Power.Request.Value = PDO_Req_Fixed_setObjectPosBits( 1 ) | PDO_Req_Fixed_CapabilityMismatch | PDO_Req_Fixed_NoUSBSuspend |
+			PDO_Req_Fixed_setOperatingCurrent_10mABits( c ) | PDO_Req_Fixed_setMaxOpCur_10mABits( c );
+}
 
-	uint8_t crc32[4] = {0,0,0,0};
+static bool pd_isPPSContract( CCHandshake_Port_t * port )
+{
+	uint8_t position = (port->PD.Power.Contract.Value & PDO_Req_Fixed_ObjectPos_MASK) >> PDO_Req_Fixed_ObjectPos_OFFSET;
 
-	if (FUSB302_D_ReadN( &Driver, FUSB302_D_Register_FIFOs, &crc32[0], 4 ) == FUSB302_D_ERROR)
+	if (port->PD.PE.HasContract == false || position == 0 || position > port->PD.Power.NSourceCapabilities)
 	{
-		DBG("failed read 4\n");
 		return false;
 	}
 
-	le_to_u32( &message->Crc32, crc32 );
-
-	return true;
+	return PDO_SrcCap_isPPS( port->PD.Power.SourceCapabilities[position - 1].Value );
 }
 
-
-static bool pd_sendMessage( PD_Message_t * message, PD_State_t (*onAcknowledged)( PD_Message_t * message) )
+/**
+ * Voltage and current of request <rdo> on the stored offers (variable / battery supplies: at their lowest voltage)
+ */
+static void pd_getRequestedPower( CCHandshake_Port_t * port, uint32_t rdo, uint16_t * millivolt, uint16_t * milliamp )
 {
-	uint8_t N = PD_HeaderWord_getNumberOfDataObjects( message->Header.Word );
-
-	DBG( "---- PD tx\n");
+	uint8_t position = (rdo & PDO_Req_Fixed_ObjectPos_MASK) >> PDO_Req_Fixed_ObjectPos_OFFSET;
 
-	DBG("mid = %d prole = %d spec = %d drole = %d cmd = %d\n" ,
-			PD_HeaderWord_getMessageId(message->Header.Word),
-			PD_HeaderWord_getPowerRole(message->Header.Word),
-			PD_HeaderWord_getSpecRev(message->Header.Word),
-			PD_HeaderWord_getDataRole(message->Header.Word),
-			PD_HeaderWord_getCommandCode(message->Header.Word)
-			);
+	*millivolt = 0;
+	*milliamp = 0;
 
-	DBG("data (%d) ", N);
-	for ( uint8_t n = 0; n < N; n++)
+	if (position == 0 || position > port->PD.Power.NSourceCapabilities)
 	{
-		DBG("%08x", message->DataObjects[n].Value);
+		return;
 	}
 
-	DBG( "\n----\n" );
-
-	PD.Tx.OnAcknowledged = onAcknowledged;
-
-	uint8_t buf[64];
+	uint32_t caps = port->PD.Power.SourceCapabilities[position - 1].Value;
+	uint32_t ma = 10 * ((rdo & PDO_Req_Fixed_OperatingCurrent_10mA_MASK) >> PDO_Req_Fixed_OperatingCurrent_10mA_OFFSET);
 
-	memset( (uint8_t*)&buf[0], 0, sizeof(buf) );
-
-	uint8_t i = 0;
-
-	// I don't get it, but the arduino code does it like this
-	buf[i++] = FUSB302_D_TxFIFOToken_SOP1;
-	buf[i++] = FUSB302_D_TxFIFOToken_SOP1;
-	buf[i++] = FUSB302_D_TxFIFOToken_SOP1;
-	buf[i++] = FUSB302_D_TxFIFOToken_SOP2;
+	switch (caps & PDO_SrcCap_SupplyType_MASK)
+	{
+		case PDO_SrcCap_SupplyType_Fixed:
+			*millivolt = 50 * PDO_SrcCap_Fixed_getVoltage_50mV( caps );
+			break;
 
+		case PDO_SrcCap_SupplyType_Variable:
+			*millivolt = 50 * PDO_SrcCap_Variable_getMinVoltage_50mV( caps );
+			break;
 
-	// set packet size
-	buf[i++] = FUSB302_D_TxFIFOToken_PACKSYM | (2 + N * sizeof(PD_DataObject_t));
+		case PDO_SrcCap_SupplyType_Battery:
+		{
+			uint32_t mw = 250 * ((rdo & PDO_Req_Battery_OperatingPower_250mW_MASK) >> PDO_Req_Battery_OperatingPower_250mW_OFFSET);
 
-//	DBG("%d\n", (2 + N * sizeof(PD_DataObject_t)));
+			*millivolt = 50 * PDO_SrcCap_Battery_getMinVoltage_50mV( caps );
+			ma = *millivolt ? 1000 * mw / *millivolt : 0;
+			break;
+		}
 
-	// immediately followed up by data
+		default:
+			if (PDO_SrcCap_isPPS( caps ) == false)
+			{
+				return;
+			}
+			*millivolt = 20 * PDO_Req_PPS_getOutputVoltage_20mV( rdo );
+			ma = 50 * PDO_Req_PPS_getOperatingCurrent_50mA( rdo );
+			break;
+	}
 
-	// add header
-	u16_to_le( &buf[i], message->Header.Word );
-	i += 2;
+	*milliamp = (uint16_t)ma;
+}
 
-	for (uint8_t n = 0; n < N; n++)
+/**
+ * A chunked message is being exchanged or waits to be sent (the request of a new contract would drop it)
+ */
+static bool pd_isChunking( CCHandshake_Port_t * port )
+{
+	if (port->PD.Timers.Running & (1 << PD_Timer_Chunk))
 	{
-//		u32_to_bigendian( &buf[i], &message->DataObjects[n] );
-		u32_to_le( &buf[i], message->DataObjects[n].Value );
-		i += sizeof(PD_DataObject_t);
+		return true;
 	}
+#if CCHANDSHAKE_PD_REV3==true
+	if (port->PD.Ext.Tx.Pending)
+	{
+		return true;
+	}
+#endif
 
-	// just some
-	buf[i++] = FUSB302_D_TxFIFOToken_JAM_CRC;
-	buf[i++] = FUSB302_D_TxFIFOToken_EOP;
-	buf[i++] = FUSB302_D_TxFIFOToken_TXOFF;
-
-	// command to actually start TX
-	buf[i++] = FUSB302_D_TxFIFOToken_TXON;
+	return false;
+}
 
-	if (FUSB302_D_WriteN( &Driver, FUSB302_D_Register_FIFOs, &buf[0], i ) == FUSB302_D_ERROR)
+/**
+ * Something to be done without waiting for an event: an exchange in progress, a new request or an extended message
+ */
+static bool pd_hasWork( CCHandshake_Port_t * port )
+{
+	if (port->PD.State != PD_State_Idle && port->PD.State != PD_State_Disabled)
 	{
-		DBG("WRite FAIL\n");
-		return false;
+		return true;
+	}
+	if (port->PD.Power.Reselect)
+	{
+		return true;
+	}
+#if CCHANDSHAKE_PD_REV3==true
+	// only sent with a contract
+	if (port->PD.PE.State == PE_State_Ready && (port->PD.Ext.Get != 0 || port->PD.Ext.Tx.Pending))
+	{
+		return true;
 	}
+#endif
 
+	return false;
+}
 
-	DBG("Tx (%d)\n", i);
+/**
+ * Spec revision of our messages and of the GoodCRCs the FUSB302 sends
+ */
+static void pd_setSpecRev( CCHandshake_Port_t * port, uint16_t specRev )
+{
+	if (port->PD.SpecRev == specRev)
+	{
+		return;
+	}
 
-//	pd_startTx();
+	DBG("PD spec rev %d\n", specRev >> PD_HeaderWord_SpecRev_OFFSET);
 
-	PD.Tx.SentTs = TimerGetCurrentTime();
-	PD.State = PD_State_Idle;
-//	PD.State = PD_State_AwaitGoodCRC;
+	port->PD.SpecRev = specRev;
 
-	return true;
+	set( port, FUSB302_D_Register_Switches1, (port->Registers.Switches1 & ~FUSB302_D_Switches1_SPECREV_MASK) |
+			(specRev == PD_HeaderWord_SpecRev_3_0 ? FUSB302_D_Switches1_SPECREV_Rev3_0 : FUSB302_D_Switches1_SPECREV_Rev2_0) );
+	commit( port );
 }
 
-static PD_State_t pd_processMessage( PD_Message_t * message )
+/**
+ * vSafe5V and, if the profile goes higher, its maximum voltage, both with the maximum current of the profile
+ */
+static void pd_sendSinkCapabilities( CCHandshake_Port_t * port )
 {
-	uint8_t N = PD_HeaderWord_getNumberOfDataObjects( message->Header.Word );
+	PD_DataObject_t pdos[2];
+	uint8_t n = 0;
 
-	DBG( "---- PD rx\n");
-
-	DBG("mid = %d prole = %d spec = %d drole = %d cmd = %d\n" ,
-			PD_HeaderWord_getMessageId(message->Header.Word),
-			PD_HeaderWord_getPowerRole(message->Header.Word),
-			PD_HeaderWord_getSpecRev(message->Header.Word),
-			PD_HeaderWord_getDataRole(message->Header.Word),
-			PD_HeaderWord_getCommandCode(message->Header.Word)
-			);
+	pdos[n++].Value = PDO_SrcCap_SupplyType_Fixed | PDO_SnkCap_Fixed_setVoltage_50mVBits( 5000 / 50 ) | PDO_SnkCap_Fixed_setOpCurrent_10mABits( port->Profile.MaxMilliamp / 10 );
 
-	DBG("data (%d) ", N);
-	for ( uint8_t n = 0; n < N; n++)
+	if (port->Profile.MaxMillivolt > 5000)
 	{
-		DBG("%08x", message->DataObjects[n].Value);
-//		DBG("%08x", message->DataObjects[n].object );
+		pdos[n++].Value = PDO_SrcCap_SupplyType_Fixed | PDO_SnkCap_Fixed_setVoltage_50mVBits( port->Profile.MaxMillivolt / 50 ) | PDO_SnkCap_Fixed_setOpCurrent_10mABits( port->Profile.MaxMilliamp / 10 );
 	}
 
-	DBG( "\n----\n" );
-
+	pd_encodeMessage( port, n, PD_DataCommand_SinkCapabilities, pdos );
+	pd_sendMessage( port, NULL );
+}
 
-	if (PD_isControlMessage( message ))
-	{
+/**
+ * Answers a request of the source the sink does not implement (Reject before PD 3.0)
+ */
+static void pd_sendNotSupported( CCHandshake_Port_t * port )
+{
+	pd_encodeMessage( port, 0, port->PD.SpecRev == PD_HeaderWord_SpecRev_3_0 ? PD_ControlCommand_NotSupported : PD_ControlCommand_Reject, NULL );
+	pd_sendMessage( port, NULL );
+}
 
-		switch(PD_HeaderWord_getCommandCode(message->Header.Word))
-		{
-			case PD_ControlCommand_GoodCRC:
-			{
-				if (PD.Tx.OnAcknowledged != NULL){
-					return PD.Tx.OnAcknowledged( message );
-				}
-				break;
-			}
+#if CCHANDSHAKE_PD_REV3==true
 
-			case PD_ControlCommand_Accept:
-			{
-				DBG("Accept!\n");
-				break;
-			}
+/**
+ * A chunk of an extended message (or a chunk request).
+ * Received chunks are collected in Ext.Rx and the next one is requested right away, in the same core call that read the
+ * chunk: the source waits for the request, so a message of n chunks takes just n - 1 round trips after the first.
+ * Chunk requests of the source are answered alike with the next chunk of Ext.Tx.
+ */
+static PD_State_t pd_onExtendedMessage( CCHandshake_Port_t * port, const PD_MessageView_t * message )
+{
+	uint8_t N = PD_MessageView_getNumberOfDataObjects( message );
+	uint8_t type = PD_MessageView_getCommandCode( message );
 
-			case PD_ControlCommand_Reject:
-			{
-				DBG("Reject!\n");
-				break;
-			}
+	if (N == 0 || PD_isValidExtendedCommand( type ) == false)
+	{
+		DBG("Ignoring extended %d\n", type);
+		return PD_State_Idle;
+	}
 
-			case PD_ControlCommand_SoftReset:
-			{
-				return PD_State_Reset;
-			}
+	uint16_t extHeader = PD_Wire_getU16( message->DataObjects );
+	uint8_t chunk = PD_ExtHeader_getChunkNumber( extHeader );
 
-			default:
-				DBG("Ignoring control %d\n", PD_HeaderWord_getCommandCode(message->Header.Word));
-		}
+	// unchunked messages do not fit the fifo (and we do not claim to support them)
+	if (PD_ExtHeader_isChunked( extHeader ) == false)
+	{
+		DBG("Ignoring unchunked %d\n", type);
+		return PD_State_Idle;
 	}
-	else
+
+	if (PD_ExtHeader_isRequestChunk( extHeader ))
 	{
-		switch(PD_HeaderWord_getCommandCode(message->Header.Word))
+		if (port->PD.Ext.Tx.Data != NULL && port->PD.Ext.Tx.Type == type && port->PD.Ext.Tx.NextChunk == chunk)
 		{
-			case PD_DataCommand_SourceCapabilities:
-			{
-//				PD_newMessage( &PD.Tx.Message, 0, pd_nextTxMessageId(), )
-				return pd_onSourceCapabilities( message );
-//				DBG("sourceCaps\n");
-//				break;
-			}
-			default:
-				DBG("Ignoring data %d\n", PD_HeaderWord_getCommandCode(message->Header.Word));
+			pd_sendChunk( port, chunk );
+		}
+		else
+		{
+			pd_abortChunking( port );
 		}
+		return PD_State_Idle;
 	}
 
-	return PD_State_Idle;
-}
-
-static PD_State_t pd_onSourceCapabilities( PD_Message_t * message )
-{
-//	DBG("sourceCaps\n");
-
-	uint8_t N = PD_HeaderWord_getNumberOfDataObjects( message->Header.Word );
+	if (chunk == 0)
+	{
+		// a new message, whatever came before is gone
+		port->PD.Ext.Rx.Type = type;
+		port->PD.Ext.Rx.Size = PD_ExtHeader_getDataSize( extHeader );
+		port->PD.Ext.Rx.Received = 0;
+		port->PD.Ext.Rx.Complete = false;
 
-	// a source capabilities message must always have
-	if (N == 0)
+		if (port->PD.Ext.Rx.Size > CCHANDSHAKE_EXTENDED_MAX_SIZE)
+		{
+			DBG("Extended %d too large (%d)\n", type, port->PD.Ext.Rx.Size);
+			port->PD.Ext.Rx.Type = 0;
+			return PD_State_Idle;
+		}
+	}
+	else if (port->PD.Ext.Rx.Type != type || port->PD.Ext.Rx.Complete || port->PD.Ext.Rx.NextChunk != chunk)
 	{
-		DBG("no data\n");
-		return PD_State_Reset;
+		DBG("Unexpected chunk %d of %d\n", chunk, type);
+		pd_abortChunking( port );
+		return PD_State_Idle;
 	}
 
-	PD.Power.NSourceCapabilities = N;
-	memcpy( &PD.Power.SourceCapabilities[0], &message->DataObjects[0], N * sizeof(PD_DataObject_t) );
-
-	// if there is only one offer, then that is the default 5V, no need for a request or anything else, because there is nothing else we can do
-	if (N == 1)
+	uint16_t len = port->PD.Ext.Rx.Size - port->PD.Ext.Rx.Received;
+	if (len > PD_EXTENDED_CHUNK_SIZE)
+	{
+		len = PD_EXTENDED_CHUNK_SIZE;
+	}
+	if (PD_EXTENDED_HEADER_SIZE + len > (int)(N * sizeof(PD_DataObject_t)))
 	{
+		DBG("Short chunk %d of %d\n", chunk, type);
+		pd_abortChunking( port );
 		return PD_State_Idle;
 	}
 
+	memcpy( &port->PD.Ext.Rx.Data[port->PD.Ext.Rx.Received], &message->DataObjects[PD_EXTENDED_HEADER_SIZE], len );
+	port->PD.Ext.Rx.Received += len;
+	port->PD.Ext.Rx.NextChunk = chunk + 1;
 
-	// find best offer
+	if (port->PD.Ext.Rx.Received < port->PD.Ext.Rx.Size)
+	{
+		pd_encodeChunk( port, type, PD_ExtHeader_makeRequest( chunk + 1 ), NULL, 0 );
+		pd_sendMessage( port, NULL );
 
-//	uint8_t best = 0;
-//	PD.Power.BestCap.Value = PD.Power.SourceCapabilities[0].Value;
+		pd_timerStart( port, PD_Timer_Chunk, PD_T_CHUNK );
+		return PD_State_Idle;
+	}
 
-	PD.Power.BestCapIndex = 0; // note: 0 is an invalid value (according to PD spec)
+	pd_timerStop( port, PD_Timer_Chunk );
+	port->PD.Ext.Rx.Complete = true;
 
-	uint32_t caps;
-	uint32_t bestPower = 0;
-	uint32_t v,p,c;
+	DBG("Extended %d complete (%d)\n", type, port->PD.Ext.Rx.Size);
 
-	for (uint8_t i = 0; i < N; i++)
+	// requests of the source the sink does not implement
+	switch (type)
 	{
-		// criteria for better
-//		switch (PD.Power.SourceCapabilities[i].PDO.SupplyType)
-		caps = PD.Power.SourceCapabilities[i].Value;
-		switch (caps & PDO_SrcCap_SupplyType_MASK)
-		{
-			case PDO_SrcCap_SupplyType_Battery:
+		case PD_ExtendedCommand_GetBatteryCap:
+		case PD_ExtendedCommand_GetBatteryStatus:
+		case PD_ExtendedCommand_GetManufacturerInfo:
+		case PD_ExtendedCommand_SecurityRequest:
+		case PD_ExtendedCommand_FirmwareUpdateRequest:
+			if (port->PD.PE.State == PE_State_Ready)
 			{
-				DBG("%d battery  %d mV - %d mV  max %d mW\n", i,
-						50 * PDO_SrcCap_Battery_getMinVoltage_50mV(caps),
-						50 * PDO_SrcCap_Battery_getMaxVoltage_50mV(caps),
-						250 * PDO_SrcCap_Battery_getMaxPower_250mW(caps) );
-//				DBG("%d battery %d mW %d mV - %d mV\n", i, 250 * PD.Power.SourceCapabilities[i].BPDO.MaxPower, 50 * PD.Power.SourceCapabilities[i].BPDO.MinVoltage, 50 * PD.Power.SourceCapabilities[i].BPDO.MaxVoltage );
-				break;
+				pd_sendNotSupported( port );
 			}
-			case PDO_SrcCap_SupplyType_Fixed:
-			{
-				v = PDO_SrcCap_Fixed_getVoltage_50mV(caps);
-				c = PDO_SrcCap_Fixed_getMaxCurrent_10mA(caps);
-
-				DBG("%d fixed  %d mV max %d mA\n", i, 50 * v, 10 * c );
+			break;
 
-				p = v * c;
-				if ( (50 * v <= PD_REQUEST_MAX_MILLIVOLT) && p > bestPower )
-				{
-					PD.Power.BestCapIndex = i + 1; // Note: it's count starting by 1
-//					PD.Power.Requested.Value = PD.Power.SourceCapabilities[i].Value;
+		default:
+			break;
+	}
 
-//					bestVolt = v;
-//					bestCur = c;
-					bestPower = p;
-				}
+	return PD_State_Idle;
+}
 
-				break;
-			}
-			case PDO_SrcCap_SupplyType_Variable:
-			{
-				DBG("%d variable  %d mV - %d mV  max %d mA\n", i,
-						50 * PDO_SrcCap_Variable_getMinVoltage_50mV(caps),
-						50 * PDO_SrcCap_Variable_getMaxVoltage_50mV(caps),
-						10 * PDO_SrcCap_Variable_getMaxCurrent_10mA(caps) );
-				break;
-			}
-//			case PD_SupplyType_Reserved:
-//			{
-//				// ignore
-//				break;
-//			}
-		}
+static void pd_encodeChunk( CCHandshake_Port_t * port, uint8_t type, uint16_t extHeader, const uint8_t * data, uint8_t len )
+{
+	uint16_t header = PD_HeaderWord_Extended_MASK | PD_HeaderWord_make( PD_ExtendedChunk_getNumberOfDataObjects( len ), pd_nextTxMessageId( port ),
+			PD_HeaderWord_PowerRole_Sink, port->PD.SpecRev, PD_HeaderWord_DataRole_Sink, type );
 
+	pd_encodeFrame( port, PD_Wire_encodeChunk( &port->PD.Tx.Frame[PD_TX_FRAME_HEAD_SIZE], header, extHeader, data, len ) );
+}
 
-	}
+/**
+ * Chunk <chunk> of Ext.Tx, the source is to request the next one (if any) within tChunkSenderRequest
+ */
+static void pd_sendChunk( CCHandshake_Port_t * port, uint8_t chunk )
+{
+	uint16_t offset = chunk * PD_EXTENDED_CHUNK_SIZE;
+	uint16_t len = port->PD.Ext.Tx.Size - offset;
 
-	// abort if we did not get a valid capability
-	if (PD.Power.BestCapIndex == 0)
+	if (len > PD_EXTENDED_CHUNK_SIZE)
 	{
-		return PD_State_Idle;
+		len = PD_EXTENDED_CHUNK_SIZE;
 	}
 
+	pd_encodeChunk( port, port->PD.Ext.Tx.Type, PD_ExtHeader_makeChunk( chunk, port->PD.Ext.Tx.Size ), &port->PD.Ext.Tx.Data[offset], len );
+	pd_sendMessage( port, NULL );
 
-	pd_createRequest( &PD.Tx.Message );
-
-//	DelayMs(1000);
-	pd_sendMessage( &PD.Tx.Message, NULL );
+	if (offset + len < port->PD.Ext.Tx.Size)
+	{
+		port->PD.Ext.Tx.NextChunk = chunk + 1;
+		pd_timerStart( port, PD_Timer_Chunk, PD_T_CHUNK );
+	}
+	else
+	{
+		// the frame is encoded, the data is not needed anymore
+		port->PD.Ext.Tx.Data = NULL;
+		pd_timerStop( port, PD_Timer_Chunk );
+	}
+}
 
-	PD.Tx.SendAttempts = 0;
+static void pd_abortChunking( CCHandshake_Port_t * port )
+{
+	pd_timerStop( port, PD_Timer_Chunk );
 
-//	return PD_State_AwaitGoodCRC;
+	port->PD.Ext.Get = 0;
+	port->PD.Ext.Tx.Data = NULL;
+	port->PD.Ext.Tx.Pending = false;
 
-	return PD_State_Idle;
+	if (port->PD.Ext.Rx.Complete == false)
+	{
+		port->PD.Ext.Rx.Type = 0;
+	}
 }
 
-static void pd_createRequest( PD_Message_t * message )
+/**
+ * Starts what the application asked for, one message per call and not while a chunked message is under way
+ */
+static void pd_extendedCore( CCHandshake_Port_t * port )
 {
-
-	// abort if we did not get a valid capability
-	if (PD.Power.BestCapIndex == 0)
+	if (port->PD.Timers.Running & (1 << PD_Timer_Chunk))
 	{
 		return;
 	}
 
-
-	uint32_t caps;
-	uint32_t bestPower = 0;
-	uint32_t v,p,c;
-
-	// make request
-
-	PD_DataObject_t request = { .Value = 0 };
-
-	caps = PD.Power.SourceCapabilities[ PD.Power.BestCapIndex - 1 ].Value;
-
-	switch( caps & PDO_SrcCap_SupplyType_MASK )
+	if (port->PD.Ext.Get != 0)
 	{
-		case PDO_SrcCap_SupplyType_Fixed:
-		{
-
-			v = PDO_SrcCap_Fixed_getVoltage_50mV(caps);
-			c = PDO_SrcCap_Fixed_getMaxCurrent_10mA(caps);
-
-			if ( 10 * c > PD_REQUEST_MAX_MILLIAMP )
-			{
-				c = PD_REQUEST_MAX_MILLIAMP / 10;
-			}
-
-			request.Value = PDO_Req_Fixed_NoUSBSuspend;
-			request.Value |= PDO_Req_Fixed_setObjectPosBits( PD.Power.BestCapIndex );
-			request.Value |= PDO_Req_Fixed_setOperatingCurrent_10mABits( c );
-			request.Value |= PDO_Req_Fixed_setMaxOpCur_10mABits( c );
-			break;
-		}
+		pd_encodeMessage( port, 0, port->PD.Ext.Get, NULL );
+		pd_sendMessage( port, NULL );
+		port->PD.Ext.Get = 0;
+	}
+	else if (port->PD.Ext.Tx.Pending)
+	{
+		port->PD.Ext.Tx.Pending = false;
+		pd_sendChunk( port, 0 );
 	}
-
-
-	PD_newMessage( message, 1, pd_nextTxMessageId(), PD_HeaderWord_PowerRole_Sink, PD_HeaderWord_SpecRev_2_0, PD_HeaderWord_DataRole_Sink, PD_DataCommand_Request, &request );
 }
 
+#endif /* CCHANDSHAKE_PD_REV3 */
+
 #endif
@@ -25,14 +25,93 @@
 #endif
 
 #include "FUSB302-D_Driver.h"
+#include "PD.h"
 
-#if !defined(CCHANDSHAKE_REQUIRE_BC_LVL) && defined(__FUSB302_D_DRIVER_H_)
-#define CCHANDSHAKE_REQUIRE_BC_LVL FUSB302_D_Status0_BC_LVL_200mV_to_660mV
+// cc level below which the source counts as detached (comparator threshold, MDAC steps of 42mV)
+#if !defined(CCHANDSHAKE_DETACH_CC_MV)
+#define CCHANDSHAKE_DETACH_CC_MV 200
 #endif
 
 #define ONSEMI_LIBRARY false
 #define CCHANDSHAKE_AUTONOMOUS false
 
+// Use the INT_N pin: only the events needed by the sink are unmasked and CCHandshake_core()
+// only reads the status registers if CCHandshake_onInterrupt() was called in the meantime.
+#if !defined(CCHANDSHAKE_USE_INTERRUPT)
+#define CCHANDSHAKE_USE_INTERRUPT false
+#endif
+
+// upper limits of the requested power contract (previously expected from the platform headers), defaults of the sink profile
+#if !defined(PD_REQUEST_MAX_MILLIVOLT)
+#define PD_REQUEST_MAX_MILLIVOLT 5000
+#endif
+#if !defined(PD_REQUEST_MAX_MILLIAMP)
+#define PD_REQUEST_MAX_MILLIAMP 1500
+#endif
+
+// Let the FUSB302 look for a source by itself (sink polling): no bus traffic while unattached, the orientation
+// is taken from Status1a TOGSS once I_TOGDONE is raised.
+#if !defined(CCHANDSHAKE_USE_TOGGLE)
+#define CCHANDSHAKE_USE_TOGGLE false
+#endif
+
+// While detached only keep bandgap/wake powered and wait for I_WAKE (WAKE_EN), the measurement block and
+// the oscillator / receiver are only powered up for detection and PD respectively.
+#if !defined(CCHANDSHAKE_LOW_POWER)
+#define CCHANDSHAKE_LOW_POWER false
+#endif
+
+// how long to look for an attach after I_WAKE before powering down again
+#if !defined(CCHANDSHAKE_WAKE_TIMEOUT_MS)
+#define CCHANDSHAKE_WAKE_TIMEOUT_MS 1000
+#endif
+
+// Talk PD 3.0 to sources that do (spec revision of their capabilities), needed for programmable supplies (PPS)
+#if !defined(CCHANDSHAKE_PD_REV3)
+#define CCHANDSHAKE_PD_REV3 false
+#endif
+
+// largest extended message kept (PD 3.0, up to PD_EXTENDED_MAX_DATA_SIZE), larger ones are dropped
+#if !defined(CCHANDSHAKE_EXTENDED_MAX_SIZE)
+#define CCHANDSHAKE_EXTENDED_MAX_SIZE PD_EXTENDED_MAX_DATA_SIZE
+#endif
+
+// messages read from the rx fifo in one go (the 80 byte fifo holds up to 11 control messages, 2 with 7 data objects)
+#if !defined(CCHANDSHAKE_RX_RING_SIZE)
+#define CCHANDSHAKE_RX_RING_SIZE 4
+#endif
+
+// messages the sink ignores are dropped after their header: by flushing the rx fifo instead of reading their data
+// objects, but only with an explicit contract and nothing due from the source (whatever is queued behind is lost too)
+#if !defined(CCHANDSHAKE_RX_FLUSH_IGNORED)
+#define CCHANDSHAKE_RX_FLUSH_IGNORED false
+#endif
+
+// INT_N edges queued by CCHandshake_onInterrupt() until CCHandshake_core() gets to them, power of two (up to 128)
+#if !defined(CCHANDSHAKE_EVENT_RING_SIZE)
+#define CCHANDSHAKE_EVENT_RING_SIZE 8
+#endif
+#if (CCHANDSHAKE_EVENT_RING_SIZE & (CCHANDSHAKE_EVENT_RING_SIZE - 1)) != 0 || CCHANDSHAKE_EVENT_RING_SIZE > 128
+#error CCHANDSHAKE_EVENT_RING_SIZE must be a power of two up to 128
+#endif
+
+// time a cc pin is measured before its level is evaluated (tCCDebounce, 100..200ms)
+#if !defined(CCHANDSHAKE_CC_DEBOUNCE_MS)
+#define CCHANDSHAKE_CC_DEBOUNCE_MS 100
+#endif
+
+// measure how much of the time between CCHandshake_service() calls the stack had nothing due (CCHandshake_getSleepStats())
+#if !defined(CCHANDSHAKE_SLEEP_STATS)
+#define CCHANDSHAKE_SLEEP_STATS false
+#endif
+
+// CCHandshake_service() result: why (and when) CCHandshake_core() has to run next, 0 = only on INT_N
+#define CCHANDSHAKE_NEXT_BUSY		(1UL << 0)	// right away: PD exchange in progress, queued INT_N edge, ..
+#define CCHANDSHAKE_NEXT_DEBOUNCE	(1UL << 1)	// cc measurement evaluated at <next>
+#define CCHANDSHAKE_NEXT_TIMER		(1UL << 2)	// PD timer (or the wake timeout) expires at <next>
+#define CCHANDSHAKE_NEXT_PPS		(1UL << 3)	// PPS contract to be requested again at <next>
+#define CCHANDSHAKE_NEXT_POLL		(1UL << 4)	// without CCHANDSHAKE_USE_INTERRUPT events are only seen by polling
+
 
 
 typedef enum {
@@ -47,21 +126,378 @@ typedef enum {
 } CCHandshake_PD_Role_t;
 
 
+typedef enum {
+	PD_State_Disabled,
+	PD_State_HardReset,
+	PD_State_Reset,
+	PD_State_Idle,
+	PD_State_Rx,
+	PD_State_AwaitGoodCRC,
+	PD_State_Resend,
+} PD_State_t;
+
+// PD protocol timers of the sink
+typedef enum {
+	PD_Timer_SinkWaitCap,			// until Source_Capabilities (after attach, vbus on or a hard reset)
+	PD_Timer_SenderResponse,		// Request sent until Accept / Reject / Wait
+	PD_Timer_PSTransition,			// Accept until PS_RDY
+	PD_Timer_HardResetComplete,		// hard reset requested until sent
+	PD_Timer_PPSRequest,			// PPS contract until it is requested again (within tPPSRequest)
+	PD_Timer_Chunk,					// chunk (request) sent until the next chunk request / chunk (tChunkSenderRequest / Response)
+	PD_Timer_Count,
+	PD_Timer_None = PD_Timer_Count
+} PD_Timer_t;
+
+// sink policy engine
+typedef enum {
+	PE_State_Disabled,				// detached, or PD given up (implicit contract only)
+	PE_State_WaitForCapabilities,	// until Source_Capabilities
+	PE_State_EvaluateCapability,	// choosing one of the offers
+	PE_State_SelectCapability,		// Request sent, until Accept / Reject / Wait
+	PE_State_TransitionSink,		// Accept (or GotoMin) until PS_RDY
+	PE_State_Ready,					// explicit contract
+	PE_State_HardReset,				// hard reset sent or received, until vbus is back
+	PE_State_SoftReset,				// Soft_Reset sent, until Accept
+	PE_State_Count
+} PE_State_t;
+
+typedef enum {
+	CCHandshake_Power_Standby,	// bandgap and wake only (CCHANDSHAKE_LOW_POWER, detached)
+	CCHandshake_Power_Detect,	// + measurement block, cc detection
+	CCHandshake_Power_Active,	// everything, attached / PD
+	CCHandshake_Power_Count
+} CCHandshake_Power_t;
+
+// fifo frames around a message (wire format): rx token .. crc, tx sop tokens, packsym .. crc, eop, txoff, txon
+#define CCHANDSHAKE_RX_FRAME_SIZE	(1 + PD_WIRE_MAX_SIZE + 4)
+#define CCHANDSHAKE_TX_FRAME_SIZE	(5 + PD_WIRE_MAX_SIZE + 4)
+
+typedef struct {
+	uint32_t Messages;			// read from the rx fifo
+	uint32_t Dropped;			// ignored ones, not queued (see CCHANDSHAKE_RX_FLUSH_IGNORED)
+	uint32_t BytesFlushed;		// of dropped messages, not read thanks to an rx flush
+	uint16_t FifoFull;			// core calls that found RX_FULL set
+	uint16_t FifoHighWater;		// most bytes (of queued messages) drained from the fifo at once
+	uint16_t RingHighWater;		// most messages drained at once
+} CCHandshake_RxStats_t;
+
+typedef struct {
+	uint32_t Events;			// INT_N edges taken from the ring
+	uint16_t Overruns;			// edges while the ring was full (nothing lost, the FUSB302 keeps the bits latched)
+	uint16_t RingHighWater;		// most edges taken at once
+	uint32_t MaxLatencyMs;		// longest from an edge until its status was read
+} CCHandshake_EventStats_t;
+
+typedef struct {
+	uint32_t TotalMs;			// since the first CCHandshake_service()
+	uint32_t SleepMs;			// of which nothing was due (no exchange in progress, before the next deadline)
+	uint32_t Calls;
+} CCHandshake_SleepStats_t;
+
+/**
+ * What the sink can take, see CCHandshake_setSinkProfile(). Every offer (fixed, variable or battery) is scored by
+ * the power it can deliver within these limits, offers outside the voltage window or below the minimum current
+ * are never requested.
+ */
+typedef struct {
+	uint16_t MinMillivolt;
+	uint16_t MaxMillivolt;			// the whole range of a variable / battery supply has to fit
+	uint16_t MinMilliamp;			// needed at least (at the highest voltage of the offer)
+	uint16_t MaxMilliamp;			// requested at most
+	uint16_t PreferredMillivolt;	// 0 = none
+	uint8_t EfficiencyWeight;		// % of the score lost per volt away from PreferredMillivolt (conversion losses)
+	uint16_t PPSMillivolt;			// target of a programmable supply (wins over all other offers), 0 = none
+	uint16_t PPSMilliamp;			// operating current with PPSMillivolt
+} CCHandshake_SinkProfile_t;
+
+typedef enum {
+	CCHandshake_Notify_Attach,				// Orientation
+	CCHandshake_Notify_SourceCapabilities,	// NSourceCapabilities (stored, the request follows)
+	CCHandshake_Notify_ContractAccepted,	// Millivolt / Milliamp requested, the source is about to switch
+	CCHandshake_Notify_PSReady,				// Millivolt / Milliamp in place (explicit contract)
+	CCHandshake_Notify_ContractLost,
+	CCHandshake_Notify_HardReset,			// FromSource or sent by the sink
+	CCHandshake_Notify_Detach
+} CCHandshake_Notify_t;
+
+typedef struct {
+	CCHandshake_Notify_t Type;
+	uint32_t Ts;					// FUSB302_D_GetTime() of the triggering event (the INT_N edge with CCHANDSHAKE_USE_INTERRUPT)
+	CCHandshake_CC_t Orientation;
+	uint8_t NSourceCapabilities;
+	uint16_t Millivolt;				// variable / battery supplies: the lowest voltage of the offer
+	uint16_t Milliamp;
+	bool FromSource;
+} CCHandshake_Notification_t;
+
+typedef struct CCHandshake_Port_s CCHandshake_Port_t;
+
+/**
+ * Called from CCHandshake_core() (never from an interrupt), must not call CCHandshake_core() itself.
+ */
+typedef void (*CCHandshake_NotifyCallback_t)( CCHandshake_Port_t * port, const CCHandshake_Notification_t * notification, void * ctx );
+
+/**
+ * All state of one FUSB302 / USB-C port, allocated by the application and passed to every CCHandshake_*() call.
+ */
+struct CCHandshake_Port_s {
+	FUSB302_D_t Driver;
+	FUSB302_D_Registers_st Registers;
+
+	volatile CCHandshake_CC_t ConnectedCC;
+
+	CCHandshake_NotifyCallback_t OnNotify;
+	void * NotifyCtx;
+
+	CCHandshake_SinkProfile_t Profile;
+	bool ExpectVbusLoss;	// hard reset in progress, vbus drops and comes back
+
+	struct {
+		CCHandshake_Power_t Current;
+		uint32_t EnteredTs;
+		uint32_t TimeMs[CCHandshake_Power_Count];	// up to EnteredTs
+	} PowerState;
+
+	// unattached (without CCHANDSHAKE_USE_TOGGLE): cc pin currently measured (if any) and since when
+	struct {
+		CCHandshake_CC_t Measuring;
+		uint32_t StartTs;
+	} Detect;
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	// single producer (CCHandshake_onInterrupt) / single consumer (CCHandshake_core) ring, no locking needed
+	struct {
+		volatile uint32_t Ts[CCHANDSHAKE_EVENT_RING_SIZE];	// FUSB302_D_GetTime() of the edge
+		volatile uint8_t Head;			// free running, written by the interrupt only
+		volatile uint8_t Tail;			// free running, written by the core only
+		volatile uint16_t Overruns;		// written by the interrupt only
+		uint32_t EdgeTs;				// first edge of the status read being handled
+		bool HasEdge;					// false: core call without a status read (timers)
+		CCHandshake_EventStats_t Stats;
+	} Events;
+#endif
+
+#if CCHANDSHAKE_SLEEP_STATS==true
+	// the last CCHandshake_service() result
+	struct {
+		uint32_t StartTs;				// of the first call
+		uint32_t Ts;
+		uint32_t Events;
+		uint32_t Next;
+		CCHandshake_SleepStats_t Stats;
+	} Sleep;
+#endif
+
+	struct {
+		volatile PD_State_t State;
+		uint16_t SpecRev;		// of our messages, PD_HeaderWord_SpecRev_*
+		struct {
+			uint8_t MessageId;
+			uint8_t Frame[CCHANDSHAKE_RX_RING_SIZE][CCHANDSHAKE_RX_FRAME_SIZE];	// as read from the fifo
+			uint8_t Head;								// next one to dispatch
+			uint8_t Count;
+			PD_MessageView_t Message;					// into Frame[], the one dispatched
+			bool HasData;
+			CCHandshake_RxStats_t Stats;
+		} Rx;
+		struct {
+			uint8_t MessageId;
+			uint8_t Frame[CCHANDSHAKE_TX_FRAME_SIZE];	// as written to the fifo
+			uint8_t FrameLen;
+			PD_State_t (*OnAcknowledged)( CCHandshake_Port_t * port, const PD_MessageView_t * message );
+			uint32_t SentTs;
+			uint8_t SendAttempts;
+			bool OnWire;				// written to the fifo, neither sent (I_TXSENT) nor given up (I_RETRYFAIL) yet
+		} Tx;
+		struct {
+			uint8_t NSourceCapabilities;
+			PD_DataObject_t SourceCapabilities[PD_MESSAGE_MAX_OBJECTS];
+
+			uint8_t BestCapIndex;
+			PD_DataObject_t Request;		// last one sent
+			PD_DataObject_t Contract;		// accepted and in place (HasContract)
+			volatile bool Reselect;			// profile changed, request again
+		} Power;
+		struct {
+			uint32_t Deadline[PD_Timer_Count];	// FUSB302_D_GetTime() ms
+			uint8_t Running;					// bit per PD_Timer_t
+		} Timers;
+#if CCHANDSHAKE_PD_REV3==true
+		struct {
+			struct {
+				uint8_t Type;				// PD_ExtendedCommand_t, 0 = none
+				uint16_t Size;				// data size of the message
+				uint16_t Received;
+				uint8_t NextChunk;
+				bool Complete;
+				uint8_t Data[CCHANDSHAKE_EXTENDED_MAX_SIZE];
+			} Rx;
+			struct {
+				uint8_t Type;
+				uint16_t Size;
+				const uint8_t * Data;		// the application's, NULL = nothing to send
+				uint8_t NextChunk;			// the one the source is to request
+				volatile bool Pending;		// not started yet
+			} Tx;
+			volatile uint8_t Get;			// PD_ControlCommand_t to send, 0 = none
+		} Ext;
+#endif
+		uint8_t HardResetCount;
+		struct {
+			PE_State_t State;
+			bool HasContract;
+			uint32_t EnteredTs;
+			uint32_t AttachTs;
+			uint32_t ContractMs;				// attach until the first PS_RDY, 0 = none yet
+			uint32_t TimeMs[PE_State_Count];	// since attach, up to EnteredTs
+		} PE;
+	} PD;
+};
+
+/**
+ * Services a set of ports from one loop: every run handles each port once (round robin), so cost per run is linear
+ * in the number of ports.
+ */
+typedef struct {
+	CCHandshake_Port_t ** Ports;
+	uint8_t NPorts;
+	uint8_t Next;		// first port of the next (partial) run
+} CCHandshake_Scheduler_t;
+
+/**
+ * <transport>, <bus> and <i2cAddr> select the bus backend and device (see FUSB302_D_Init()), eg FUSB302_D_Transport_STM32
+ * and FUSB302_D_DEFAULT_ADDRESS. Every port takes one of the FUSB302_D_MAX_INSTANCES driver slots.
+ * returns false if the FUSB302 could not be found or configured
+ */
+bool CCHandshake_init( CCHandshake_Port_t * port, const FUSB302_D_Transport_t * transport, void * bus, uint16_t i2cAddr );
+void CCHandshake_deinit( CCHandshake_Port_t * port );
+
+CCHandshake_CC_t CCHandshake_getOrientation( CCHandshake_Port_t * port );
+
 #if ONSEMI_LIBRARY==false
+/**
+ * <callback> (NULL for none) is told about attach, offers, contract changes, hard resets and detach, set after
+ * CCHandshake_init().
+ */
+void CCHandshake_setNotifyCallback( CCHandshake_Port_t * port, CCHandshake_NotifyCallback_t callback, void * ctx );
+#endif
+
+void CCHandshake_core( CCHandshake_Port_t * port );
+
+#if ONSEMI_LIBRARY==false
+// status registers Interrupta, Interruptb, Status0, Status1, Interrupt (one auto-increment read)
+#define CCHANDSHAKE_STATUS_LEN		5
+
+/**
+ * Runs the port on a status read elsewhere (eg batched over several ports, see CCHandshake_Hub.h),
+ * <status> NULL keeps the last status without any events.
+ */
+void CCHandshake_dispatch( CCHandshake_Port_t * port, const uint8_t * status );
+
+// attached and nothing to do until the next event (or deadline)
+bool CCHandshake_isIdle( CCHandshake_Port_t * port );
+
+/**
+ * Earliest running PD timer (FUSB302_D_GetTime() ms) in <deadline>, false (and 0) if none is running.
+ * An idle port needs no CCHandshake_core() call before then (unless there is an interrupt).
+ */
+bool CCHandshake_getNextDeadline( CCHandshake_Port_t * port, uint32_t * deadline );
+
+/**
+ * What the port waits for (CCHANDSHAKE_NEXT_*), with a deadline (DEBOUNCE, TIMER, PPS) the earliest time
+ * (FUSB302_D_GetTime() ms) it needs CCHandshake_core() again in <next>. BUSY: call again right away.
+ * 0: nothing until INT_N, the MCU may enter stop mode.
+ */
+uint32_t CCHandshake_getNextService( CCHandshake_Port_t * port, uint32_t * next );
+
+// CCHandshake_core() and CCHandshake_getNextService()
+uint32_t CCHandshake_service( CCHandshake_Port_t * port, uint32_t * next );
 
-#endif /* ONSEMILIBRARY == false */
+/**
+ * Changes what the sink requests: applies to the next Source_Capabilities, or, with a contract in place, right away
+ * with a new request on the stored offers (on the next CCHandshake_core()).
+ */
+void CCHandshake_setSinkProfile( CCHandshake_Port_t * port, const CCHandshake_SinkProfile_t * profile );
+
+/**
+ * Sets the PPS target of the sink profile, eg to follow the charge of a battery: requested right away if there is
+ * a contract, kept alive by requesting it again periodically.
+ * <millivolt> 0 turns PPS off.
+ */
+void CCHandshake_setPPS( CCHandshake_Port_t * port, uint16_t millivolt, uint16_t milliamp );
+
+PE_State_t CCHandshake_getPolicyState( CCHandshake_Port_t * port );
+
+// explicit contract in place (the last request was accepted and the source is ready)
+bool CCHandshake_hasContract( CCHandshake_Port_t * port );
+
+// ms from attach until the first explicit contract, 0 if there is none yet
+uint32_t CCHandshake_getContractTime( CCHandshake_Port_t * port );
+
+// ms spent in each policy engine state since the last attach
+void CCHandshake_getPolicyStats( CCHandshake_Port_t * port, uint32_t timeMs[PE_State_Count] );
+
+#if CCHANDSHAKE_PD_REV3==true
+/**
+ * Asks the source for an extended message with <command>: PD_ControlCommand_GetSourceCapExtended, _GetStatus,
+ * _GetPPSStatus or _GetCountryCodes. Sent on the next CCHandshake_core() with a PD 3.0 contract in place,
+ * the answer is available from CCHandshake_getExtendedMessage().
+ */
+bool CCHandshake_requestExtended( CCHandshake_Port_t * port, PD_ControlCommand_t command );
+
+/**
+ * Sends extended message <type> with <size> bytes of <data>, chunked if need be. <data> must stay valid until sent.
+ * false if PD 3.0 is not in use or a message is pending still.
+ */
+bool CCHandshake_sendExtended( CCHandshake_Port_t * port, PD_ExtendedCommand_t type, const uint8_t * data, uint16_t size );
+
+/**
+ * The last extended message received completely, NULL if none. Valid until the next one arrives.
+ */
+const uint8_t * CCHandshake_getExtendedMessage( CCHandshake_Port_t * port, PD_ExtendedCommand_t * type, uint16_t * size );
+#endif
+#endif
 
-void CCHandshake_init( void );
-void CCHandshake_deinit( void );
+void CCHandshake_Scheduler_init( CCHandshake_Scheduler_t * sched, CCHandshake_Port_t ** ports, uint8_t nports );
 
-CCHandshake_CC_t CCHandshake_getOrientation( void );
+// CCHandshake_core() on every port once
+void CCHandshake_Scheduler_run( CCHandshake_Scheduler_t * sched );
 
-void CCHandshake_core( void );
+// CCHandshake_core() on at most <budget> ports, continuing where the last call stopped
+void CCHandshake_Scheduler_runSlice( CCHandshake_Scheduler_t * sched, uint8_t budget );
 
 #if ONSEMI_LIBRARY==true
 bool CCHandshake_hasInterrupt( void );
 #else
 
+#if CCHANDSHAKE_USE_INTERRUPT==true
+// to be called from the INT_N (falling edge) EXTI handler of the port: timestamps the edge and queues it
+void CCHandshake_onInterrupt( CCHandshake_Port_t * port );
+bool CCHandshake_hasInterrupt( CCHandshake_Port_t * port );
+
+// once the status registers were read: releases the queued edges up to <head> (Events.Head before the read)
+void CCHandshake_takeEvents( CCHandshake_Port_t * port, uint8_t head );
+
+void CCHandshake_getEventStats( CCHandshake_Port_t * port, CCHandshake_EventStats_t * stats );
+#endif
+
+/**
+ * Time spent in each power state since init (ms), eg to estimate the standby current with CCHANDSHAKE_LOW_POWER
+ */
+void CCHandshake_getPowerStats( CCHandshake_Port_t * port, uint32_t timeMs[CCHandshake_Power_Count] );
+
+// rx fifo / ring usage since init, eg to size CCHANDSHAKE_RX_RING_SIZE
+void CCHandshake_getRxStats( CCHandshake_Port_t * port, CCHandshake_RxStats_t * stats );
+
+#if CCHANDSHAKE_SLEEP_STATS==true
+// SleepMs / TotalMs is the fraction of time the MCU could have slept (ms resolution)
+void CCHandshake_getSleepStats( CCHandshake_Port_t * port, CCHandshake_SleepStats_t * stats );
+#endif
+
+#if FUSB302_D_STATS==true
+void CCHandshake_getBusStats( CCHandshake_Port_t * port, FUSB302_D_Stats_t * stats );
+#endif
+
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,248 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#include "CCHandshake_Hub.h"
+
+#if ONSEMI_LIBRARY==false
+
+#ifndef DBG
+#define DBG(format, ...)
+#endif
+
+#define HUB_BIT( __i__ )	( 1UL << (__i__) )
+
+static void Hub_StatusDone( FUSB302_D_t * fusb, FUSB302_D_Error_t result, void * ctx );
+
+
+void CCHandshake_Hub_init( CCHandshake_Hub_t * hub, CCHandshake_Port_t ** ports, uint8_t nports )
+{
+	if (nports > CCHANDSHAKE_HUB_MAX_PORTS)
+	{
+		DBG("too many ports\n");
+		nports = CCHANDSHAKE_HUB_MAX_PORTS;
+	}
+
+	hub->Ports = ports;
+	hub->NPorts = nports;
+
+	hub->Requested = 0;
+	hub->Rejected = 0;
+	hub->Completed = 0;
+	hub->Failed = 0;
+	hub->Pending = 0;
+	hub->Timed = 0;
+
+	// every port starts unattached
+	hub->Busy = nports < 32 ? HUB_BIT(nports) - 1 : 0xFFFFFFFF;
+
+	hub->Polls = 0;
+	hub->Dispatches = 0;
+}
+
+void CCHandshake_Hub_startPoll( CCHandshake_Hub_t * hub )
+{
+	uint32_t requested = 0;
+
+	for (uint8_t i = 0; i < hub->NPorts; i++)
+	{
+#if CCHANDSHAKE_USE_INTERRUPT==true
+		CCHandshake_Port_t * port = hub->Ports[i];
+
+		uint8_t head = port->Events.Head;
+
+		if (head == port->Events.Tail)
+		{
+			continue;
+		}
+
+		// edges during the read stay queued
+		hub->EventHead[i] = head;
+#endif
+		requested |= HUB_BIT(i);
+	}
+
+	// no transfers outstanding, so nothing else touches these
+	hub->Requested = requested;
+	hub->Rejected = 0;
+	hub->Completed = 0;
+	hub->Failed = 0;
+
+	hub->Polls++;
+
+	// all reads are queued before the first completes (if the transport works asynchronously)
+	for (uint8_t i = 0; i < hub->NPorts; i++)
+	{
+		if ((requested & HUB_BIT(i)) == 0)
+		{
+			continue;
+		}
+
+		if (FUSB302_D_ReadAsync( &hub->Ports[i]->Driver, FUSB302_D_Register_Interrupta, &hub->Status[i][0], CCHANDSHAKE_STATUS_LEN, Hub_StatusDone, hub ) == FUSB302_D_ERROR)
+		{
+			hub->Rejected |= HUB_BIT(i);
+		}
+	}
+}
+
+bool CCHandshake_Hub_isPolling( CCHandshake_Hub_t * hub )
+{
+	return (hub->Completed | hub->Rejected) != hub->Requested;
+}
+
+void CCHandshake_Hub_dispatch( CCHandshake_Hub_t * hub )
+{
+	uint32_t valid = hub->Requested & ~(hub->Rejected | hub->Failed);
+	uint32_t pending = 0;
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	// the edges of failed reads stay queued for the next time
+	for (uint8_t i = 0; i < hub->NPorts; i++)
+	{
+		if (valid & HUB_BIT(i))
+		{
+			CCHandshake_takeEvents( hub->Ports[i], hub->EventHead[i] );
+		}
+	}
+#endif
+
+	// any interrupt register set?
+	for (uint8_t i = 0; i < hub->NPorts; i++)
+	{
+		uint8_t * status = &hub->Status[i][0];
+
+		if (status[0] | status[1] | status[4])
+		{
+			pending |= HUB_BIT(i);
+		}
+	}
+
+	hub->Pending = pending & valid;
+
+	uint32_t run = hub->Pending | (hub->Busy & ~(hub->Requested & ~valid));
+
+	// PD timeouts, new sink profiles
+	for (uint8_t i = 0; i < hub->NPorts; i++)
+	{
+		if ((hub->Timed & HUB_BIT(i)) && (int32_t)(FUSB302_D_GetTime( &hub->Ports[i]->Driver ) - hub->Deadline[i]) >= 0)
+		{
+			run |= HUB_BIT(i);
+		}
+		if (hub->Ports[i]->PD.Power.Reselect)
+		{
+			run |= HUB_BIT(i);
+		}
+	}
+
+	for (uint8_t i = 0; run != 0; i++, run >>= 1)
+	{
+		if ((run & 1) == 0)
+		{
+			continue;
+		}
+
+		CCHandshake_Port_t * port = hub->Ports[i];
+
+		CCHandshake_dispatch( port, (valid & HUB_BIT(i)) ? &hub->Status[i][0] : NULL );
+
+		hub->Dispatches++;
+
+		if (CCHandshake_isIdle( port ))
+		{
+			hub->Busy &= ~HUB_BIT(i);
+		}
+		else
+		{
+			hub->Busy |= HUB_BIT(i);
+		}
+
+		if (CCHandshake_getNextDeadline( port, &hub->Deadline[i] ))
+		{
+			hub->Timed |= HUB_BIT(i);
+		}
+		else
+		{
+			hub->Timed &= ~HUB_BIT(i);
+		}
+	}
+}
+
+void CCHandshake_Hub_abortPoll( CCHandshake_Hub_t * hub )
+{
+	for (uint8_t i = 0; i < hub->NPorts; i++)
+	{
+		if ((hub->Requested & ~(hub->Completed | hub->Rejected)) & HUB_BIT(i))
+		{
+			// completes the read as failed (and whatever else is queued for the port)
+			FUSB302_D_Abort( &hub->Ports[i]->Driver );
+		}
+	}
+}
+
+bool CCHandshake_Hub_run( CCHandshake_Hub_t * hub )
+{
+	bool ok = true;
+
+	CCHandshake_Hub_startPoll( hub );
+
+	if (CCHandshake_Hub_isPolling( hub ))
+	{
+		FUSB302_D_t * clock = &hub->Ports[0]->Driver;
+		uint32_t start = FUSB302_D_GetTime( clock );
+
+		while (CCHandshake_Hub_isPolling( hub ))
+		{
+			// a lost completion must not stop all ports
+			if (FUSB302_D_GetTime( clock ) - start >= FUSB302_D_TIMEOUT_MS)
+			{
+				DBG("hub poll timeout\n");
+				CCHandshake_Hub_abortPoll( hub );
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	// the failed reads are taken as such, the other ports go on
+	CCHandshake_Hub_dispatch( hub );
+
+	return ok;
+}
+
+/**
+ * NOTE: called from the I2C interrupt context
+ */
+static void Hub_StatusDone( FUSB302_D_t * fusb, FUSB302_D_Error_t result, void * ctx )
+{
+	CCHandshake_Hub_t * hub = (CCHandshake_Hub_t*)ctx;
+
+	for (uint8_t i = 0; i < hub->NPorts; i++)
+	{
+		if (&hub->Ports[i]->Driver == fusb)
+		{
+			if (result != FUSB302_D_OK)
+			{
+				hub->Failed |= HUB_BIT(i);
+			}
+			hub->Completed |= HUB_BIT(i);
+			return;
+		}
+	}
+}
+
+#endif /* ONSEMI_LIBRARY==false */
@@ -0,0 +1,92 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#ifndef CCHANDSHAKE_HUB_H_
+#define CCHANDSHAKE_HUB_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "CCHandshake.h"
+
+#if ONSEMI_LIBRARY==false
+
+// max number of ports per hub (one bit per port)
+#if !defined(CCHANDSHAKE_HUB_MAX_PORTS)
+#define CCHANDSHAKE_HUB_MAX_PORTS 8
+#endif
+#if FUSB302_D_MAX_INSTANCES < CCHANDSHAKE_HUB_MAX_PORTS
+#error FUSB302_D_MAX_INSTANCES must be at least CCHANDSHAKE_HUB_MAX_PORTS (a driver instance per port)
+#endif
+
+/**
+ * Many ports on one (or few) I2C buses: the status reads of all ports are queued at once and run back to back
+ * from the I2C interrupt (DMA with FUSB302_D_USE_DMA), then only ports with latched events or internal work are
+ * dispatched to the PD engine (or those with a PD timer due).
+ *
+ * Per port state is kept as arrays / bit masks indexed by port so the scan for pending work stays a short loop.
+ * Polled mode reads every port, with CCHANDSHAKE_USE_INTERRUPT only the ports whose INT_N fired.
+ */
+typedef struct {
+	CCHandshake_Port_t ** Ports;
+	uint8_t NPorts;
+
+	// targets of the batched status read
+	uint8_t Status[CCHANDSHAKE_HUB_MAX_PORTS][CCHANDSHAKE_STATUS_LEN];
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	uint8_t EventHead[CCHANDSHAKE_HUB_MAX_PORTS];	// Events.Head when the read was queued
+#endif
+
+	uint32_t Requested;				// status read queued by the current poll
+	uint32_t Rejected;				// could not be queued
+	volatile uint32_t Completed;	// set from the I2C interrupt
+	volatile uint32_t Failed;		// set from the I2C interrupt
+
+	uint32_t Pending;				// events latched in the last status
+	uint32_t Busy;					// work without events (unattached, PD exchange in progress)
+	uint32_t Timed;					// PD timer running until Deadline
+	uint32_t Deadline[CCHANDSHAKE_HUB_MAX_PORTS];
+
+	uint32_t Polls;
+	uint32_t Dispatches;
+} CCHandshake_Hub_t;
+
+void CCHandshake_Hub_init( CCHandshake_Hub_t * hub, CCHandshake_Port_t ** ports, uint8_t nports );
+
+// queues the status reads and returns right away
+void CCHandshake_Hub_startPoll( CCHandshake_Hub_t * hub );
+bool CCHandshake_Hub_isPolling( CCHandshake_Hub_t * hub );
+
+// once the poll completed: runs the ports with pending events or work
+void CCHandshake_Hub_dispatch( CCHandshake_Hub_t * hub );
+
+// fails the reads of the current poll still outstanding
+void CCHandshake_Hub_abortPoll( CCHandshake_Hub_t * hub );
+
+// poll, wait (at most FUSB302_D_TIMEOUT_MS) and dispatch, false if the poll had to be aborted
+bool CCHandshake_Hub_run( CCHandshake_Hub_t * hub );
+
+#endif /* ONSEMI_LIBRARY==false */
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* CCHANDSHAKE_HUB_H_ */
@@ -0,0 +1,52 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#ifndef CCHANDSHAKE_OS_H_
+#define CCHANDSHAKE_OS_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Wait() timeout: no deadline
+#define CCHANDSHAKE_OS_FOREVER	0xFFFFFFFF
+
+/**
+ * Operating system services (the OS backend) of CCHandshake_Task, <os> is the backend specific context given to
+ * CCHandshake_Task_init().
+ *
+ * Lock/Unlock: mutex guarding the port against other threads (not taken from interrupts).
+ * Signal: sets event flags, callable from any context including interrupts.
+ * Wait: sleeps until any event flag is set or <timeoutMs> passed (the next deadline, CCHANDSHAKE_OS_FOREVER for
+ * none), returns and clears the flags set (0 on timeout).
+ */
+typedef struct {
+	void (*Lock)( void * os );
+	void (*Unlock)( void * os );
+	void (*Signal)( void * os, uint32_t events );
+	uint32_t (*Wait)( void * os, uint32_t timeoutMs );
+} CCHandshake_OS_t;
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* CCHANDSHAKE_OS_H_ */
@@ -0,0 +1,127 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#include "CCHandshake_OS_POSIX.h"
+
+#include <errno.h>
+#include <time.h>
+
+
+static void POSIX_Lock( void * os );
+static void POSIX_Unlock( void * os );
+static void POSIX_Signal( void * os, uint32_t events );
+static uint32_t POSIX_Wait( void * os, uint32_t timeoutMs );
+
+
+const CCHandshake_OS_t CCHandshake_OS_POSIX = {
+	.Lock = POSIX_Lock,
+	.Unlock = POSIX_Unlock,
+	.Signal = POSIX_Signal,
+	.Wait = POSIX_Wait
+};
+
+
+int CCHandshake_OS_POSIX_Init( CCHandshake_OS_POSIX_t * os )
+{
+	pthread_condattr_t attr;
+	int rc;
+
+	os->Events = 0;
+
+	if ((rc = pthread_mutex_init( &os->Mutex, NULL )) != 0)
+	{
+		return rc;
+	}
+	if ((rc = pthread_mutex_init( &os->EventMutex, NULL )) != 0)
+	{
+		return rc;
+	}
+
+	// deadlines must not move with the wall clock
+	pthread_condattr_init( &attr );
+	pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+	rc = pthread_cond_init( &os->EventCond, &attr );
+	pthread_condattr_destroy( &attr );
+
+	return rc;
+}
+
+void CCHandshake_OS_POSIX_DeInit( CCHandshake_OS_POSIX_t * os )
+{
+	pthread_cond_destroy( &os->EventCond );
+	pthread_mutex_destroy( &os->EventMutex );
+	pthread_mutex_destroy( &os->Mutex );
+}
+
+static void POSIX_Lock( void * os )
+{
+	pthread_mutex_lock( &((CCHandshake_OS_POSIX_t*)os)->Mutex );
+}
+
+static void POSIX_Unlock( void * os )
+{
+	pthread_mutex_unlock( &((CCHandshake_OS_POSIX_t*)os)->Mutex );
+}
+
+static void POSIX_Signal( void * os, uint32_t events )
+{
+	CCHandshake_OS_POSIX_t * p = (CCHandshake_OS_POSIX_t*)os;
+
+	pthread_mutex_lock( &p->EventMutex );
+	p->Events |= events;
+	pthread_cond_signal( &p->EventCond );
+	pthread_mutex_unlock( &p->EventMutex );
+}
+
+static uint32_t POSIX_Wait( void * os, uint32_t timeoutMs )
+{
+	CCHandshake_OS_POSIX_t * p = (CCHandshake_OS_POSIX_t*)os;
+	struct timespec until;
+	uint32_t events;
+
+	clock_gettime( CLOCK_MONOTONIC, &until );
+	until.tv_sec += timeoutMs / 1000;
+	until.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+	if (until.tv_nsec >= 1000000000L)
+	{
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock( &p->EventMutex );
+
+	while (p->Events == 0 && timeoutMs != 0)
+	{
+		int rc = timeoutMs == CCHANDSHAKE_OS_FOREVER
+				? pthread_cond_wait( &p->EventCond, &p->EventMutex )
+				: pthread_cond_timedwait( &p->EventCond, &p->EventMutex, &until );
+
+		if (rc == ETIMEDOUT)
+		{
+			break;
+		}
+	}
+
+	events = p->Events;
+	p->Events = 0;
+
+	pthread_mutex_unlock( &p->EventMutex );
+
+	return events;
+}
@@ -0,0 +1,48 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#ifndef CCHANDSHAKE_OS_POSIX_H_
+#define CCHANDSHAKE_OS_POSIX_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "CCHandshake_OS.h"
+
+#include <pthread.h>
+
+ typedef struct {
+	 pthread_mutex_t Mutex;		// Lock / Unlock
+	 pthread_mutex_t EventMutex;
+	 pthread_cond_t EventCond;	// CLOCK_MONOTONIC
+	 uint32_t Events;
+ } CCHandshake_OS_POSIX_t;
+
+ // pthreads mutex and condition variable (monotonic timeouts), Signal() is not async-signal-safe
+ extern const CCHandshake_OS_t CCHandshake_OS_POSIX;
+
+ int CCHandshake_OS_POSIX_Init( CCHandshake_OS_POSIX_t * os );
+ void CCHandshake_OS_POSIX_DeInit( CCHandshake_OS_POSIX_t * os );
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* CCHANDSHAKE_OS_POSIX_H_ */
@@ -0,0 +1,142 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#include "CCHandshake_Task.h"
+
+#if ONSEMI_LIBRARY==false
+
+#ifndef DBG
+#define DBG(format, ...)
+#endif
+
+static uint32_t Task_getTimeout( CCHandshake_Task_t * task, uint32_t service, uint32_t next );
+
+
+void CCHandshake_Task_init( CCHandshake_Task_t * task, CCHandshake_Port_t * port, const CCHandshake_OS_t * os, void * ctx )
+{
+	task->Port = port;
+	task->OS = os;
+	task->Ctx = ctx;
+
+	task->Stats.Irq = 0;
+	task->Stats.Wake = 0;
+	task->Stats.Timeout = 0;
+	task->Stats.Runs = 0;
+}
+
+void CCHandshake_Task_run( CCHandshake_Task_t * task )
+{
+	// first run right away
+	uint32_t timeout = 0;
+
+	while (1)
+	{
+		uint32_t events = task->OS->Wait( task->Ctx, timeout );
+
+		if (events & CCHANDSHAKE_TASK_EVENT_STOP)
+		{
+			DBG("task stopped\n");
+			return;
+		}
+
+		if (events & CCHANDSHAKE_TASK_EVENT_IRQ)
+		{
+			task->Stats.Irq++;
+		}
+		if (events & CCHANDSHAKE_TASK_EVENT_WAKE)
+		{
+			task->Stats.Wake++;
+		}
+		if (events == 0)
+		{
+			task->Stats.Timeout++;
+		}
+
+		task->OS->Lock( task->Ctx );
+
+		uint32_t next;
+		uint32_t service = CCHandshake_service( task->Port, &next );
+		task->Stats.Runs++;
+
+		timeout = Task_getTimeout( task, service, next );
+
+		task->OS->Unlock( task->Ctx );
+	}
+}
+
+void CCHandshake_Task_stop( CCHandshake_Task_t * task )
+{
+	task->OS->Signal( task->Ctx, CCHANDSHAKE_TASK_EVENT_STOP );
+}
+
+void CCHandshake_Task_onInterrupt( CCHandshake_Task_t * task )
+{
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	CCHandshake_onInterrupt( task->Port );
+#endif
+
+	task->OS->Signal( task->Ctx, CCHANDSHAKE_TASK_EVENT_IRQ );
+}
+
+void CCHandshake_Task_lock( CCHandshake_Task_t * task )
+{
+	task->OS->Lock( task->Ctx );
+}
+
+void CCHandshake_Task_unlock( CCHandshake_Task_t * task )
+{
+	task->OS->Unlock( task->Ctx );
+}
+
+void CCHandshake_Task_wake( CCHandshake_Task_t * task )
+{
+	task->OS->Signal( task->Ctx, CCHANDSHAKE_TASK_EVENT_WAKE );
+}
+
+/**
+ * How long the task may sleep after a core call (with the port locked), <service> and <next> as returned by it
+ */
+static uint32_t Task_getTimeout( CCHandshake_Task_t * task, uint32_t service, uint32_t next )
+{
+	uint32_t timeout = CCHANDSHAKE_OS_FOREVER;
+
+	// an edge during the core call is signalled already, nothing to poll for
+	if (service & (CCHANDSHAKE_NEXT_BUSY | CCHANDSHAKE_NEXT_POLL))
+	{
+		timeout = CCHANDSHAKE_TASK_POLL_MS;
+	}
+
+	if (service & (CCHANDSHAKE_NEXT_DEBOUNCE | CCHANDSHAKE_NEXT_TIMER | CCHANDSHAKE_NEXT_PPS))
+	{
+		int32_t remaining = (int32_t)(next - FUSB302_D_GetTime( &task->Port->Driver ));
+
+		if (remaining <= 0)
+		{
+			return 0;
+		}
+		if ((uint32_t)remaining < timeout)
+		{
+			timeout = (uint32_t)remaining;
+		}
+	}
+
+	return timeout;
+}
+
+#endif /* ONSEMI_LIBRARY==false */
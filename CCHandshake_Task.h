@@ -0,0 +1,83 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#ifndef CCHANDSHAKE_TASK_H_
+#define CCHANDSHAKE_TASK_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "CCHandshake.h"
+#include "CCHandshake_OS.h"
+
+#if ONSEMI_LIBRARY==false
+
+// poll interval while the port is busy (or always, without CCHANDSHAKE_USE_INTERRUPT)
+#if !defined(CCHANDSHAKE_TASK_POLL_MS)
+#define CCHANDSHAKE_TASK_POLL_MS 1
+#endif
+
+// event flags of the task
+#define CCHANDSHAKE_TASK_EVENT_IRQ		(1UL << 0)	// INT_N
+#define CCHANDSHAKE_TASK_EVENT_WAKE		(1UL << 1)	// the application changed something (sink profile, PPS, ..)
+#define CCHANDSHAKE_TASK_EVENT_STOP		(1UL << 2)
+
+/**
+ * A PD task for one port: blocks until INT_N, the next PD timer deadline or a wake up by the application and only
+ * then runs CCHandshake_core(), with the port locked. Without CCHANDSHAKE_USE_INTERRUPT it polls instead.
+ *
+ * Other threads lock the port around any CCHandshake_*() call and wake the task for changes to take effect.
+ */
+typedef struct {
+	CCHandshake_Port_t * Port;
+	const CCHandshake_OS_t * OS;
+	void * Ctx;
+
+	struct {
+		uint32_t Irq;		// wake ups by INT_N
+		uint32_t Wake;		// by the application
+		uint32_t Timeout;	// deadline or poll interval
+		uint32_t Runs;		// CCHandshake_core() calls
+	} Stats;
+} CCHandshake_Task_t;
+
+void CCHandshake_Task_init( CCHandshake_Task_t * task, CCHandshake_Port_t * port, const CCHandshake_OS_t * os, void * ctx );
+
+// the body of the task (thread), returns after CCHandshake_Task_stop()
+void CCHandshake_Task_run( CCHandshake_Task_t * task );
+
+void CCHandshake_Task_stop( CCHandshake_Task_t * task );
+
+// to be called from the INT_N (falling edge) handler of the port instead of CCHandshake_onInterrupt()
+void CCHandshake_Task_onInterrupt( CCHandshake_Task_t * task );
+
+void CCHandshake_Task_lock( CCHandshake_Task_t * task );
+void CCHandshake_Task_unlock( CCHandshake_Task_t * task );
+
+// eg after CCHandshake_setSinkProfile()
+void CCHandshake_Task_wake( CCHandshake_Task_t * task );
+
+#endif /* ONSEMI_LIBRARY==false */
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* CCHANDSHAKE_TASK_H_ */
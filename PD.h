@@ -31,16 +31,18 @@
 #define PD_MESSAGE_MAX_OBJECTS 	7
 #define PD_MESSAGE_MAX_MID 		7
 
-#define PD_isValidNumberOfDataObjects(__n__) 	( 0 <= (__n__) && (__n__) <= PD_MESSAGE_MAX_OBJECTS )
-#define PD_isValidMessageId(__n__) 				( 0 <= (__n__) && (__n__) <= PD_MESSAGE_MAX_MID )
+#define PD_isValidNumberOfDataObjects(__n__) 	( (unsigned)(__n__) <= PD_MESSAGE_MAX_OBJECTS )
+#define PD_isValidMessageId(__n__) 				( (unsigned)(__n__) <= PD_MESSAGE_MAX_MID )
 
+#define PD_HeaderWord_Extended_MASK				0b1000000000000000	// PD 3.0
 #define PD_HeaderWord_NumberOfDataObjects_MASK 	0b0111000000000000
 #define PD_HeaderWord_MessageId_MASK			0b0000111000000000
 #define PD_HeaderWord_PowerRole_MASK			0b0000000100000000
 #define PD_HeaderWord_SpecRev_MASK				0b0000000011000000
 #define PD_HeaderWord_DataRole_MASK				0b0000000000100000
-#define PD_HeaderWord_CommandCode_MASK			0b0000000000001111
+#define PD_HeaderWord_CommandCode_MASK			0b0000000000011111	// bit 4 is reserved (0) before PD 3.0
 
+#define PD_HeaderWord_Extended_OFFSET				15
 #define PD_HeaderWord_NumberOfDataObjects_OFFSET	12
 #define PD_HeaderWord_MessageId_OFFSET				9
 #define PD_HeaderWord_PowerRole_OFFSET				8
@@ -52,13 +54,15 @@
 #define PD_HeaderWord_PowerRole_Sink			0b0000000000000000
 #define PD_HeaderWord_SpecRev_1_0				0b0000000000000000
 #define PD_HeaderWord_SpecRev_2_0				0b0000000001000000
+#define PD_HeaderWord_SpecRev_3_0				0b0000000010000000
 #define PD_HeaderWord_DataRole_Source			0b0000000000100000
 #define PD_HeaderWord_DataRole_Sink				0b0000000000000000
 
 #define PD_isValidPowerRole( __r__ ) ( (__r__) == PD_HeaderWord_PowerRole_Source || (__r__) == PD_HeaderWord_PowerRole_Sink )
-#define PD_isValidSpecRev( __r__ ) ( (__r__) == PD_HeaderWord_SpecRev_1_0 || (__r__) == PD_HeaderWord_SpecRev_2_0 )
+#define PD_isValidSpecRev( __r__ ) ( (__r__) == PD_HeaderWord_SpecRev_1_0 || (__r__) == PD_HeaderWord_SpecRev_2_0 || (__r__) == PD_HeaderWord_SpecRev_3_0 )
 #define PD_isValidDataRole( __r__ ) ( (__r__) == PD_HeaderWord_DataRole_Source || (__r__) == PD_HeaderWord_DataRole_Sink )
 
+#define PD_HeaderWord_isExtended( __h__ )							( ((__h__) & PD_HeaderWord_Extended_MASK) == PD_HeaderWord_Extended_MASK )
 #define PD_HeaderWord_getNumberOfDataObjects( __h__ )				( ((__h__) & PD_HeaderWord_NumberOfDataObjects_MASK) >> PD_HeaderWord_NumberOfDataObjects_OFFSET )
 #define PD_HeaderWord_getMessageId( __h__ )							( ((__h__) & PD_HeaderWord_MessageId_MASK) >> PD_HeaderWord_MessageId_OFFSET )
 #define PD_HeaderWord_getPowerRole( __h__ )							( ((__h__) & PD_HeaderWord_PowerRole_MASK) >> PD_HeaderWord_PowerRole_OFFSET )
@@ -73,6 +77,11 @@
 #define PD_HeaderWord_setDataRoleBits( __v__ ) 						( ((__v__) << PD_HeaderWord_DataRole_OFFSET ) & PD_HeaderWord_DataRole_MASK )
 #define PD_HeaderWord_setCommandCodeBits( __v__ ) 					( ((__v__) << PD_HeaderWord_CommandCode_OFFSET ) & PD_HeaderWord_CommandCode_MASK )
 
+// whole header in one expression, folds to a constant (or an or with the message id) for constant arguments
+#define PD_HeaderWord_make( __n__, __mid__, __prole__, __spec__, __drole__, __cmd__ ) ( \
+		PD_HeaderWord_setNumberOfDataObjectsBits(__n__) | PD_HeaderWord_setMessageIdBits(__mid__) | \
+		(__prole__) | (__spec__) | (__drole__) | PD_HeaderWord_setCommandCodeBits(__cmd__) )
+
 typedef enum {
 	PD_ControlCommand_GoodCRC			= 0b0001, // 1
 	PD_ControlCommand_GotoMin			= 0b0010, // 2
@@ -86,40 +95,122 @@ typedef enum {
 	PD_ControlCommand_PRSwap			= 0b1010, // 10
 	PD_ControlCommand_VCONNSwap			= 0b1011, // 11
 	PD_ControlCommand_Wait				= 0b1100, // 12
-	PD_ControlCommand_SoftReset			= 0b1101  // 13
+	PD_ControlCommand_SoftReset			= 0b1101, // 13
+	// PD 3.0
+	PD_ControlCommand_NotSupported		= 0b10000, // 16
+	PD_ControlCommand_GetSourceCapExtended	= 0b10001, // 17
+	PD_ControlCommand_GetStatus			= 0b10010, // 18
+	PD_ControlCommand_FRSwap			= 0b10011, // 19
+	PD_ControlCommand_GetPPSStatus		= 0b10100, // 20
+	PD_ControlCommand_GetCountryCodes	= 0b10101  // 21
 } PD_ControlCommand_t;
 
-#define PD_isValidControlCommand( __c__ ) ( \
-		(__c__) == PD_ControlCommand_GoodCRC || \
-		(__c__) == PD_ControlCommand_GotoMin || \
-		(__c__) == PD_ControlCommand_Accept || \
-		(__c__) == PD_ControlCommand_Reject || \
-		(__c__) == PD_ControlCommand_Ping || \
-		(__c__) == PD_ControlCommand_PSRDY || \
-		(__c__) == PD_ControlCommand_GetSourceCap || \
-		(__c__) == PD_ControlCommand_GetSinkCap || \
-		(__c__) == PD_ControlCommand_DRSwap || \
-		(__c__) == PD_ControlCommand_PRSwap || \
-		(__c__) == PD_ControlCommand_VCONNSwap || \
-		(__c__) == PD_ControlCommand_Wait || \
-		(__c__) == PD_ControlCommand_SoftReset \
+// bit per valid command code
+#define PD_ControlCommand_VALID_MASK	( \
+		(1 << PD_ControlCommand_GoodCRC) | \
+		(1 << PD_ControlCommand_GotoMin) | \
+		(1 << PD_ControlCommand_Accept) | \
+		(1 << PD_ControlCommand_Reject) | \
+		(1 << PD_ControlCommand_Ping) | \
+		(1 << PD_ControlCommand_PSRDY) | \
+		(1 << PD_ControlCommand_GetSourceCap) | \
+		(1 << PD_ControlCommand_GetSinkCap) | \
+		(1 << PD_ControlCommand_DRSwap) | \
+		(1 << PD_ControlCommand_PRSwap) | \
+		(1 << PD_ControlCommand_VCONNSwap) | \
+		(1 << PD_ControlCommand_Wait) | \
+		(1 << PD_ControlCommand_SoftReset) | \
+		(1 << PD_ControlCommand_NotSupported) | \
+		(1 << PD_ControlCommand_GetSourceCapExtended) | \
+		(1 << PD_ControlCommand_GetStatus) | \
+		(1 << PD_ControlCommand_FRSwap) | \
+		(1 << PD_ControlCommand_GetPPSStatus) | \
+		(1 << PD_ControlCommand_GetCountryCodes) \
 )
 
+#define PD_isValidControlCommand( __c__ ) ( (unsigned)(__c__) < 32 && ((PD_ControlCommand_VALID_MASK >> (__c__)) & 1) )
+
 typedef enum {
 	PD_DataCommand_SourceCapabilities	= 0b0001, // 1
 	PD_DataCommand_Request				= 0b0010, // 2
 	PD_DataCommand_BIST					= 0b0011, // 3
 	PD_DataCommand_SinkCapabilities		= 0b0100, // 4
+	// PD 3.0
+	PD_DataCommand_BatteryStatus		= 0b0101, // 5
+	PD_DataCommand_Alert				= 0b0110, // 6
+	PD_DataCommand_GetCountryInfo		= 0b0111, // 7
+	PD_DataCommand_VendorDefined		= 0b1111, // 15
 } PD_DataCommand_t;
 
-#define PD_isValidDataCommand( __c__ ) ( \
-		(__c__) == PD_DataCommand_SourceCapabilities || \
-		(__c__) == PD_DataCommand_Request || \
-		(__c__) == PD_DataCommand_BIST || \
-		(__c__) == PD_DataCommand_SinkCapabilities \
+#define PD_DataCommand_VALID_MASK	( \
+		(1 << PD_DataCommand_SourceCapabilities) | \
+		(1 << PD_DataCommand_Request) | \
+		(1 << PD_DataCommand_BIST) | \
+		(1 << PD_DataCommand_SinkCapabilities) | \
+		(1 << PD_DataCommand_BatteryStatus) | \
+		(1 << PD_DataCommand_Alert) | \
+		(1 << PD_DataCommand_GetCountryInfo) | \
+		(1 << PD_DataCommand_VendorDefined) \
 )
 
-#define PD_isValidCommand( __c__ ) (PD_isValidControlCommand(__c__) || PD_isValidDataCommand(__c__))
+#define PD_isValidDataCommand( __c__ ) ( (unsigned)(__c__) < 32 && ((PD_DataCommand_VALID_MASK >> (__c__)) & 1) )
+
+#define PD_isValidCommand( __c__ ) ( (unsigned)(__c__) < 32 && (((PD_ControlCommand_VALID_MASK | PD_DataCommand_VALID_MASK) >> (__c__)) & 1) )
+
+// known command for the kind of message (control or data) of header <__h__>, a select, one shift and mask
+#define PD_HeaderWord_isValidCommand( __h__ ) \
+	( (( PD_HeaderWord_getNumberOfDataObjects(__h__) ? (uint32_t)PD_DataCommand_VALID_MASK : (uint32_t)PD_ControlCommand_VALID_MASK ) >> PD_HeaderWord_getCommandCode(__h__)) & 1 )
+
+typedef enum {
+	PD_ExtendedCommand_SourceCapabilitiesExtended	= 0b00001, // 1
+	PD_ExtendedCommand_Status						= 0b00010, // 2
+	PD_ExtendedCommand_GetBatteryCap				= 0b00011, // 3
+	PD_ExtendedCommand_GetBatteryStatus				= 0b00100, // 4
+	PD_ExtendedCommand_BatteryCapabilities			= 0b00101, // 5
+	PD_ExtendedCommand_GetManufacturerInfo			= 0b00110, // 6
+	PD_ExtendedCommand_ManufacturerInfo				= 0b00111, // 7
+	PD_ExtendedCommand_SecurityRequest				= 0b01000, // 8
+	PD_ExtendedCommand_SecurityResponse				= 0b01001, // 9
+	PD_ExtendedCommand_FirmwareUpdateRequest		= 0b01010, // 10
+	PD_ExtendedCommand_FirmwareUpdateResponse		= 0b01011, // 11
+	PD_ExtendedCommand_PPSStatus					= 0b01100, // 12
+	PD_ExtendedCommand_CountryInfo					= 0b01101, // 13
+	PD_ExtendedCommand_CountryCodes					= 0b01110  // 14
+} PD_ExtendedCommand_t;
+
+#define PD_isValidExtendedCommand( __c__ ) ( (unsigned)(__c__) - 1 < PD_ExtendedCommand_CountryCodes )
+
+/*
+ * Extended messages (PD 3.0): the data starts with the extended header, chunked messages carry at most
+ * PD_EXTENDED_CHUNK_SIZE bytes of it per message (padded to whole data objects).
+ */
+#define PD_EXTENDED_HEADER_SIZE		2
+#define PD_EXTENDED_CHUNK_SIZE		26
+#define PD_EXTENDED_MAX_DATA_SIZE	260
+
+#define PD_ExtHeader_Chunked_MASK			0b1000000000000000
+#define PD_ExtHeader_ChunkNumber_MASK		0b0111100000000000
+#define PD_ExtHeader_RequestChunk_MASK		0b0000010000000000
+#define PD_ExtHeader_DataSize_MASK			0b0000000111111111
+
+#define PD_ExtHeader_ChunkNumber_OFFSET		11
+#define PD_ExtHeader_DataSize_OFFSET		0
+
+#define PD_ExtHeader_isChunked( __h__ )				( ((__h__) & PD_ExtHeader_Chunked_MASK) == PD_ExtHeader_Chunked_MASK )
+#define PD_ExtHeader_isRequestChunk( __h__ )		( ((__h__) & PD_ExtHeader_RequestChunk_MASK) == PD_ExtHeader_RequestChunk_MASK )
+#define PD_ExtHeader_getChunkNumber( __h__ )		( ((__h__) & PD_ExtHeader_ChunkNumber_MASK) >> PD_ExtHeader_ChunkNumber_OFFSET )
+#define PD_ExtHeader_getDataSize( __h__ )			( ((__h__) & PD_ExtHeader_DataSize_MASK) >> PD_ExtHeader_DataSize_OFFSET )
+
+#define PD_ExtHeader_setChunkNumberBits( __v__ )	( ((__v__) << PD_ExtHeader_ChunkNumber_OFFSET) & PD_ExtHeader_ChunkNumber_MASK )
+#define PD_ExtHeader_setDataSizeBits( __v__ )		( ((__v__) << PD_ExtHeader_DataSize_OFFSET) & PD_ExtHeader_DataSize_MASK )
+
+// chunk <__chunk__> of a chunked message of <__size__> bytes
+#define PD_ExtHeader_makeChunk( __chunk__, __size__ )	( PD_ExtHeader_Chunked_MASK | PD_ExtHeader_setChunkNumberBits(__chunk__) | PD_ExtHeader_setDataSizeBits(__size__) )
+// request for chunk <__chunk__> (data size 0)
+#define PD_ExtHeader_makeRequest( __chunk__ )			( PD_ExtHeader_Chunked_MASK | PD_ExtHeader_RequestChunk_MASK | PD_ExtHeader_setChunkNumberBits(__chunk__) )
+
+// data objects needed for a chunk of <__len__> bytes (a chunk request has one, zero padded)
+#define PD_ExtendedChunk_getNumberOfDataObjects( __len__ )	( (PD_EXTENDED_HEADER_SIZE + (__len__) + 3) / 4 )
 
 typedef enum {
 	PD_SupplyType_Battery 	= 0,
@@ -138,6 +229,7 @@ typedef union {
 #define PDO_SrcCap_SupplyType_Battery			0b01000000000000000000000000000000
 #define PDO_SrcCap_SupplyType_Variable			0b10000000000000000000000000000000
 #define PDO_SrcCap_SupplyType_Reserved			0b11000000000000000000000000000000
+#define PDO_SrcCap_SupplyType_APDO				PDO_SrcCap_SupplyType_Reserved		// PD 3.0 augmented PDO
 
 #define PDO_SrcCap_Fixed_DualRolePower			0b00100000000000000000000000000000
 #define PDO_SrcCap_Fixed_USBSuspendSupport		0b00010000000000000000000000000000
@@ -184,6 +276,28 @@ typedef union {
 #define PDO_SrcCap_Battery_getMinVoltage_50mV( __v__ ) ( ( (__v__) & PDO_SrcCap_Battery_MinVoltage_50mV_MASK ) >> PDO_SrcCap_Battery_MinVoltage_50mV_OFFSET )
 #define PDO_SrcCap_Battery_getMaxPower_250mW( __v__ ) ( (__v__) & PDO_SrcCap_Battery_MaxPower_250mW_MASK )
 
+#define PDO_SrcCap_APDO_Type_MASK					0b00110000000000000000000000000000
+#define PDO_SrcCap_APDO_Type_PPS					0b00000000000000000000000000000000
+
+#define PDO_SrcCap_PPS_PowerLimited					0b00001000000000000000000000000000
+#define PDO_SrcCap_PPS_MaxVoltage_100mV_MASK		0b00000001111111100000000000000000
+#define PDO_SrcCap_PPS_MinVoltage_100mV_MASK		0b00000000000000001111111100000000
+#define PDO_SrcCap_PPS_MaxCurrent_50mA_MASK			0b00000000000000000000000001111111
+
+#define PDO_SrcCap_PPS_MaxVoltage_100mV_OFFSET		17
+#define PDO_SrcCap_PPS_MinVoltage_100mV_OFFSET		8
+#define PDO_SrcCap_PPS_MaxCurrent_50mA_OFFSET		0
+
+#define PDO_SrcCap_isPPS( __v__ ) ( ((__v__) & PDO_SrcCap_SupplyType_MASK) == PDO_SrcCap_SupplyType_APDO && ((__v__) & PDO_SrcCap_APDO_Type_MASK) == PDO_SrcCap_APDO_Type_PPS )
+
+#define PDO_SrcCap_PPS_getMaxVoltage_100mV( __v__ ) ( ( (__v__) & PDO_SrcCap_PPS_MaxVoltage_100mV_MASK ) >> PDO_SrcCap_PPS_MaxVoltage_100mV_OFFSET )
+#define PDO_SrcCap_PPS_getMinVoltage_100mV( __v__ ) ( ( (__v__) & PDO_SrcCap_PPS_MinVoltage_100mV_MASK ) >> PDO_SrcCap_PPS_MinVoltage_100mV_OFFSET )
+#define PDO_SrcCap_PPS_getMaxCurrent_50mA( __v__ ) ( (__v__) & PDO_SrcCap_PPS_MaxCurrent_50mA_MASK )
+
+// sink capabilities: fixed supplies like the source ones, the current is the operational one
+#define PDO_SnkCap_Fixed_setVoltage_50mVBits( __v__ )		( ( (__v__) << PDO_SrcCap_Fixed_Voltage_50mV_OFFSET ) & PDO_SrcCap_Fixed_Voltage_50mV_MASK )
+#define PDO_SnkCap_Fixed_setOpCurrent_10mABits( __v__ )		( (__v__) & PDO_SrcCap_Fixed_MaxCurrent_10mA_MASK )
+
 
 #define PDO_Req_Fixed_Reserved_MASK					0b10000000111100000000000000000000
 #define PDO_Req_Fixed_ObjectPos_MASK				0b01110000000000000000000000000000
@@ -202,6 +316,28 @@ typedef union {
 #define PDO_Req_Fixed_setOperatingCurrent_10mABits(__v__)	( ( (__v__) << PDO_Req_Fixed_OperatingCurrent_10mA_OFFSET ) & PDO_Req_Fixed_OperatingCurrent_10mA_MASK )
 #define PDO_Req_Fixed_setMaxOpCur_10mABits(__v__)			( (__v__) & PDO_Req_Fixed_MaxOpCur_10mA_MASK )
 
+// requests of variable supplies are laid out like those of fixed supplies, battery requests give power instead of current
+#define PDO_Req_Battery_OperatingPower_250mW_MASK	0b00000000000011111111110000000000
+#define PDO_Req_Battery_MaxOpPower_250mW_MASK		0b00000000000000000000001111111111
+
+#define PDO_Req_Battery_OperatingPower_250mW_OFFSET	10
+#define PDO_Req_Battery_MaxOpPower_250mW_OFFSET		0
+
+#define PDO_Req_Battery_setOperatingPower_250mWBits(__v__)	( ( (__v__) << PDO_Req_Battery_OperatingPower_250mW_OFFSET ) & PDO_Req_Battery_OperatingPower_250mW_MASK )
+#define PDO_Req_Battery_setMaxOpPower_250mWBits(__v__)		( (__v__) & PDO_Req_Battery_MaxOpPower_250mW_MASK )
+
+// programmable supply (PPS): output voltage and operating current (flags and object position like fixed requests)
+#define PDO_Req_PPS_OutputVoltage_20mV_MASK			0b00000000000011111111111000000000
+#define PDO_Req_PPS_OperatingCurrent_50mA_MASK		0b00000000000000000000000001111111
+
+#define PDO_Req_PPS_OutputVoltage_20mV_OFFSET		9
+#define PDO_Req_PPS_OperatingCurrent_50mA_OFFSET	0
+
+#define PDO_Req_PPS_setOutputVoltage_20mVBits(__v__)		( ( (__v__) << PDO_Req_PPS_OutputVoltage_20mV_OFFSET ) & PDO_Req_PPS_OutputVoltage_20mV_MASK )
+#define PDO_Req_PPS_setOperatingCurrent_50mABits(__v__)	( (__v__) & PDO_Req_PPS_OperatingCurrent_50mA_MASK )
+#define PDO_Req_PPS_getOutputVoltage_20mV( __v__ )			( ( (__v__) & PDO_Req_PPS_OutputVoltage_20mV_MASK ) >> PDO_Req_PPS_OutputVoltage_20mV_OFFSET )
+#define PDO_Req_PPS_getOperatingCurrent_50mA( __v__ )		( (__v__) & PDO_Req_PPS_OperatingCurrent_50mA_MASK )
+
 //__attribute__ ((packed))
 typedef struct {
 	uint16_t  Address;
@@ -218,7 +354,7 @@ typedef struct {
 #define PD_isDataMessage( __msg__ ) 		( PD_HeaderWord_getNumberOfDataObjects((__msg__)->Header.Word) > 0 )
 
 
-inline void PD_newMessage( PD_Message_t * message, uint8_t numberOfDataObjects, uint8_t messageId, uint16_t powerRole, uint16_t specRev, uint16_t dataRole, uint16_t commandCode, PD_DataObject_t * dataObjects )
+static inline void PD_newMessage( PD_Message_t * message, uint8_t numberOfDataObjects, uint8_t messageId, uint16_t powerRole, uint16_t specRev, uint16_t dataRole, uint16_t commandCode, const PD_DataObject_t * dataObjects )
 {
 	assert( PD_isValidNumberOfDataObjects(numberOfDataObjects) );
 	assert( PD_isValidMessageId(messageId) );
@@ -229,9 +365,7 @@ inline void PD_newMessage( PD_Message_t * message, uint8_t numberOfDataObjects,
 	assert( numberOfDataObjects == 0 || PD_isValidDataCommand(commandCode) );
 	assert( numberOfDataObjects > 0 || PD_isValidControlCommand(commandCode) );
 
-	message->Header.Word = PD_HeaderWord_setNumberOfDataObjectsBits(numberOfDataObjects);
-	message->Header.Word |= PD_HeaderWord_setMessageIdBits(numberOfDataObjects);
-	message->Header.Word |= powerRole | specRev | dataRole | commandCode;
+	message->Header.Word = PD_HeaderWord_make( numberOfDataObjects, messageId, powerRole, specRev, dataRole, commandCode );
 
 	for(uint8_t i = 0; i < numberOfDataObjects; i++)
 	{
@@ -244,6 +378,105 @@ inline void PD_newMessage( PD_Message_t * message, uint8_t numberOfDataObjects,
 }
 
 
+/*
+ * Messages in wire format (as in the FIFOs): little endian header followed by the data objects, 4 bytes each.
+ * A view decodes the header once and every data object only when it is asked for, straight from the buffer.
+ */
+#define PD_WIRE_HEADER_SIZE		2
+#define PD_WIRE_MAX_SIZE		(PD_WIRE_HEADER_SIZE + PD_MESSAGE_MAX_OBJECTS * sizeof(PD_DataObject_t))
+
+typedef struct {
+	uint16_t Header;
+	const uint8_t * DataObjects;	// wire format, valid as long as the buffer is
+} PD_MessageView_t;
+
+static inline uint16_t PD_Wire_getU16( const uint8_t * b )
+{
+	return (uint16_t)b[0] | ((uint16_t)b[1] << 8);
+}
+
+static inline uint32_t PD_Wire_getU32( const uint8_t * b )
+{
+	return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static inline void PD_Wire_setU16( uint8_t * b, uint16_t v )
+{
+	b[0] = v;
+	b[1] = v >> 8;
+}
+
+static inline void PD_Wire_setU32( uint8_t * b, uint32_t v )
+{
+	b[0] = v;
+	b[1] = v >> 8;
+	b[2] = v >> 16;
+	b[3] = v >> 24;
+}
+
+static inline void PD_MessageView_init( PD_MessageView_t * view, const uint8_t * wire )
+{
+	view->Header = PD_Wire_getU16( wire );
+	view->DataObjects = &wire[PD_WIRE_HEADER_SIZE];
+}
+
+#define PD_MessageView_getNumberOfDataObjects( __view__ )	PD_HeaderWord_getNumberOfDataObjects( (__view__)->Header )
+#define PD_MessageView_getCommandCode( __view__ )			PD_HeaderWord_getCommandCode( (__view__)->Header )
+#define PD_MessageView_isControlMessage( __view__ )			( PD_MessageView_getNumberOfDataObjects(__view__) == 0 )
+
+// data object <n> (0 based), not checked against the number of data objects
+static inline uint32_t PD_MessageView_getDataObject( const PD_MessageView_t * view, uint8_t n )
+{
+	return PD_Wire_getU32( &view->DataObjects[ n * sizeof(PD_DataObject_t) ] );
+}
+
+/**
+ * Encodes <header> and its data objects into <wire>, returns the number of bytes written
+ */
+static inline uint8_t PD_Wire_encode( uint8_t * wire, uint16_t header, const PD_DataObject_t * dataObjects )
+{
+	uint8_t N = PD_HeaderWord_getNumberOfDataObjects( header );
+
+	assert( N == 0 || dataObjects != NULL );
+
+	PD_Wire_setU16( wire, header );
+
+	for (uint8_t n = 0; n < N; n++)
+	{
+		PD_Wire_setU32( &wire[PD_WIRE_HEADER_SIZE + n * sizeof(PD_DataObject_t)], dataObjects[n].Value );
+	}
+
+	return PD_WIRE_HEADER_SIZE + N * sizeof(PD_DataObject_t);
+}
+
+/**
+ * Encodes a chunk of an extended message: <header> (number of data objects included), the extended header and
+ * <len> bytes of <data>, zero padded to the data objects. Returns the number of bytes written
+ */
+static inline uint8_t PD_Wire_encodeChunk( uint8_t * wire, uint16_t header, uint16_t extHeader, const uint8_t * data, uint8_t len )
+{
+	uint8_t size = PD_WIRE_HEADER_SIZE + PD_HeaderWord_getNumberOfDataObjects( header ) * sizeof(PD_DataObject_t);
+	uint8_t i = PD_WIRE_HEADER_SIZE + PD_EXTENDED_HEADER_SIZE;
+
+	assert( len <= PD_EXTENDED_CHUNK_SIZE );
+	assert( i + len <= size );
+
+	PD_Wire_setU16( wire, header );
+	PD_Wire_setU16( &wire[PD_WIRE_HEADER_SIZE], extHeader );
+
+	for (uint8_t n = 0; n < len; n++)
+	{
+		wire[i++] = data[n];
+	}
+	while (i < size)
+	{
+		wire[i++] = 0;
+	}
+
+	return size;
+}
+
+
 #ifdef __cplusplus
  }
 #endif
@@ -81,6 +81,7 @@
 
 #define FUSB302_D_Switches1_SPECREV_Rev1_0		0b00000000
 #define FUSB302_D_Switches1_SPECREV_Rev2_0		0b00100000
+#define FUSB302_D_Switches1_SPECREV_Rev3_0		0b01000000
 #define FUSB302_D_Switches1_POWERROLE_Source	0b10000000
 #define FUSB302_D_Switches1_POWERROLE_Sink		0b00000000
 #define FUSB302_D_Switches1_DATAROLE_Source		0b00010000
@@ -19,8 +19,6 @@
 
 #include "FUSB302-D_Driver.h"
 
-#include "delay.h"
-
 
 #ifndef DBG
 #define DBG(format, ...)
@@ -28,261 +26,671 @@
 
 
 
-static FUSB302_D_Error_t FUSB302_D_WriteReg( FUSB302_D_t * fusb, uint8_t * buf, uint16_t len );
-static FUSB302_D_Error_t FUSB302_D_ReadReg( FUSB302_D_t * fusb, uint8_t offset, uint8_t * buf, uint16_t len );
-//static FUSB302_D_Error_t FUSB302_D_ReadReg( FUSB302_D_t * fusb, uint8_t * buf, uint16_t len );
+typedef struct {
+	volatile bool Done;
+	FUSB302_D_Error_t Result;
+} FUSB302_D_Sync_t;
 
-static FUSB302_D_Error_t FUSB302_D_StartSequence( FUSB302_D_t * fusb );
-static FUSB302_D_Error_t FUSB302_D_EndSequence( FUSB302_D_t * fusb );
-static FUSB302_D_Error_t FUSB302_D_SequentialWrite( FUSB302_D_t * fusb, uint8_t * buf, uint16_t len, uint32_t XferOptions );
-static FUSB302_D_Error_t FUSB302_D_SequentialRead( FUSB302_D_t * fusb, uint8_t * buf, uint16_t len, uint32_t XferOptions );
+static FUSB302_D_t * Instances[FUSB302_D_MAX_INSTANCES];
 
+static FUSB302_D_Error_t FUSB302_D_Transfer( FUSB302_D_t * fusb, uint8_t dir, uint8_t reg, uint8_t * data, uint8_t len );
+static void FUSB302_D_SyncDone( FUSB302_D_t * fusb, FUSB302_D_Error_t result, void * ctx );
+static bool FUSB302_D_WaitIdle( FUSB302_D_t * fusb );
+static bool FUSB302_D_Expired( FUSB302_D_t * fusb, uint32_t start );
 
-static FUSB302_D_Error_t FUSB302_D_WriteReg( FUSB302_D_t * fusb, uint8_t * buf, uint16_t len )
-{
-	uint16_t addr = (fusb->Addr << 1) + FUSB302_D_WRITE;
+static FUSB302_D_Error_t FUSB302_D_Submit( FUSB302_D_t * fusb, uint8_t dir, uint8_t reg, uint8_t * data, uint8_t len, FUSB302_D_Callback_t callback, void * ctx );
+static void FUSB302_D_StartXfer( FUSB302_D_t * fusb );
+static FUSB302_D_Error_t FUSB302_D_RunXfer( FUSB302_D_t * fusb, FUSB302_D_Xfer_t * xfer );
 
-	HAL_StatusTypeDef status = HAL_I2C_Master_Transmit( fusb->Hi2c, addr, buf, len, 1000 );
+static bool FUSB302_D_BusActive( void * bus );
+static void FUSB302_D_KickBus( void * bus );
 
-	if (HAL_OK != status){
+static void FUSB302_D_Lock( FUSB302_D_t * fusb );
+static void FUSB302_D_Unlock( FUSB302_D_t * fusb );
 
-		DBG("write error %d\n", status);
-		return FUSB302_D_ERROR;
-	}
 
-//	DBG("wrote (%d) = ", len );
-//	for (uint8_t i = 0; i < len; i++)
-//	{
-//		DBG("%02X", buf[i]);
-//	}
-//	DBG("\n");
+static FUSB302_D_Error_t FUSB302_D_Transfer( FUSB302_D_t * fusb, uint8_t dir, uint8_t reg, uint8_t * data, uint8_t len )
+{
+	FUSB302_D_Sync_t sync = {
+		.Done = false,
+		.Result = FUSB302_D_ERROR
+	};
 
-	return FUSB302_D_OK;
-}
+	// wait for a free slot
+	if (fusb->QueueCount >= FUSB302_D_XFER_QUEUE_LEN)
+	{
+		uint32_t start = FUSB302_D_GetTime( fusb );
 
-static FUSB302_D_Error_t FUSB302_D_ReadReg( FUSB302_D_t * fusb, uint8_t registerAddress, uint8_t * buf, uint16_t len )
-{
-//	uint16_t addr = (fusb->Addr << 1) + FUSB302_D_READ;
+		while (fusb->QueueCount >= FUSB302_D_XFER_QUEUE_LEN)
+		{
+			if (FUSB302_D_Expired( fusb, start ))
+			{
+				DBG("queue timeout\n");
+				FUSB302_D_Abort( fusb );
+				return FUSB302_D_ERROR;
+			}
+		}
+	}
 
-	if (FUSB302_D_StartSequence( fusb ))
+	if (FUSB302_D_Submit( fusb, dir, reg, data, len, FUSB302_D_SyncDone, &sync ) == FUSB302_D_ERROR)
 	{
 		return FUSB302_D_ERROR;
 	}
 
-	FUSB302_D_Error_t result = FUSB302_D_SequentialWrite( fusb, &registerAddress, 1, I2C_FIRST_FRAME );
-	if ( result == FUSB302_D_OK )
+	// wait for completion (anything queued before is completed first)
+	if (sync.Done == false)
 	{
-		result = FUSB302_D_SequentialRead( fusb, buf, len, I2C_LAST_FRAME );
+		uint32_t start = FUSB302_D_GetTime( fusb );
+
+		while (sync.Done == false)
+		{
+			if (FUSB302_D_Expired( fusb, start ))
+			{
+				DBG("transfer timeout\n");
+				// fails ours too, sync is not referenced afterwards
+				FUSB302_D_Abort( fusb );
+				return FUSB302_D_ERROR;
+			}
+		}
 	}
 
-	// make sure to always call EndSequence
-	FUSB302_D_EndSequence( fusb );
+	return sync.Result;
+}
+
+static void FUSB302_D_SyncDone( FUSB302_D_t * fusb, FUSB302_D_Error_t result, void * ctx )
+{
+	FUSB302_D_Sync_t * sync = (FUSB302_D_Sync_t*)ctx;
 
-//	HAL_StatusTypeDef status = HAL_I2C_Master_Receive(bq->Hi2c, addr, buf, len, 1000);
-//
-//	if (HAL_OK != status){
-//		return FUSB302_D_ERROR;
-//	}
-//
-//	DBG("read (%d) = ", len );
-//	for (uint8_t i = 0; i < len; i++)
-//	{
-//		DBG("%02X", buf[i]);
-//	}
-//	DBG("\n");
+	(void)fusb;
 
-	return result;
+	sync->Result = result;
+	sync->Done = true;
 }
 
-static FUSB302_D_Error_t FUSB302_D_StartSequence( FUSB302_D_t * fusb )
+/**
+ * Waits for the queue to drain, aborts it after FUSB302_D_TIMEOUT_MS.
+ */
+static bool FUSB302_D_WaitIdle( FUSB302_D_t * fusb )
 {
-	  HAL_NVIC_SetPriority( fusb->IrqN, 0, 1);
-	  HAL_NVIC_EnableIRQ( fusb->IrqN );
+	if (FUSB302_D_IsBusy( fusb ) == false)
+	{
+		return true;
+	}
+
+	uint32_t start = FUSB302_D_GetTime( fusb );
 
-	  return FUSB302_D_OK;
+	while (FUSB302_D_IsBusy( fusb ))
+	{
+		if (FUSB302_D_Expired( fusb, start ))
+		{
+			DBG("queue timeout\n");
+			FUSB302_D_Abort( fusb );
+			return false;
+		}
+	}
+
+	return true;
 }
 
-static FUSB302_D_Error_t FUSB302_D_EndSequence( FUSB302_D_t * fusb )
+static bool FUSB302_D_Expired( FUSB302_D_t * fusb, uint32_t start )
 {
-	  HAL_NVIC_DisableIRQ( fusb->IrqN );
+	// without a time source there is nothing to measure
+	if (fusb->Transport->GetTime == NULL)
+	{
+		return false;
+	}
 
-	  return FUSB302_D_OK;
+	return FUSB302_D_GetTime( fusb ) - start >= FUSB302_D_TIMEOUT_MS;
 }
 
-static FUSB302_D_Error_t FUSB302_D_SequentialWrite( FUSB302_D_t * fusb, uint8_t * buf, uint16_t len, uint32_t XferOptions )
+/**
+ * Gives up on the queue: stops the transfer on the bus (if the transport can) and fails all queued transfers.
+ */
+void FUSB302_D_Abort( FUSB302_D_t * fusb )
 {
-	uint16_t addr = (fusb->Addr << 1) + FUSB302_D_WRITE;
+	FUSB302_D_Lock( fusb );
 
-	HAL_StatusTypeDef status =HAL_I2C_Master_Sequential_Transmit_IT(fusb->Hi2c, addr, buf, len, XferOptions);
+	if (fusb->Active && fusb->Transport->Abort != NULL)
+	{
+		fusb->Transport->Abort( fusb->Bus );
+	}
+	fusb->Active = false;
+
+	while (fusb->QueueCount > 0)
+	{
+		FUSB302_D_Xfer_t * xfer = &fusb->Queue[ fusb->QueueHead ];
+
+		fusb->QueueHead = (fusb->QueueHead + 1) % FUSB302_D_XFER_QUEUE_LEN;
+		fusb->QueueCount--;
+
+		if (xfer->Callback != NULL)
+		{
+			xfer->Callback( fusb, FUSB302_D_ERROR, xfer->Ctx );
+		}
+	}
 
-	if (HAL_OK != status){
+	// other devices on the bus go on
+	FUSB302_D_KickBus( fusb->Bus );
 
+	FUSB302_D_Unlock( fusb );
+}
+
+static FUSB302_D_Error_t FUSB302_D_Submit( FUSB302_D_t * fusb, uint8_t dir, uint8_t reg, uint8_t * data, uint8_t len, FUSB302_D_Callback_t callback, void * ctx )
+{
+	if (len == 0 || (dir == FUSB302_D_WRITE && len > FUSB302_D_XFER_MAX_WRITE))
+	{
 		return FUSB302_D_ERROR;
 	}
 
-	// wait for end of transmission
-	while ( HAL_I2C_GetState( fusb->Hi2c ) != HAL_I2C_STATE_READY);
+	FUSB302_D_Lock( fusb );
 
-	if (HAL_I2C_GetError( fusb->Hi2c ) == HAL_I2C_ERROR_AF)
+	if (fusb->QueueCount >= FUSB302_D_XFER_QUEUE_LEN)
 	{
-		DBG("slave didn't acknowledge\n");
+		FUSB302_D_Unlock( fusb );
 		return FUSB302_D_ERROR;
 	}
 
-//	DBG("wrote (%d) = ", len );
-//	for (uint8_t i = 0; i < len; i++)
-//	{
-//		DBG("%02X", buf[i]);
-//	}
-//	DBG("\n");
+	FUSB302_D_Xfer_t * xfer = &fusb->Queue[ (fusb->QueueHead + fusb->QueueCount) % FUSB302_D_XFER_QUEUE_LEN ];
+
+	xfer->Dir = dir;
+	xfer->Len = len;
+	xfer->Callback = callback;
+	xfer->Ctx = ctx;
+	xfer->Buf[0] = reg;
+
+	if (dir == FUSB302_D_WRITE)
+	{
+		xfer->Data = NULL;
+		for (uint8_t i = 0; i < len; i++)
+		{
+			xfer->Buf[i+1] = data[i];
+		}
+	}
+	else
+	{
+		xfer->Data = data;
+	}
+
+	fusb->QueueCount++;
+
+	// also retries if we were waiting for the bus
+	if (fusb->Active == false)
+	{
+		FUSB302_D_StartXfer( fusb );
+	}
+
+	FUSB302_D_Unlock( fusb );
 
 	return FUSB302_D_OK;
 }
 
-static FUSB302_D_Error_t FUSB302_D_SequentialRead( FUSB302_D_t * fusb, uint8_t * buf, uint16_t len, uint32_t XferOptions )
+/**
+ * Puts the head of the queue on the bus.
+ * NOTE: called with the lock held or from the interrupt context
+ */
+static void FUSB302_D_StartXfer( FUSB302_D_t * fusb )
 {
-	uint16_t addr = (fusb->Addr << 1) + FUSB302_D_READ;
+	FUSB302_D_Xfer_t * xfer = &fusb->Queue[ fusb->QueueHead ];
+	FUSB302_D_Error_t status;
 
-	HAL_StatusTypeDef status = HAL_I2C_Master_Sequential_Receive_IT( fusb->Hi2c, addr, buf, len, XferOptions);
+	fusb->Active = true;
 
-	if (HAL_OK != status){
-		return FUSB302_D_ERROR;
+	if (fusb->Transport->Submit == NULL)
+	{
+		// blocking transport, done right away
+		FUSB302_D_XferComplete( fusb, FUSB302_D_RunXfer( fusb, xfer ) );
+		return;
 	}
-	// wait for end of reception
-	while (HAL_I2C_GetState( fusb->Hi2c ) != HAL_I2C_STATE_READY);
 
-	if (HAL_I2C_GetError( fusb->Hi2c ) == HAL_I2C_ERROR_AF)
+	if (xfer->Dir == FUSB302_D_WRITE)
+	{
+		status = fusb->Transport->Submit( fusb->Bus, fusb, fusb->Addr, &xfer->Buf[0], 1 + xfer->Len, NULL, 0 );
+	}
+	else
+	{
+		status = fusb->Transport->Submit( fusb->Bus, fusb, fusb->Addr, &xfer->Buf[0], 1, xfer->Data, xfer->Len );
+	}
+
+	if (status == FUSB302_D_BUSY)
+	{
+		// another device is using the bus, retried once that one completes
+		fusb->Active = false;
+		return;
+	}
+
+	if (status != FUSB302_D_OK)
+	{
+		FUSB302_D_XferComplete( fusb, FUSB302_D_ERROR );
+		return;
+	}
+
+	if (fusb->Transport->IrqEnable != NULL)
+	{
+		fusb->Transport->IrqEnable( fusb->Bus );
+	}
+}
+
+static FUSB302_D_Error_t FUSB302_D_RunXfer( FUSB302_D_t * fusb, FUSB302_D_Xfer_t * xfer )
+{
+	const FUSB302_D_Transport_t * t = fusb->Transport;
+
+	if (xfer->Dir == FUSB302_D_WRITE)
+	{
+		return t->Write( fusb->Bus, fusb->Addr, &xfer->Buf[0], 1 + xfer->Len );
+	}
+
+	if (t->WriteRead != NULL)
+	{
+		return t->WriteRead( fusb->Bus, fusb->Addr, &xfer->Buf[0], 1, xfer->Data, xfer->Len );
+	}
+
+	// register pointer first, then read
+	if (t->Write( fusb->Bus, fusb->Addr, &xfer->Buf[0], 1 ) != FUSB302_D_OK)
 	{
-		DBG("slave didn't acknowledge\n");
 		return FUSB302_D_ERROR;
 	}
+	return t->Read( fusb->Bus, fusb->Addr, xfer->Data, xfer->Len );
+}
+
+/**
+ * Removes the head of the queue, notifies and starts the next transfer.
+ * NOTE: called with the lock held or from the interrupt context
+ */
+void FUSB302_D_XferComplete( FUSB302_D_t * fusb, FUSB302_D_Error_t result )
+{
+	// late completion of an aborted transfer
+	if (fusb->Active == false || fusb->QueueCount == 0)
+	{
+		return;
+	}
 
-//	DBG("read (%d) = ", len );
-//	for (uint8_t i = 0; i < len; i++)
-//	{
-//		DBG("%02X", buf[i]);
-//	}
-//	DBG("\n");
+	FUSB302_D_Xfer_t * xfer = &fusb->Queue[ fusb->QueueHead ];
+	FUSB302_D_Callback_t callback = xfer->Callback;
+	void * ctx = xfer->Ctx;
 
-	return FUSB302_D_OK;
+#if FUSB302_D_STATS==true
+	fusb->Stats.Transactions++;
+	if (xfer->Dir == FUSB302_D_WRITE)
+	{
+		fusb->Stats.BytesWritten += 1 + xfer->Len;
+	}
+	else
+	{
+		// register pointer write + data read count as one combined transaction
+		fusb->Stats.BytesWritten += 1;
+		fusb->Stats.BytesRead += xfer->Len;
+	}
+	if (result != FUSB302_D_OK)
+	{
+		fusb->Stats.Errors++;
+	}
+#endif
+
+	fusb->Active = false;
+	fusb->QueueHead = (fusb->QueueHead + 1) % FUSB302_D_XFER_QUEUE_LEN;
+	fusb->QueueCount--;
+
+	if (callback != NULL)
+	{
+		callback( fusb, result, ctx );
+	}
+
+	if (fusb->QueueCount > 0)
+	{
+		FUSB302_D_StartXfer( fusb );
+	}
+	else
+	{
+		FUSB302_D_KickBus( fusb->Bus );
+	}
+
+	if (fusb->Transport->IrqDisable != NULL && FUSB302_D_BusActive( fusb->Bus ) == false)
+	{
+		fusb->Transport->IrqDisable( fusb->Bus );
+	}
+}
+
+static bool FUSB302_D_BusActive( void * bus )
+{
+	for (uint8_t i = 0; i < FUSB302_D_MAX_INSTANCES; i++)
+	{
+		if (Instances[i] != NULL && Instances[i]->Bus == bus && Instances[i]->Active)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void FUSB302_D_KickBus( void * bus )
+{
+	for (uint8_t i = 0; i < FUSB302_D_MAX_INSTANCES && FUSB302_D_BusActive( bus ) == false; i++)
+	{
+		if (Instances[i] != NULL && Instances[i]->Bus == bus && Instances[i]->QueueCount > 0)
+		{
+			FUSB302_D_StartXfer( Instances[i] );
+		}
+	}
+}
+
+static void FUSB302_D_Lock( FUSB302_D_t * fusb )
+{
+	if (fusb->Transport->IrqDisable != NULL)
+	{
+		fusb->Transport->IrqDisable( fusb->Bus );
+	}
+}
+
+static void FUSB302_D_Unlock( FUSB302_D_t * fusb )
+{
+	if (fusb->Transport->IrqEnable != NULL && FUSB302_D_BusActive( fusb->Bus ))
+	{
+		fusb->Transport->IrqEnable( fusb->Bus );
+	}
 }
 
 
-FUSB302_D_Error_t FUSB302_D_Init( FUSB302_D_t * fusb, I2C_HandleTypeDef * hi2c, IRQn_Type irqN, uint16_t i2cAddr )
+FUSB302_D_Error_t FUSB302_D_Init( FUSB302_D_t * fusb, const FUSB302_D_Transport_t * transport, void * bus, uint16_t i2cAddr )
 {
-	fusb->Hi2c = hi2c;
-	fusb->IrqN = irqN;
+	fusb->Transport = transport;
+	fusb->Bus = bus;
 	fusb->Addr = i2cAddr;
 
+	fusb->QueueHead = 0;
+	fusb->QueueCount = 0;
+	fusb->Active = false;
+
+#if FUSB302_D_STATS==true
+	FUSB302_D_ResetStats( fusb );
+#endif
+
+	// register so devices on the same bus can take turns
+	uint8_t i = 0;
+	while (i < FUSB302_D_MAX_INSTANCES && Instances[i] != NULL && Instances[i] != fusb)
+	{
+		i++;
+	}
+	if (i == FUSB302_D_MAX_INSTANCES)
+	{
+		DBG("too many instances\n");
+		return FUSB302_D_ERROR;
+	}
+	Instances[i] = fusb;
+
     return FUSB302_D_OK;
 }
 
 FUSB302_D_Error_t FUSB302_D_DeInit( FUSB302_D_t * fusb )
 {
-	fusb->Hi2c = NULL;
+	// let pending transfers finish
+	FUSB302_D_WaitIdle( fusb );
+
+	for (uint8_t i = 0; i < FUSB302_D_MAX_INSTANCES; i++)
+	{
+		if (Instances[i] == fusb)
+		{
+			Instances[i] = NULL;
+		}
+	}
+
+	fusb->Bus = NULL;
 
     return FUSB302_D_OK;
 }
 
 FUSB302_D_Error_t FUSB302_D_Probe( FUSB302_D_t * fusb, uint8_t ntrials, uint32_t timeout  )
 {
-	HAL_StatusTypeDef status = HAL_I2C_IsDeviceReady( fusb->Hi2c, fusb->Addr << 1, ntrials, timeout);
-
-	if (status != HAL_OK)
+	// blocking transport call, must not interfere with queued transfers
+	if (FUSB302_D_WaitIdle( fusb ) == false)
 	{
 		return FUSB302_D_ERROR;
 	}
 
-	return FUSB302_D_OK;
+	if (fusb->Transport->Probe != NULL)
+	{
+		return fusb->Transport->Probe( fusb->Bus, fusb->Addr, ntrials, timeout );
+	}
+
+	// otherwise just see if the device id can be read
+	uint8_t id;
+
+	for (uint8_t i = 0; i < ntrials; i++)
+	{
+		if (FUSB302_D_Read( fusb, FUSB302_D_Register_DeviceID, &id ) == FUSB302_D_OK)
+		{
+			return FUSB302_D_OK;
+		}
+	}
+
+	return FUSB302_D_ERROR;
 }
 
 FUSB302_D_Error_t FUSB302_D_Read( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t * data )
 {
-	HAL_StatusTypeDef status = FUSB302_D_ReadReg( fusb, reg, data, 1 );
+	FUSB302_D_Error_t status = FUSB302_D_Transfer( fusb, FUSB302_D_READ, reg, data, 1 );
 
 	#if FUSB302_D_BUS_FREE_TIME > 0
-	DelayMs( FUSB302_D_BUS_FREE_TIME );
+	FUSB302_D_DelayMs( fusb, FUSB302_D_BUS_FREE_TIME );
 	#endif
 
-	if (status != HAL_OK)
-	{
-		return FUSB302_D_ERROR;
-	}
-
-	return FUSB302_D_OK;
+	return status;
 }
 
 
 FUSB302_D_Error_t FUSB302_D_ReadN( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t * data, uint8_t n )
 {
-	HAL_StatusTypeDef status = FUSB302_D_ReadReg( fusb, reg, data, n );
+	FUSB302_D_Error_t status = FUSB302_D_Transfer( fusb, FUSB302_D_READ, reg, data, n );
 
 	#if FUSB302_D_BUS_FREE_TIME > 0
-	DelayMs( FUSB302_D_BUS_FREE_TIME );
+	FUSB302_D_DelayMs( fusb, FUSB302_D_BUS_FREE_TIME );
 	#endif
 
-	if (status != HAL_OK)
-	{
-		return FUSB302_D_ERROR;
-	}
-
-	return FUSB302_D_OK;
+	return status;
 }
 
 
 
 FUSB302_D_Error_t FUSB302_D_Write( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t data )
 {
-	uint8_t buf[2];
+	FUSB302_D_Error_t status = FUSB302_D_Transfer( fusb, FUSB302_D_WRITE, reg, &data, 1 );
 
-	buf[0] = reg;
-	buf[1] = data;
+	#if FUSB302_D_BUS_FREE_TIME > 0
+	FUSB302_D_DelayMs( fusb, FUSB302_D_BUS_FREE_TIME );
+	#endif
+
+	if (status != FUSB302_D_OK)
+	{
+		DBG("write error\n");
+	}
 
-	HAL_StatusTypeDef status = FUSB302_D_WriteReg( fusb, buf, 2 );
+	return status;
+}
+FUSB302_D_Error_t FUSB302_D_WriteN( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t * data, uint8_t n)
+{
+	FUSB302_D_Error_t status = FUSB302_D_Transfer( fusb, FUSB302_D_WRITE, reg, data, n );
 
 	#if FUSB302_D_BUS_FREE_TIME > 0
-	DelayMs( FUSB302_D_BUS_FREE_TIME );
+	FUSB302_D_DelayMs( fusb, FUSB302_D_BUS_FREE_TIME );
 	#endif
 
-	if (status != HAL_OK)
+	if (status != FUSB302_D_OK)
 	{
-		return FUSB302_D_ERROR;
+		DBG("write error\n");
 	}
 
-	return FUSB302_D_OK;
+	return status;
 }
-FUSB302_D_Error_t FUSB302_D_WriteN( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t * data, uint8_t n)
+
+FUSB302_D_Error_t FUSB302_D_ReadAsync( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t * data, uint8_t n, FUSB302_D_Callback_t callback, void * ctx )
 {
-	uint8_t buf[64];
+	return FUSB302_D_Submit( fusb, FUSB302_D_READ, reg, data, n, callback, ctx );
+}
+
+FUSB302_D_Error_t FUSB302_D_WriteAsync( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t * data, uint8_t n, FUSB302_D_Callback_t callback, void * ctx )
+{
+	return FUSB302_D_Submit( fusb, FUSB302_D_WRITE, reg, data, n, callback, ctx );
+}
 
-	buf[0] = reg;
+bool FUSB302_D_IsBusy( FUSB302_D_t * fusb )
+{
+	return fusb->QueueCount > 0;
+}
 
-	// copy
-	for (uint8_t i = 0; i < n; i++)
+uint32_t FUSB302_D_GetTime( FUSB302_D_t * fusb )
+{
+	if (fusb->Transport->GetTime == NULL)
 	{
-		buf[i+1] = data[i];
+		return 0;
 	}
 
-	HAL_StatusTypeDef status = FUSB302_D_WriteReg( fusb, buf, n+1 );
+	return fusb->Transport->GetTime( fusb->Bus );
+}
 
-	#if FUSB302_D_BUS_FREE_TIME > 0
-	DelayMs( FUSB302_D_BUS_FREE_TIME );
-	#endif
+void FUSB302_D_DelayMs( FUSB302_D_t * fusb, uint32_t ms )
+{
+	uint32_t start = FUSB302_D_GetTime( fusb );
 
-	if (status != HAL_OK)
+	while (FUSB302_D_GetTime( fusb ) - start < ms && fusb->Transport->GetTime != NULL);
+}
+
+uint8_t * FUSB302_D_ShadowPtr( FUSB302_D_Registers_st * regs, FUSB302_D_Register_t reg )
+{
+	return &((uint8_t*)regs)[ FUSB302_D_Register_index(reg) ];
+}
+
+void FUSB302_D_ShadowSet( FUSB302_D_Registers_st * regs, FUSB302_D_Register_t reg, uint8_t value )
+{
+	uint8_t * r = FUSB302_D_ShadowPtr( regs, reg );
+	uint32_t bit = FUSB302_D_Register_bit(reg);
+
+	// nothing to do if the device already has this value
+	if (*r == value && (regs->Valid & bit) == bit)
+	{
+		return;
+	}
+
+	*r = value;
+	regs->Dirty |= bit;
+}
+
+FUSB302_D_Error_t FUSB302_D_ShadowRead( FUSB302_D_t * fusb, FUSB302_D_Registers_st * regs, FUSB302_D_Register_t reg )
+{
+	uint32_t bit = FUSB302_D_Register_bit(reg);
+
+	if ((bit & FUSB302_D_REGISTERS_VOLATILE) == 0 && (regs->Valid & bit) == bit)
+	{
+		return FUSB302_D_OK;
+	}
+
+	if (FUSB302_D_Read( fusb, reg, FUSB302_D_ShadowPtr( regs, reg ) ) == FUSB302_D_ERROR)
 	{
 		return FUSB302_D_ERROR;
 	}
 
+	regs->Valid |= bit & ~FUSB302_D_REGISTERS_VOLATILE;
+	regs->Dirty &= ~bit;
+
+	return FUSB302_D_OK;
+}
+
+FUSB302_D_Error_t FUSB302_D_ShadowLoad( FUSB302_D_t * fusb, FUSB302_D_Registers_st * regs )
+{
+	// control block 0x01-0x10 (reading Reset is harmless)
+	if (FUSB302_D_ReadN( fusb, FUSB302_D_Register_DeviceID, FUSB302_D_ShadowPtr( regs, FUSB302_D_Register_DeviceID ), 16 ) == FUSB302_D_ERROR)
+	{
+		return FUSB302_D_ERROR;
+	}
+
+	// status block 0x3C-0x42, but not the fifo
+	if (FUSB302_D_ReadN( fusb, FUSB302_D_Register_Status0a, FUSB302_D_ShadowPtr( regs, FUSB302_D_Register_Status0a ), 7 ) == FUSB302_D_ERROR)
+	{
+		return FUSB302_D_ERROR;
+	}
+
+	regs->Reset = 0;
+	regs->Dirty = 0;
+	regs->Valid = ((1UL << FUSB302_D_REGISTER_COUNT) - 1) & ~FUSB302_D_REGISTERS_VOLATILE;
+
+	return FUSB302_D_OK;
+}
+
+FUSB302_D_Error_t FUSB302_D_ShadowCommit( FUSB302_D_t * fusb, FUSB302_D_Registers_st * regs )
+{
+	static const FUSB302_D_Register_t blocks[2][2] = {
+		{ FUSB302_D_Register_DeviceID, FUSB302_D_Register_Control4 },
+		{ FUSB302_D_Register_Status0a, FUSB302_D_Register_FIFOs }
+	};
+
+	for (uint8_t b = 0; b < 2 && regs->Dirty != 0; b++)
+	{
+		uint8_t reg = blocks[b][0];
+
+		while (reg <= blocks[b][1])
+		{
+			if ((regs->Dirty & FUSB302_D_Register_bit(reg)) == 0)
+			{
+				reg++;
+				continue;
+			}
+
+			// extend the range as long as there are dirty registers within reach
+			uint8_t first = reg;
+			uint8_t last = reg;
+
+			for (uint8_t r = reg + 1; r <= blocks[b][1] && r <= last + 1 + FUSB302_D_SHADOW_MAX_GAP; r++)
+			{
+				uint32_t bit = FUSB302_D_Register_bit(r);
+
+				if ((regs->Dirty & bit) == bit)
+				{
+					last = r;
+				}
+				else if ((bit & FUSB302_D_REGISTERS_NOFILL) == bit || (regs->Valid & bit) != bit)
+				{
+					// can't write this one as filler
+					break;
+				}
+			}
+
+			if (FUSB302_D_WriteN( fusb, first, FUSB302_D_ShadowPtr( regs, first ), last - first + 1 ) == FUSB302_D_ERROR)
+			{
+				return FUSB302_D_ERROR;
+			}
+
+			for (uint8_t r = first; r <= last; r++)
+			{
+				regs->Dirty &= ~FUSB302_D_Register_bit(r);
+				regs->Valid |= FUSB302_D_Register_bit(r) & ~FUSB302_D_REGISTERS_VOLATILE;
+			}
+
+			reg = last + 1;
+		}
+	}
+
 	return FUSB302_D_OK;
 }
 
-void FUSB302_D_Test( I2C_HandleTypeDef * hi2c, IRQn_Type irqN, uint16_t i2cAddr )
+#if FUSB302_D_STATS==true
+void FUSB302_D_GetStats( FUSB302_D_t * fusb, FUSB302_D_Stats_t * stats )
+{
+	*stats = fusb->Stats;
+}
+
+void FUSB302_D_ResetStats( FUSB302_D_t * fusb )
+{
+	fusb->Stats.Transactions = 0;
+	fusb->Stats.BytesRead = 0;
+	fusb->Stats.BytesWritten = 0;
+	fusb->Stats.Errors = 0;
+}
+#endif
+
+void FUSB302_D_Test( const FUSB302_D_Transport_t * transport, void * bus, uint16_t i2cAddr )
 {
 	FUSB302_D_t fusb;
 //	FUSB302_D_Error_t error;
 
-	FUSB302_D_Init( &fusb, hi2c, irqN, i2cAddr );
+	FUSB302_D_Init( &fusb, transport, bus, i2cAddr );
 
 	if (FUSB302_D_Probe( &fusb, 3, 100 ) == FUSB302_D_ERROR)
 	{
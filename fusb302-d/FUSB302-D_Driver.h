@@ -27,9 +27,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#include "FUSB302-D.h"
+#include <stddef.h>
 
-#include "hw_i2c.h"
+#include "FUSB302-D.h"
 
 
 #define FUSB302_D_DEFAULT_ADDRESS 0b0100010 // 0x22
@@ -40,16 +40,101 @@
  // Bus wait after each command (1 microsec)
  #define FUSB302_D_BUS_FREE_TIME 0
 
+ // Count bus transactions and transferred bytes (for profiling)
+#if !defined(FUSB302_D_STATS)
+#define FUSB302_D_STATS false
+#endif
+
+ // Number of queued asynchronous transfers (per device)
+#if !defined(FUSB302_D_XFER_QUEUE_LEN)
+#define FUSB302_D_XFER_QUEUE_LEN 4
+#endif
+
+ // Max payload of a single write (register address excluded)
+#if !defined(FUSB302_D_XFER_MAX_WRITE)
+#define FUSB302_D_XFER_MAX_WRITE 63
+#endif
+
+ // Max number of driver instances that can be looked up from the I2C callbacks (one per port, as many as a default hub)
+#if !defined(FUSB302_D_MAX_INSTANCES)
+#define FUSB302_D_MAX_INSTANCES 8
+#endif
+
+ // Max time (ms) a blocking call waits for the transfer queue (needs the transport GetTime)
+#if !defined(FUSB302_D_TIMEOUT_MS)
+#define FUSB302_D_TIMEOUT_MS 1000
+#endif
+
  typedef enum {
 	 FUSB302_D_OK = 0,
-	 FUSB302_D_ERROR = !FUSB302_D_OK
+	 FUSB302_D_ERROR = !FUSB302_D_OK,
+	 FUSB302_D_BUSY = 2	// (transport) bus is used by another device
  } FUSB302_D_Error_t;
 
+ typedef struct FUSB302_D_s FUSB302_D_t;
+
+ /**
+  * Transport operations (the bus backend), <bus> is the backend specific bus context given to FUSB302_D_Init().
+  * Addresses are 7-bit, write buffers start with the register address.
+  *
+  * Required: Write and WriteRead (or Read)
+  * Submit (optional) starts a write (rlen == 0) or write-then-read without waiting and returns FUSB302_D_BUSY if the
+  * bus is taken, the backend then calls FUSB302_D_XferComplete() on completion (from its interrupt context).
+  * Without Submit asynchronous transfers complete right away.
+  * Abort (optional) stops the submitted transfer without calling FUSB302_D_XferComplete().
+  * IrqEnable/IrqDisable (optional) guard the transfer queue against the completion interrupt.
+  * GetTime (optional) returns a monotonic millisecond time, without it blocking calls wait forever.
+  */
+ typedef struct {
+	 FUSB302_D_Error_t (*Write)( void * bus, uint16_t addr, uint8_t * buf, uint16_t len );
+	 FUSB302_D_Error_t (*Read)( void * bus, uint16_t addr, uint8_t * buf, uint16_t len );
+	 FUSB302_D_Error_t (*WriteRead)( void * bus, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen );
+	 FUSB302_D_Error_t (*Submit)( void * bus, FUSB302_D_t * fusb, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen );
+	 FUSB302_D_Error_t (*Probe)( void * bus, uint16_t addr, uint8_t ntrials, uint32_t timeout );
+	 void (*Abort)( void * bus );
+	 void (*IrqEnable)( void * bus );
+	 void (*IrqDisable)( void * bus );
+	 uint32_t (*GetTime)( void * bus );
+ } FUSB302_D_Transport_t;
+
+ /**
+  * Completion callback of an asynchronous transfer.
+  * NOTE: called from the I2C interrupt context.
+  */
+ typedef void (*FUSB302_D_Callback_t)( FUSB302_D_t * fusb, FUSB302_D_Error_t result, void * ctx );
+
+ typedef struct {
+	 uint8_t Dir;
+	 uint8_t Len;
+	 uint8_t * Data;
+	 FUSB302_D_Callback_t Callback;
+	 void * Ctx;
+	 // register address followed by the payload to write
+	 uint8_t Buf[1 + FUSB302_D_XFER_MAX_WRITE];
+ } FUSB302_D_Xfer_t;
+
  typedef struct {
- 	I2C_HandleTypeDef * Hi2c;
+	 uint32_t Transactions;
+	 uint32_t BytesRead;
+	 uint32_t BytesWritten;
+	 uint32_t Errors;
+ } FUSB302_D_Stats_t;
+
+ struct FUSB302_D_s {
+	const FUSB302_D_Transport_t * Transport;
+	void * Bus;
  	uint16_t Addr;
-	IRQn_Type IrqN;
- } FUSB302_D_t;
+
+	// asynchronous transfer queue, the head is the one on the bus
+	FUSB302_D_Xfer_t Queue[FUSB302_D_XFER_QUEUE_LEN];
+	volatile uint8_t QueueHead;
+	volatile uint8_t QueueCount;
+	volatile bool Active;
+
+#if FUSB302_D_STATS==true
+	FUSB302_D_Stats_t Stats;
+#endif
+ };
 
  typedef struct {
 	 uint8_t DeviceID;
@@ -76,10 +161,34 @@
 	 uint8_t Status1;
 	 uint8_t Interrupt;
 	 uint8_t FIFOs;
+
+	 // shadow metadata, one bit per register (see FUSB302_D_Register_bit())
+	 uint32_t Dirty;	// changed in the shadow, not yet written to the device
+	 uint32_t Valid;	// shadow holds the device value
  } FUSB302_D_Registers_st;
 
+ // the register fields above mirror 0x01-0x10 and 0x3C-0x43 in this order
+#define FUSB302_D_REGISTER_COUNT	24
+
+#define FUSB302_D_Register_index( __r__ )	( (__r__) <= FUSB302_D_Register_Control4 ? (__r__) - FUSB302_D_Register_DeviceID : (__r__) - FUSB302_D_Register_Status0a + 16 )
+#define FUSB302_D_Register_bit( __r__ )		( 1UL << FUSB302_D_Register_index(__r__) )
+
+ // registers changing on their own (status, interrupt latches, fifo), these are never served from the shadow
+#define FUSB302_D_REGISTERS_VOLATILE		( FUSB302_D_Register_bit(FUSB302_D_Register_Status0a) | FUSB302_D_Register_bit(FUSB302_D_Register_Status1a) | \
+											  FUSB302_D_Register_bit(FUSB302_D_Register_Interrupta) | FUSB302_D_Register_bit(FUSB302_D_Register_Interruptb) | \
+											  FUSB302_D_Register_bit(FUSB302_D_Register_Status0) | FUSB302_D_Register_bit(FUSB302_D_Register_Status1) | \
+											  FUSB302_D_Register_bit(FUSB302_D_Register_Interrupt) | FUSB302_D_Register_bit(FUSB302_D_Register_FIFOs) )
+
+ // registers that must not be written as filler when coalescing writes
+#define FUSB302_D_REGISTERS_NOFILL			( FUSB302_D_REGISTERS_VOLATILE | FUSB302_D_Register_bit(FUSB302_D_Register_DeviceID) | FUSB302_D_Register_bit(FUSB302_D_Register_Reset) )
+
+ // max number of clean registers written in between to merge two dirty ranges into one transaction
+#if !defined(FUSB302_D_SHADOW_MAX_GAP)
+#define FUSB302_D_SHADOW_MAX_GAP	2
+#endif
+
 
- FUSB302_D_Error_t FUSB302_D_Init( FUSB302_D_t * fusb, I2C_HandleTypeDef * hi2c, IRQn_Type irqN, uint16_t i2cAddr );
+ FUSB302_D_Error_t FUSB302_D_Init( FUSB302_D_t * fusb, const FUSB302_D_Transport_t * transport, void * bus, uint16_t i2cAddr );
  FUSB302_D_Error_t FUSB302_D_DeInit( FUSB302_D_t * fusb );
 
  FUSB302_D_Error_t FUSB302_D_Probe( FUSB302_D_t * fusb, uint8_t ntrials, uint32_t timeout  );
@@ -89,8 +198,43 @@
  FUSB302_D_Error_t FUSB302_D_Write( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t data );
  FUSB302_D_Error_t FUSB302_D_WriteN( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t * data, uint8_t n);
 
+ /**
+  * Queue a transfer and return right away, <callback> (optional) is called on completion from the I2C interrupt.
+  * <data> of a read must stay valid until completion, the payload of a write is copied.
+  */
+ FUSB302_D_Error_t FUSB302_D_ReadAsync( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t * data, uint8_t n, FUSB302_D_Callback_t callback, void * ctx );
+ FUSB302_D_Error_t FUSB302_D_WriteAsync( FUSB302_D_t * fusb, FUSB302_D_Register_t reg, uint8_t * data, uint8_t n, FUSB302_D_Callback_t callback, void * ctx );
+
+ bool FUSB302_D_IsBusy( FUSB302_D_t * fusb );
+
+ // gives up on everything queued (eg a completion that never came), callbacks get FUSB302_D_ERROR
+ void FUSB302_D_Abort( FUSB302_D_t * fusb );
+
+ // to be called by the transport backend once a submitted transfer is done
+ void FUSB302_D_XferComplete( FUSB302_D_t * fusb, FUSB302_D_Error_t result );
+
+ // transport time source (0 if there is none)
+ uint32_t FUSB302_D_GetTime( FUSB302_D_t * fusb );
+ void FUSB302_D_DelayMs( FUSB302_D_t * fusb, uint32_t ms );
+
+ /**
+  * Register shadow
+  * Set only changes the shadow and marks the register dirty, Commit writes all dirty registers with as few auto-increment
+  * transactions as possible. Read only goes to the bus for volatile registers or if the shadow is not valid.
+  */
+ uint8_t * FUSB302_D_ShadowPtr( FUSB302_D_Registers_st * regs, FUSB302_D_Register_t reg );
+ void FUSB302_D_ShadowSet( FUSB302_D_Registers_st * regs, FUSB302_D_Register_t reg, uint8_t value );
+ FUSB302_D_Error_t FUSB302_D_ShadowRead( FUSB302_D_t * fusb, FUSB302_D_Registers_st * regs, FUSB302_D_Register_t reg );
+ FUSB302_D_Error_t FUSB302_D_ShadowLoad( FUSB302_D_t * fusb, FUSB302_D_Registers_st * regs );
+ FUSB302_D_Error_t FUSB302_D_ShadowCommit( FUSB302_D_t * fusb, FUSB302_D_Registers_st * regs );
+
+#if FUSB302_D_STATS==true
+ void FUSB302_D_GetStats( FUSB302_D_t * fusb, FUSB302_D_Stats_t * stats );
+ void FUSB302_D_ResetStats( FUSB302_D_t * fusb );
+#endif
+
 
- void FUSB302_D_Test( I2C_HandleTypeDef * hi2c, IRQn_Type irqN, uint16_t i2cAddr );
+ void FUSB302_D_Test( const FUSB302_D_Transport_t * transport, void * bus, uint16_t i2cAddr );
 
 #ifdef __cplusplus
  }
@@ -0,0 +1,131 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#include "FUSB302-D_Transport_Linux.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+
+#ifndef DBG
+#define DBG(format, ...)
+#endif
+
+
+static FUSB302_D_Error_t Linux_Write( void * bus, uint16_t addr, uint8_t * buf, uint16_t len );
+static FUSB302_D_Error_t Linux_Read( void * bus, uint16_t addr, uint8_t * buf, uint16_t len );
+static FUSB302_D_Error_t Linux_WriteRead( void * bus, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen );
+static FUSB302_D_Error_t Linux_Transfer( FUSB302_D_Linux_Bus_t * b, struct i2c_msg * msgs, uint32_t n );
+static uint32_t Linux_GetTime( void * bus );
+
+
+const FUSB302_D_Transport_t FUSB302_D_Transport_Linux = {
+	.Write = Linux_Write,
+	.Read = Linux_Read,
+	.WriteRead = Linux_WriteRead,
+	.Submit = NULL,
+	.Probe = NULL,
+	.Abort = NULL,
+	.IrqEnable = NULL,
+	.IrqDisable = NULL,
+	.GetTime = Linux_GetTime
+};
+
+
+FUSB302_D_Error_t FUSB302_D_Linux_Open( FUSB302_D_Linux_Bus_t * bus, const char * device )
+{
+	bus->Fd = open( device, O_RDWR );
+
+	if (bus->Fd < 0)
+	{
+		DBG("failed to open %s\n", device);
+		return FUSB302_D_ERROR;
+	}
+
+	return FUSB302_D_OK;
+}
+
+void FUSB302_D_Linux_Close( FUSB302_D_Linux_Bus_t * bus )
+{
+	if (bus->Fd >= 0)
+	{
+		close( bus->Fd );
+		bus->Fd = -1;
+	}
+}
+
+uint32_t FUSB302_D_Linux_GetTime( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static FUSB302_D_Error_t Linux_Transfer( FUSB302_D_Linux_Bus_t * b, struct i2c_msg * msgs, uint32_t n )
+{
+	struct i2c_rdwr_ioctl_data data = {
+		.msgs = msgs,
+		.nmsgs = n
+	};
+
+	if (ioctl( b->Fd, I2C_RDWR, &data ) < 0)
+	{
+		return FUSB302_D_ERROR;
+	}
+
+	return FUSB302_D_OK;
+}
+
+static FUSB302_D_Error_t Linux_Write( void * bus, uint16_t addr, uint8_t * buf, uint16_t len )
+{
+	struct i2c_msg msg = { .addr = addr, .flags = 0, .len = len, .buf = buf };
+
+	return Linux_Transfer( (FUSB302_D_Linux_Bus_t*)bus, &msg, 1 );
+}
+
+static FUSB302_D_Error_t Linux_Read( void * bus, uint16_t addr, uint8_t * buf, uint16_t len )
+{
+	struct i2c_msg msg = { .addr = addr, .flags = I2C_M_RD, .len = len, .buf = buf };
+
+	return Linux_Transfer( (FUSB302_D_Linux_Bus_t*)bus, &msg, 1 );
+}
+
+static FUSB302_D_Error_t Linux_WriteRead( void * bus, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen )
+{
+	// one transaction with repeated start
+	struct i2c_msg msgs[2] = {
+		{ .addr = addr, .flags = 0, .len = wlen, .buf = wbuf },
+		{ .addr = addr, .flags = I2C_M_RD, .len = rlen, .buf = rbuf }
+	};
+
+	return Linux_Transfer( (FUSB302_D_Linux_Bus_t*)bus, &msgs[0], 2 );
+}
+
+static uint32_t Linux_GetTime( void * bus )
+{
+	(void)bus;
+
+	return FUSB302_D_Linux_GetTime();
+}
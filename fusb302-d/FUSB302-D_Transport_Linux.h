@@ -0,0 +1,47 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#ifndef __FUSB302_D_TRANSPORT_LINUX_H_
+#define __FUSB302_D_TRANSPORT_LINUX_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "FUSB302-D_Driver.h"
+
+ typedef struct {
+	 int Fd;
+ } FUSB302_D_Linux_Bus_t;
+
+ // blocking transfers through i2c-dev (combined write-then-read with I2C_RDWR), CLOCK_MONOTONIC time
+ extern const FUSB302_D_Transport_t FUSB302_D_Transport_Linux;
+
+ // <device> eg "/dev/i2c-1"
+ FUSB302_D_Error_t FUSB302_D_Linux_Open( FUSB302_D_Linux_Bus_t * bus, const char * device );
+ void FUSB302_D_Linux_Close( FUSB302_D_Linux_Bus_t * bus );
+
+ // monotonic millisecond time, also usable by the application
+ uint32_t FUSB302_D_Linux_GetTime( void );
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __FUSB302_D_TRANSPORT_LINUX_H_ */
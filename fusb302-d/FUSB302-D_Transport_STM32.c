@@ -0,0 +1,346 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#include "FUSB302-D_Transport_STM32.h"
+
+
+#ifndef DBG
+#define DBG(format, ...)
+#endif
+
+#define STM32_I2C_TIMEOUT 1000
+
+
+static FUSB302_D_STM32_Bus_t * Buses[FUSB302_D_STM32_MAX_BUSES];
+
+static FUSB302_D_Error_t STM32_Write( void * bus, uint16_t addr, uint8_t * buf, uint16_t len );
+static FUSB302_D_Error_t STM32_Read( void * bus, uint16_t addr, uint8_t * buf, uint16_t len );
+static FUSB302_D_Error_t STM32_WriteRead( void * bus, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen );
+static FUSB302_D_Error_t STM32_Submit( void * bus, FUSB302_D_t * fusb, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen );
+static FUSB302_D_Error_t STM32_Probe( void * bus, uint16_t addr, uint8_t ntrials, uint32_t timeout );
+static void STM32_Abort( void * bus );
+static void STM32_IrqEnable( void * bus );
+static void STM32_IrqDisable( void * bus );
+static uint32_t STM32_GetTime( void * bus );
+
+static FUSB302_D_STM32_Bus_t * STM32_Lookup( I2C_HandleTypeDef * hi2c );
+static void STM32_Done( FUSB302_D_STM32_Bus_t * b, FUSB302_D_Error_t result );
+
+
+const FUSB302_D_Transport_t FUSB302_D_Transport_STM32 = {
+	.Write = STM32_Write,
+	.Read = STM32_Read,
+	.WriteRead = STM32_WriteRead,
+	.Submit = STM32_Submit,
+	.Probe = STM32_Probe,
+	.Abort = STM32_Abort,
+	.IrqEnable = STM32_IrqEnable,
+	.IrqDisable = STM32_IrqDisable,
+	.GetTime = STM32_GetTime
+};
+
+const FUSB302_D_Transport_t FUSB302_D_Transport_STM32_Polling = {
+	.Write = STM32_Write,
+	.Read = STM32_Read,
+	.WriteRead = STM32_WriteRead,
+	.Submit = NULL,
+	.Probe = STM32_Probe,
+	.Abort = NULL,
+	.IrqEnable = NULL,
+	.IrqDisable = NULL,
+	.GetTime = STM32_GetTime
+};
+
+
+FUSB302_D_Error_t FUSB302_D_STM32_InitBus( FUSB302_D_STM32_Bus_t * bus, I2C_HandleTypeDef * hi2c, IRQn_Type irqN )
+{
+	bus->Hi2c = hi2c;
+	bus->IrqN = irqN;
+#if FUSB302_D_USE_DMA==true
+	// none yet, masking the I2C interrupt twice is harmless
+	bus->TxDmaIrqN = irqN;
+	bus->RxDmaIrqN = irqN;
+#endif
+	bus->Active = NULL;
+	bus->ReadPending = false;
+
+	// register so the HAL callbacks can find us
+	uint8_t i = 0;
+	while (i < FUSB302_D_STM32_MAX_BUSES && Buses[i] != NULL && Buses[i] != bus)
+	{
+		i++;
+	}
+	if (i == FUSB302_D_STM32_MAX_BUSES)
+	{
+		DBG("too many buses\n");
+		return FUSB302_D_ERROR;
+	}
+	Buses[i] = bus;
+
+	HAL_NVIC_SetPriority( irqN, 0, 1);
+
+	return FUSB302_D_OK;
+}
+
+#if FUSB302_D_USE_DMA==true
+void FUSB302_D_STM32_SetDmaIrq( FUSB302_D_STM32_Bus_t * bus, IRQn_Type txIrqN, IRQn_Type rxIrqN )
+{
+	bus->TxDmaIrqN = txIrqN;
+	bus->RxDmaIrqN = rxIrqN;
+}
+#endif
+
+static FUSB302_D_Error_t STM32_Write( void * bus, uint16_t addr, uint8_t * buf, uint16_t len )
+{
+	FUSB302_D_STM32_Bus_t * b = (FUSB302_D_STM32_Bus_t*)bus;
+
+	HAL_StatusTypeDef status = HAL_I2C_Master_Transmit( b->Hi2c, (addr << 1) + FUSB302_D_WRITE, buf, len, STM32_I2C_TIMEOUT );
+
+	if (HAL_OK != status){
+
+		DBG("write error %d\n", status);
+		return FUSB302_D_ERROR;
+	}
+
+	return FUSB302_D_OK;
+}
+
+static FUSB302_D_Error_t STM32_Read( void * bus, uint16_t addr, uint8_t * buf, uint16_t len )
+{
+	FUSB302_D_STM32_Bus_t * b = (FUSB302_D_STM32_Bus_t*)bus;
+
+	HAL_StatusTypeDef status = HAL_I2C_Master_Receive( b->Hi2c, (addr << 1) + FUSB302_D_READ, buf, len, STM32_I2C_TIMEOUT );
+
+	if (HAL_OK != status){
+
+		DBG("read error %d\n", status);
+		return FUSB302_D_ERROR;
+	}
+
+	return FUSB302_D_OK;
+}
+
+static FUSB302_D_Error_t STM32_WriteRead( void * bus, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen )
+{
+	FUSB302_D_STM32_Bus_t * b = (FUSB302_D_STM32_Bus_t*)bus;
+
+	if (wlen != 1)
+	{
+		return FUSB302_D_ERROR;
+	}
+
+	// register address, repeated start, data
+	HAL_StatusTypeDef status = HAL_I2C_Mem_Read( b->Hi2c, addr << 1, wbuf[0], I2C_MEMADD_SIZE_8BIT, rbuf, rlen, STM32_I2C_TIMEOUT );
+
+	if (HAL_OK != status){
+
+		DBG("read error %d\n", status);
+		return FUSB302_D_ERROR;
+	}
+
+	return FUSB302_D_OK;
+}
+
+static FUSB302_D_Error_t STM32_Submit( void * bus, FUSB302_D_t * fusb, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen )
+{
+	FUSB302_D_STM32_Bus_t * b = (FUSB302_D_STM32_Bus_t*)bus;
+	HAL_StatusTypeDef status;
+
+	if (b->Active != NULL)
+	{
+		return FUSB302_D_BUSY;
+	}
+
+	b->Active = fusb;
+	b->Addr = addr;
+	b->RBuf = rbuf;
+	b->RLen = rlen;
+	b->ReadPending = rlen > 0;
+
+	// a read continues with a repeated start once the register pointer is sent
+	uint32_t options = rlen > 0 ? I2C_FIRST_FRAME : I2C_FIRST_AND_LAST_FRAME;
+
+#if FUSB302_D_USE_DMA==true
+	if (wlen >= FUSB302_D_DMA_MIN_LEN)
+	{
+		status = HAL_I2C_Master_Sequential_Transmit_DMA( b->Hi2c, (addr << 1) + FUSB302_D_WRITE, wbuf, wlen, options );
+	}
+	else
+#endif
+	{
+		status = HAL_I2C_Master_Sequential_Transmit_IT( b->Hi2c, (addr << 1) + FUSB302_D_WRITE, wbuf, wlen, options );
+	}
+
+	if (status != HAL_OK)
+	{
+		b->Active = NULL;
+		b->ReadPending = false;
+
+		return status == HAL_BUSY ? FUSB302_D_BUSY : FUSB302_D_ERROR;
+	}
+
+	return FUSB302_D_OK;
+}
+
+static FUSB302_D_Error_t STM32_Probe( void * bus, uint16_t addr, uint8_t ntrials, uint32_t timeout )
+{
+	FUSB302_D_STM32_Bus_t * b = (FUSB302_D_STM32_Bus_t*)bus;
+
+	HAL_StatusTypeDef status = HAL_I2C_IsDeviceReady( b->Hi2c, addr << 1, ntrials, timeout);
+
+	if (status != HAL_OK)
+	{
+		return FUSB302_D_ERROR;
+	}
+
+	return FUSB302_D_OK;
+}
+
+static void STM32_Abort( void * bus )
+{
+	FUSB302_D_STM32_Bus_t * b = (FUSB302_D_STM32_Bus_t*)bus;
+
+	if (b->Active == NULL)
+	{
+		return;
+	}
+
+	HAL_I2C_Master_Abort_IT( b->Hi2c, b->Addr << 1 );
+
+	// late HAL callbacks are ignored (no lookup match)
+	b->Active = NULL;
+	b->ReadPending = false;
+}
+
+static void STM32_IrqEnable( void * bus )
+{
+	FUSB302_D_STM32_Bus_t * b = (FUSB302_D_STM32_Bus_t*)bus;
+
+	HAL_NVIC_EnableIRQ( b->IrqN );
+#if FUSB302_D_USE_DMA==true
+	HAL_NVIC_EnableIRQ( b->TxDmaIrqN );
+	HAL_NVIC_EnableIRQ( b->RxDmaIrqN );
+#endif
+}
+
+static void STM32_IrqDisable( void * bus )
+{
+	FUSB302_D_STM32_Bus_t * b = (FUSB302_D_STM32_Bus_t*)bus;
+
+	HAL_NVIC_DisableIRQ( b->IrqN );
+#if FUSB302_D_USE_DMA==true
+	HAL_NVIC_DisableIRQ( b->TxDmaIrqN );
+	HAL_NVIC_DisableIRQ( b->RxDmaIrqN );
+#endif
+}
+
+static uint32_t STM32_GetTime( void * bus )
+{
+	(void)bus;
+
+	return HAL_GetTick();
+}
+
+static FUSB302_D_STM32_Bus_t * STM32_Lookup( I2C_HandleTypeDef * hi2c )
+{
+	for (uint8_t i = 0; i < FUSB302_D_STM32_MAX_BUSES; i++)
+	{
+		if (Buses[i] != NULL && Buses[i]->Hi2c == hi2c && Buses[i]->Active != NULL)
+		{
+			return Buses[i];
+		}
+	}
+	return NULL;
+}
+
+static void STM32_Done( FUSB302_D_STM32_Bus_t * b, FUSB302_D_Error_t result )
+{
+	FUSB302_D_t * fusb = b->Active;
+
+	// free the bus first, completion may already submit the next transfer
+	b->Active = NULL;
+	b->ReadPending = false;
+
+	FUSB302_D_XferComplete( fusb, result );
+}
+
+void FUSB302_D_I2C_TxCpltHandler( I2C_HandleTypeDef * hi2c )
+{
+	FUSB302_D_STM32_Bus_t * b = STM32_Lookup( hi2c );
+
+	if (b == NULL)
+	{
+		return;
+	}
+
+	if (b->ReadPending)
+	{
+		HAL_StatusTypeDef status;
+
+		b->ReadPending = false;
+
+#if FUSB302_D_USE_DMA==true
+		if (b->RLen >= FUSB302_D_DMA_MIN_LEN)
+		{
+			status = HAL_I2C_Master_Sequential_Receive_DMA( hi2c, (b->Addr << 1) + FUSB302_D_READ, b->RBuf, b->RLen, I2C_LAST_FRAME );
+		}
+		else
+#endif
+		{
+			status = HAL_I2C_Master_Sequential_Receive_IT( hi2c, (b->Addr << 1) + FUSB302_D_READ, b->RBuf, b->RLen, I2C_LAST_FRAME );
+		}
+
+		if (status != HAL_OK)
+		{
+			STM32_Done( b, FUSB302_D_ERROR );
+		}
+		return;
+	}
+
+	STM32_Done( b, FUSB302_D_OK );
+}
+
+void FUSB302_D_I2C_RxCpltHandler( I2C_HandleTypeDef * hi2c )
+{
+	FUSB302_D_STM32_Bus_t * b = STM32_Lookup( hi2c );
+
+	if (b == NULL)
+	{
+		return;
+	}
+
+	STM32_Done( b, FUSB302_D_OK );
+}
+
+void FUSB302_D_I2C_ErrorHandler( I2C_HandleTypeDef * hi2c )
+{
+	FUSB302_D_STM32_Bus_t * b = STM32_Lookup( hi2c );
+
+	if (b == NULL)
+	{
+		return;
+	}
+
+	if (HAL_I2C_GetError( hi2c ) == HAL_I2C_ERROR_AF)
+	{
+		DBG("slave didn't acknowledge\n");
+	}
+
+	STM32_Done( b, FUSB302_D_ERROR );
+}
@@ -0,0 +1,85 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#ifndef __FUSB302_D_TRANSPORT_STM32_H_
+#define __FUSB302_D_TRANSPORT_STM32_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "FUSB302-D_Driver.h"
+
+#include "hw_i2c.h"
+
+ // Use DMA instead of IT transfers for payloads of at least FUSB302_D_DMA_MIN_LEN bytes (eg the rx/tx fifo),
+ // the I2C handle must be linked to DMA channels and buffers must be DMA accessible
+#if !defined(FUSB302_D_USE_DMA)
+#define FUSB302_D_USE_DMA false
+#endif
+
+#if !defined(FUSB302_D_DMA_MIN_LEN)
+#define FUSB302_D_DMA_MIN_LEN 4
+#endif
+
+ // Max number of I2C peripherals that can be looked up from the HAL callbacks
+#if !defined(FUSB302_D_STM32_MAX_BUSES)
+#define FUSB302_D_STM32_MAX_BUSES 1
+#endif
+
+ typedef struct {
+	 I2C_HandleTypeDef * Hi2c;
+	 IRQn_Type IrqN;
+#if FUSB302_D_USE_DMA==true
+	 // the HAL callbacks also run from the DMA stream interrupts
+	 IRQn_Type TxDmaIrqN;
+	 IRQn_Type RxDmaIrqN;
+#endif
+
+	 // transfer on the bus
+	 FUSB302_D_t * volatile Active;
+	 uint16_t Addr;
+	 uint8_t * RBuf;
+	 uint16_t RLen;
+	 volatile bool ReadPending;
+ } FUSB302_D_STM32_Bus_t;
+
+ // transfers driven from the I2C interrupt (IT or DMA)
+ extern const FUSB302_D_Transport_t FUSB302_D_Transport_STM32;
+
+ // blocking HAL transfers only
+ extern const FUSB302_D_Transport_t FUSB302_D_Transport_STM32_Polling;
+
+ FUSB302_D_Error_t FUSB302_D_STM32_InitBus( FUSB302_D_STM32_Bus_t * bus, I2C_HandleTypeDef * hi2c, IRQn_Type irqN );
+
+#if FUSB302_D_USE_DMA==true
+ // DMA stream interrupts of the I2C handle, masked together with the I2C interrupt (call after FUSB302_D_STM32_InitBus())
+ void FUSB302_D_STM32_SetDmaIrq( FUSB302_D_STM32_Bus_t * bus, IRQn_Type txIrqN, IRQn_Type rxIrqN );
+#endif
+
+ // to be called from HAL_I2C_MasterTxCpltCallback(), HAL_I2C_MasterRxCpltCallback() and HAL_I2C_ErrorCallback()
+ void FUSB302_D_I2C_TxCpltHandler( I2C_HandleTypeDef * hi2c );
+ void FUSB302_D_I2C_RxCpltHandler( I2C_HandleTypeDef * hi2c );
+ void FUSB302_D_I2C_ErrorHandler( I2C_HandleTypeDef * hi2c );
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __FUSB302_D_TRANSPORT_STM32_H_ */
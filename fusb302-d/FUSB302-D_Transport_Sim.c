@@ -0,0 +1,1524 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#include "FUSB302-D_Transport_Sim.h"
+
+#include <string.h>
+
+#include "PD.h"
+
+
+#ifndef DBG
+#define DBG(format, ...)
+#endif
+
+#define REG( __sim__, __r__ )		( (__sim__)->Regs[FUSB302_D_Register_index(__r__)] )
+
+#define SIM_isRegister( __a__ )		( (FUSB302_D_Register_DeviceID <= (__a__) && (__a__) <= FUSB302_D_Register_Control4) || \
+									  (FUSB302_D_Register_Status0a <= (__a__) && (__a__) <= FUSB302_D_Register_FIFOs) )
+
+// BMC frame: preamble, SOP, 4b5b coded payload, crc, EOP at 300kbit/s
+#define SIM_BMC_BITS( __len__ )		( 64 + 20 + (__len__) * 10 + 40 + 5 )
+#define SIM_WIRE_US( __len__ )		( SIM_BMC_BITS(__len__) * 10 / 3 )
+#define SIM_HARD_RESET_US			( (64 + 20) * 10 / 3 )
+
+// a frame until its GoodCRC was received
+#define SIM_FRAME_US( __len__ )		( SIM_WIRE_US(__len__) + SIM_T_IFG_US + SIM_WIRE_US(2) )
+
+#define SIM_T_IFG_US				25
+#define SIM_T_RECEIVE_US			1100
+#define SIM_T_CC_DEBOUNCE_US		150000
+#define SIM_T_TOG_DONE_US			4000
+#define SIM_T_SEND_SOURCE_CAP_US	150000
+#define SIM_T_SENDER_RESPONSE_US	30000
+#define SIM_T_SRC_RECOVER_US		700000
+#define SIM_T_PPS_TIMEOUT_US		14000000
+#define SIM_N_RETRY_COUNT			3
+#define SIM_N_CAPS_COUNT			50
+
+#define SIM_VSAFE5V_MV				5000
+#define SIM_VBUSOK_MV				4000
+
+#define SIM_PWR_PD					( FUSB302_D_Power_PWR_InternalOscillator | FUSB302_D_Power_PWR_RxAndCur4MB )
+
+
+static FUSB302_D_Error_t Sim_Write( void * bus, uint16_t addr, uint8_t * buf, uint16_t len );
+static FUSB302_D_Error_t Sim_Read( void * bus, uint16_t addr, uint8_t * buf, uint16_t len );
+static FUSB302_D_Error_t Sim_WriteRead( void * bus, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen );
+static FUSB302_D_Error_t Sim_Probe( void * bus, uint16_t addr, uint8_t ntrials, uint32_t timeout );
+static uint32_t Sim_GetTime( void * bus );
+
+static void Sim_Reset( FUSB302_D_Sim_t * sim );
+static void Sim_PdReset( FUSB302_D_Sim_t * sim );
+static void Sim_AdvanceTo( FUSB302_D_Sim_t * sim, uint64_t us );
+static void Sim_Update( FUSB302_D_Sim_t * sim );
+static bool Sim_Transaction( FUSB302_D_Sim_t * sim, uint16_t addr, uint16_t wlen, uint16_t rlen );
+
+static uint8_t Sim_ReadReg( FUSB302_D_Sim_t * sim );
+static void Sim_WriteReg( FUSB302_D_Sim_t * sim, uint8_t value );
+
+static void Sim_TxToken( FUSB302_D_Sim_t * sim, uint8_t token );
+static void Sim_StartTx( FUSB302_D_Sim_t * sim );
+static void Sim_StartHardReset( FUSB302_D_Sim_t * sim );
+static void Sim_TxDone( FUSB302_D_Sim_t * sim );
+
+static bool Sim_IsListening( FUSB302_D_Sim_t * sim );
+static bool Sim_PushRx( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_Frame_t * frame );
+static bool Sim_Receive( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_Frame_t * frame );
+static bool Sim_IsToggling( FUSB302_D_Sim_t * sim );
+static bool Sim_HasRd( FUSB302_D_Sim_t * sim, uint8_t pin );
+static uint16_t Sim_CcMv( FUSB302_D_Sim_t * sim, uint8_t pin );
+static void Sim_TogDone( FUSB302_D_Sim_t * sim );
+
+static void Source_Goto( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_SrcState_t state );
+static void Source_GotoIn( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_SrcState_t state, uint32_t us );
+static void Source_Send( FUSB302_D_Sim_t * sim, uint16_t command, uint32_t * objects, uint8_t n );
+static void Source_SendChunk( FUSB302_D_Sim_t * sim, uint8_t type, uint16_t extHeader, const uint8_t * data, uint8_t len );
+static void Source_Ready( FUSB302_D_Sim_t * sim );
+static bool Source_ReceiveExtended( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_Frame_t * frame, uint8_t type );
+static void Source_Run( FUSB302_D_Sim_t * sim );
+static void Source_TxDone( FUSB302_D_Sim_t * sim );
+static void Source_OnSent( FUSB302_D_Sim_t * sim, uint16_t header, bool acked );
+static bool Source_Receive( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_Frame_t * frame );
+static void Source_HardReset( FUSB302_D_Sim_t * sim, bool signal );
+
+
+const FUSB302_D_Transport_t FUSB302_D_Transport_Sim = {
+	.Write = Sim_Write,
+	.Read = Sim_Read,
+	.WriteRead = Sim_WriteRead,
+	.Submit = NULL,
+	.Probe = Sim_Probe,
+	.Abort = NULL,
+	.IrqEnable = NULL,
+	.IrqDisable = NULL,
+	.GetTime = Sim_GetTime
+};
+
+static const uint16_t RpMv[] = {
+	[FUSB302_D_Sim_Rp_Default] = 410,
+	[FUSB302_D_Sim_Rp_1A5] = 920,
+	[FUSB302_D_Sim_Rp_3A0] = 1680
+};
+
+
+void FUSB302_D_Sim_Init( FUSB302_D_Sim_t * sim )
+{
+	memset( sim, 0, sizeof(FUSB302_D_Sim_t) );
+
+	sim->Addr = FUSB302_D_DEFAULT_ADDRESS;
+	sim->ClockHz = 400000;
+	sim->IdleStepUs = 10;
+	sim->IntN = true;
+
+	// 5V 3A
+	sim->Source.Pdos[0] = PDO_SrcCap_SupplyType_Fixed | (100 << PDO_SrcCap_Fixed_Voltage_50mV_OFFSET) | 300;
+	sim->Source.NPdos = 1;
+
+	sim->Source.FirstCapsUs = 100000;
+	sim->Source.ResponseUs = 2000;
+	sim->Source.TransitionUs = 25000;
+	sim->Source.RxMessageId = -1;
+	sim->Source.SpecRev = PD_HeaderWord_SpecRev_2_0;
+	sim->Source.ExtendedSize = 25;	// Source_Capabilities_Extended (all zero)
+
+	Sim_Reset( sim );
+}
+
+void FUSB302_D_Sim_SetSourceCaps( FUSB302_D_Sim_t * sim, const uint32_t * pdos, uint8_t n )
+{
+	if (n > FUSB302_D_SIM_MAX_PDOS)
+	{
+		n = FUSB302_D_SIM_MAX_PDOS;
+	}
+
+	memcpy( &sim->Source.Pdos[0], pdos, n * sizeof(uint32_t) );
+	sim->Source.NPdos = n;
+}
+
+void FUSB302_D_Sim_Attach( FUSB302_D_Sim_t * sim, uint8_t cc, FUSB302_D_Sim_Rp_t rp )
+{
+	sim->Cc = cc;
+	sim->Rp = rp;
+
+	sim->Source.AttachUs = sim->NowUs;
+	sim->Source.ContractUs = 0;
+	sim->Source.PPSTimeoutUs = 0;
+	sim->Source.TxMessageId = 0;
+	sim->Source.RxMessageId = -1;
+
+	Source_GotoIn( sim, FUSB302_D_Sim_Src_WaitRd, SIM_T_CC_DEBOUNCE_US );
+
+	Sim_Update( sim );
+}
+
+void FUSB302_D_Sim_Detach( FUSB302_D_Sim_t * sim )
+{
+	sim->Cc = 0;
+	sim->VbusMv = 0;
+
+	sim->Source.TxBusy = false;
+	sim->Source.ContractUs = 0;
+	sim->Source.PPSTimeoutUs = 0;
+
+	Source_Goto( sim, FUSB302_D_Sim_Src_Detached );
+
+	Sim_Update( sim );
+}
+
+void FUSB302_D_Sim_HardReset( FUSB302_D_Sim_t * sim )
+{
+	Source_HardReset( sim, true );
+
+	Sim_Update( sim );
+}
+
+void FUSB302_D_Sim_SendMessage( FUSB302_D_Sim_t * sim, uint16_t command, const uint32_t * objects, uint8_t n )
+{
+	if (n > FUSB302_D_SIM_MAX_PDOS)
+	{
+		n = FUSB302_D_SIM_MAX_PDOS;
+	}
+
+	sim->Source.MsgCommand = command;
+	memcpy( sim->Source.Msg, objects, n * sizeof(uint32_t) );
+	sim->Source.MsgN = n;
+
+	Source_GotoIn( sim, FUSB302_D_Sim_Src_SendMessage, 0 );
+}
+
+void FUSB302_D_Sim_Advance( FUSB302_D_Sim_t * sim, uint32_t us )
+{
+	Sim_AdvanceTo( sim, sim->NowUs + us );
+}
+
+uint64_t FUSB302_D_Sim_GetTimeUs( FUSB302_D_Sim_t * sim )
+{
+	return sim->NowUs;
+}
+
+uint32_t FUSB302_D_Sim_GetContractLatencyUs( FUSB302_D_Sim_t * sim )
+{
+	if (sim->Source.ContractUs == 0)
+	{
+		return 0;
+	}
+
+	return (uint32_t)(sim->Source.ContractUs - sim->Source.AttachUs);
+}
+
+
+/**
+ * Transport
+ */
+
+static FUSB302_D_Error_t Sim_Write( void * bus, uint16_t addr, uint8_t * buf, uint16_t len )
+{
+	FUSB302_D_Sim_t * sim = (FUSB302_D_Sim_t*)bus;
+
+	if (Sim_Transaction( sim, addr, len, 0 ) == false)
+	{
+		return FUSB302_D_ERROR;
+	}
+
+	if (len > 0)
+	{
+		sim->RegPtr = buf[0];
+	}
+
+	for (uint16_t i = 1; i < len; i++)
+	{
+		Sim_WriteReg( sim, buf[i] );
+	}
+
+	Sim_Update( sim );
+
+	return FUSB302_D_OK;
+}
+
+static FUSB302_D_Error_t Sim_Read( void * bus, uint16_t addr, uint8_t * buf, uint16_t len )
+{
+	FUSB302_D_Sim_t * sim = (FUSB302_D_Sim_t*)bus;
+
+	if (Sim_Transaction( sim, addr, 0, len ) == false)
+	{
+		return FUSB302_D_ERROR;
+	}
+
+	for (uint16_t i = 0; i < len; i++)
+	{
+		buf[i] = Sim_ReadReg( sim );
+	}
+
+	Sim_Update( sim );
+
+	return FUSB302_D_OK;
+}
+
+static FUSB302_D_Error_t Sim_WriteRead( void * bus, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen )
+{
+	FUSB302_D_Sim_t * sim = (FUSB302_D_Sim_t*)bus;
+
+	if (Sim_Transaction( sim, addr, wlen, rlen ) == false)
+	{
+		return FUSB302_D_ERROR;
+	}
+
+	if (wlen > 0)
+	{
+		sim->RegPtr = wbuf[0];
+	}
+
+	for (uint16_t i = 1; i < wlen; i++)
+	{
+		Sim_WriteReg( sim, wbuf[i] );
+	}
+
+	for (uint16_t i = 0; i < rlen; i++)
+	{
+		rbuf[i] = Sim_ReadReg( sim );
+	}
+
+	Sim_Update( sim );
+
+	return FUSB302_D_OK;
+}
+
+static FUSB302_D_Error_t Sim_Probe( void * bus, uint16_t addr, uint8_t ntrials, uint32_t timeout )
+{
+	FUSB302_D_Sim_t * sim = (FUSB302_D_Sim_t*)bus;
+
+	// the model always answers right away
+	(void)ntrials;
+	(void)timeout;
+
+	return Sim_Transaction( sim, addr, 0, 0 ) ? FUSB302_D_OK : FUSB302_D_ERROR;
+}
+
+static uint32_t Sim_GetTime( void * bus )
+{
+	FUSB302_D_Sim_t * sim = (FUSB302_D_Sim_t*)bus;
+
+	// let busy waits make progress
+	Sim_AdvanceTo( sim, sim->NowUs + sim->IdleStepUs );
+
+	return (uint32_t)(sim->NowUs / 1000);
+}
+
+/**
+ * Accounts the bus time of a transaction (address, write and read bytes with start, repeated start and stop)
+ * and runs everything that happened meanwhile. Returns false if the address is not acknowledged.
+ */
+static bool Sim_Transaction( FUSB302_D_Sim_t * sim, uint16_t addr, uint16_t wlen, uint16_t rlen )
+{
+	uint32_t bits = 9 * (1 + wlen) + 2;
+
+	if (rlen > 0)
+	{
+		bits += 9 * (1 + rlen) + 1;
+	}
+
+	Sim_AdvanceTo( sim, sim->NowUs + (uint64_t)bits * 1000000 / sim->ClockHz );
+
+	sim->Stats.Transactions++;
+
+	if (addr != sim->Addr)
+	{
+		sim->Stats.Nacks++;
+		return false;
+	}
+
+	// register address included
+	sim->Stats.BytesWritten += wlen;
+	sim->Stats.BytesRead += rlen;
+
+	return true;
+}
+
+
+/**
+ * Registers
+ */
+
+static void Sim_Reset( FUSB302_D_Sim_t * sim )
+{
+	memset( &sim->Regs[0], 0, sizeof(sim->Regs) );
+
+	// power-on defaults
+	REG( sim, FUSB302_D_Register_DeviceID ) = FUSB302_D_SIM_DEVICE_ID;
+	REG( sim, FUSB302_D_Register_Switches0 ) = FUSB302_D_Switches0_PDWN1 | FUSB302_D_Switches0_PDWN2;
+	REG( sim, FUSB302_D_Register_Switches1 ) = FUSB302_D_Switches1_SPECREV_Rev2_0;
+	REG( sim, FUSB302_D_Register_Measure ) = 0x31;
+	REG( sim, FUSB302_D_Register_Slice ) = 0x60;
+	REG( sim, FUSB302_D_Register_Control0 ) = FUSB302_D_Control0_INT_MASK | FUSB302_D_Control0_HOST_CUR_DefaultUSBPower;
+	REG( sim, FUSB302_D_Register_Control2 ) = FUSB302_D_Control2_MODE_DrpPolling;
+	REG( sim, FUSB302_D_Register_Control3 ) = FUSB302_D_Control3_N_RETRIES_MASK;
+	REG( sim, FUSB302_D_Register_Power ) = FUSB302_D_Power_PWR_BandgapAndWake;
+	REG( sim, FUSB302_D_Register_OCPreg ) = 0x0F;
+
+	sim->RegPtr = 0;
+
+	sim->RxHead = 0;
+	sim->RxCount = 0;
+	sim->TxCount = 0;
+
+	Sim_PdReset( sim );
+}
+
+static void Sim_PdReset( FUSB302_D_Sim_t * sim )
+{
+	sim->TxPackRemain = 0;
+	sim->TxBusy = false;
+	sim->TxHardReset = false;
+	sim->TxRetries = 0;
+}
+
+static uint8_t Sim_ReadReg( FUSB302_D_Sim_t * sim )
+{
+	uint8_t reg = sim->RegPtr;
+	uint8_t value = 0;
+
+	if (reg == FUSB302_D_Register_FIFOs)
+	{
+		// no auto-increment on the fifo
+		if (sim->RxCount > 0)
+		{
+			value = sim->RxFifo[sim->RxHead];
+			sim->RxHead = (sim->RxHead + 1) % FUSB302_D_SIM_RX_FIFO_SIZE;
+			sim->RxCount--;
+		}
+		return value;
+	}
+
+	sim->RegPtr++;
+
+	if (SIM_isRegister(reg) == false)
+	{
+		return 0;
+	}
+
+	value = REG( sim, reg );
+
+	// interrupt latches clear on read
+	if (reg == FUSB302_D_Register_Interrupta || reg == FUSB302_D_Register_Interruptb || reg == FUSB302_D_Register_Interrupt)
+	{
+		REG( sim, reg ) = 0;
+	}
+
+	return value;
+}
+
+static void Sim_WriteReg( FUSB302_D_Sim_t * sim, uint8_t value )
+{
+	uint8_t reg = sim->RegPtr;
+
+	if (reg == FUSB302_D_Register_FIFOs)
+	{
+		Sim_TxToken( sim, value );
+		return;
+	}
+
+	sim->RegPtr++;
+
+	switch (reg)
+	{
+		case FUSB302_D_Register_Switches0:
+		case FUSB302_D_Register_Switches1:
+		case FUSB302_D_Register_Measure:
+		case FUSB302_D_Register_Slice:
+		case FUSB302_D_Register_Mask1:
+		case FUSB302_D_Register_Power:
+		case FUSB302_D_Register_OCPreg:
+		case FUSB302_D_Register_Maska:
+		case FUSB302_D_Register_Maskb:
+		case FUSB302_D_Register_Control4:
+			REG( sim, reg ) = value;
+			break;
+
+		case FUSB302_D_Register_Control0:
+			REG( sim, reg ) = value & ~(FUSB302_D_Control0_TX_FLUSH | FUSB302_D_Control0_TX_START);
+			if (value & FUSB302_D_Control0_TX_FLUSH)
+			{
+				sim->TxCount = 0;
+				sim->TxPackRemain = 0;
+			}
+			if (value & FUSB302_D_Control0_TX_START)
+			{
+				Sim_StartTx( sim );
+			}
+			break;
+
+		case FUSB302_D_Register_Control2:
+			REG( sim, reg ) = value;
+			// toggle logic restarts
+			if ((value & FUSB302_D_Control2_TOGGLE) == 0)
+			{
+				REG( sim, FUSB302_D_Register_Status1a ) &= ~FUSB302_D_Status1a_TOGSS;
+			}
+			break;
+
+		case FUSB302_D_Register_Control1:
+			REG( sim, reg ) = value & ~FUSB302_D_Control1_RX_FLUSH;
+			if (value & FUSB302_D_Control1_RX_FLUSH)
+			{
+				sim->RxHead = 0;
+				sim->RxCount = 0;
+			}
+			break;
+
+		case FUSB302_D_Register_Control3:
+			REG( sim, reg ) = value & ~FUSB302_D_Control3_SEND_HARD_RESET;
+			if (value & FUSB302_D_Control3_SEND_HARD_RESET)
+			{
+				Sim_StartHardReset( sim );
+			}
+			break;
+
+		case FUSB302_D_Register_Reset:
+			// self-clearing
+			if (value & FUSB302_D_Reset_SW_RES)
+			{
+				Sim_Reset( sim );
+			}
+			else if (value & FUSB302_D_Reset_PD_RESET)
+			{
+				Sim_PdReset( sim );
+			}
+			break;
+
+		default:
+			// read-only or not mapped
+			break;
+	}
+}
+
+
+/**
+ * Transmitter
+ */
+
+static void Sim_TxToken( FUSB302_D_Sim_t * sim, uint8_t token )
+{
+	if (sim->TxCount >= FUSB302_D_SIM_TX_FIFO_SIZE)
+	{
+		return;
+	}
+
+	sim->TxFifo[sim->TxCount++] = token;
+
+	if (sim->TxPackRemain > 0)
+	{
+		sim->TxPackRemain--;
+		return;
+	}
+
+	if ((token & 0xE0) == FUSB302_D_TxFIFOToken_PACKSYM)
+	{
+		sim->TxPackRemain = token & 0x1F;
+	}
+	else if (token == FUSB302_D_TxFIFOToken_TXON)
+	{
+		Sim_StartTx( sim );
+	}
+}
+
+/**
+ * Takes the next frame (ordered set, PACKSYM payload, JAM_CRC, EOP) out of the tx fifo and puts it on the wire.
+ */
+static void Sim_StartTx( FUSB302_D_Sim_t * sim )
+{
+	FUSB302_D_Sim_Frame_t frame = { .Len = 0, .Sop = 0 };
+	uint8_t k[4];
+	uint8_t nk = 0;
+	bool crc = false, eop = false, error = false;
+	uint8_t i = 0;
+
+	if (sim->TxBusy)
+	{
+		return;
+	}
+
+	while (i < sim->TxCount)
+	{
+		uint8_t token = sim->TxFifo[i++];
+
+		if (token == FUSB302_D_TxFIFOToken_TXON)
+		{
+			break;
+		}
+
+		switch (token)
+		{
+			case FUSB302_D_TxFIFOToken_SOP1:
+			case FUSB302_D_TxFIFOToken_SOP2:
+			case FUSB302_D_TxFIFOToken_SOP3:
+			case FUSB302_D_TxFIFOToken_RESET1:
+			case FUSB302_D_TxFIFOToken_RESET2:
+				if (nk < 4)
+				{
+					k[nk++] = token;
+				}
+				break;
+
+			case FUSB302_D_TxFIFOToken_JAM_CRC:
+				crc = true;
+				break;
+
+			case FUSB302_D_TxFIFOToken_EOP:
+				eop = true;
+				break;
+
+			case FUSB302_D_TxFIFOToken_TXOFF:
+				break;
+
+			default:
+				if ((token & 0xE0) == FUSB302_D_TxFIFOToken_PACKSYM)
+				{
+					uint8_t n = token & 0x1F;
+
+					if (n > sizeof(frame.Data) || i + n > sim->TxCount)
+					{
+						error = true;
+						i = sim->TxCount;
+						break;
+					}
+
+					memcpy( &frame.Data[0], &sim->TxFifo[i], n );
+					frame.Len = n;
+					i += n;
+				}
+				else
+				{
+					error = true;
+				}
+		}
+	}
+
+	// consume the frame
+	memmove( &sim->TxFifo[0], &sim->TxFifo[i], sim->TxCount - i );
+	sim->TxCount -= i;
+
+	if (nk == 4)
+	{
+		if (k[0] == FUSB302_D_TxFIFOToken_RESET1 && k[1] == FUSB302_D_TxFIFOToken_RESET1 && k[2] == FUSB302_D_TxFIFOToken_RESET1 && k[3] == FUSB302_D_TxFIFOToken_RESET2)
+		{
+			Sim_StartHardReset( sim );
+			return;
+		}
+		if (k[0] == FUSB302_D_TxFIFOToken_SOP1 && k[1] == FUSB302_D_TxFIFOToken_SOP1 && k[2] == FUSB302_D_TxFIFOToken_SOP1 && k[3] == FUSB302_D_TxFIFOToken_SOP2)
+		{
+			frame.Sop = FUSB302_D_RxFIFOToken_SOP;
+		}
+		else if (k[0] == FUSB302_D_TxFIFOToken_SOP1 && k[1] == FUSB302_D_TxFIFOToken_SOP1 && k[2] == FUSB302_D_TxFIFOToken_SOP3 && k[3] == FUSB302_D_TxFIFOToken_SOP3)
+		{
+			frame.Sop = FUSB302_D_RxFIFOToken_SOP1;
+		}
+		else if (k[0] == FUSB302_D_TxFIFOToken_SOP1 && k[1] == FUSB302_D_TxFIFOToken_SOP3 && k[2] == FUSB302_D_TxFIFOToken_SOP1 && k[3] == FUSB302_D_TxFIFOToken_SOP3)
+		{
+			frame.Sop = FUSB302_D_RxFIFOToken_SOP2;
+		}
+	}
+
+	if (error || frame.Sop == 0 || frame.Len < 2 || crc == false || eop == false)
+	{
+		DBG("sim: malformed tx frame\n");
+		sim->Stats.TxErrors++;
+		return;
+	}
+
+	sim->TxFrame = frame;
+	sim->TxBusy = true;
+	sim->TxHardReset = false;
+	sim->TxRetries = 0;
+	sim->TxDoneUs = sim->NowUs + SIM_FRAME_US( frame.Len );
+}
+
+static void Sim_StartHardReset( FUSB302_D_Sim_t * sim )
+{
+	sim->TxBusy = true;
+	sim->TxHardReset = true;
+	sim->TxDoneUs = sim->NowUs + SIM_HARD_RESET_US;
+}
+
+static void Sim_TxDone( FUSB302_D_Sim_t * sim )
+{
+	if (sim->TxHardReset)
+	{
+		sim->TxBusy = false;
+		sim->TxHardReset = false;
+
+		REG( sim, FUSB302_D_Register_Interrupta ) |= FUSB302_D_Interrupta_I_HARDSENT;
+
+		if (Sim_IsListening( sim ))
+		{
+			Source_HardReset( sim, false );
+		}
+		return;
+	}
+
+	// the transmitter drives the same pin the receiver listens on
+	if (Sim_IsListening( sim ) && Source_Receive( sim, &sim->TxFrame ))
+	{
+		uint16_t header = sim->TxFrame.Data[0] | (sim->TxFrame.Data[1] << 8);
+		FUSB302_D_Sim_Frame_t goodcrc = {
+			.Len = 2,
+			.Sop = FUSB302_D_RxFIFOToken_SOP
+		};
+		uint16_t reply = PD_HeaderWord_setMessageIdBits( PD_HeaderWord_getMessageId(header) ) | PD_HeaderWord_PowerRole_Source |
+						 sim->Source.SpecRev | PD_HeaderWord_DataRole_Source | PD_ControlCommand_GoodCRC;
+
+		goodcrc.Data[0] = reply & 0xFF;
+		goodcrc.Data[1] = reply >> 8;
+
+		// the received GoodCRC ends up in the rx fifo as well
+		Sim_PushRx( sim, &goodcrc );
+
+		sim->TxBusy = false;
+		sim->Stats.TxMessages++;
+
+		REG( sim, FUSB302_D_Register_Interrupta ) |= FUSB302_D_Interrupta_I_TXSENT;
+		return;
+	}
+
+	uint8_t control3 = REG( sim, FUSB302_D_Register_Control3 );
+
+	if ((control3 & FUSB302_D_Control3_AUTO_RETRY) && sim->TxRetries < ((control3 & FUSB302_D_Control3_N_RETRIES_MASK) >> 1))
+	{
+		sim->TxRetries++;
+		sim->TxDoneUs = sim->NowUs + SIM_T_RECEIVE_US + SIM_FRAME_US( sim->TxFrame.Len );
+		return;
+	}
+
+	sim->TxBusy = false;
+
+	REG( sim, FUSB302_D_Register_Status0a ) |= FUSB302_D_Status0a_RETRYFAIL;
+	REG( sim, FUSB302_D_Register_Interrupta ) |= FUSB302_D_Interrupta_I_RETRYFAIL;
+}
+
+
+/**
+ * Receiver
+ */
+
+static bool Sim_IsListening( FUSB302_D_Sim_t * sim )
+{
+	if (sim->Cc == 0)
+	{
+		return false;
+	}
+	if ((REG( sim, FUSB302_D_Register_Power ) & SIM_PWR_PD) != SIM_PWR_PD)
+	{
+		return false;
+	}
+
+	return (REG( sim, FUSB302_D_Register_Switches1 ) & FUSB302_D_Switches1_TXCC_MASK) == sim->Cc;
+}
+
+static uint32_t Sim_Crc32( uint8_t * data, uint8_t len )
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for (uint8_t i = 0; i < len; i++)
+	{
+		crc ^= data[i];
+		for (uint8_t b = 0; b < 8; b++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+
+/**
+ * Token, header, data objects and crc into the rx fifo, false if it does not fit.
+ */
+static bool Sim_PushRx( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_Frame_t * frame )
+{
+	uint8_t buf[1 + sizeof(frame->Data) + 4];
+	uint8_t len = 0;
+
+	if (FUSB302_D_SIM_RX_FIFO_SIZE - sim->RxCount < 1 + frame->Len + 4)
+	{
+		sim->Stats.RxDropped++;
+		return false;
+	}
+
+	uint32_t crc = Sim_Crc32( &frame->Data[0], frame->Len );
+
+	buf[len++] = frame->Sop;
+	memcpy( &buf[len], &frame->Data[0], frame->Len );
+	len += frame->Len;
+	buf[len++] = crc & 0xFF;
+	buf[len++] = (crc >> 8) & 0xFF;
+	buf[len++] = (crc >> 16) & 0xFF;
+	buf[len++] = (crc >> 24) & 0xFF;
+
+	for (uint8_t i = 0; i < len; i++)
+	{
+		sim->RxFifo[(sim->RxHead + sim->RxCount) % FUSB302_D_SIM_RX_FIFO_SIZE] = buf[i];
+		sim->RxCount++;
+	}
+
+	REG( sim, FUSB302_D_Register_Status1a ) = (REG( sim, FUSB302_D_Register_Status1a ) & FUSB302_D_Status1a_TOGSS) |
+			(frame->Sop == FUSB302_D_RxFIFOToken_SOP ? FUSB302_D_Status1a_RXSOP : 0);
+
+	if ((REG( sim, FUSB302_D_Register_Status0 ) & FUSB302_D_Status0_CRC_CHK) == 0)
+	{
+		REG( sim, FUSB302_D_Register_Status0 ) |= FUSB302_D_Status0_CRC_CHK;
+		REG( sim, FUSB302_D_Register_Interrupt ) |= FUSB302_D_Interrupt_I_CRC_CHK;
+	}
+
+	return true;
+}
+
+/**
+ * A frame from the partner, true if the device acknowledged it (auto GoodCRC)
+ */
+static bool Sim_Receive( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_Frame_t * frame )
+{
+	if (Sim_IsListening( sim ) == false)
+	{
+		sim->Stats.RxDropped++;
+		return false;
+	}
+
+	if (Sim_PushRx( sim, frame ) == false)
+	{
+		return false;
+	}
+
+	sim->Stats.RxMessages++;
+
+	uint16_t header = frame->Data[0] | (frame->Data[1] << 8);
+
+	if (PD_HeaderWord_getNumberOfDataObjects(header) == 0 && PD_HeaderWord_getCommandCode(header) == PD_ControlCommand_SoftReset)
+	{
+		REG( sim, FUSB302_D_Register_Status0a ) |= FUSB302_D_Status0a_SOFTRST;
+		REG( sim, FUSB302_D_Register_Interrupta ) |= FUSB302_D_Interrupta_I_SOFTRST;
+	}
+
+	if ((REG( sim, FUSB302_D_Register_Switches1 ) & FUSB302_D_Switches1_AUTO_CRC) == 0)
+	{
+		return false;
+	}
+
+	REG( sim, FUSB302_D_Register_Interruptb ) |= FUSB302_D_Interruptb_I_GCRCSENT;
+
+	return true;
+}
+
+/**
+ * Toggle logic, only sink polling is modelled: Rd on both pins until a source was found
+ */
+static bool Sim_IsToggling( FUSB302_D_Sim_t * sim )
+{
+	uint8_t control2 = REG( sim, FUSB302_D_Register_Control2 );
+
+	return (control2 & FUSB302_D_Control2_TOGGLE) && (control2 & FUSB302_D_Control2_MODE_MASK) == FUSB302_D_Control2_MODE_SnkPolling;
+}
+
+static bool Sim_HasRd( FUSB302_D_Sim_t * sim, uint8_t pin )
+{
+	if (Sim_IsToggling( sim ))
+	{
+		return true;
+	}
+
+	return REG( sim, FUSB302_D_Register_Switches0 ) & (pin == 1 ? FUSB302_D_Switches0_PDWN1 : FUSB302_D_Switches0_PDWN2);
+}
+
+static void Sim_TogDone( FUSB302_D_Sim_t * sim )
+{
+	sim->TogDoneUs = 0;
+
+	if (Sim_IsToggling( sim ) == false || sim->Cc == 0)
+	{
+		return;
+	}
+
+	REG( sim, FUSB302_D_Register_Status1a ) = (REG( sim, FUSB302_D_Register_Status1a ) & ~FUSB302_D_Status1a_TOGSS) |
+			(sim->Cc == 1 ? FUSB302_D_Status1a_TOGSS_SNK_on_CC1 : FUSB302_D_Status1a_TOGSS_SNK_on_CC2);
+	REG( sim, FUSB302_D_Register_Interrupta ) |= FUSB302_D_Interrupta_I_TOGDONE;
+}
+
+static uint16_t Sim_CcMv( FUSB302_D_Sim_t * sim, uint8_t pin )
+{
+	uint8_t switches0 = REG( sim, FUSB302_D_Register_Switches0 );
+	bool pdwn = Sim_HasRd( sim, pin );
+	bool pu = switches0 & (pin == 1 ? FUSB302_D_Switches0_PU_EN1 : FUSB302_D_Switches0_PU_EN2) && Sim_IsToggling( sim ) == false;
+
+	if (pin == sim->Cc)
+	{
+		// Rp against Rd, otherwise pulled up
+		return pdwn ? RpMv[sim->Rp] : 3300;
+	}
+
+	return (pu && pdwn == false) ? 3300 : 0;
+}
+
+
+/**
+ * Status registers, interrupt latches and INT_N
+ */
+static void Sim_Update( FUSB302_D_Sim_t * sim )
+{
+	uint8_t power = REG( sim, FUSB302_D_Register_Power );
+	uint8_t status0 = REG( sim, FUSB302_D_Register_Status0 );
+	uint8_t next = status0 & (FUSB302_D_Status0_CRC_CHK | FUSB302_D_Status0_ALERT);
+
+	if (power & FUSB302_D_Power_PWR_MeasurementBlock)
+	{
+		uint8_t meas = REG( sim, FUSB302_D_Register_Switches0 ) & FUSB302_D_Switches0_MEAS_CC_MASK;
+		uint8_t mdac = REG( sim, FUSB302_D_Register_Measure ) & FUSB302_D_Measure_MDAC_MASK;
+		uint16_t mv = 0;
+
+		if (meas == FUSB302_D_Switches0_MEAS_CC1)
+		{
+			mv = Sim_CcMv( sim, 1 );
+		}
+		else if (meas == FUSB302_D_Switches0_MEAS_CC2)
+		{
+			mv = Sim_CcMv( sim, 2 );
+		}
+
+		if (mv >= 1230)
+		{
+			next |= FUSB302_D_Status0_BC_LVL_MoreThan1230mV;
+		}
+		else if (mv >= 660)
+		{
+			next |= FUSB302_D_Status0_BC_LVL_660mV_to_1230mV;
+		}
+		else if (mv >= 200)
+		{
+			next |= FUSB302_D_Status0_BC_LVL_200mV_to_660mV;
+		}
+
+		// MDAC steps are 42mV on cc, 420mV on vbus
+		if (REG( sim, FUSB302_D_Register_Measure ) & FUSB302_D_Measure_MEAS_VBUS)
+		{
+			mv = sim->VbusMv / 10;
+		}
+		if (mv > (mdac + 1) * 42)
+		{
+			next |= FUSB302_D_Status0_COMP;
+		}
+	}
+
+	if ((power & FUSB302_D_Power_PWR_BandgapAndWake) && sim->VbusMv >= SIM_VBUSOK_MV)
+	{
+		next |= FUSB302_D_Status0_VBUSOK;
+	}
+
+	// wake detection works on bandgap power alone
+	if ((power & FUSB302_D_Power_PWR_BandgapAndWake) && (REG( sim, FUSB302_D_Register_Control2 ) & FUSB302_D_Control2_WAKE_EN) && sim->Cc != 0)
+	{
+		next |= FUSB302_D_Status0_WAKE;
+	}
+
+	if (sim->TxBusy || sim->Source.TxBusy)
+	{
+		next |= FUSB302_D_Status0_ACTIVITY;
+	}
+
+	uint8_t changed = status0 ^ next;
+
+	if (changed & FUSB302_D_Status0_BC_LVL_MASK)	REG( sim, FUSB302_D_Register_Interrupt ) |= FUSB302_D_Interrupt_I_BC_LVL;
+	if (changed & FUSB302_D_Status0_COMP)			REG( sim, FUSB302_D_Register_Interrupt ) |= FUSB302_D_Interrupt_I_COMP_CHNG;
+	if (changed & FUSB302_D_Status0_VBUSOK)			REG( sim, FUSB302_D_Register_Interrupt ) |= FUSB302_D_Interrupt_I_VBUSOK;
+	if (changed & FUSB302_D_Status0_ACTIVITY)		REG( sim, FUSB302_D_Register_Interrupt ) |= FUSB302_D_Interrupt_I_ACTIVITY;
+	if (changed & next & FUSB302_D_Status0_WAKE)	REG( sim, FUSB302_D_Register_Interrupt ) |= FUSB302_D_Interrupt_I_WAKE;
+
+	REG( sim, FUSB302_D_Register_Status0 ) = next;
+
+	uint8_t status1 = REG( sim, FUSB302_D_Register_Status1 ) & (FUSB302_D_Status1_RXSOP1 | FUSB302_D_Status1_RXSOP2 | FUSB302_D_Status1_OVRTEMP | FUSB302_D_Status1_OCP);
+
+	if (sim->RxCount == 0)							status1 |= FUSB302_D_Status1_RX_EMPTY;
+	if (sim->RxCount == FUSB302_D_SIM_RX_FIFO_SIZE)	status1 |= FUSB302_D_Status1_RX_FULL;
+	if (sim->TxCount == 0)							status1 |= FUSB302_D_Status1_TX_EMPTY;
+	if (sim->TxCount == FUSB302_D_SIM_TX_FIFO_SIZE)	status1 |= FUSB302_D_Status1_TX_FULL;
+
+	REG( sim, FUSB302_D_Register_Status1 ) = status1;
+
+	// sink polling finds an attached source after a while
+	if (Sim_IsToggling( sim ) && (REG( sim, FUSB302_D_Register_Status1a ) & FUSB302_D_Status1a_TOGSS) == FUSB302_D_Status1a_TOGSS_Running && sim->Cc != 0)
+	{
+		if (sim->TogDoneUs == 0)
+		{
+			sim->TogDoneUs = sim->NowUs + SIM_T_TOG_DONE_US;
+		}
+	}
+	else
+	{
+		sim->TogDoneUs = 0;
+	}
+
+	// INT_N is active low
+	bool pending = (REG( sim, FUSB302_D_Register_Interrupt ) & ~REG( sim, FUSB302_D_Register_Mask1 )) ||
+				   (REG( sim, FUSB302_D_Register_Interrupta ) & ~REG( sim, FUSB302_D_Register_Maska )) ||
+				   (REG( sim, FUSB302_D_Register_Interruptb ) & ~REG( sim, FUSB302_D_Register_Maskb ) & FUSB302_D_Interruptb_I_ALL);
+	bool level = !(pending && (REG( sim, FUSB302_D_Register_Control0 ) & FUSB302_D_Control0_INT_MASK) == 0);
+
+	if (level != sim->IntN)
+	{
+		sim->IntN = level;
+
+		if (sim->OnIntN != NULL)
+		{
+			sim->OnIntN( sim, level );
+		}
+	}
+}
+
+/**
+ * Runs all events up to <us> in order
+ */
+static void Sim_AdvanceTo( FUSB302_D_Sim_t * sim, uint64_t us )
+{
+	while (1)
+	{
+		uint64_t next = us + 1;
+		uint8_t event = 0;
+
+		if (sim->TxBusy && sim->TxDoneUs < next)
+		{
+			next = sim->TxDoneUs;
+			event = 1;
+		}
+		if (sim->Source.TxBusy && sim->Source.TxDoneUs < next)
+		{
+			next = sim->Source.TxDoneUs;
+			event = 2;
+		}
+		if (sim->Source.WakeUs != 0 && sim->Source.WakeUs < next)
+		{
+			next = sim->Source.WakeUs;
+			event = 3;
+		}
+
+		if (sim->TogDoneUs != 0 && sim->TogDoneUs < next)
+		{
+			next = sim->TogDoneUs;
+			event = 4;
+		}
+
+		if (event == 0)
+		{
+			break;
+		}
+
+		if (next > sim->NowUs)
+		{
+			sim->NowUs = next;
+		}
+
+		switch (event)
+		{
+			case 1: Sim_TxDone( sim ); break;
+			case 2: Source_TxDone( sim ); break;
+			case 3: sim->Source.WakeUs = 0; Source_Run( sim ); break;
+			case 4: Sim_TogDone( sim ); break;
+		}
+
+		Sim_Update( sim );
+	}
+
+	if (us > sim->NowUs)
+	{
+		sim->NowUs = us;
+	}
+}
+
+
+/**
+ * Scripted source partner
+ */
+
+static void Source_Goto( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_SrcState_t state )
+{
+	sim->Source.State = state;
+	sim->Source.WakeUs = 0;
+}
+
+static void Source_GotoIn( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_SrcState_t state, uint32_t us )
+{
+	sim->Source.State = state;
+	sim->Source.WakeUs = sim->NowUs + (us > 0 ? us : 1);
+}
+
+static void Source_Send( FUSB302_D_Sim_t * sim, uint16_t command, uint32_t * objects, uint8_t n )
+{
+	FUSB302_D_Sim_Frame_t * frame = &sim->Source.TxFrame;
+	uint16_t header = PD_HeaderWord_setNumberOfDataObjectsBits( n ) | PD_HeaderWord_setMessageIdBits( sim->Source.TxMessageId ) |
+					  PD_HeaderWord_PowerRole_Source | sim->Source.SpecRev | PD_HeaderWord_DataRole_Source | command;
+
+	frame->Sop = FUSB302_D_RxFIFOToken_SOP;
+	frame->Data[0] = header & 0xFF;
+	frame->Data[1] = header >> 8;
+	frame->Len = 2;
+
+	for (uint8_t i = 0; i < n; i++)
+	{
+		frame->Data[frame->Len++] = objects[i] & 0xFF;
+		frame->Data[frame->Len++] = (objects[i] >> 8) & 0xFF;
+		frame->Data[frame->Len++] = (objects[i] >> 16) & 0xFF;
+		frame->Data[frame->Len++] = (objects[i] >> 24) & 0xFF;
+	}
+
+	sim->Source.TxBusy = true;
+	sim->Source.TxRetries = 0;
+	sim->Source.TxDoneUs = sim->NowUs + SIM_FRAME_US( frame->Len );
+}
+
+static void Source_SendChunk( FUSB302_D_Sim_t * sim, uint8_t type, uint16_t extHeader, const uint8_t * data, uint8_t len )
+{
+	FUSB302_D_Sim_Frame_t * frame = &sim->Source.TxFrame;
+	uint16_t header = PD_HeaderWord_Extended_MASK | PD_HeaderWord_setNumberOfDataObjectsBits( PD_ExtendedChunk_getNumberOfDataObjects( len ) ) |
+					  PD_HeaderWord_setMessageIdBits( sim->Source.TxMessageId ) | PD_HeaderWord_PowerRole_Source | sim->Source.SpecRev |
+					  PD_HeaderWord_DataRole_Source | type;
+
+	frame->Sop = FUSB302_D_RxFIFOToken_SOP;
+	frame->Len = PD_Wire_encodeChunk( frame->Data, header, extHeader, data, len );
+
+	sim->Source.TxBusy = true;
+	sim->Source.TxRetries = 0;
+	sim->Source.TxDoneUs = sim->NowUs + SIM_FRAME_US( frame->Len );
+}
+
+/**
+ * Back to the contract, a PPS contract still times out
+ */
+static void Source_Ready( FUSB302_D_Sim_t * sim )
+{
+	if (sim->Source.PPSTimeoutUs == 0)
+	{
+		Source_Goto( sim, FUSB302_D_Sim_Src_Ready );
+	}
+	else
+	{
+		Source_GotoIn( sim, FUSB302_D_Sim_Src_Ready, sim->Source.PPSTimeoutUs > sim->NowUs ? sim->Source.PPSTimeoutUs - sim->NowUs : 0 );
+	}
+}
+
+/**
+ * State timeout
+ */
+static void Source_Run( FUSB302_D_Sim_t * sim )
+{
+	// the line is taken, try again after the interframe gap
+	if (sim->TxBusy || sim->Source.TxBusy)
+	{
+		sim->Source.WakeUs = (sim->TxBusy ? sim->TxDoneUs : sim->Source.TxDoneUs) + SIM_T_IFG_US;
+		return;
+	}
+
+	switch (sim->Source.State)
+	{
+		case FUSB302_D_Sim_Src_WaitRd:
+		{
+			if (Sim_HasRd( sim, sim->Cc ) == false)
+			{
+				Source_GotoIn( sim, FUSB302_D_Sim_Src_WaitRd, SIM_T_CC_DEBOUNCE_US );
+				break;
+			}
+
+			sim->VbusMv = SIM_VSAFE5V_MV;
+			sim->Source.CapsCount = 0;
+			Source_GotoIn( sim, FUSB302_D_Sim_Src_SendCaps, sim->Source.FirstCapsUs );
+			break;
+		}
+
+		case FUSB302_D_Sim_Src_SendCaps:
+			Source_Send( sim, PD_DataCommand_SourceCapabilities, &sim->Source.Pdos[0], sim->Source.NPdos );
+			break;
+
+		case FUSB302_D_Sim_Src_WaitRequest:
+			DBG("sim: no request\n");
+			Source_HardReset( sim, true );
+			break;
+
+		case FUSB302_D_Sim_Src_SendAccept:
+			Source_Send( sim, PD_ControlCommand_Accept, NULL, 0 );
+			break;
+
+		case FUSB302_D_Sim_Src_SendReject:
+			Source_Send( sim, PD_ControlCommand_Reject, NULL, 0 );
+			break;
+
+		case FUSB302_D_Sim_Src_TransitionSupply:
+		{
+			uint32_t pdo = sim->Source.Pdos[ ((sim->Source.RequestRdo & PDO_Req_Fixed_ObjectPos_MASK) >> PDO_Req_Fixed_ObjectPos_OFFSET) - 1 ];
+
+			if (PDO_SrcCap_isPPS( pdo ))
+			{
+				sim->VbusMv = 20 * PDO_Req_PPS_getOutputVoltage_20mV( sim->Source.RequestRdo );
+			}
+			else
+			{
+				// the minimum voltage of variable / battery supplies is in the same place
+				sim->VbusMv = 50 * PDO_SrcCap_Fixed_getVoltage_50mV( pdo );
+			}
+			Source_Send( sim, PD_ControlCommand_PSRDY, NULL, 0 );
+			break;
+		}
+
+		case FUSB302_D_Sim_Src_Ready:
+			// only ever woken up for a PPS contract
+			DBG("sim: pps timeout\n");
+			Source_HardReset( sim, true );
+			break;
+
+		case FUSB302_D_Sim_Src_SendChunk:
+		{
+			uint16_t offset = sim->Source.ExtTxChunk * PD_EXTENDED_CHUNK_SIZE;
+			uint16_t len = sim->Source.ExtendedSize - offset;
+
+			Source_SendChunk( sim, sim->Source.ExtTxType, PD_ExtHeader_makeChunk( sim->Source.ExtTxChunk, sim->Source.ExtendedSize ),
+					&sim->Source.Extended[offset], len > PD_EXTENDED_CHUNK_SIZE ? PD_EXTENDED_CHUNK_SIZE : len );
+			break;
+		}
+
+		case FUSB302_D_Sim_Src_SendChunkRequest:
+			Source_SendChunk( sim, sim->Source.ExtRxType, PD_ExtHeader_makeRequest( sim->Source.ExtRxChunk ), NULL, 0 );
+			break;
+
+		case FUSB302_D_Sim_Src_SendMessage:
+			Source_Send( sim, sim->Source.MsgCommand, sim->Source.Msg, sim->Source.MsgN );
+			break;
+
+		case FUSB302_D_Sim_Src_HardReset:
+			sim->VbusMv = SIM_VSAFE5V_MV;
+			sim->Source.CapsCount = 0;
+			Source_GotoIn( sim, FUSB302_D_Sim_Src_SendCaps, sim->Source.FirstCapsUs );
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void Source_TxDone( FUSB302_D_Sim_t * sim )
+{
+	bool acked = Sim_Receive( sim, &sim->Source.TxFrame );
+
+	if (acked == false && sim->Source.TxRetries < SIM_N_RETRY_COUNT)
+	{
+		sim->Source.TxRetries++;
+		sim->Source.TxDoneUs = sim->NowUs + SIM_T_RECEIVE_US + SIM_FRAME_US( sim->Source.TxFrame.Len );
+		return;
+	}
+
+	sim->Source.TxBusy = false;
+
+	if (acked)
+	{
+		sim->Source.TxMessageId = (sim->Source.TxMessageId + 1) % (PD_MESSAGE_MAX_MID + 1);
+	}
+
+	Source_OnSent( sim, sim->Source.TxFrame.Data[0] | (sim->Source.TxFrame.Data[1] << 8), acked );
+}
+
+static void Source_OnSent( FUSB302_D_Sim_t * sim, uint16_t header, bool acked )
+{
+	uint8_t n = PD_HeaderWord_getNumberOfDataObjects( header );
+	uint8_t command = PD_HeaderWord_getCommandCode( header );
+
+	// chunks and chunk requests (the sink asks for / sends the next one), messages of the source's own
+	if (PD_HeaderWord_isExtended( header ) || sim->Source.State == FUSB302_D_Sim_Src_SendMessage)
+	{
+		Source_Ready( sim );
+		return;
+	}
+
+	if (n > 0)
+	{
+		// Source_Capabilities
+		if (acked)
+		{
+			sim->Source.CapsCount = 0;
+			Source_GotoIn( sim, FUSB302_D_Sim_Src_WaitRequest, SIM_T_SENDER_RESPONSE_US );
+		}
+		else if (++sim->Source.CapsCount > SIM_N_CAPS_COUNT)
+		{
+			DBG("sim: sink not pd capable\n");
+			Source_Goto( sim, FUSB302_D_Sim_Src_Disabled );
+		}
+		else
+		{
+			Source_GotoIn( sim, FUSB302_D_Sim_Src_SendCaps, SIM_T_SEND_SOURCE_CAP_US );
+		}
+		return;
+	}
+
+	if (acked == false)
+	{
+		// (simplified) no soft reset, just start over
+		if (command == PD_ControlCommand_PSRDY)
+		{
+			Source_HardReset( sim, true );
+		}
+		else
+		{
+			Source_GotoIn( sim, FUSB302_D_Sim_Src_SendCaps, sim->Source.ResponseUs );
+		}
+		return;
+	}
+
+	switch (command)
+	{
+		case PD_ControlCommand_Accept:
+			if (sim->Source.AfterAccept == FUSB302_D_Sim_Src_TransitionSupply)
+			{
+				Source_GotoIn( sim, FUSB302_D_Sim_Src_TransitionSupply, sim->Source.TransitionUs );
+			}
+			else
+			{
+				Source_GotoIn( sim, sim->Source.AfterAccept, sim->Source.ResponseUs );
+			}
+			break;
+
+		case PD_ControlCommand_Reject:
+			Source_Ready( sim );
+			break;
+
+		case PD_ControlCommand_PSRDY:
+			sim->Source.Rdo = sim->Source.RequestRdo;
+			sim->Source.ContractUs = sim->NowUs;
+			// the sink has to request a PPS contract again in time
+			sim->Source.PPSTimeoutUs = 0;
+			if (PDO_SrcCap_isPPS( sim->Source.Pdos[ ((sim->Source.Rdo & PDO_Req_Fixed_ObjectPos_MASK) >> PDO_Req_Fixed_ObjectPos_OFFSET) - 1 ] ))
+			{
+				sim->Source.PPSTimeoutUs = sim->NowUs + SIM_T_PPS_TIMEOUT_US;
+			}
+			Source_Ready( sim );
+			DBG("sim: contract after %u us\n", FUSB302_D_Sim_GetContractLatencyUs( sim ));
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+ * A frame from the device, true if the source acknowledges it (GoodCRC)
+ */
+static bool Source_Receive( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_Frame_t * frame )
+{
+	if (frame->Sop != FUSB302_D_RxFIFOToken_SOP)
+	{
+		return false;
+	}
+
+	switch (sim->Source.State)
+	{
+		case FUSB302_D_Sim_Src_Detached:
+		case FUSB302_D_Sim_Src_WaitRd:
+		case FUSB302_D_Sim_Src_HardReset:
+		case FUSB302_D_Sim_Src_Disabled:
+			return false;
+
+		default:
+			break;
+	}
+
+	uint16_t header = frame->Data[0] | (frame->Data[1] << 8);
+	uint8_t n = PD_HeaderWord_getNumberOfDataObjects( header );
+	uint8_t command = PD_HeaderWord_getCommandCode( header );
+	uint8_t id = PD_HeaderWord_getMessageId( header );
+
+	if (frame->Len < 2 + 4 * n)
+	{
+		return false;
+	}
+
+	if (n == 0 && command == PD_ControlCommand_SoftReset)
+	{
+		sim->Source.TxMessageId = 0;
+		sim->Source.RxMessageId = id;
+		sim->Source.AfterAccept = FUSB302_D_Sim_Src_SendCaps;
+		Source_GotoIn( sim, FUSB302_D_Sim_Src_SendAccept, sim->Source.ResponseUs );
+		return true;
+	}
+
+	// retry of a message that was handled already
+	if (id == sim->Source.RxMessageId)
+	{
+		return true;
+	}
+	sim->Source.RxMessageId = id;
+
+	if (PD_HeaderWord_isExtended( header ))
+	{
+		return Source_ReceiveExtended( sim, frame, command );
+	}
+
+	if (n == 0)
+	{
+		if (command == PD_ControlCommand_GetSourceCap)
+		{
+			Source_GotoIn( sim, FUSB302_D_Sim_Src_SendCaps, sim->Source.ResponseUs );
+		}
+		else if (command == PD_ControlCommand_GetSourceCapExtended && sim->Source.SpecRev == PD_HeaderWord_SpecRev_3_0)
+		{
+			sim->Source.ExtTxType = PD_ExtendedCommand_SourceCapabilitiesExtended;
+			sim->Source.ExtTxChunk = 0;
+			Source_GotoIn( sim, FUSB302_D_Sim_Src_SendChunk, sim->Source.ResponseUs );
+		}
+		return true;
+	}
+
+	if (command == PD_DataCommand_Request)
+	{
+		uint32_t rdo = frame->Data[2] | (frame->Data[3] << 8) | (frame->Data[4] << 16) | ((uint32_t)frame->Data[5] << 24);
+		uint8_t pos = (rdo & PDO_Req_Fixed_ObjectPos_MASK) >> PDO_Req_Fixed_ObjectPos_OFFSET;
+		bool valid = false;
+
+		if (1 <= pos && pos <= sim->Source.NPdos)
+		{
+			uint32_t pdo = sim->Source.Pdos[pos - 1];
+			// operating current (10mA) or power (250mW, battery) alike
+			uint32_t operating = (rdo & PDO_Req_Fixed_OperatingCurrent_10mA_MASK) >> PDO_Req_Fixed_OperatingCurrent_10mA_OFFSET;
+
+			switch (pdo & PDO_SrcCap_SupplyType_MASK)
+			{
+				case PDO_SrcCap_SupplyType_Fixed:
+					valid = operating <= PDO_SrcCap_Fixed_getMaxCurrent_10mA( pdo );
+					break;
+				case PDO_SrcCap_SupplyType_Variable:
+					valid = operating <= PDO_SrcCap_Variable_getMaxCurrent_10mA( pdo );
+					break;
+				case PDO_SrcCap_SupplyType_Battery:
+					valid = operating <= PDO_SrcCap_Battery_getMaxPower_250mW( pdo );
+					break;
+				case PDO_SrcCap_SupplyType_APDO:
+				{
+					uint32_t mv = 20 * PDO_Req_PPS_getOutputVoltage_20mV( rdo );
+
+					valid = sim->Source.SpecRev == PD_HeaderWord_SpecRev_3_0 && PDO_SrcCap_isPPS( pdo ) &&
+							100 * PDO_SrcCap_PPS_getMinVoltage_100mV( pdo ) <= mv && mv <= 100 * PDO_SrcCap_PPS_getMaxVoltage_100mV( pdo ) &&
+							PDO_Req_PPS_getOperatingCurrent_50mA( rdo ) <= PDO_SrcCap_PPS_getMaxCurrent_50mA( pdo );
+					break;
+				}
+				default:
+					break;
+			}
+		}
+
+		sim->Source.Requests++;
+		sim->Source.RequestRdo = rdo;
+		sim->Source.AfterAccept = FUSB302_D_Sim_Src_TransitionSupply;
+
+		Source_GotoIn( sim, valid ? FUSB302_D_Sim_Src_SendAccept : FUSB302_D_Sim_Src_SendReject, sim->Source.ResponseUs );
+	}
+
+	return true;
+}
+
+/**
+ * Chunk (request) of an extended message of the sink, answered after ResponseUs
+ */
+static bool Source_ReceiveExtended( FUSB302_D_Sim_t * sim, FUSB302_D_Sim_Frame_t * frame, uint8_t type )
+{
+	if (frame->Len < PD_WIRE_HEADER_SIZE + PD_EXTENDED_HEADER_SIZE)
+	{
+		return true;
+	}
+
+	uint16_t ext = PD_Wire_getU16( &frame->Data[PD_WIRE_HEADER_SIZE] );
+	uint8_t chunk = PD_ExtHeader_getChunkNumber( ext );
+
+	if (PD_ExtHeader_isRequestChunk( ext ))
+	{
+		if (type == sim->Source.ExtTxType && chunk * PD_EXTENDED_CHUNK_SIZE < sim->Source.ExtendedSize)
+		{
+			sim->Source.ExtTxChunk = chunk;
+			Source_GotoIn( sim, FUSB302_D_Sim_Src_SendChunk, sim->Source.ResponseUs );
+		}
+		return true;
+	}
+
+	if (chunk == 0)
+	{
+		sim->Source.ExtRxType = type;
+		sim->Source.ExtRxSize = PD_ExtHeader_getDataSize( ext );
+		sim->Source.ExtRxReceived = 0;
+	}
+	else if (type != sim->Source.ExtRxType || chunk != sim->Source.ExtRxChunk)
+	{
+		return true;
+	}
+
+	uint16_t len = sim->Source.ExtRxSize - sim->Source.ExtRxReceived;
+	if (len > PD_EXTENDED_CHUNK_SIZE)
+	{
+		len = PD_EXTENDED_CHUNK_SIZE;
+	}
+	if (frame->Len < PD_WIRE_HEADER_SIZE + PD_EXTENDED_HEADER_SIZE + len || sim->Source.ExtRxSize > FUSB302_D_SIM_MAX_EXTENDED)
+	{
+		return true;
+	}
+
+	memcpy( &sim->Source.ExtRx[sim->Source.ExtRxReceived], &frame->Data[PD_WIRE_HEADER_SIZE + PD_EXTENDED_HEADER_SIZE], len );
+	sim->Source.ExtRxReceived += len;
+	sim->Source.ExtRxChunk = chunk + 1;
+
+	if (sim->Source.ExtRxReceived < sim->Source.ExtRxSize)
+	{
+		Source_GotoIn( sim, FUSB302_D_Sim_Src_SendChunkRequest, sim->Source.ResponseUs );
+	}
+	else
+	{
+		sim->Source.ExtRxMessages++;
+	}
+
+	return true;
+}
+
+/**
+ * <signal> the source sends the hard reset (otherwise it received one)
+ */
+static void Source_HardReset( FUSB302_D_Sim_t * sim, bool signal )
+{
+	if (sim->Cc == 0)
+	{
+		return;
+	}
+
+	if (signal && Sim_IsListening( sim ))
+	{
+		REG( sim, FUSB302_D_Register_Status0a ) |= FUSB302_D_Status0a_HARDRST;
+		REG( sim, FUSB302_D_Register_Interrupta ) |= FUSB302_D_Interrupta_I_HARDRST;
+
+		if (REG( sim, FUSB302_D_Register_Control3 ) & FUSB302_D_Control3_AUTO_HARDRESET)
+		{
+			Sim_PdReset( sim );
+		}
+	}
+
+	sim->VbusMv = 0;
+
+	sim->Source.TxBusy = false;
+	sim->Source.TxMessageId = 0;
+	sim->Source.RxMessageId = -1;
+	sim->Source.ContractUs = 0;
+	sim->Source.PPSTimeoutUs = 0;
+
+	Source_GotoIn( sim, FUSB302_D_Sim_Src_HardReset, SIM_T_SRC_RECOVER_US );
+}
@@ -0,0 +1,212 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#ifndef __FUSB302_D_TRANSPORT_SIM_H_
+#define __FUSB302_D_TRANSPORT_SIM_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "FUSB302-D_Driver.h"
+
+ /**
+  * Software model of a FUSB302 with an attached USB-C source, for host side testing and benchmarking.
+  *
+  * Models the register file (0x01-0x10, 0x3C-0x43) with auto-increment (except for the fifo), the tx fifo token
+  * stream (SOP1/SOP2/SOP3/RESETx, PACKSYM, JAM_CRC, EOP, TXOFF, TXON or TX_START), rx fifo tokens, BC_LVL and COMP
+  * of the measured cc pin, sink polling (TOGGLE, TOGSS, I_TOGDONE), wake detection (WAKE_EN, I_WAKE), power blocks, auto GoodCRC / auto retry and the interrupt
+  * latches including INT_N.
+  *
+  * Time is virtual: it advances by the I2C transfer time of each transaction, by <IdleStepUs> on each time
+  * query (so busy waits terminate) and by FUSB302_D_Sim_Advance(). PD messages take their BMC wire time.
+  *
+  * The scripted source partner applies Rp, turns on VBUS once it sees Rd, sends Source_Capabilities and answers a
+  * valid Request with Accept and PS_RDY (otherwise Reject), also Get_Source_Cap, Soft_Reset and hard resets.
+  */
+
+ // FIFO depths of the device
+#define FUSB302_D_SIM_TX_FIFO_SIZE	48
+#define FUSB302_D_SIM_RX_FIFO_SIZE	80
+
+#define FUSB302_D_SIM_MAX_PDOS		7
+#define FUSB302_D_SIM_MAX_EXTENDED	260	// PD_EXTENDED_MAX_DATA_SIZE
+
+ // default device id (version B, revision 1)
+#define FUSB302_D_SIM_DEVICE_ID		0x91
+
+ typedef enum {
+	 FUSB302_D_Sim_Rp_Default,	// 0.41V on cc, BC_LVL 1
+	 FUSB302_D_Sim_Rp_1A5,		// 0.92V, BC_LVL 2
+	 FUSB302_D_Sim_Rp_3A0		// 1.68V, BC_LVL 3
+ } FUSB302_D_Sim_Rp_t;
+
+ typedef enum {
+	 FUSB302_D_Sim_Src_Detached,
+	 FUSB302_D_Sim_Src_WaitRd,				// cable attached, waiting for the sink pull-down (tCCDebounce)
+	 FUSB302_D_Sim_Src_SendCaps,			// vbus on, sending Source_Capabilities (every tTypeCSendSourceCap)
+	 FUSB302_D_Sim_Src_WaitRequest,			// caps acknowledged (tSenderResponse, then hard reset)
+	 FUSB302_D_Sim_Src_SendAccept,
+	 FUSB302_D_Sim_Src_SendReject,
+	 FUSB302_D_Sim_Src_TransitionSupply,	// Accept sent, PS_RDY follows after tSrcTransition
+	 FUSB302_D_Sim_Src_Ready,				// explicit contract (or rejected request)
+	 FUSB302_D_Sim_Src_SendChunk,			// chunk ExtTxChunk of the extended message (PD 3.0)
+	 FUSB302_D_Sim_Src_SendChunkRequest,	// for chunk ExtRxChunk of the sink's extended message
+	 FUSB302_D_Sim_Src_SendMessage,			// Msg, see FUSB302_D_Sim_SendMessage()
+	 FUSB302_D_Sim_Src_HardReset,			// vbus off (tSrcRecover)
+	 FUSB302_D_Sim_Src_Disabled				// nCapsCount exceeded, no PD
+ } FUSB302_D_Sim_SrcState_t;
+
+ typedef struct {
+	 uint8_t Len;
+	 uint8_t Sop;		// rx fifo token type
+	 uint8_t Data[2 + 4 * FUSB302_D_SIM_MAX_PDOS];	// header and data objects
+ } FUSB302_D_Sim_Frame_t;
+
+ typedef struct FUSB302_D_Sim_s FUSB302_D_Sim_t;
+
+ struct FUSB302_D_Sim_s {
+	 uint16_t Addr;
+	 uint32_t ClockHz;		// I2C clock
+	 uint32_t IdleStepUs;	// time passing per time query
+
+	 uint64_t NowUs;
+
+	 // registers in FUSB302_D_Register_index() order
+	 uint8_t Regs[FUSB302_D_REGISTER_COUNT];
+	 uint8_t RegPtr;
+
+	 uint8_t TxFifo[FUSB302_D_SIM_TX_FIFO_SIZE];
+	 uint8_t TxCount;
+	 uint8_t TxPackRemain;	// payload bytes of the last PACKSYM still to come (not tokens)
+
+	 uint8_t RxFifo[FUSB302_D_SIM_RX_FIFO_SIZE];
+	 uint8_t RxHead;
+	 uint8_t RxCount;
+
+	 // frame of the device on the wire
+	 bool TxBusy;
+	 bool TxHardReset;
+	 uint64_t TxDoneUs;
+	 FUSB302_D_Sim_Frame_t TxFrame;
+	 uint8_t TxRetries;
+
+	 // cable
+	 uint8_t Cc;				// 0 = detached, 1 or 2
+	 FUSB302_D_Sim_Rp_t Rp;
+	 uint16_t VbusMv;
+
+	 uint64_t TogDoneUs;		// sink polling result due, 0 = none
+
+	 bool IntN;				// pin level (active low)
+	 void (*OnIntN)( FUSB302_D_Sim_t * sim, bool level );	// called on each change of INT_N
+	 void * Ctx;
+
+	 struct {
+		 FUSB302_D_Sim_SrcState_t State;
+		 uint64_t WakeUs;	// state timeout, 0 = none
+
+		 uint32_t Pdos[FUSB302_D_SIM_MAX_PDOS];
+		 uint8_t NPdos;
+
+		 uint32_t FirstCapsUs;
+		 uint32_t ResponseUs;
+		 uint32_t TransitionUs;
+		 uint16_t SpecRev;		// PD_HeaderWord_SpecRev_x
+
+		 uint8_t CapsCount;
+		 uint8_t TxMessageId;
+		 int8_t RxMessageId;	// last one received, -1 = none
+
+		 // message on the wire
+		 bool TxBusy;
+		 uint64_t TxDoneUs;
+		 FUSB302_D_Sim_Frame_t TxFrame;
+		 uint8_t TxRetries;
+
+		 uint32_t RequestRdo;
+		 uint32_t Requests;
+		 FUSB302_D_Sim_SrcState_t AfterAccept;
+
+		 uint32_t Rdo;			// accepted request
+		 uint64_t AttachUs;
+		 uint64_t ContractUs;	// 0 = no contract (yet)
+		 uint64_t PPSTimeoutUs;	// PPS contract not requested again by then, 0 = none
+
+		 // extended messages: the answer to Get_Source_Cap_Extended and the last one of the sink
+		 uint8_t Extended[FUSB302_D_SIM_MAX_EXTENDED];
+		 uint16_t ExtendedSize;
+		 uint8_t ExtTxType;
+		 uint8_t ExtTxChunk;
+		 uint8_t ExtRx[FUSB302_D_SIM_MAX_EXTENDED];
+		 uint8_t ExtRxType;
+		 uint16_t ExtRxSize;
+		 uint16_t ExtRxReceived;
+		 uint8_t ExtRxChunk;
+		 uint32_t ExtRxMessages;	// complete ones
+
+		 uint16_t MsgCommand;
+		 uint32_t Msg[FUSB302_D_SIM_MAX_PDOS];
+		 uint8_t MsgN;
+	 } Source;
+
+	 struct {
+		 uint32_t Transactions;
+		 uint32_t BytesRead;
+		 uint32_t BytesWritten;
+		 uint32_t Nacks;
+		 uint32_t RxMessages;	// delivered to the rx fifo
+		 uint32_t TxMessages;	// sent by the device
+		 uint32_t RxDropped;	// rx fifo overflow / receiver off
+		 uint32_t TxErrors;		// malformed token streams
+	 } Stats;
+ };
+
+ extern const FUSB302_D_Transport_t FUSB302_D_Transport_Sim;
+
+ /**
+  * Power-on state, a 5V/3A only source. <sim> is the bus given to FUSB302_D_Init().
+  */
+ void FUSB302_D_Sim_Init( FUSB302_D_Sim_t * sim );
+
+ // raw PDOs (see PD.h PDO_SrcCap_*) the source offers
+ void FUSB302_D_Sim_SetSourceCaps( FUSB302_D_Sim_t * sim, const uint32_t * pdos, uint8_t n );
+
+ // <cc> 1 or 2: the pin of the device the cable cc line ends up on
+ void FUSB302_D_Sim_Attach( FUSB302_D_Sim_t * sim, uint8_t cc, FUSB302_D_Sim_Rp_t rp );
+ void FUSB302_D_Sim_Detach( FUSB302_D_Sim_t * sim );
+
+ // source signals a hard reset
+ void FUSB302_D_Sim_HardReset( FUSB302_D_Sim_t * sim );
+
+ // the source sends a message of its own with a contract in place (eg a VDM or Alert), then is ready again
+ void FUSB302_D_Sim_SendMessage( FUSB302_D_Sim_t * sim, uint16_t command, const uint32_t * objects, uint8_t n );
+
+ void FUSB302_D_Sim_Advance( FUSB302_D_Sim_t * sim, uint32_t us );
+
+ uint64_t FUSB302_D_Sim_GetTimeUs( FUSB302_D_Sim_t * sim );
+
+ // time from attach to PS_RDY (0 if there is no contract)
+ uint32_t FUSB302_D_Sim_GetContractLatencyUs( FUSB302_D_Sim_t * sim );
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* __FUSB302_D_TRANSPORT_SIM_H_ */
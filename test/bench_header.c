@@ -0,0 +1,268 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check and microbenchmark of the PD header helpers (PD.h): the bitmask command validation and
+ * PD_HeaderWord_make() are compared against the previous comparison chains and field by field header build
+ * for all 64k header words, then both variants are timed on a shuffled header stream.
+ * PD_HeaderWord_make() gains where its arguments are constants (it folds), built from variables both cost the same.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "PD.h"
+
+
+ // passes over all 64k headers per timed run
+#define BENCH_ROUNDS	200
+
+#define HEADER_COUNT	0x10000
+
+
+ // previous command validation, one comparison per command
+#define REF_isValidControlCommand( __c__ ) ( \
+		(__c__) == PD_ControlCommand_GoodCRC || \
+		(__c__) == PD_ControlCommand_GotoMin || \
+		(__c__) == PD_ControlCommand_Accept || \
+		(__c__) == PD_ControlCommand_Reject || \
+		(__c__) == PD_ControlCommand_Ping || \
+		(__c__) == PD_ControlCommand_PSRDY || \
+		(__c__) == PD_ControlCommand_GetSourceCap || \
+		(__c__) == PD_ControlCommand_GetSinkCap || \
+		(__c__) == PD_ControlCommand_DRSwap || \
+		(__c__) == PD_ControlCommand_PRSwap || \
+		(__c__) == PD_ControlCommand_VCONNSwap || \
+		(__c__) == PD_ControlCommand_Wait || \
+		(__c__) == PD_ControlCommand_SoftReset || \
+		(__c__) == PD_ControlCommand_NotSupported || \
+		(__c__) == PD_ControlCommand_GetSourceCapExtended || \
+		(__c__) == PD_ControlCommand_GetStatus || \
+		(__c__) == PD_ControlCommand_FRSwap || \
+		(__c__) == PD_ControlCommand_GetPPSStatus || \
+		(__c__) == PD_ControlCommand_GetCountryCodes \
+)
+
+#define REF_isValidDataCommand( __c__ ) ( \
+		(__c__) == PD_DataCommand_SourceCapabilities || \
+		(__c__) == PD_DataCommand_Request || \
+		(__c__) == PD_DataCommand_BIST || \
+		(__c__) == PD_DataCommand_SinkCapabilities || \
+		(__c__) == PD_DataCommand_BatteryStatus || \
+		(__c__) == PD_DataCommand_Alert || \
+		(__c__) == PD_DataCommand_GetCountryInfo || \
+		(__c__) == PD_DataCommand_VendorDefined \
+)
+
+#define REF_isValidCommand( __c__ ) (REF_isValidControlCommand(__c__) || REF_isValidDataCommand(__c__))
+
+#define REF_HeaderWord_isValidCommand( __h__ ) ( PD_HeaderWord_getNumberOfDataObjects(__h__) > 0 ? \
+		REF_isValidDataCommand( PD_HeaderWord_getCommandCode(__h__) ) : REF_isValidControlCommand( PD_HeaderWord_getCommandCode(__h__) ) )
+
+
+static uint16_t Headers[HEADER_COUNT];
+
+static uint16_t refMake( uint16_t h );
+static uint16_t make( uint16_t h );
+static bool check( void );
+static void shuffle( void );
+static uint32_t runRefValid( void );
+static uint32_t runValid( void );
+static uint32_t runRefMake( void );
+static uint32_t runMake( void );
+static double timeNs( uint32_t (*run)( void ), uint32_t * result );
+
+
+// previous build, field by field
+static uint16_t refMake( uint16_t h )
+{
+	uint16_t word;
+
+	word = PD_HeaderWord_setNumberOfDataObjectsBits( PD_HeaderWord_getNumberOfDataObjects(h) );
+	word |= PD_HeaderWord_setMessageIdBits( PD_HeaderWord_getMessageId(h) );
+	word |= (h & PD_HeaderWord_PowerRole_MASK) | (h & PD_HeaderWord_SpecRev_MASK) | (h & PD_HeaderWord_DataRole_MASK);
+	word |= PD_HeaderWord_getCommandCode(h);
+
+	return word;
+}
+
+static uint16_t make( uint16_t h )
+{
+	return PD_HeaderWord_make( PD_HeaderWord_getNumberOfDataObjects(h), PD_HeaderWord_getMessageId(h),
+			h & PD_HeaderWord_PowerRole_MASK, h & PD_HeaderWord_SpecRev_MASK, h & PD_HeaderWord_DataRole_MASK,
+			PD_HeaderWord_getCommandCode(h) );
+}
+
+static bool check( void )
+{
+	uint32_t errors = 0;
+
+	for (uint32_t c = 0; c < 64; c++)
+	{
+		if (PD_isValidControlCommand(c) != REF_isValidControlCommand(c) ||
+				PD_isValidDataCommand(c) != REF_isValidDataCommand(c) ||
+				PD_isValidCommand(c) != REF_isValidCommand(c))
+		{
+			printf("command %u: mismatch\n", c);
+			errors++;
+		}
+	}
+
+	for (uint32_t h = 0; h < HEADER_COUNT; h++)
+	{
+		if (PD_HeaderWord_isValidCommand(h) != REF_HeaderWord_isValidCommand(h))
+		{
+			printf("header %04x: validation mismatch\n", h);
+			errors++;
+		}
+		// everything but the extended flag
+		if (make( h ) != refMake( h ) || make( h ) != (h & ~PD_HeaderWord_Extended_MASK))
+		{
+			printf("header %04x: build mismatch %04x\n", h, make( h ));
+			errors++;
+		}
+	}
+
+	return errors == 0;
+}
+
+// all headers in random order, so the branches of the comparison chains can't be learned
+static void shuffle( void )
+{
+	uint32_t seed = 1;
+
+	for (uint32_t i = 0; i < HEADER_COUNT; i++)
+	{
+		Headers[i] = i;
+	}
+	for (uint32_t i = HEADER_COUNT - 1; i > 0; i--)
+	{
+		seed = seed * 1103515245 + 12345;
+
+		uint32_t j = (seed >> 8) % (i + 1);
+		uint16_t t = Headers[i];
+
+		Headers[i] = Headers[j];
+		Headers[j] = t;
+	}
+}
+
+__attribute__((noinline)) static uint32_t runRefValid( void )
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < HEADER_COUNT; i++)
+	{
+		n += REF_HeaderWord_isValidCommand( Headers[i] );
+	}
+	return n;
+}
+
+__attribute__((noinline)) static uint32_t runValid( void )
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < HEADER_COUNT; i++)
+	{
+		n += PD_HeaderWord_isValidCommand( Headers[i] );
+	}
+	return n;
+}
+
+__attribute__((noinline)) static uint32_t runRefMake( void )
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < HEADER_COUNT; i++)
+	{
+		n += refMake( Headers[i] );
+	}
+	return n;
+}
+
+__attribute__((noinline)) static uint32_t runMake( void )
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < HEADER_COUNT; i++)
+	{
+		n += make( Headers[i] );
+	}
+	return n;
+}
+
+// ns per header
+static double timeNs( uint32_t (*run)( void ), uint32_t * result )
+{
+	struct timespec t0, t1;
+	volatile uint32_t sink = 0;
+
+	clock_gettime( CLOCK_MONOTONIC, &t0 );
+	for (uint32_t r = 0; r < BENCH_ROUNDS; r++)
+	{
+		sink += run();
+	}
+	clock_gettime( CLOCK_MONOTONIC, &t1 );
+
+	*result = sink / BENCH_ROUNDS;
+
+	return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / ((double)BENCH_ROUNDS * HEADER_COUNT);
+}
+
+int main( void )
+{
+	uint32_t refResult, result;
+
+	if (check() == false)
+	{
+		printf("FAIL: differs from the previous macros\n");
+		return 1;
+	}
+	printf("all %u headers and 64 command codes match the previous macros\n", HEADER_COUNT);
+
+	shuffle();
+
+	double refNs = timeNs( runRefValid, &refResult );
+	double ns = timeNs( runValid, &result );
+
+	printf("validate: comparisons %.2f ns, mask %.2f ns per header (x%.2f), %u valid\n", refNs, ns, refNs / ns, result);
+
+	if (refResult != result)
+	{
+		printf("FAIL: validation results differ\n");
+		return 1;
+	}
+
+	refNs = timeNs( runRefMake, &refResult );
+	ns = timeNs( runMake, &result );
+
+	printf("build: field by field %.2f ns, one expression %.2f ns per header (x%.2f)\n", refNs, ns, refNs / ns);
+
+	if (refResult != result)
+	{
+		printf("FAIL: built headers differ\n");
+		return 1;
+	}
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,83 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#include "sim_common.h"
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+static void Sim_onIntN( FUSB302_D_Sim_t * sim, bool level );
+#endif
+
+const uint32_t Sim_Pdos[3] = {
+	SIM_PDO_FIXED( 5000, 3000 ),
+	SIM_PDO_FIXED( 9000, 3000 ),
+	SIM_PDO_FIXED( 20000, 2250 )
+};
+
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+static void Sim_onIntN( FUSB302_D_Sim_t * sim, bool level )
+{
+	// falling edge
+	if (level == false)
+	{
+		CCHandshake_onInterrupt( (CCHandshake_Port_t*)sim->Ctx );
+	}
+}
+#endif
+
+bool Sim_init( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port, const FUSB302_D_Transport_t * transport )
+{
+	FUSB302_D_Sim_Init( sim );
+	FUSB302_D_Sim_SetSourceCaps( sim, Sim_Pdos, sizeof(Sim_Pdos) / sizeof(Sim_Pdos[0]) );
+
+	sim->Ctx = port;
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	sim->OnIntN = Sim_onIntN;
+#endif
+
+	return CCHandshake_init( port, transport, sim, FUSB302_D_DEFAULT_ADDRESS );
+}
+
+bool Sim_run( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port, uint32_t us, Sim_Done_t done )
+{
+	uint64_t start = FUSB302_D_Sim_GetTimeUs( sim );
+
+	while (FUSB302_D_Sim_GetTimeUs( sim ) - start < us)
+	{
+		if (done != NULL && done( sim, port ))
+		{
+			return true;
+		}
+
+		CCHandshake_core( port );
+		FUSB302_D_Sim_Advance( sim, SIM_LOOP_US );
+	}
+
+	return done != NULL && done( sim, port );
+}
+
+bool Sim_hasContract( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port )
+{
+	return sim->Source.ContractUs != 0 && CCHandshake_hasContract( port );
+}
+
+uint32_t Sim_perSecond( uint32_t n, uint64_t us )
+{
+	return us > 0 ? (uint32_t)(n * 1000000ULL / us) : 0;
+}
@@ -0,0 +1,67 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+#ifndef SIM_COMMON_H_
+#define SIM_COMMON_H_
+
+#include <stdio.h>
+
+#include "CCHandshake.h"
+#include "FUSB302-D_Transport_Sim.h"
+
+/**
+ * Shared setup of the host side checks: one simulated FUSB302 and source partner per port, CCHandshake_core()
+ * called every SIM_LOOP_US of virtual time.
+ */
+
+ // time spent elsewhere in the main loop (per CCHandshake_core() call)
+#define SIM_LOOP_US		100
+
+ // a contract must be in place by then
+#define SIM_TIMEOUT_US	2000000
+
+ // fails the check (returning from main() or a check function)
+#define CHECK( __cond__ ) \
+	do { \
+		if ((__cond__) == false) \
+		{ \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #__cond__); \
+			return 1; \
+		} \
+	} while (0)
+
+ // 5V 3A, 9V 3A, 20V 2.25A
+#define SIM_PDO_FIXED( __mv__, __ma__ )	(PDO_SrcCap_SupplyType_Fixed | (((__mv__) / 50) << 10) | ((__ma__) / 10))
+
+extern const uint32_t Sim_Pdos[3];
+
+typedef bool (*Sim_Done_t)( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+
+ // Sim_Pdos offered, INT_N forwarded to CCHandshake_onInterrupt() (with CCHANDSHAKE_USE_INTERRUPT)
+bool Sim_init( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port, const FUSB302_D_Transport_t * transport );
+
+ // runs the port for <us> of virtual time or until <done> (if given) is true, which is returned
+bool Sim_run( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port, uint32_t us, Sim_Done_t done );
+
+ // the source accepted a request and the sink knows
+bool Sim_hasContract( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+
+uint32_t Sim_perSecond( uint32_t n, uint64_t us );
+
+#endif /* SIM_COMMON_H_ */
@@ -0,0 +1,153 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check: a single sink port negotiates a contract with the simulated FUSB302 and source partner,
+ * then keeps it for a while. Reports the bus load (transactions per second of virtual time) of both phases,
+ * built once per CCHANDSHAKE_USE_INTERRUPT setting (see Makefile) to compare polling with INT_N.
+ * Fails (exit code != 0) if no 20V contract is reached in time, it is lost or the bus shows errors.
+ */
+
+#include <stdio.h>
+
+#include "CCHandshake.h"
+#include "FUSB302-D_Transport_Sim.h"
+
+
+ // time spent elsewhere in the main loop (per CCHandshake_core() call)
+#define SIM_LOOP_US		100
+
+ // the contract must be in place by then
+#define SIM_TIMEOUT_US	2000000
+
+ // then run with the contract in place for
+#define SIM_IDLE_US		1000000
+
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+static uint32_t perSecond( uint32_t n, uint64_t us );
+#if CCHANDSHAKE_USE_INTERRUPT==true
+static void onIntN( FUSB302_D_Sim_t * sim, bool level );
+#endif
+
+
+static uint32_t perSecond( uint32_t n, uint64_t us )
+{
+	return us > 0 ? (uint32_t)(n * 1000000ULL / us) : 0;
+}
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+static void onIntN( FUSB302_D_Sim_t * sim, bool level )
+{
+	// falling edge
+	if (level == false)
+	{
+		CCHandshake_onInterrupt( (CCHandshake_Port_t*)sim->Ctx );
+	}
+}
+#endif
+
+int main( void )
+{
+	// 5V 3A, 9V 3A, 20V 2.25A
+	const uint32_t pdos[] = {
+		PDO_SrcCap_SupplyType_Fixed | (100 << 10) | 300,
+		PDO_SrcCap_SupplyType_Fixed | (180 << 10) | 300,
+		PDO_SrcCap_SupplyType_Fixed | (400 << 10) | 225
+	};
+	uint32_t loops = 0;
+	uint64_t start;
+	uint32_t transactions;
+
+	FUSB302_D_Sim_Init( &Sim );
+	FUSB302_D_Sim_SetSourceCaps( &Sim, pdos, sizeof(pdos) / sizeof(pdos[0]) );
+
+	Sim.Ctx = &Port;
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	Sim.OnIntN = onIntN;
+#endif
+
+	if (CCHandshake_init( &Port, &FUSB302_D_Transport_Sim, &Sim, FUSB302_D_DEFAULT_ADDRESS ) == false)
+	{
+		printf("FAIL: init\n");
+		return 1;
+	}
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	start = FUSB302_D_Sim_GetTimeUs( &Sim );
+	transactions = Sim.Stats.Transactions;
+
+	while (Sim.Source.ContractUs == 0 && FUSB302_D_Sim_GetTimeUs( &Sim ) < SIM_TIMEOUT_US)
+	{
+		CCHandshake_core( &Port );
+		FUSB302_D_Sim_Advance( &Sim, SIM_LOOP_US );
+		loops++;
+	}
+
+	printf("interrupt=%d loops=%u latency=%u us rdo=%08x vbus=%u mV\n",
+			CCHANDSHAKE_USE_INTERRUPT==true, loops, FUSB302_D_Sim_GetContractLatencyUs( &Sim ), Sim.Source.Rdo, Sim.VbusMv);
+	printf("bus transactions=%u (%u/s) read=%u written=%u nacks=%u\n",
+			Sim.Stats.Transactions, perSecond( Sim.Stats.Transactions - transactions, FUSB302_D_Sim_GetTimeUs( &Sim ) - start ),
+			Sim.Stats.BytesRead, Sim.Stats.BytesWritten, Sim.Stats.Nacks);
+	printf("pd rx=%u tx=%u dropped=%u txerrors=%u\n",
+			Sim.Stats.RxMessages, Sim.Stats.TxMessages, Sim.Stats.RxDropped, Sim.Stats.TxErrors);
+
+	if (Sim.Source.ContractUs == 0)
+	{
+		printf("FAIL: no contract after %u us\n", SIM_TIMEOUT_US);
+		return 1;
+	}
+
+	// steady state, the sink has nothing to do but keep the contract
+	start = FUSB302_D_Sim_GetTimeUs( &Sim );
+	transactions = Sim.Stats.Transactions;
+
+	while (FUSB302_D_Sim_GetTimeUs( &Sim ) - start < SIM_IDLE_US)
+	{
+		CCHandshake_core( &Port );
+		FUSB302_D_Sim_Advance( &Sim, SIM_LOOP_US );
+	}
+
+	printf("with contract: %u bus transactions/s\n",
+			perSecond( Sim.Stats.Transactions - transactions, FUSB302_D_Sim_GetTimeUs( &Sim ) - start ));
+
+	if (CCHandshake_hasContract( &Port ) == false)
+	{
+		printf("FAIL: contract lost\n");
+		return 1;
+	}
+	// highest offer within PD_REQUEST_MAX_MILLIVOLT/MILLIAMP
+	if ((Sim.Source.Rdo & PDO_Req_Fixed_ObjectPos_MASK) != PDO_Req_Fixed_setObjectPosBits( 3 ) || Sim.VbusMv != 20000)
+	{
+		printf("FAIL: unexpected request\n");
+		return 1;
+	}
+	if (Sim.Stats.Nacks != 0 || Sim.Stats.TxErrors != 0)
+	{
+		printf("FAIL: bus errors\n");
+		return 1;
+	}
+
+	printf("OK\n");
+
+	return 0;
+}
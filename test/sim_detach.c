@@ -0,0 +1,108 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of the detach detection: with a contract a pulled cable has to be noticed from the status read
+ * (VBUSOK gone, cc below CCHANDSHAKE_DETACH_CC_MV) within a few ms, dropping the contract. Also pulled during the
+ * cc debounce and while negotiating, each followed by a new attach that has to reach a contract again.
+ */
+
+#include "sim_common.h"
+
+
+ // a detach must be noticed within
+#define SIM_DETACH_US	5000
+
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+static bool detached( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+static int detachAfter( uint32_t us );
+
+
+static bool detached( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port )
+{
+	(void)sim;
+
+	return CCHandshake_getOrientation( port ) == CCHandshake_CC_None;
+}
+
+ // attaches, pulls the cable again after <us> (0 = with a contract) and checks the port is back to detached
+static int detachAfter( uint32_t us )
+{
+	uint64_t start;
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	if (us == 0)
+	{
+		CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+	}
+	else
+	{
+		Sim_run( &Sim, &Port, us, NULL );
+	}
+
+	FUSB302_D_Sim_Detach( &Sim );
+	start = FUSB302_D_Sim_GetTimeUs( &Sim );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, detached ) );
+
+	printf("detached after %u us: noticed after %u us\n", us, (uint32_t)(FUSB302_D_Sim_GetTimeUs( &Sim ) - start));
+
+	CHECK( FUSB302_D_Sim_GetTimeUs( &Sim ) - start <= SIM_DETACH_US );
+
+	// and stays so
+	Sim_run( &Sim, &Port, SIM_TIMEOUT_US, NULL );
+
+	CHECK( detached( &Sim, &Port ) );
+	CHECK( CCHandshake_hasContract( &Port ) == false );
+	CHECK( CCHandshake_getPolicyState( &Port ) == PE_State_Disabled );
+
+	return 0;
+}
+
+int main( void )
+{
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+	printf("interrupt=%d\n", CCHANDSHAKE_USE_INTERRUPT==true);
+
+	// with a contract
+	CHECK( detachAfter( 0 ) == 0 );
+
+	// during the cc debounce (not attached yet), must not end up attached
+	CHECK( detachAfter( CCHANDSHAKE_CC_DEBOUNCE_MS * 1000 / 2 ) == 0 );
+
+	// waiting for the capabilities (sent 100ms after the attach, then the request)
+	CHECK( detachAfter( CCHANDSHAKE_CC_DEBOUNCE_MS * 1000 + 20000 ) == 0 );
+
+	// a contract again
+	FUSB302_D_Sim_Attach( &Sim, 2, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+	CHECK( CCHandshake_getOrientation( &Port ) == CCHandshake_CC_2 );
+
+	CHECK( Sim.Stats.Nacks == 0 && Sim.Stats.TxErrors == 0 );
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of the PD 3.0 extended messages (CCHANDSHAKE_PD_REV3): a chunked answer of the source to
+ * Get_Source_Cap_Extended is reassembled, a chunked message of the sink arrives in one piece at the source, also
+ * when a new sink profile is set right after it was queued (the reselect waits for the chunks). A request left
+ * when the contract is gone (detach, PD given up) does not keep the port busy.
+ */
+
+#include <string.h>
+
+#include "sim_common.h"
+
+
+ // several chunks (26 bytes each) both ways
+#define SIM_EXT_SIZE	200
+
+ // the chunks are exchanged within
+#define SIM_EXT_US		500000
+
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+static uint8_t Out[SIM_EXT_SIZE];
+
+static bool received( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+static bool sent( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+static bool gaveUp( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+static int attach( void );
+static int idle( void );
+
+
+static bool received( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port )
+{
+	PD_ExtendedCommand_t type;
+	uint16_t size;
+
+	(void)sim;
+
+	return CCHandshake_getExtendedMessage( port, &type, &size ) != NULL;
+}
+
+static bool sent( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port )
+{
+	(void)port;
+
+	return sim->Source.ExtRxMessages > 0;
+}
+
+static bool gaveUp( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port )
+{
+	(void)sim;
+
+	return CCHandshake_getPolicyState( port ) == PE_State_Disabled;
+}
+
+ // a PD 3.0 source up to the contract
+static int attach( void )
+{
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+	Sim.Source.SpecRev = PD_HeaderWord_SpecRev_3_0;
+	Sim.Source.ExtendedSize = SIM_EXT_SIZE;
+	for (int i = 0; i < SIM_EXT_SIZE; i++)
+	{
+		Sim.Source.Extended[i] = (uint8_t)(i * 7);
+	}
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	return 0;
+}
+
+ // nothing left to do for the port (attached)
+static int idle( void )
+{
+	uint32_t deadline;
+	uint32_t next;
+
+	Sim_run( &Sim, &Port, 10000, NULL );
+
+	CHECK( CCHandshake_getNextDeadline( &Port, &deadline ) == false );
+	CHECK( CCHandshake_isIdle( &Port ) );
+	CHECK( (CCHandshake_service( &Port, &next ) & CCHANDSHAKE_NEXT_BUSY) == 0 );
+
+	return 0;
+}
+
+int main( void )
+{
+	const uint8_t * data;
+	PD_ExtendedCommand_t type;
+	uint16_t size;
+	uint32_t requests;
+	uint32_t deadline;
+	uint64_t start;
+
+	CHECK( attach() == 0 );
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+
+	// from the source
+	start = FUSB302_D_Sim_GetTimeUs( &Sim );
+
+	CHECK( CCHandshake_requestExtended( &Port, PD_ControlCommand_GetSourceCapExtended ) );
+	CHECK( Sim_run( &Sim, &Port, SIM_EXT_US, received ) );
+
+	data = CCHandshake_getExtendedMessage( &Port, &type, &size );
+
+	printf("interrupt=%d received %u bytes after %u us\n", CCHANDSHAKE_USE_INTERRUPT==true, size, (uint32_t)(FUSB302_D_Sim_GetTimeUs( &Sim ) - start));
+
+	CHECK( type == PD_ExtendedCommand_SourceCapabilitiesExtended && size == SIM_EXT_SIZE );
+	CHECK( memcmp( data, Sim.Source.Extended, SIM_EXT_SIZE ) == 0 );
+
+	// to the source, a new profile queued right behind it
+	for (int i = 0; i < SIM_EXT_SIZE; i++)
+	{
+		Out[i] = (uint8_t)(i * 3 + 1);
+	}
+
+	start = FUSB302_D_Sim_GetTimeUs( &Sim );
+	requests = Sim.Source.Requests;
+
+	CHECK( CCHandshake_sendExtended( &Port, PD_ExtendedCommand_ManufacturerInfo, Out, SIM_EXT_SIZE ) );
+	CCHandshake_setPPS( &Port, 0, 0 );
+	CCHandshake_SinkProfile_t profile = { .MaxMillivolt = 9000, .MaxMilliamp = 3000 };
+	CCHandshake_setSinkProfile( &Port, &profile );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_EXT_US, sent ) );
+
+	printf("sent %u bytes after %u us\n", Sim.Source.ExtRxSize, (uint32_t)(FUSB302_D_Sim_GetTimeUs( &Sim ) - start));
+
+	CHECK( Sim.Source.ExtRxMessages == 1 && Sim.Source.ExtRxSize == SIM_EXT_SIZE );
+	CHECK( memcmp( Sim.Source.ExtRx, Out, SIM_EXT_SIZE ) == 0 );
+
+	// then the new request
+	Sim_run( &Sim, &Port, SIM_EXT_US, NULL );
+
+	printf("then requested: rdo=%08x vbus=%u mV\n", Sim.Source.Rdo, Sim.VbusMv);
+
+	CHECK( Sim.Source.Requests == requests + 1 );
+	CHECK( CCHandshake_hasContract( &Port ) && Sim.VbusMv == 9000 );
+
+	// detached before the answer, the request is gone with the contract
+	CHECK( CCHandshake_requestExtended( &Port, PD_ControlCommand_GetSourceCapExtended ) );
+	FUSB302_D_Sim_Detach( &Sim );
+	Sim_run( &Sim, &Port, 10000, NULL );
+
+	CHECK( CCHandshake_getNextDeadline( &Port, &deadline ) == false );
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+	CHECK( CCHandshake_requestExtended( &Port, PD_ControlCommand_GetSourceCapExtended ) );
+	CHECK( Sim_run( &Sim, &Port, SIM_EXT_US, received ) );
+
+	// PD given up (no PS_RDY) with a request queued
+	CCHandshake_deinit( &Port );
+	CHECK( attach() == 0 );
+	Sim.Source.TransitionUs = 2000000;
+
+	while (Sim.Source.Requests == 0 && FUSB302_D_Sim_GetTimeUs( &Sim ) < SIM_TIMEOUT_US)
+	{
+		Sim_run( &Sim, &Port, SIM_LOOP_US, NULL );
+	}
+
+	CHECK( CCHandshake_requestExtended( &Port, PD_ControlCommand_GetSourceCapExtended ) );
+	CHECK( Sim_run( &Sim, &Port, 5000000, gaveUp ) );
+	CHECK( idle() == 0 );
+
+	printf("nothing left after detach and giving up\n");
+
+	CHECK( Sim.Stats.Nacks == 0 && Sim.Stats.TxErrors == 0 );
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,197 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of CCHandshake_Hub: SIM_PORTS ports on one hub negotiate their contracts through the batched
+ * status reads, then the bus of one port stops completing transfers. CCHandshake_Hub_run() has to give up on that
+ * port after FUSB302_D_TIMEOUT_MS (returning false) while the other ports keep their contracts, and has to
+ * succeed again once the bus is back.
+ * The transfers go through an asynchronous Submit (completed right away unless the bus is lost) so the hub
+ * queues its reads the way it does on the target.
+ */
+
+#include <string.h>
+
+#include "sim_common.h"
+#include "CCHandshake_Hub.h"
+
+
+#define SIM_PORTS	4
+
+ // port whose bus is lost
+#define SIM_LOST	2
+
+ // polls while the bus is lost
+#define SIM_LOST_POLLS	3
+
+
+static FUSB302_D_Sim_t Sims[SIM_PORTS];
+static CCHandshake_Port_t Ports[SIM_PORTS];
+static CCHandshake_Port_t * PortList[SIM_PORTS];
+static CCHandshake_Hub_t Hub;
+
+static FUSB302_D_Transport_t Transport;
+static bool Lost[SIM_PORTS];
+
+static FUSB302_D_Error_t Lossy_Submit( void * bus, FUSB302_D_t * fusb, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen );
+static void Lossy_Abort( void * bus );
+static void hubRun( uint32_t polls, uint32_t * failed );
+static bool allContracts( int except );
+
+
+static FUSB302_D_Error_t Lossy_Submit( void * bus, FUSB302_D_t * fusb, uint16_t addr, uint8_t * wbuf, uint16_t wlen, uint8_t * rbuf, uint16_t rlen )
+{
+	FUSB302_D_Sim_t * sim = (FUSB302_D_Sim_t*)bus;
+	FUSB302_D_Error_t result;
+
+	// accepted, but the completion never comes
+	if (Lost[sim - Sims])
+	{
+		return FUSB302_D_OK;
+	}
+
+	if (rlen == 0)
+	{
+		result = FUSB302_D_Transport_Sim.Write( bus, addr, wbuf, wlen );
+	}
+	else
+	{
+		result = FUSB302_D_Transport_Sim.WriteRead( bus, addr, wbuf, wlen, rbuf, rlen );
+	}
+
+	FUSB302_D_XferComplete( fusb, result );
+
+	return FUSB302_D_OK;
+}
+
+static void Lossy_Abort( void * bus )
+{
+	(void)bus;
+}
+
+ // Hub_run() <polls> times (each followed by SIM_LOOP_US on all ports), counting the failed ones
+static void hubRun( uint32_t polls, uint32_t * failed )
+{
+	for (uint32_t n = 0; n < polls; n++)
+	{
+		if (CCHandshake_Hub_run( &Hub ) == false)
+		{
+			(*failed)++;
+		}
+
+		for (int i = 0; i < SIM_PORTS; i++)
+		{
+			FUSB302_D_Sim_Advance( &Sims[i], SIM_LOOP_US );
+		}
+	}
+}
+
+static bool allContracts( int except )
+{
+	for (int i = 0; i < SIM_PORTS; i++)
+	{
+		if (i != except && Sim_hasContract( &Sims[i], &Ports[i] ) == false)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int main( void )
+{
+	const uint32_t vdm[] = { 0xFF008001 };
+	uint32_t failed = 0;
+	uint32_t polls;
+	uint32_t dispatches;
+	uint64_t start;
+
+	// the simulator with an asynchronous Submit
+	memcpy( &Transport, &FUSB302_D_Transport_Sim, sizeof(Transport) );
+	Transport.Submit = Lossy_Submit;
+	Transport.Abort = Lossy_Abort;
+
+	for (int i = 0; i < SIM_PORTS; i++)
+	{
+		CHECK( Sim_init( &Sims[i], &Ports[i], &Transport ) );
+		PortList[i] = &Ports[i];
+	}
+
+	CCHandshake_Hub_init( &Hub, PortList, SIM_PORTS );
+
+	for (int i = 0; i < SIM_PORTS; i++)
+	{
+		FUSB302_D_Sim_Attach( &Sims[i], 1 + (i & 1), FUSB302_D_Sim_Rp_3A0 );
+	}
+
+	// all ports negotiate
+	while (allContracts( -1 ) == false && FUSB302_D_Sim_GetTimeUs( &Sims[0] ) < SIM_TIMEOUT_US)
+	{
+		hubRun( 1, &failed );
+	}
+
+	printf("interrupt=%d contracts after %u us: polls=%u dispatches=%u\n",
+			CCHANDSHAKE_USE_INTERRUPT==true, (uint32_t)FUSB302_D_Sim_GetTimeUs( &Sims[0] ), Hub.Polls, Hub.Dispatches);
+
+	CHECK( allContracts( -1 ) );
+	CHECK( failed == 0 );
+
+	for (int i = 0; i < SIM_PORTS; i++)
+	{
+		CHECK( CCHandshake_getOrientation( &Ports[i] ) == (i & 1 ? CCHandshake_CC_2 : CCHandshake_CC_1) );
+		CHECK( Sims[i].Stats.Nacks == 0 && Sims[i].Stats.TxErrors == 0 );
+	}
+
+	// with the contracts in place only ports with events are dispatched
+	polls = Hub.Polls;
+	dispatches = Hub.Dispatches;
+	hubRun( 10000, &failed );
+
+	printf("with contracts: %u dispatches in %u polls\n", Hub.Dispatches - dispatches, Hub.Polls - polls);
+
+	CHECK( failed == 0 );
+	CHECK( Hub.Dispatches - dispatches < (Hub.Polls - polls) / 10 );
+
+	// one bus stops completing while its source sends a message (so INT_N fires too),
+	// the timeout is measured on the clock of port 0
+	Lost[SIM_LOST] = true;
+	FUSB302_D_Sim_SendMessage( &Sims[SIM_LOST], PD_DataCommand_VendorDefined, vdm, 1 );
+	FUSB302_D_Sim_Advance( &Sims[SIM_LOST], 10000 );
+
+	start = FUSB302_D_Sim_GetTimeUs( &Sims[0] );
+	hubRun( SIM_LOST_POLLS, &failed );
+
+	printf("bus lost: %u of %u polls failed after %u ms\n", failed, SIM_LOST_POLLS, (uint32_t)((FUSB302_D_Sim_GetTimeUs( &Sims[0] ) - start) / 1000));
+
+	CHECK( failed > 0 );
+	CHECK( FUSB302_D_Sim_GetTimeUs( &Sims[0] ) - start >= FUSB302_D_TIMEOUT_MS * 1000ULL );
+	CHECK( allContracts( SIM_LOST ) );
+
+	// back again
+	Lost[SIM_LOST] = false;
+	failed = 0;
+	hubRun( 100, &failed );
+
+	CHECK( failed == 0 );
+	CHECK( allContracts( SIM_LOST ) );
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,129 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of CCHANDSHAKE_LOW_POWER: detached, only bandgap and wake stay powered (and with
+ * CCHANDSHAKE_USE_INTERRUPT the bus stays quiet) until I_WAKE. An attach wakes the port up to a contract, a wake
+ * without attach (cable pulled again before the detection) goes back to standby after CCHANDSHAKE_WAKE_TIMEOUT_MS.
+ * Times per power state from CCHandshake_getPowerStats().
+ */
+
+#include "sim_common.h"
+
+
+ // unattached for
+#define SIM_DETACHED_US	1000000
+
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+static void powerDelta( uint32_t delta[CCHandshake_Power_Count] );
+static bool detached( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+
+
+ // ms per power state since the last call
+static void powerDelta( uint32_t delta[CCHandshake_Power_Count] )
+{
+	static uint32_t last[CCHandshake_Power_Count];
+	uint32_t now[CCHandshake_Power_Count];
+
+	CCHandshake_getPowerStats( &Port, now );
+
+	for (int i = 0; i < CCHandshake_Power_Count; i++)
+	{
+		delta[i] = now[i] - last[i];
+		last[i] = now[i];
+	}
+}
+
+static bool detached( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port )
+{
+	(void)sim;
+
+	return CCHandshake_getOrientation( port ) == CCHandshake_CC_None;
+}
+
+int main( void )
+{
+	uint32_t ms[CCHandshake_Power_Count];
+	uint32_t transactions;
+
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+	// standby right away
+	transactions = Sim.Stats.Transactions;
+	Sim_run( &Sim, &Port, SIM_DETACHED_US, NULL );
+	powerDelta( ms );
+
+	printf("interrupt=%d detached: standby=%u detect=%u active=%u ms, %u bus transactions\n",
+			CCHANDSHAKE_USE_INTERRUPT==true, ms[CCHandshake_Power_Standby], ms[CCHandshake_Power_Detect], ms[CCHandshake_Power_Active],
+			Sim.Stats.Transactions - transactions);
+
+	CHECK( ms[CCHandshake_Power_Standby] >= SIM_DETACHED_US / 1000 - 10 );
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	CHECK( Sim.Stats.Transactions == transactions );
+#endif
+
+	// woken up by the attach
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+	powerDelta( ms );
+
+	printf("contract after %u us: standby=%u detect=%u active=%u ms\n",
+			FUSB302_D_Sim_GetContractLatencyUs( &Sim ), ms[CCHandshake_Power_Standby], ms[CCHandshake_Power_Detect], ms[CCHandshake_Power_Active]);
+
+	CHECK( ms[CCHandshake_Power_Detect] > 0 && ms[CCHandshake_Power_Active] > 0 );
+
+	// back to standby once detached
+	FUSB302_D_Sim_Detach( &Sim );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, detached ) );
+	powerDelta( ms );
+	Sim_run( &Sim, &Port, SIM_DETACHED_US, NULL );
+	powerDelta( ms );
+
+	printf("detached again: standby=%u detect=%u active=%u ms\n", ms[CCHandshake_Power_Standby], ms[CCHandshake_Power_Detect], ms[CCHandshake_Power_Active]);
+
+	CHECK( ms[CCHandshake_Power_Standby] >= SIM_DETACHED_US / 1000 - 10 );
+
+	// woken up, but gone before the detection: standby again after the wake timeout
+	FUSB302_D_Sim_Attach( &Sim, 2, FUSB302_D_Sim_Rp_3A0 );
+	Sim_run( &Sim, &Port, 10000, NULL );
+	FUSB302_D_Sim_Detach( &Sim );
+	powerDelta( ms );
+	Sim_run( &Sim, &Port, CCHANDSHAKE_WAKE_TIMEOUT_MS * 1000 + SIM_DETACHED_US, NULL );
+	powerDelta( ms );
+
+	printf("wake without attach: standby=%u detect=%u active=%u ms\n", ms[CCHandshake_Power_Standby], ms[CCHandshake_Power_Detect], ms[CCHandshake_Power_Active]);
+
+	CHECK( detached( &Sim, &Port ) );
+#if CCHANDSHAKE_USE_TOGGLE==false
+	CHECK( ms[CCHandshake_Power_Detect] >= CCHANDSHAKE_WAKE_TIMEOUT_MS - 10 );
+#endif
+	CHECK( ms[CCHandshake_Power_Detect] <= CCHANDSHAKE_WAKE_TIMEOUT_MS + 10 );
+	CHECK( ms[CCHandshake_Power_Standby] >= SIM_DETACHED_US / 1000 - 20 );
+
+	CHECK( Sim.Stats.Nacks == 0 && Sim.Stats.TxErrors == 0 );
+
+	printf("OK\n");
+
+	return 0;
+}
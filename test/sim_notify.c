@@ -0,0 +1,198 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of CCHandshake_setNotifyCallback(): the notifications of a negotiation (attach, offers, accept,
+ * PS_RDY), of a hard reset by the source (the contract lost once, negotiated again), of a detach and of a hard
+ * reset sent by the sink come in order with their values, timestamped at (with CCHANDSHAKE_USE_INTERRUPT before)
+ * the time they are delivered.
+ */
+
+#include "sim_common.h"
+
+
+ // recorded at most
+#define SIM_NOTIFICATIONS	16
+
+ // long enough for the hard reset (tSrcRecover) and a new contract
+#define SIM_RECOVER_US		1000000
+
+ // the source switching slower than tPSTransition
+#define SIM_SLOW_US			2000000
+
+
+typedef struct {
+	CCHandshake_Notify_t Type;
+	CCHandshake_CC_t Orientation;
+	uint8_t NSourceCapabilities;
+	uint16_t Millivolt;
+	uint16_t Milliamp;
+	bool FromSource;
+} Expected_t;
+
+ // a contract at 20V 2.25A (the default profile)
+#define SIM_NEGOTIATED \
+	{ CCHandshake_Notify_SourceCapabilities, CCHandshake_CC_None, 3, 0, 0, false }, \
+	{ CCHandshake_Notify_ContractAccepted, CCHandshake_CC_None, 0, 20000, 2250, false }, \
+	{ CCHandshake_Notify_PSReady, CCHandshake_CC_None, 0, 20000, 2250, false }
+
+static const Expected_t Attached[] = {
+	{ CCHandshake_Notify_Attach, CCHandshake_CC_1, 0, 0, 0, false },
+	SIM_NEGOTIATED
+};
+
+static const Expected_t SourceHardReset[] = {
+	{ CCHandshake_Notify_HardReset, CCHandshake_CC_None, 0, 0, 0, true },
+	{ CCHandshake_Notify_ContractLost, CCHandshake_CC_None, 0, 0, 0, false },
+	SIM_NEGOTIATED
+};
+
+static const Expected_t Detached[] = {
+	{ CCHandshake_Notify_ContractLost, CCHandshake_CC_None, 0, 0, 0, false },
+	{ CCHandshake_Notify_Detach, CCHandshake_CC_None, 0, 0, 0, false }
+};
+
+static const Expected_t SinkHardReset[] = {
+	{ CCHandshake_Notify_Attach, CCHandshake_CC_2, 0, 0, 0, false },
+	{ CCHandshake_Notify_SourceCapabilities, CCHandshake_CC_None, 3, 0, 0, false },
+	{ CCHandshake_Notify_ContractAccepted, CCHandshake_CC_None, 0, 20000, 2250, false },
+	{ CCHandshake_Notify_HardReset, CCHandshake_CC_None, 0, 0, 0, false }
+};
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+static CCHandshake_Notification_t Notifications[SIM_NOTIFICATIONS];
+static uint8_t NNotifications;
+static bool BadTs;
+static void * NotifyCtx;
+
+static void onNotify( CCHandshake_Port_t * port, const CCHandshake_Notification_t * notification, void * ctx );
+static bool received( const Expected_t * expected, uint8_t n );
+
+
+static void onNotify( CCHandshake_Port_t * port, const CCHandshake_Notification_t * notification, void * ctx )
+{
+	uint32_t now = FUSB302_D_GetTime( &port->Driver );
+
+	NotifyCtx = ctx;
+
+	// never after it was delivered (polled: at the time) and in order
+	if ((int32_t)(now - notification->Ts) < 0)
+	{
+		BadTs = true;
+	}
+#if CCHANDSHAKE_USE_INTERRUPT==false
+	if (notification->Ts != now)
+	{
+		BadTs = true;
+	}
+#endif
+	if (NNotifications > 0 && (int32_t)(notification->Ts - Notifications[NNotifications - 1].Ts) < 0)
+	{
+		BadTs = true;
+	}
+
+	if (NNotifications < SIM_NOTIFICATIONS)
+	{
+		Notifications[NNotifications] = *notification;
+	}
+	NNotifications++;
+}
+
+ // exactly these notifications since the last call
+static bool received( const Expected_t * expected, uint8_t n )
+{
+	bool ok = (NNotifications == n);
+
+	for (uint8_t i = 0; ok && i < n; i++)
+	{
+		const CCHandshake_Notification_t * got = &Notifications[i];
+
+		ok = got->Type == expected[i].Type && got->FromSource == expected[i].FromSource;
+
+		switch (got->Type)
+		{
+			case CCHandshake_Notify_Attach:
+				ok = ok && got->Orientation == expected[i].Orientation;
+				break;
+			case CCHandshake_Notify_SourceCapabilities:
+				ok = ok && got->NSourceCapabilities == expected[i].NSourceCapabilities;
+				break;
+			case CCHandshake_Notify_ContractAccepted:
+			case CCHandshake_Notify_PSReady:
+				ok = ok && got->Millivolt == expected[i].Millivolt && got->Milliamp == expected[i].Milliamp;
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (ok == false)
+	{
+		for (uint8_t i = 0; i < NNotifications && i < SIM_NOTIFICATIONS; i++)
+		{
+			printf("  got %d at %u ms\n", Notifications[i].Type, Notifications[i].Ts);
+		}
+	}
+
+	NNotifications = 0;
+
+	return ok;
+}
+
+int main( void )
+{
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+	CCHandshake_setNotifyCallback( &Port, onNotify, &Sim );
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+	CHECK( received( Attached, sizeof(Attached) / sizeof(Attached[0]) ) );
+	CHECK( NotifyCtx == &Sim );
+
+	// by the source
+	FUSB302_D_Sim_HardReset( &Sim );
+	Sim_run( &Sim, &Port, SIM_RECOVER_US, NULL );
+
+	CHECK( Sim_hasContract( &Sim, &Port ) );
+	CHECK( received( SourceHardReset, sizeof(SourceHardReset) / sizeof(SourceHardReset[0]) ) );
+
+	FUSB302_D_Sim_Detach( &Sim );
+	Sim_run( &Sim, &Port, SIM_RECOVER_US, NULL );
+
+	CHECK( received( Detached, sizeof(Detached) / sizeof(Detached[0]) ) );
+
+	// by the sink, the source missing tPSTransition
+	Sim.Source.TransitionUs = SIM_SLOW_US;
+	FUSB302_D_Sim_Attach( &Sim, 2, FUSB302_D_Sim_Rp_3A0 );
+	Sim_run( &Sim, &Port, SIM_SLOW_US * 3 / 4, NULL );
+
+	CHECK( received( SinkHardReset, sizeof(SinkHardReset) / sizeof(SinkHardReset[0]) ) );
+
+	CHECK( BadTs == false );
+
+	printf("interrupt=%d notifications in order\n", CCHANDSHAKE_USE_INTERRUPT==true);
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of the offer scoring: source capabilities mixing fixed, variable and battery supplies against
+ * sink profiles (voltage window, current limits, preferred voltage), each negotiated with the simulated source.
+ * The request sent (object position, operating current or power) has to be the expected one.
+ */
+
+#include "sim_common.h"
+
+
+#define SIM_VARIABLE( __min_mv__, __max_mv__, __ma__ ) \
+	(PDO_SrcCap_SupplyType_Variable | (((__max_mv__) / 50) << 20) | (((__min_mv__) / 50) << 10) | ((__ma__) / 10))
+#define SIM_BATTERY( __min_mv__, __max_mv__, __mw__ ) \
+	(PDO_SrcCap_SupplyType_Battery | (((__max_mv__) / 50) << 20) | (((__min_mv__) / 50) << 10) | ((__mw__) / 250))
+
+ // fixed and variable requests: operating and max current (10mA), battery requests: power (250mW)
+#define SIM_RDO( __position__, __operating__ ) \
+	(PDO_Req_Fixed_setObjectPosBits( __position__ ) | PDO_Req_Fixed_NoUSBSuspend | \
+	 PDO_Req_Fixed_setOperatingCurrent_10mABits( __operating__ ) | PDO_Req_Fixed_setMaxOpCur_10mABits( __operating__ ))
+
+typedef struct {
+	const char * Name;
+	uint32_t Pdos[FUSB302_D_SIM_MAX_PDOS];
+	uint8_t NPdos;
+	CCHandshake_SinkProfile_t Profile;
+	uint32_t Rdo;
+} Case_t;
+
+static const Case_t Cases[] = {
+	{
+		.Name = "fixed beats a variable supply with less power at its lowest voltage",
+		.Pdos = { SIM_PDO_FIXED( 5000, 3000 ), SIM_PDO_FIXED( 9000, 3000 ), SIM_VARIABLE( 5000, 12000, 3000 ) }, .NPdos = 3,
+		.Profile = { .MaxMillivolt = 20000, .MaxMilliamp = 3000 },
+		.Rdo = SIM_RDO( 2, 300 )
+	},
+	{
+		.Name = "variable supply",
+		.Pdos = { SIM_PDO_FIXED( 5000, 3000 ), SIM_VARIABLE( 9000, 15000, 3000 ) }, .NPdos = 2,
+		.Profile = { .MaxMillivolt = 20000, .MaxMilliamp = 3000 },
+		.Rdo = SIM_RDO( 2, 300 )
+	},
+	{
+		.Name = "variable supply above the voltage window",
+		.Pdos = { SIM_PDO_FIXED( 5000, 3000 ), SIM_VARIABLE( 9000, 21000, 3000 ) }, .NPdos = 2,
+		.Profile = { .MaxMillivolt = 20000, .MaxMilliamp = 3000 },
+		.Rdo = SIM_RDO( 1, 300 )
+	},
+	{
+		.Name = "battery supply limited by the max current at its lowest voltage",
+		.Pdos = { SIM_PDO_FIXED( 5000, 3000 ), SIM_PDO_FIXED( 9000, 2000 ), SIM_BATTERY( 9000, 20000, 60000 ) }, .NPdos = 3,
+		.Profile = { .MaxMillivolt = 20000, .MaxMilliamp = 3000 },
+		.Rdo = SIM_RDO( 3, 27000 / 250 )
+	},
+	{
+		.Name = "highest power",
+		.Pdos = { SIM_PDO_FIXED( 5000, 3000 ), SIM_PDO_FIXED( 9000, 3000 ), SIM_PDO_FIXED( 20000, 2250 ) }, .NPdos = 3,
+		.Profile = { .MaxMillivolt = 20000, .MaxMilliamp = 3000 },
+		.Rdo = SIM_RDO( 3, 225 )
+	},
+	{
+		.Name = "preferred voltage",
+		.Pdos = { SIM_PDO_FIXED( 5000, 3000 ), SIM_PDO_FIXED( 9000, 3000 ), SIM_PDO_FIXED( 20000, 2250 ) }, .NPdos = 3,
+		.Profile = { .MaxMillivolt = 20000, .MaxMilliamp = 3000, .PreferredMillivolt = 9000, .EfficiencyWeight = 10 },
+		.Rdo = SIM_RDO( 2, 300 )
+	},
+	{
+		.Name = "below the min current",
+		.Pdos = { SIM_PDO_FIXED( 5000, 3000 ), SIM_PDO_FIXED( 9000, 3000 ), SIM_PDO_FIXED( 20000, 2250 ) }, .NPdos = 3,
+		.Profile = { .MaxMillivolt = 20000, .MinMilliamp = 2500, .MaxMilliamp = 3000 },
+		.Rdo = SIM_RDO( 2, 300 )
+	},
+	{
+		.Name = "max current",
+		.Pdos = { SIM_PDO_FIXED( 5000, 3000 ), SIM_PDO_FIXED( 9000, 3000 ) }, .NPdos = 2,
+		.Profile = { .MaxMillivolt = 20000, .MaxMilliamp = 1500 },
+		.Rdo = SIM_RDO( 2, 150 )
+	},
+	{
+		.Name = "nothing usable, vSafe5V with capability mismatch",
+		.Pdos = { SIM_PDO_FIXED( 5000, 3000 ), SIM_PDO_FIXED( 9000, 3000 ) }, .NPdos = 2,
+		.Profile = { .MinMillivolt = 12000, .MaxMillivolt = 20000, .MaxMilliamp = 2000 },
+		.Rdo = SIM_RDO( 1, 200 ) | PDO_Req_Fixed_CapabilityMismatch
+	}
+};
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+static int negotiate( const Case_t * c );
+
+
+static int negotiate( const Case_t * c )
+{
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+	FUSB302_D_Sim_SetSourceCaps( &Sim, c->Pdos, c->NPdos );
+	CCHandshake_setSinkProfile( &Port, &c->Profile );
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+
+	printf("%s: rdo=%08x\n", c->Name, Sim.Source.Rdo);
+
+	CHECK( Sim.Source.Rdo == c->Rdo );
+	CHECK( Sim.Source.Requests == 1 );
+
+	CCHandshake_deinit( &Port );
+
+	return 0;
+}
+
+int main( void )
+{
+	for (uint32_t i = 0; i < sizeof(Cases) / sizeof(Cases[0]); i++)
+	{
+		CHECK( negotiate( &Cases[i] ) == 0 );
+	}
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,130 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of PPS (CCHANDSHAKE_PD_REV3): a PD 3.0 source offering a programmable supply gets the target
+ * of CCHandshake_setPPS() requested, the sink requests it again before the source's tPPSTimeout for as long as
+ * the contract lasts (no hard reset), follows a new target and falls back to the fixed offers without one.
+ * A PD 2.0 source is never asked for PPS.
+ */
+
+#include "sim_common.h"
+
+
+ // 3.3-11V 3A
+#define SIM_PPS( __min_mv__, __max_mv__, __ma__ ) \
+	(PDO_SrcCap_SupplyType_APDO | PDO_SrcCap_APDO_Type_PPS | (((__max_mv__) / 100) << PDO_SrcCap_PPS_MaxVoltage_100mV_OFFSET) | \
+	 (((__min_mv__) / 100) << PDO_SrcCap_PPS_MinVoltage_100mV_OFFSET) | ((__ma__) / 50))
+
+ // several times tPPSTimeout of the source
+#define SIM_KEEP_US		40000000
+
+ // a new request is done within
+#define SIM_RESELECT_US	100000
+
+
+static const uint32_t Pdos[] = {
+	SIM_PDO_FIXED( 5000, 3000 ),
+	SIM_PDO_FIXED( 9000, 3000 ),
+	SIM_PPS( 3300, 11000, 3000 )
+};
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+static bool hasPPS( uint16_t millivolt, uint16_t milliamp );
+
+
+ // PPS contract with this output voltage / operating current in place
+static bool hasPPS( uint16_t millivolt, uint16_t milliamp )
+{
+	return CCHandshake_hasContract( &Port ) && Sim.VbusMv == millivolt &&
+			Sim.Source.Rdo == (PDO_Req_Fixed_setObjectPosBits( 3 ) | PDO_Req_Fixed_NoUSBSuspend |
+					PDO_Req_PPS_setOutputVoltage_20mVBits( millivolt / 20 ) | PDO_Req_PPS_setOperatingCurrent_50mABits( milliamp / 50 ));
+}
+
+int main( void )
+{
+	uint32_t timeMs[PE_State_Count];
+	uint32_t requests;
+
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+	FUSB302_D_Sim_SetSourceCaps( &Sim, Pdos, sizeof(Pdos) / sizeof(Pdos[0]) );
+	Sim.Source.SpecRev = PD_HeaderWord_SpecRev_3_0;
+
+	CCHandshake_setPPS( &Port, 7400, 2000 );
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+
+	printf("interrupt=%d pps contract after %u us: rdo=%08x vbus=%u mV\n",
+			CCHANDSHAKE_USE_INTERRUPT==true, FUSB302_D_Sim_GetContractLatencyUs( &Sim ), Sim.Source.Rdo, Sim.VbusMv);
+
+	CHECK( hasPPS( 7400, 2000 ) );
+
+	// kept alive
+	requests = Sim.Source.Requests;
+	Sim_run( &Sim, &Port, SIM_KEEP_US, NULL );
+	CCHandshake_getPolicyStats( &Port, timeMs );
+
+	printf("after %u s: %u requests, hard reset %u ms\n", SIM_KEEP_US / 1000000, Sim.Source.Requests - requests, timeMs[PE_State_HardReset]);
+
+	CHECK( hasPPS( 7400, 2000 ) );
+	CHECK( Sim.Source.Requests - requests >= SIM_KEEP_US / 10000000 );
+	CHECK( timeMs[PE_State_HardReset] == 0 );
+
+	// new target
+	CCHandshake_setPPS( &Port, 9000, 1500 );
+	Sim_run( &Sim, &Port, SIM_RESELECT_US, NULL );
+
+	printf("new target: rdo=%08x vbus=%u mV\n", Sim.Source.Rdo, Sim.VbusMv);
+
+	CHECK( hasPPS( 9000, 1500 ) );
+
+	// none, the best fixed offer
+	CCHandshake_setPPS( &Port, 0, 0 );
+	Sim_run( &Sim, &Port, SIM_RESELECT_US, NULL );
+
+	printf("no target: rdo=%08x vbus=%u mV\n", Sim.Source.Rdo, Sim.VbusMv);
+
+	CHECK( CCHandshake_hasContract( &Port ) && Sim.VbusMv == 9000 );
+	CHECK( (Sim.Source.Rdo & PDO_Req_Fixed_ObjectPos_MASK) == PDO_Req_Fixed_setObjectPosBits( 2 ) );
+
+	// PD 2.0
+	CCHandshake_deinit( &Port );
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+	FUSB302_D_Sim_SetSourceCaps( &Sim, Pdos, sizeof(Pdos) / sizeof(Pdos[0]) );
+	CCHandshake_setPPS( &Port, 7400, 2000 );
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+
+	printf("pd 2.0 source: rdo=%08x vbus=%u mV\n", Sim.Source.Rdo, Sim.VbusMv);
+
+	CHECK( (Sim.Source.Rdo & PDO_Req_Fixed_ObjectPos_MASK) == PDO_Req_Fixed_setObjectPosBits( 2 ) );
+
+	CHECK( Sim.Stats.Nacks == 0 && Sim.Stats.TxErrors == 0 );
+
+	printf("OK\n");
+
+	return 0;
+}
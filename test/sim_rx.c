@@ -0,0 +1,112 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of the rx path: with PS_RDY right behind Accept (no transition time) the messages pile up in
+ * the rx fifo and have to be drained in one go into the ring (CCHANDSHAKE_RX_RING_SIZE, also built with a ring
+ * of one message where the rest waits for the next call), the sink then spends no time in TransitionSink.
+ * Then the source sends VDMs the sink ignores: dropped after their header, their data objects read out in one burst
+ * or flushed (CCHANDSHAKE_RX_FLUSH_IGNORED), the contract stays. Drain counts from CCHandshake_getRxStats().
+ */
+
+#include "sim_common.h"
+
+
+
+ // VDMs of 7 data objects sent by the source, one per
+#define SIM_VDMS		10
+#define SIM_VDM_US		100000
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+
+int main( void )
+{
+	const uint32_t vdm[7] = { 0xFF008001, 1, 2, 3, 4, 5, 6 };
+	CCHandshake_RxStats_t rx;
+	uint32_t timeMs[PE_State_Count];
+	uint32_t bytesRead;
+	uint32_t dropped;
+	uint32_t flushed;
+
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+	// Accept, PS_RDY back to back
+	Sim.Source.TransitionUs = 0;
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+	Sim_run( &Sim, &Port, 10000, NULL );
+
+	CCHandshake_getRxStats( &Port, &rx );
+	CCHandshake_getPolicyStats( &Port, timeMs );
+
+	printf("interrupt=%d ring=%d: contract after %u us, transition %u ms, rx messages=%u fifo high water=%u bytes ring high water=%u full=%u\n",
+			CCHANDSHAKE_USE_INTERRUPT==true, CCHANDSHAKE_RX_RING_SIZE, FUSB302_D_Sim_GetContractLatencyUs( &Sim ), timeMs[PE_State_TransitionSink],
+			rx.Messages, rx.FifoHighWater, rx.RingHighWater, rx.FifoFull);
+
+	CHECK( CCHandshake_hasContract( &Port ) );
+	// Source_Capabilities, Accept, PS_RDY
+	CHECK( rx.Messages >= 3 );
+	CHECK( Sim.Stats.RxDropped == 0 );
+#if CCHANDSHAKE_USE_INTERRUPT==true && CCHANDSHAKE_RX_RING_SIZE >= 2
+	// Accept and PS_RDY in one drain
+	CHECK( rx.RingHighWater >= 2 );
+	CHECK( timeMs[PE_State_TransitionSink] == 0 );
+#endif
+	CHECK( rx.RingHighWater <= CCHANDSHAKE_RX_RING_SIZE );
+
+	// ignored ones
+	bytesRead = Sim.Stats.BytesRead;
+	dropped = rx.Dropped;
+	flushed = rx.BytesFlushed;
+
+	for (int i = 0; i < SIM_VDMS; i++)
+	{
+		FUSB302_D_Sim_SendMessage( &Sim, PD_DataCommand_VendorDefined, vdm, 7 );
+		Sim_run( &Sim, &Port, SIM_VDM_US, NULL );
+	}
+
+	CCHandshake_getRxStats( &Port, &rx );
+	bytesRead = Sim.Stats.BytesRead - bytesRead;
+
+	printf("flush=%d %u VDMs: bytes read %u, dropped=%u flushed=%u bytes\n",
+			CCHANDSHAKE_RX_FLUSH_IGNORED==true, SIM_VDMS, bytesRead, rx.Dropped - dropped, rx.BytesFlushed - flushed);
+
+	CHECK( rx.Dropped - dropped == SIM_VDMS );
+	CHECK( Sim_hasContract( &Sim, &Port ) );
+#if CCHANDSHAKE_RX_FLUSH_IGNORED==true
+	CHECK( rx.BytesFlushed - flushed >= SIM_VDMS * sizeof(vdm) );
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	// the data objects never cross the bus (polling reads the status all the time)
+	CHECK( bytesRead < SIM_VDMS * sizeof(vdm) );
+#endif
+#else
+	CHECK( rx.BytesFlushed == flushed );
+	CHECK( bytesRead >= SIM_VDMS * sizeof(vdm) );
+#endif
+
+	CHECK( Sim.Stats.Nacks == 0 && Sim.Stats.TxErrors == 0 );
+
+	printf("OK\n");
+
+	return 0;
+}
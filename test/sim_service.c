@@ -0,0 +1,201 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of CCHandshake_service() (CCHANDSHAKE_SLEEP_STATS): the loop below calls it only when it said
+ * so, at its deadline, on INT_N or right away when busy, and the simulated chip runs on in between like an MCU
+ * in stop mode. With CCHANDSHAKE_USE_INTERRUPT the contract takes a few calls and the time is almost all
+ * sleepable, a port with a contract needs no call at all and a PPS contract (CCHANDSHAKE_PD_REV3) is kept alive
+ * from the PPS deadline alone.
+ */
+
+#include "sim_common.h"
+
+
+ // calls to a contract with INT_N
+#define SIM_SERVICE_MAX_CALLS	20
+
+ // least share of the time sleepable, percent
+#define SIM_SLEEPABLE_PCT		90
+
+ // idle with a contract
+#define SIM_IDLE_US			1000000
+
+#if CCHANDSHAKE_PD_REV3==true
+ // several times tPPSTimeout of the source
+#define SIM_KEEP_US			40000000
+
+ // the keep-alive sleeps (almost) all of its 8 s period
+#define SIM_PPS_SLEEP_US	7900000
+#endif
+
+
+#if CCHANDSHAKE_PD_REV3==true
+static const uint32_t Pdos[] = {
+	SIM_PDO_FIXED( 5000, 3000 ),
+	SIM_PDO_FIXED( 9000, 3000 ),
+	(PDO_SrcCap_SupplyType_APDO | PDO_SrcCap_APDO_Type_PPS | ((11000 / 100) << PDO_SrcCap_PPS_MaxVoltage_100mV_OFFSET) |
+	 ((3300 / 100) << PDO_SrcCap_PPS_MinVoltage_100mV_OFFSET) | (3000 / 50))
+};
+#endif
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+ // CCHandshake_service() calls and the longest sleep between two
+static uint32_t Calls;
+static uint32_t MaxSleepUs;
+
+static bool isDue( uint32_t events, uint32_t next );
+static void serviceFor( uint32_t us, Sim_Done_t done );
+static uint32_t sleepablePct( void );
+
+
+ // CCHandshake_core() has to run again
+static bool isDue( uint32_t events, uint32_t next )
+{
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	if (CCHandshake_hasInterrupt( &Port ))
+	{
+		return true;
+	}
+#endif
+	if (events & (CCHANDSHAKE_NEXT_BUSY | CCHANDSHAKE_NEXT_POLL))
+	{
+		return true;
+	}
+	if (events & (CCHANDSHAKE_NEXT_DEBOUNCE | CCHANDSHAKE_NEXT_TIMER | CCHANDSHAKE_NEXT_PPS))
+	{
+		return (int32_t)(FUSB302_D_GetTime( &Port.Driver ) - next) >= 0;
+	}
+
+	return false;
+}
+
+ // serves the port for <us> (or until <done>), sleeping in between
+static void serviceFor( uint32_t us, Sim_Done_t done )
+{
+	uint64_t start = FUSB302_D_Sim_GetTimeUs( &Sim );
+
+	while (FUSB302_D_Sim_GetTimeUs( &Sim ) - start < us)
+	{
+		uint32_t events, next;
+		uint64_t sleep;
+
+		if (done != NULL && done( &Sim, &Port ))
+		{
+			return;
+		}
+
+		events = CCHandshake_service( &Port, &next );
+		Calls++;
+
+		sleep = FUSB302_D_Sim_GetTimeUs( &Sim );
+		do
+		{
+			FUSB302_D_Sim_Advance( &Sim, SIM_LOOP_US );
+		}
+		while (isDue( events, next ) == false && FUSB302_D_Sim_GetTimeUs( &Sim ) - start < us);
+
+		sleep = FUSB302_D_Sim_GetTimeUs( &Sim ) - sleep;
+		if (sleep > MaxSleepUs)
+		{
+			MaxSleepUs = (uint32_t)sleep;
+		}
+	}
+}
+
+static uint32_t sleepablePct( void )
+{
+	CCHandshake_SleepStats_t stats;
+
+	CCHandshake_getSleepStats( &Port, &stats );
+
+	return stats.TotalMs > 0 ? (uint32_t)(stats.SleepMs * 100ULL / stats.TotalMs) : 0;
+}
+
+int main( void )
+{
+	uint32_t events, next;
+#if CCHANDSHAKE_PD_REV3==true
+	uint32_t timeMs[PE_State_Count];
+	uint32_t requests;
+#endif
+
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+#if CCHANDSHAKE_PD_REV3==true
+	FUSB302_D_Sim_SetSourceCaps( &Sim, Pdos, sizeof(Pdos) / sizeof(Pdos[0]) );
+	Sim.Source.SpecRev = PD_HeaderWord_SpecRev_3_0;
+
+	CCHandshake_setPPS( &Port, 7400, 2000 );
+#endif
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	serviceFor( SIM_TIMEOUT_US, Sim_hasContract );
+
+	printf("interrupt=%d contract after %u us: %u service calls, %u%% sleepable\n",
+			CCHANDSHAKE_USE_INTERRUPT==true, FUSB302_D_Sim_GetContractLatencyUs( &Sim ), Calls, sleepablePct());
+
+	CHECK( Sim_hasContract( &Sim, &Port ) );
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	CHECK( Calls <= SIM_SERVICE_MAX_CALLS );
+	CHECK( sleepablePct() >= SIM_SLEEPABLE_PCT );
+#endif
+
+#if CCHANDSHAKE_PD_REV3==true
+	// nothing due before the keep-alive
+	events = CCHandshake_getNextService( &Port, &next );
+	CHECK( events == CCHANDSHAKE_NEXT_PPS );
+
+	requests = Sim.Source.Requests;
+	Calls = 0;
+	MaxSleepUs = 0;
+	serviceFor( SIM_KEEP_US, NULL );
+	CCHandshake_getPolicyStats( &Port, timeMs );
+
+	printf("pps after %u s: %u requests, %u service calls, longest sleep %u ms, hard reset %u ms\n",
+			SIM_KEEP_US / 1000000, Sim.Source.Requests - requests, Calls, MaxSleepUs / 1000, timeMs[PE_State_HardReset]);
+
+	CHECK( CCHandshake_hasContract( &Port ) && Sim.VbusMv == 7400 );
+	CHECK( Sim.Source.Requests - requests >= SIM_KEEP_US / 10000000 );
+	CHECK( timeMs[PE_State_HardReset] == 0 );
+	CHECK( MaxSleepUs >= SIM_PPS_SLEEP_US );
+#elif CCHANDSHAKE_USE_INTERRUPT==true
+	// nothing due until INT_N
+	events = CCHandshake_getNextService( &Port, &next );
+	CHECK( events == 0 );
+
+	Calls = 0;
+	serviceFor( SIM_IDLE_US, NULL );
+
+	printf("idle for %u ms: %u service calls\n", SIM_IDLE_US / 1000, Calls);
+
+	CHECK( Calls == 1 );
+	CHECK( Sim_hasContract( &Sim, &Port ) );
+#else
+	(void)events;
+	(void)next;
+#endif
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,172 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of CCHandshake_Task with the CCHandshake_OS_POSIX backend: the task runs in its own thread and
+ * this one stands in for the hardware, advancing the simulated chip in real time with the port locked. With
+ * CCHANDSHAKE_USE_INTERRUPT the task only runs on INT_N and PD deadlines, a new sink profile takes effect after
+ * CCHandshake_Task_wake() and CCHandshake_Task_stop() ends the thread.
+ */
+
+#include "sim_common.h"
+
+#include "CCHandshake_Task.h"
+#include "CCHandshake_OS_POSIX.h"
+
+#include <time.h>
+
+
+ // sim clock steps of the hardware thread
+#define SIM_TASK_STEP_US	100
+
+ // core calls to a contract with INT_N (one per CCHANDSHAKE_TASK_POLL_MS when polled)
+#define SIM_TASK_MAX_RUNS	100
+
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+static CCHandshake_Task_t Task;
+static CCHandshake_OS_POSIX_t Os;
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+static void onIntN( FUSB302_D_Sim_t * sim, bool level );
+#endif
+static void * taskBody( void * arg );
+static uint64_t nowUs( void );
+static bool runRealTime( uint32_t us, Sim_Done_t done );
+static bool hasNineVolts( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+static void onIntN( FUSB302_D_Sim_t * sim, bool level )
+{
+	(void)sim;
+
+	if (level == false)
+	{
+		CCHandshake_Task_onInterrupt( &Task );
+	}
+}
+#endif
+
+static void * taskBody( void * arg )
+{
+	(void)arg;
+
+	CCHandshake_Task_run( &Task );
+
+	return NULL;
+}
+
+static uint64_t nowUs( void )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+ // the sim clock follows the real one (plus bus time) until <done> or <us> passed
+static bool runRealTime( uint32_t us, Sim_Done_t done )
+{
+	uint64_t start = nowUs(), last = start;
+	struct timespec step = { 0, SIM_TASK_STEP_US * 1000 };
+	bool finished = false;
+
+	while (finished == false && nowUs() - start < us)
+	{
+		uint64_t now;
+
+		nanosleep( &step, NULL );
+
+		now = nowUs();
+
+		CCHandshake_Task_lock( &Task );
+		FUSB302_D_Sim_Advance( &Sim, (uint32_t)(now - last) );
+		finished = done( &Sim, &Port );
+		CCHandshake_Task_unlock( &Task );
+
+		last = now;
+	}
+
+	return finished;
+}
+
+static bool hasNineVolts( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port )
+{
+	return sim->VbusMv == 9000 && CCHandshake_hasContract( port );
+}
+
+int main( void )
+{
+	pthread_t thread;
+	CCHandshake_SinkProfile_t profile;
+	uint32_t runs, transactions;
+
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	Sim.OnIntN = onIntN;
+#endif
+
+	CHECK( CCHandshake_OS_POSIX_Init( &Os ) == 0 );
+	CCHandshake_Task_init( &Task, &Port, &CCHandshake_OS_POSIX, &Os );
+
+	CHECK( pthread_create( &thread, NULL, taskBody, NULL ) == 0 );
+
+	CCHandshake_Task_lock( &Task );
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+	CCHandshake_Task_unlock( &Task );
+
+	CHECK( runRealTime( SIM_TIMEOUT_US, Sim_hasContract ) );
+
+	CCHandshake_Task_lock( &Task );
+	runs = Task.Stats.Runs;
+	transactions = Sim.Stats.Transactions;
+	printf("interrupt=%d contract after %u us: %u core calls (irq %u, wake %u, timeout %u), %u bus transactions\n",
+		CCHANDSHAKE_USE_INTERRUPT==true, FUSB302_D_Sim_GetContractLatencyUs( &Sim ), runs, Task.Stats.Irq,
+		Task.Stats.Wake, Task.Stats.Timeout, transactions);
+	CCHandshake_Task_unlock( &Task );
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	CHECK( runs <= SIM_TASK_MAX_RUNS );
+#endif
+
+	// a new profile is only picked up when the task is woken
+	CCHandshake_Task_lock( &Task );
+	profile = Port.Profile;
+	profile.MaxMillivolt = 9000;
+	CCHandshake_setSinkProfile( &Port, &profile );
+	CCHandshake_Task_unlock( &Task );
+	CCHandshake_Task_wake( &Task );
+
+	CHECK( runRealTime( SIM_TIMEOUT_US, hasNineVolts ) );
+	CHECK( Task.Stats.Wake >= 1 );
+
+	CCHandshake_Task_stop( &Task );
+	CHECK( pthread_join( thread, NULL ) == 0 );
+
+	CHECK( CCHandshake_hasContract( &Port ) );
+
+	CCHandshake_OS_POSIX_DeInit( &Os );
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of the PD protocol timers: a hard reset by the source is recovered from, a source that is too
+ * slow (no capabilities within tTypeCSinkWaitCap, no answer within tSenderResponse, no PS_RDY within
+ * tPSTransition) gets hard resets until PD is given up after nHardResetCount. The port is then idle (no
+ * deadline left) until the cable is pulled, after which a well behaved source gets a contract again.
+ */
+
+#include "sim_common.h"
+
+
+ // Request, then one per hard reset (nHardResetCount)
+#define SIM_REQUESTS_UNTIL_GIVING_UP	3
+
+ // hard resets included
+#define SIM_GIVE_UP_US	5000000
+
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+static bool detached( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+static int reattach( void );
+static int giveUp( const char * what, uint32_t requests );
+
+
+static bool detached( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port )
+{
+	(void)sim;
+
+	return CCHandshake_getOrientation( port ) == CCHandshake_CC_None;
+}
+
+static int reattach( void )
+{
+	FUSB302_D_Sim_Detach( &Sim );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, detached ) );
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	return 0;
+}
+
+ // attached to a source set up to miss a timeout: no contract, <requests> sent until giving up
+static int giveUp( const char * what, uint32_t requests )
+{
+	uint32_t before = Sim.Source.Requests;
+	uint32_t deadline;
+
+	CHECK( reattach() == 0 );
+
+	Sim_run( &Sim, &Port, SIM_GIVE_UP_US, NULL );
+
+	printf("%s: pe=%d contract=%d requests=%u\n", what, CCHandshake_getPolicyState( &Port ), CCHandshake_hasContract( &Port ), Sim.Source.Requests - before);
+
+	CHECK( CCHandshake_getPolicyState( &Port ) == PE_State_Disabled );
+	CHECK( CCHandshake_hasContract( &Port ) == false );
+	CHECK( Sim.Source.Requests - before == requests );
+
+	// nothing due anymore
+	CHECK( CCHandshake_getNextDeadline( &Port, &deadline ) == false );
+	CHECK( CCHandshake_isIdle( &Port ) );
+
+	return 0;
+}
+
+int main( void )
+{
+	uint32_t timeMs[PE_State_Count];
+
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+	printf("interrupt=%d\n", CCHANDSHAKE_USE_INTERRUPT==true);
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+
+	// by the source: vbus off and on again, then a new negotiation
+	FUSB302_D_Sim_HardReset( &Sim );
+	Sim_run( &Sim, &Port, 10000, NULL );
+
+	CHECK( CCHandshake_hasContract( &Port ) == false );
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+
+	CCHandshake_getPolicyStats( &Port, timeMs );
+
+	printf("contract after a hard reset: hard reset %u ms\n", timeMs[PE_State_HardReset]);
+
+	CHECK( timeMs[PE_State_HardReset] > 0 );
+
+	// tPSTransition
+	Sim.Source.TransitionUs = 2000000;
+	CHECK( giveUp( "no PS_RDY", SIM_REQUESTS_UNTIL_GIVING_UP ) == 0 );
+	Sim.Source.TransitionUs = 25000;
+
+	// tSenderResponse
+	Sim.Source.ResponseUs = 100000;
+	CHECK( giveUp( "late Accept", SIM_REQUESTS_UNTIL_GIVING_UP ) == 0 );
+	Sim.Source.ResponseUs = 2000;
+
+	// tTypeCSinkWaitCap
+	Sim.Source.FirstCapsUs = 3000000;
+	CHECK( giveUp( "no capabilities", 0 ) == 0 );
+	Sim.Source.FirstCapsUs = 100000;
+
+	// the next attach starts over
+	CHECK( reattach() == 0 );
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+
+	CHECK( Sim.Stats.Nacks == 0 && Sim.Stats.TxErrors == 0 );
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+/**
+  * usbc-pd-fusb302-d: Library for ONSEMI FUSB302-D (USB-C Controller) for PD negotiation
+  * Copyright (C) 2020  Philip Tschiemer https://filou.se
+  *
+  * This program is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Lesser General Public
+  * License as published by the Free Software Foundation; either
+  * version 3 of the License, or (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Lesser General Public License for more details.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program; if not, write to the Free Software Foundation,
+  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+  */
+
+/**
+ * Host side check of CCHANDSHAKE_USE_TOGGLE: while detached the chip looks for a source by itself, so with
+ * CCHANDSHAKE_USE_INTERRUPT there is no bus traffic at all until I_TOGDONE. The orientation comes from TOGSS,
+ * checked for a source on either cc pin (attached, detached and attached again).
+ */
+
+#include "sim_common.h"
+
+
+ // unattached for
+#define SIM_DETACHED_US	1000000
+
+
+static FUSB302_D_Sim_t Sim;
+static CCHandshake_Port_t Port;
+
+static uint32_t detachedLoad( void );
+static bool detached( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port );
+
+
+ // bus transactions per second while nothing is attached
+static uint32_t detachedLoad( void )
+{
+	uint64_t start = FUSB302_D_Sim_GetTimeUs( &Sim );
+	uint32_t transactions = Sim.Stats.Transactions;
+
+	Sim_run( &Sim, &Port, SIM_DETACHED_US, NULL );
+
+	return Sim_perSecond( Sim.Stats.Transactions - transactions, FUSB302_D_Sim_GetTimeUs( &Sim ) - start );
+}
+
+static bool detached( FUSB302_D_Sim_t * sim, CCHandshake_Port_t * port )
+{
+	(void)sim;
+
+	return CCHandshake_getOrientation( port ) == CCHandshake_CC_None;
+}
+
+int main( void )
+{
+	uint32_t load;
+
+	CHECK( Sim_init( &Sim, &Port, &FUSB302_D_Transport_Sim ) );
+
+	load = detachedLoad();
+
+	printf("interrupt=%d detached: %u bus transactions/s\n", CCHANDSHAKE_USE_INTERRUPT==true, load);
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	// nothing to measure or poll
+	CHECK( load == 0 );
+#endif
+
+	FUSB302_D_Sim_Attach( &Sim, 2, FUSB302_D_Sim_Rp_3A0 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+	CHECK( CCHandshake_getOrientation( &Port ) == CCHandshake_CC_2 );
+
+	printf("contract on cc2 after %u us\n", FUSB302_D_Sim_GetContractLatencyUs( &Sim ));
+
+	FUSB302_D_Sim_Detach( &Sim );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, detached ) );
+
+	// back to sink polling
+	load = detachedLoad();
+
+	printf("detached again: %u bus transactions/s\n", load);
+
+#if CCHANDSHAKE_USE_INTERRUPT==true
+	CHECK( load == 0 );
+#endif
+
+	FUSB302_D_Sim_Attach( &Sim, 1, FUSB302_D_Sim_Rp_1A5 );
+
+	CHECK( Sim_run( &Sim, &Port, SIM_TIMEOUT_US, Sim_hasContract ) );
+	CHECK( CCHandshake_getOrientation( &Port ) == CCHandshake_CC_1 );
+
+	printf("contract on cc1 after %u us\n", FUSB302_D_Sim_GetContractLatencyUs( &Sim ));
+
+	CHECK( Sim.Stats.Nacks == 0 && Sim.Stats.TxErrors == 0 );
+
+	printf("OK\n");
+
+	return 0;
+}